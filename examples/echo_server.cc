@@ -3,6 +3,7 @@
 #include "sy/iomanager.h"
 #include "sy/socket.h"
 #include "sy/address.h"
+#include "sy/config.h"
 
 static sy::Logger::ptr g_logger = SY_LOG_ROOT();
 
@@ -62,15 +63,20 @@ void run() {
 
 int main(int argc, char** argv) {
     if(argc < 2) {
-        SY_LOG_INFO(g_logger) << "used as[" << argv[0] << " -t] or [" << argv[0] << " -b]";
+        SY_LOG_INFO(g_logger) << "used as[" << argv[0] << " -t] or [" << argv[0] << " -b] [threads] [-r]";
         return 0;
     }
 
     if(!strcmp(argv[1], "-b")) {
         type = 2;
     }
+    int threads = argc > 2 ? atoi(argv[2]) : 2;
+    // -r 每个IO线程一个epoll
+    if(argc > 3 && !strcmp(argv[3], "-r")) {
+        sy::Config::Lookup<bool>("iomanager.per_thread_reactor")->setValue(true);
+    }
 
-    sy::IOManager iom(2);
+    sy::IOManager iom(threads > 0 ? threads : 2);
     iom.schedule(run);
     return 0;
 }
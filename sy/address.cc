@@ -1,4 +1,5 @@
 #include "address.h"
+#include "dns.h"
 #include "log.h"
 #include <sstream>
 #include <netdb.h>
@@ -52,9 +53,27 @@ IPAddress::ptr Address::LookupAnyIPAddress(const std::string& host,
 }
 
 
+// 调用getaddrinfo，把得到的地址追加到result，返回getaddrinfo的错误码
+static int GetAddrInfo(std::vector<Address::ptr>& result, const std::string& node
+                       ,const char* service, const addrinfo& hints) {
+    addrinfo* results = nullptr;
+    int error = getaddrinfo(node.c_str(), service, &hints, &results);
+    if(error) {
+        return error;
+    }
+    // results指向头节点，用next遍历
+    for(addrinfo* next = results; next; next = next->ai_next) {
+        // 将得到的地址创建出来放到result容器中
+        result.push_back(Address::Create(next->ai_addr, next->ai_addrlen));
+    }
+    // 释放addrinfo指针
+    freeaddrinfo(results);
+    return 0;
+}
+
 bool Address::Lookup(std::vector<Address::ptr>& result, const std::string& host,
                      int family, int type, int protocol) {
-    addrinfo hints, *results, *next;
+    addrinfo hints;
     hints.ai_flags = 0;
     hints.ai_family = family;
     hints.ai_socktype = type;
@@ -103,25 +122,33 @@ bool Address::Lookup(std::vector<Address::ptr>& result, const std::string& host,
     if (node.empty()) {
         node = host;
     }
+    // 在IOManager的协程里通过异步DNS解析域名，不阻塞IO线程
+    unsigned char buf[sizeof(struct in6_addr)];
+    if(DnsResolver::CanResolve() && inet_pton(AF_INET, node.c_str(), buf) != 1
+            && inet_pton(AF_INET6, node.c_str(), buf) != 1) {
+        std::vector<std::string> ips;
+        int rt = DnsMgr::GetInstance()->resolve(node, family, ips);
+        if(rt) {
+            SY_LOG_ERROR(g_logger) << "Address::Lookup resolve(" << host
+                << ", " << family << ", " << type << ") error = " << rt;
+            return false;
+        }
+        // 地址已经是数字形式，getaddrinfo只展开端口和socket类型，不访问网络
+        hints.ai_flags |= AI_NUMERICHOST;
+        size_t size = result.size();
+        for(auto& i : ips) {
+            GetAddrInfo(result, i, service, hints);
+        }
+        return result.size() > size;
+    }
     // 获得地址链表
-    int error = getaddrinfo(node.c_str(), service, &hints, &results);
+    int error = GetAddrInfo(result, node, service, hints);
     if (error) {
         SY_LOG_ERROR(g_logger) << "Address::Lookup getaddress(" << host
             << ", " << family << ", " << type << ") error = " << error
             << ", gai_strerror = " << gai_strerror(error);
         return false;
     }
-    
-    // results指向头节点，用next遍历
-    next = results;
-    while (next) {
-        // 将得到的地址创建出来放到result容器中
-        result.push_back(Create(next->ai_addr, next->ai_addrlen));
-        next = next->ai_next;
-    }
-    
-    // 释放addrinfo指针
-    freeaddrinfo(results);
     return true;
 }
 
@@ -258,6 +258,8 @@ int Application::run_fiber() {
         if(!i.name.empty()) {
             server->setName(i.name);
         }
+        // 监听相关的设置(reuseport等)要在bind之前生效
+        server->setConf(i);
         std::vector<Address::ptr> fails;
         if(!server->bind(address, fails, i.ssl)) {
             for(auto& x : fails) {
@@ -272,7 +274,6 @@ int Application::run_fiber() {
                     << i.cert_file << " key_file=" << i.key_file;
             }
         }
-        server->setConf(i);
         //server->start();
         m_servers[i.type].push_back(server);
         svrs.push_back(server);
@@ -353,4 +354,17 @@ void Application::listAllServer(std::map<std::string, std::vector<TcpServer::ptr
     servers = m_servers;
 }
 
+std::ostream& Application::dumpStatus(std::ostream& os) {
+    if(m_mainIOManager) {
+        m_mainIOManager->dump(os) << std::endl;
+    }
+    sy::WorkerMgr::GetInstance()->dump(os);
+    std::vector<Module::ptr> modules;
+    ModuleMgr::GetInstance()->listAll(modules);
+    for(auto& i : modules) {
+        os << i->statusString();
+    }
+    return os;
+}
+
 }
@@ -18,6 +18,9 @@ public:
     bool getServer(const std::string& type, std::vector<TcpServer::ptr>& svrs);
     void listAllServer(std::map<std::string, std::vector<TcpServer::ptr> >& servers);
 
+    // 输出运行状态：主调度器和各worker调度器的统计，已加载的模块
+    std::ostream& dumpStatus(std::ostream& os);
+
     ZKServiceDiscovery::ptr getServiceDiscovery() const { return m_serviceDiscovery;}
     RockSDLoadBalance::ptr getRockSDLoadBalance() const { return m_rockSDLoadBalance;}
 private:
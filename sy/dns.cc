@@ -0,0 +1,651 @@
+#include "dns.h"
+#include "config.h"
+#include "hook.h"
+#include "iomanager.h"
+#include "log.h"
+#include "socket.h"
+#include "util.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <fstream>
+#include <functional>
+#include <random>
+#include <sstream>
+#include <string.h>
+
+namespace sy {
+
+static sy::Logger::ptr g_logger = SY_LOG_NAME("system");
+
+static sy::ConfigVar<bool>::ptr g_dns_enable =
+    sy::Config::Lookup("dns.enable", true, "resolve names asynchronously in fibers");
+static sy::ConfigVar<std::string>::ptr g_dns_resolv_conf =
+    sy::Config::Lookup("dns.resolv_conf", std::string("/etc/resolv.conf"), "dns resolv.conf path");
+static sy::ConfigVar<std::string>::ptr g_dns_hosts =
+    sy::Config::Lookup("dns.hosts", std::string("/etc/hosts"), "dns hosts file path");
+static sy::ConfigVar<uint32_t>::ptr g_dns_max_ttl =
+    sy::Config::Lookup("dns.cache.max_ttl", (uint32_t)3600, "dns cache max ttl(s)");
+static sy::ConfigVar<uint32_t>::ptr g_dns_negative_ttl =
+    sy::Config::Lookup("dns.cache.negative_ttl", (uint32_t)30, "dns negative cache ttl(s)");
+static sy::ConfigVar<uint32_t>::ptr g_dns_capacity =
+    sy::Config::Lookup("dns.cache.capacity", (uint32_t)10000, "dns cache max entries");
+
+static std::atomic<bool> s_dns_enable = {true};
+static std::atomic<uint32_t> s_dns_max_ttl = {3600};
+static std::atomic<uint32_t> s_dns_negative_ttl = {30};
+
+struct _DnsIniter {
+    _DnsIniter() {
+        s_dns_enable = g_dns_enable->getValue();
+        s_dns_max_ttl = g_dns_max_ttl->getValue();
+        s_dns_negative_ttl = g_dns_negative_ttl->getValue();
+        g_dns_enable->addListener([](const bool& old_value, const bool& new_value){
+            s_dns_enable = new_value;
+        });
+        g_dns_max_ttl->addListener([](const uint32_t& old_value, const uint32_t& new_value){
+            s_dns_max_ttl = new_value;
+        });
+        g_dns_negative_ttl->addListener([](const uint32_t& old_value, const uint32_t& new_value){
+            s_dns_negative_ttl = new_value;
+        });
+    }
+};
+
+static _DnsIniter s_dns_initer;
+
+// DNS报文的固定头部长度
+static const size_t DNS_HEADER_SIZE = 12;
+// UDP响应的最大长度(不带EDNS)
+static const size_t DNS_UDP_SIZE = 512;
+// CNAME链的最大长度
+static const int DNS_MAX_CNAME = 8;
+
+static uint64_t NowMS() {
+    return sy::GetMonotonicUS() / 1000;
+}
+
+// 小写并去掉结尾的点
+static std::string NormalizeName(const std::string& name) {
+    std::string rt = sy::ToLower(name);
+    if(!rt.empty() && rt[rt.size() - 1] == '.') {
+        rt.resize(rt.size() - 1);
+    }
+    return rt;
+}
+
+static uint16_t ReadU16(const uint8_t* p) {
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static uint32_t ReadU32(const uint8_t* p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void WriteU16(std::string& out, uint16_t v) {
+    out.push_back((char)(v >> 8));
+    out.push_back((char)(v & 0xff));
+}
+
+// 读取pos处的名字(支持压缩指针)，转成小写的点分形式，pos移到名字之后
+static bool ReadName(const uint8_t* data, size_t len, size_t& pos, std::string& name) {
+    name.clear();
+    size_t p = pos;
+    bool jumped = false;
+    // 防止压缩指针成环
+    for(int jumps = 0; jumps < 64; ) {
+        if(p >= len) {
+            return false;
+        }
+        uint8_t l = data[p];
+        if(l == 0) {
+            if(!jumped) {
+                pos = p + 1;
+            }
+            return true;
+        }
+        if((l & 0xc0) == 0xc0) {
+            if(p + 1 >= len) {
+                return false;
+            }
+            if(!jumped) {
+                pos = p + 2;
+            }
+            p = ((l & 0x3f) << 8) | data[p + 1];
+            jumped = true;
+            ++jumps;
+            continue;
+        }
+        if((l & 0xc0) || p + 1 + l > len) {
+            return false;
+        }
+        if(!name.empty()) {
+            name.push_back('.');
+        }
+        for(size_t i = 0; i < l; ++i) {
+            name.push_back((char)tolower(data[p + 1 + i]));
+        }
+        if(name.size() > 255) {
+            return false;
+        }
+        p += 1 + l;
+    }
+    return false;
+}
+
+bool DnsResolver::BuildQuery(std::string& packet, uint16_t id, const std::string& name, int type) {
+    packet.clear();
+    packet.reserve(DNS_HEADER_SIZE + name.size() + 6);
+    WriteU16(packet, id);
+    // 标准查询，期望递归(RD)
+    WriteU16(packet, 0x0100);
+    WriteU16(packet, 1);
+    WriteU16(packet, 0);
+    WriteU16(packet, 0);
+    WriteU16(packet, 0);
+    if(name.empty() || name.size() > 253) {
+        return false;
+    }
+    size_t begin = 0;
+    while(begin <= name.size()) {
+        size_t end = name.find('.', begin);
+        if(end == std::string::npos) {
+            end = name.size();
+        }
+        size_t l = end - begin;
+        if(l == 0 || l > 63) {
+            return false;
+        }
+        packet.push_back((char)l);
+        packet.append(name, begin, l);
+        begin = end + 1;
+    }
+    packet.push_back(0);
+    WriteU16(packet, (uint16_t)type);
+    // IN
+    WriteU16(packet, 1);
+    return true;
+}
+
+int DnsResolver::ParseResponse(const uint8_t* data, size_t len, uint16_t id
+                               ,const std::string& name, int type, Answer& answer
+                               ,bool* truncated) {
+    if(truncated) {
+        *truncated = false;
+    }
+    if(len < DNS_HEADER_SIZE || ReadU16(data) != id) {
+        return SERVER_FAIL;
+    }
+    uint16_t flags = ReadU16(data + 2);
+    // 不是响应
+    if(!(flags & 0x8000)) {
+        return SERVER_FAIL;
+    }
+    if(flags & 0x0200) {
+        if(truncated) {
+            *truncated = true;
+        }
+        return SERVER_FAIL;
+    }
+    int rcode = flags & 0x0f;
+    if(rcode == 3) {
+        return NOT_FOUND;
+    }
+    if(rcode != 0) {
+        return SERVER_FAIL;
+    }
+    uint16_t qdcount = ReadU16(data + 4);
+    uint16_t ancount = ReadU16(data + 6);
+
+    size_t pos = DNS_HEADER_SIZE;
+    std::string owner;
+    for(uint16_t i = 0; i < qdcount; ++i) {
+        if(!ReadName(data, len, pos, owner) || pos + 4 > len) {
+            return SERVER_FAIL;
+        }
+        // 响应的问题要和查询一致，防止串包
+        if(owner != name || ReadU16(data + pos) != type) {
+            return SERVER_FAIL;
+        }
+        pos += 4;
+    }
+
+    struct Record {
+        std::string owner;
+        uint16_t type;
+        uint32_t ttl;
+        // CNAME的目标或者IP的文本形式
+        std::string value;
+    };
+    std::vector<Record> records;
+    for(uint16_t i = 0; i < ancount; ++i) {
+        Record r;
+        if(!ReadName(data, len, pos, r.owner) || pos + 10 > len) {
+            return SERVER_FAIL;
+        }
+        r.type = ReadU16(data + pos);
+        r.ttl = ReadU32(data + pos + 4);
+        uint16_t rdlen = ReadU16(data + pos + 8);
+        pos += 10;
+        if(pos + rdlen > len) {
+            return SERVER_FAIL;
+        }
+        char buf[INET6_ADDRSTRLEN];
+        if(r.type == CNAME) {
+            size_t p = pos;
+            if(!ReadName(data, len, p, r.value)) {
+                return SERVER_FAIL;
+            }
+        } else if(r.type == A && rdlen == 4) {
+            r.value = inet_ntop(AF_INET, data + pos, buf, sizeof(buf));
+        } else if(r.type == AAAA && rdlen == 16) {
+            r.value = inet_ntop(AF_INET6, data + pos, buf, sizeof(buf));
+        } else {
+            pos += rdlen;
+            continue;
+        }
+        pos += rdlen;
+        records.push_back(std::move(r));
+    }
+
+    // 沿CNAME链找到最终的名字
+    std::string target = name;
+    uint32_t ttl = ~0u;
+    for(int n = 0; n < DNS_MAX_CNAME; ++n) {
+        bool found = false;
+        for(auto& r : records) {
+            if(r.type == CNAME && r.owner == target) {
+                target = r.value;
+                ttl = std::min(ttl, r.ttl);
+                found = true;
+                break;
+            }
+        }
+        if(!found) {
+            break;
+        }
+    }
+    answer.ips.clear();
+    for(auto& r : records) {
+        if(r.type == type && r.owner == target) {
+            answer.ips.push_back(r.value);
+            ttl = std::min(ttl, r.ttl);
+        }
+    }
+    if(answer.ips.empty()) {
+        return NOT_FOUND;
+    }
+    answer.ttl = ttl;
+    return OK;
+}
+
+// 查询报文的id，同一个socket上用于匹配响应
+static uint16_t NextQueryId() {
+    static thread_local std::mt19937 s_rng(std::random_device{}() ^ (uint32_t)sy::GetCurrentUS());
+    return (uint16_t)s_rng();
+}
+
+DnsResolver::DnsResolver()
+    :m_cache(SHARD_COUNT, g_dns_capacity->getValue(), g_dns_capacity->getValue() / 10) {
+    reload(g_dns_resolv_conf->getValue(), g_dns_hosts->getValue());
+}
+
+bool DnsResolver::CanResolve() {
+    return s_dns_enable && sy::is_hook_enable() && IOManager::GetThis()
+        && Scheduler::GetTaskStartUs()
+        && !Fiber::GetThis()->isSharedStack();
+}
+
+void DnsResolver::reload(const std::string& resolv_conf, const std::string& hosts) {
+    std::vector<Address::ptr> servers;
+    std::vector<std::string> search;
+    uint32_t ndots = 1;
+    uint32_t timeout = 5000;
+    uint32_t attempts = 2;
+
+    std::ifstream ifs(resolv_conf);
+    std::string line;
+    while(std::getline(ifs, line)) {
+        size_t comment = line.find_first_of("#;");
+        if(comment != std::string::npos) {
+            line.resize(comment);
+        }
+        std::istringstream ss(line);
+        std::string key;
+        if(!(ss >> key)) {
+            continue;
+        }
+        if(key == "nameserver") {
+            std::string ip;
+            ss >> ip;
+            // 去掉IPv6地址的%scope
+            IPAddress::ptr addr = IPAddress::Create(ip.substr(0, ip.find('%')).c_str(), 53);
+            if(addr) {
+                servers.push_back(addr);
+            }
+        } else if(key == "search" || key == "domain") {
+            search.clear();
+            std::string domain;
+            while(ss >> domain) {
+                search.push_back(NormalizeName(domain));
+            }
+        } else if(key == "options") {
+            std::string opt;
+            while(ss >> opt) {
+                if(opt.compare(0, 6, "ndots:") == 0) {
+                    ndots = std::min(atoi(opt.c_str() + 6), 15);
+                } else if(opt.compare(0, 8, "timeout:") == 0) {
+                    timeout = std::max(atoi(opt.c_str() + 8), 1) * 1000;
+                } else if(opt.compare(0, 9, "attempts:") == 0) {
+                    attempts = std::max(atoi(opt.c_str() + 9), 1);
+                }
+            }
+        }
+    }
+    // 和glibc一样，没有配置服务器时使用本机
+    if(servers.empty()) {
+        servers.push_back(IPAddress::Create("127.0.0.1", 53));
+    }
+
+    std::unordered_map<std::string, std::vector<std::string> > hosts4;
+    std::unordered_map<std::string, std::vector<std::string> > hosts6;
+    std::ifstream hfs(hosts);
+    while(std::getline(hfs, line)) {
+        size_t comment = line.find('#');
+        if(comment != std::string::npos) {
+            line.resize(comment);
+        }
+        std::istringstream ss(line);
+        std::string ip;
+        if(!(ss >> ip)) {
+            continue;
+        }
+        unsigned char buf[sizeof(struct in6_addr)];
+        std::unordered_map<std::string, std::vector<std::string> >* m = nullptr;
+        if(inet_pton(AF_INET, ip.c_str(), buf) == 1) {
+            m = &hosts4;
+        } else if(inet_pton(AF_INET6, ip.c_str(), buf) == 1) {
+            m = &hosts6;
+        } else {
+            continue;
+        }
+        std::string name;
+        while(ss >> name) {
+            (*m)[NormalizeName(name)].push_back(ip);
+        }
+    }
+
+    RWMutex::WriteLock lock(m_mutex);
+    m_servers.swap(servers);
+    m_search.swap(search);
+    m_ndots = ndots;
+    m_timeout = timeout;
+    m_attempts = attempts;
+    m_hosts4.swap(hosts4);
+    m_hosts6.swap(hosts6);
+}
+
+void DnsResolver::setNameservers(const std::vector<Address::ptr>& servers) {
+    RWMutex::WriteLock lock(m_mutex);
+    m_servers = servers;
+    m_search.clear();
+}
+
+void DnsResolver::setTimeout(uint32_t timeout_ms, uint32_t attempts) {
+    RWMutex::WriteLock lock(m_mutex);
+    m_timeout = timeout_ms;
+    m_attempts = std::max(attempts, 1u);
+}
+
+void DnsResolver::clearCache() {
+    m_cache.clear();
+}
+
+DnsResolver::Shard& DnsResolver::getShard(const std::string& key) {
+    return m_shards[std::hash<std::string>()(key) % SHARD_COUNT];
+}
+
+bool DnsResolver::lookupHosts(const std::string& name, int family, std::vector<std::string>& ips) {
+    RWMutex::ReadLock lock(m_mutex);
+    size_t size = ips.size();
+    if(family == AF_INET || family == AF_UNSPEC) {
+        auto it = m_hosts4.find(name);
+        if(it != m_hosts4.end()) {
+            ips.insert(ips.end(), it->second.begin(), it->second.end());
+        }
+    }
+    if(family == AF_INET6 || family == AF_UNSPEC) {
+        auto it = m_hosts6.find(name);
+        if(it != m_hosts6.end()) {
+            ips.insert(ips.end(), it->second.begin(), it->second.end());
+        }
+    }
+    return ips.size() > size;
+}
+
+int DnsResolver::resolve(const std::string& host, int family, std::vector<std::string>& ips) {
+    std::string name = NormalizeName(host);
+    if(name.empty() || name.size() > 253) {
+        return BAD_NAME;
+    }
+    if(lookupHosts(name, family, ips)) {
+        return OK;
+    }
+    if(family == AF_INET) {
+        return resolveType(name, A, ips);
+    }
+    if(family == AF_INET6) {
+        return resolveType(name, AAAA, ips);
+    }
+    // 两种都查，有一种成功就算成功
+    int rt4 = resolveType(name, A, ips);
+    int rt6 = resolveType(name, AAAA, ips);
+    if(rt4 == OK || rt6 == OK) {
+        return OK;
+    }
+    return rt4 == NOT_FOUND ? rt6 : rt4;
+}
+
+int DnsResolver::resolveType(const std::string& name, int type, std::vector<std::string>& ips) {
+    std::string key = name + "#" + std::to_string(type);
+    Entry entry;
+    if(m_cache.get(key, entry) && entry.expire > NowMS()) {
+        ips.insert(ips.end(), entry.ips.begin(), entry.ips.end());
+        return entry.error;
+    }
+
+    Shard& shard = getShard(key);
+    Promise<std::vector<std::string> > promise;
+    // 共享栈协程不能挂起等待别人发出的查询(FiberWaiter不支持)，自己查询，也不登记给别人等待
+    bool coalesce = !Fiber::GetThis()->isSharedStack();
+    if(coalesce) {
+        Mutex::Lock lock(shard.mutex);
+        auto it = shard.pending.find(key);
+        if(it != shard.pending.end()) {
+            // 已经有协程在查询同一个名字，等它的结果
+            Future<std::vector<std::string> > f = it->second;
+            lock.unlock();
+            f.wait();
+            if(!f.hasValue()) {
+                return f.getError();
+            }
+            ips.insert(ips.end(), f.get().begin(), f.get().end());
+            return OK;
+        }
+        // 查询结果先写缓存再撤销登记，持锁再查一次缓存，避免刚完成的查询又被重复发起
+        if(m_cache.get(key, entry) && entry.expire > NowMS()) {
+            ips.insert(ips.end(), entry.ips.begin(), entry.ips.end());
+            return entry.error;
+        }
+        shard.pending[key] = promise.getFuture();
+    }
+
+    Answer answer;
+    int rt = query(name, type, answer);
+    uint32_t ttl = 0;
+    if(rt == OK) {
+        ttl = std::min(answer.ttl, (uint32_t)s_dns_max_ttl);
+    } else if(rt == NOT_FOUND) {
+        ttl = s_dns_negative_ttl;
+    }
+    // 超时和服务器错误不缓存，下次重新查询
+    if(ttl) {
+        entry.error = rt;
+        entry.ips = answer.ips;
+        entry.expire = NowMS() + ttl * 1000ull;
+        m_cache.set(key, entry, ttl * 1000ull);
+    }
+    if(coalesce) {
+        Mutex::Lock lock(shard.mutex);
+        shard.pending.erase(key);
+    }
+    if(rt == OK) {
+        promise.setValue(answer.ips);
+        ips.insert(ips.end(), answer.ips.begin(), answer.ips.end());
+    } else {
+        promise.setError(rt);
+    }
+    return rt;
+}
+
+int DnsResolver::query(const std::string& name, int type, Answer& answer) {
+    std::vector<std::string> names;
+    {
+        RWMutex::ReadLock lock(m_mutex);
+        uint32_t dots = std::count(name.begin(), name.end(), '.');
+        if(dots >= m_ndots) {
+            names.push_back(name);
+        }
+        for(auto& i : m_search) {
+            names.push_back(name + "." + i);
+        }
+        if(dots < m_ndots) {
+            names.push_back(name);
+        }
+    }
+    int rt = NOT_FOUND;
+    for(auto& i : names) {
+        if(i.size() > 253) {
+            continue;
+        }
+        int r = queryName(i, type, answer);
+        if(r == OK) {
+            return OK;
+        }
+        // 有一个名字是服务器错误或者超时，整体就不能确定名字不存在
+        if(r != NOT_FOUND) {
+            rt = r;
+        }
+    }
+    return rt;
+}
+
+int DnsResolver::queryName(const std::string& name, int type, Answer& answer) {
+    std::vector<Address::ptr> servers;
+    uint32_t attempts = 0;
+    {
+        RWMutex::ReadLock lock(m_mutex);
+        servers = m_servers;
+        attempts = m_attempts;
+    }
+    int rt = TIMEOUT;
+    for(uint32_t i = 0; i < attempts; ++i) {
+        for(auto& server : servers) {
+            rt = queryServer(server, name, type, answer);
+            // 名字不存在是确定的答案，不用再问别的服务器
+            if(rt == OK || rt == NOT_FOUND) {
+                return rt;
+            }
+        }
+    }
+    return rt;
+}
+
+int DnsResolver::queryServer(Address::ptr server, const std::string& name, int type, Answer& answer) {
+    uint16_t id = NextQueryId();
+    std::string packet;
+    if(!BuildQuery(packet, id, name, type)) {
+        return BAD_NAME;
+    }
+    uint32_t timeout = 0;
+    {
+        RWMutex::ReadLock lock(m_mutex);
+        timeout = m_timeout;
+    }
+
+    // 连接的UDP socket只接收该服务器的响应
+    Socket::ptr sock = Socket::CreateUDP(server);
+    if(!sock->connect(server)) {
+        return SERVER_FAIL;
+    }
+    sock->setRecvTimeout(timeout);
+    if(sock->send(packet.c_str(), packet.size()) != (int)packet.size()) {
+        return SERVER_FAIL;
+    }
+    uint8_t buf[DNS_UDP_SIZE];
+    uint64_t deadline = NowMS() + timeout;
+    while(true) {
+        int n = sock->recv(buf, sizeof(buf));
+        if(n < 0) {
+            return errno == ETIMEDOUT || errno == EAGAIN ? TIMEOUT : SERVER_FAIL;
+        }
+        // id不匹配的是迟到的旧响应或者伪造的报文，继续等待
+        if(n >= 2 && ReadU16(buf) == id) {
+            bool truncated = false;
+            int rt = ParseResponse(buf, n, id, name, type, answer, &truncated);
+            if(truncated) {
+                return queryTcp(server, packet, id, name, type, answer);
+            }
+            return rt;
+        }
+        uint64_t now = NowMS();
+        if(now >= deadline) {
+            return TIMEOUT;
+        }
+        sock->setRecvTimeout(deadline - now);
+    }
+}
+
+int DnsResolver::queryTcp(Address::ptr server, const std::string& packet, uint16_t id
+                          ,const std::string& name, int type, Answer& answer) {
+    uint32_t timeout = 0;
+    {
+        RWMutex::ReadLock lock(m_mutex);
+        timeout = m_timeout;
+    }
+    Socket::ptr sock = Socket::CreateTCP(server);
+    if(!sock->connect(server, timeout)) {
+        return errno == ETIMEDOUT ? TIMEOUT : SERVER_FAIL;
+    }
+    sock->setRecvTimeout(timeout);
+    sock->setSendTimeout(timeout);
+    std::string msg;
+    WriteU16(msg, (uint16_t)packet.size());
+    msg += packet;
+    if(sock->send(msg.c_str(), msg.size()) != (int)msg.size()) {
+        return SERVER_FAIL;
+    }
+
+    // 读满len个字节
+    auto read_full = [&sock](uint8_t* p, size_t len) {
+        size_t off = 0;
+        while(off < len) {
+            int n = sock->recv(p + off, len - off);
+            if(n <= 0) {
+                return false;
+            }
+            off += n;
+        }
+        return true;
+    };
+    uint8_t head[2];
+    if(!read_full(head, sizeof(head))) {
+        return errno == ETIMEDOUT ? TIMEOUT : SERVER_FAIL;
+    }
+    std::vector<uint8_t> buf(ReadU16(head));
+    if(buf.empty() || !read_full(&buf[0], buf.size())) {
+        return errno == ETIMEDOUT ? TIMEOUT : SERVER_FAIL;
+    }
+    return ParseResponse(&buf[0], buf.size(), id, name, type, answer);
+}
+
+}
@@ -0,0 +1,146 @@
+// 协程里的异步DNS解析
+#ifndef __SY_DNS_H__
+#define __SY_DNS_H__
+
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "address.h"
+#include "ds/timed_cache.h"
+#include "future.h"
+#include "mutex.h"
+#include "singleton.h"
+
+namespace sy {
+
+// 异步DNS解析器
+// 名字先查/etc/hosts，再通过hook的socket以UDP向resolv.conf里的服务器查询，响应被截断时改用TCP
+// 查询在协程里挂起等待，不阻塞IO线程；只能在IOManager的协程里使用(CanResolve)，否则由调用者退回getaddrinfo
+// 结果按记录的TTL缓存在分片加锁的HashTimedCache里；不存在的名字(NXDOMAIN/没有记录)短时间负缓存
+// 同一个名字的并发查询合并成一次，其他协程等待第一次查询的结果
+class DnsResolver {
+public:
+    typedef std::shared_ptr<DnsResolver> ptr;
+
+    // 解析的错误码
+    enum Error {
+        OK = 0,
+        // 名字不存在或者没有该类型的记录
+        NOT_FOUND = 1,
+        // 所有服务器都没有在超时时间内响应
+        TIMEOUT = 2,
+        // 服务器返回错误或者响应无法解析
+        SERVER_FAIL = 3,
+        // 名字不合法
+        BAD_NAME = 4,
+    };
+
+    // 记录类型
+    enum Type {
+        A = 1,
+        CNAME = 5,
+        AAAA = 28,
+    };
+
+    // 一次查询的结果
+    struct Answer {
+        // IP地址的文本形式
+        std::vector<std::string> ips;
+        // 结果的有效期(秒)，CNAME链和各条记录中最小的TTL
+        uint32_t ttl = 0;
+    };
+
+    DnsResolver();
+
+    // 当前上下文能否异步解析：开启了dns.enable，在IOManager的协程里并且开启了hook
+    // 共享栈协程不能挂起等待别人发出的查询(FiberWaiter)，也退回getaddrinfo
+    static bool CanResolve();
+
+    // 把host解析成IP地址的文本形式，family为AF_INET、AF_INET6或AF_UNSPEC(两种都查)
+    // 返回Error，成功时ips不为空
+    int resolve(const std::string& host, int family, std::vector<std::string>& ips);
+
+    // 重新读取resolv.conf和hosts文件
+    void reload(const std::string& resolv_conf, const std::string& hosts);
+
+    // 指定DNS服务器，替换resolv.conf中的服务器，并清空搜索域
+    void setNameservers(const std::vector<Address::ptr>& servers);
+
+    // 每次查询的超时时间(毫秒)和每个服务器的尝试次数
+    void setTimeout(uint32_t timeout_ms, uint32_t attempts);
+
+    // 清空缓存
+    void clearCache();
+
+    // 构造查询报文，name不合法返回false
+    static bool BuildQuery(std::string& packet, uint16_t id, const std::string& name, int type);
+
+    // 解析响应报文，按CNAME链收集name的type类型记录
+    // 返回Error；报文被截断(TC)时返回SERVER_FAIL并设置truncated
+    static int ParseResponse(const uint8_t* data, size_t len, uint16_t id
+                             ,const std::string& name, int type, Answer& answer
+                             ,bool* truncated = nullptr);
+private:
+    // 缓存项
+    struct Entry {
+        // 错误码，NOT_FOUND为负缓存
+        int error = OK;
+        std::vector<std::string> ips;
+        // 过期时间(单调时钟的毫秒)
+        uint64_t expire = 0;
+    };
+
+    // 正在进行的查询按名字分片登记，用于合并并发查询
+    struct Shard {
+        Mutex mutex;
+        std::unordered_map<std::string, Future<std::vector<std::string> > > pending;
+    };
+
+    static const size_t SHARD_COUNT = 16;
+
+    // 解析名字的一种记录，先查缓存，再合并或者发起查询
+    int resolveType(const std::string& name, int type, std::vector<std::string>& ips);
+
+    // 按搜索域依次查询
+    int query(const std::string& name, int type, Answer& answer);
+
+    // 依次向各个服务器查询一个完整的名字
+    int queryName(const std::string& name, int type, Answer& answer);
+
+    // 向一个服务器查询，UDP响应被截断时改用TCP
+    int queryServer(Address::ptr server, const std::string& name, int type, Answer& answer);
+
+    // TCP查询，报文前加两字节的长度
+    int queryTcp(Address::ptr server, const std::string& packet, uint16_t id
+                 ,const std::string& name, int type, Answer& answer);
+
+    // 查hosts文件，没有返回false
+    bool lookupHosts(const std::string& name, int family, std::vector<std::string>& ips);
+
+    Shard& getShard(const std::string& key);
+private:
+    // 保护以下配置
+    RWMutex m_mutex;
+    std::vector<Address::ptr> m_servers;
+    // 搜索域
+    std::vector<std::string> m_search;
+    // 名字里的点少于ndots个时先加搜索域查询
+    uint32_t m_ndots = 1;
+    uint32_t m_timeout = 5000;
+    uint32_t m_attempts = 2;
+    // hosts文件，小写的名字到地址
+    std::unordered_map<std::string, std::vector<std::string> > m_hosts4;
+    std::unordered_map<std::string, std::vector<std::string> > m_hosts6;
+
+    // 缓存，key为名字#类型
+    sy::ds::HashTimedCache<std::string, Entry> m_cache;
+    Shard m_shards[SHARD_COUNT];
+};
+
+typedef sy::Singleton<DnsResolver> DnsMgr;
+
+}
+
+#endif
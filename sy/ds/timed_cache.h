@@ -56,6 +56,7 @@ public:
         typename RWMutexType::WriteLock lock(m_mutex);
         auto it = m_cache.find(k);
         if(it != m_cache.end()) {
+            m_timed.erase(it->second);
             m_cache.erase(it);
         }
         auto sit = m_timed.insert(Item(k, v, expired + sy::GetCurrentMS()));
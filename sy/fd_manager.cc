@@ -1,5 +1,7 @@
 #include "fd_manager.h"
 #include "hook.h"
+#include <new>
+#include <stdlib.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -9,13 +11,14 @@ namespace sy {
 FdCtx::FdCtx(int fd)
     :m_isInit(false)
     ,m_isSocket(false)
+    ,m_isFile(false)
     ,m_sysNonblock(false)
     ,m_userNonblock(false)
     ,m_isClosed(false)
+    ,m_inUse(false)
     ,m_fd(fd)
     ,m_recvTimeout(-1)
     ,m_sendTimeout(-1) {
-    init();
 }
 
 FdCtx::~FdCtx() {
@@ -35,11 +38,14 @@ bool FdCtx::init() {
     if (-1 == fstat(m_fd, &fd_stat)) {
         m_isInit = false;
         m_isSocket = false;
+        m_isFile = false;
     } else {
         m_isInit = true;
         // 判断文件是否为socket
         m_isSocket = S_ISSOCK(fd_stat.st_mode);
+        m_isFile = S_ISREG(fd_stat.st_mode);
     }
+    readAhead = ReadAhead();
     
     // 是socket则设置为非阻塞模式
     if (m_isSocket) {
@@ -74,45 +80,65 @@ uint64_t FdCtx::getTimeout(int type) {
 }
 
 FdManager::FdManager() {
-    m_datas.resize(64);
+    for(int i = 0; i < MAX_SEGMENTS; ++i) {
+        m_segments[i].store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+FdCtx* FdManager::allocSegment(int index) {
+    // FdCtx按cache line对齐，new不保证超过16字节的对齐，这里手动分配再placement new
+    void* mem = nullptr;
+    if(posix_memalign(&mem, alignof(FdCtx), sizeof(FdCtx) * SEGMENT_SIZE)) {
+        throw std::bad_alloc();
+    }
+    FdCtx* seg = (FdCtx*)mem;
+    int base = index << SEGMENT_SHIFT;
+    for(int i = 0; i < SEGMENT_SIZE; ++i) {
+        new (&seg[i]) FdCtx(base + i);
+    }
+    FdCtx* expected = nullptr;
+    if(m_segments[index].compare_exchange_strong(expected, seg
+                , std::memory_order_acq_rel, std::memory_order_acquire)) {
+        return seg;
+    }
+    // 其他线程已经发布了这一段，释放自己分配的
+    for(int i = 0; i < SEGMENT_SIZE; ++i) {
+        seg[i].~FdCtx();
+    }
+    free(mem);
+    return expected;
 }
 
 FdCtx::ptr FdManager::get(int fd, bool auto_create) {
-    if(fd == -1) {
+    FdCtx* ctx = lookup(fd, auto_create);
+    if(!ctx) {
         return nullptr;
     }
-    // 集合中没有，并且不自动创建，返回nullptr
-    RWMUtexType::ReadLock lock(m_mutex);
-    if ((int)m_datas.size() <= fd) {
-        if (auto_create == false) {
-            return nullptr;
-        }
-    } else {
-        // 找到了直接返回
-        if (m_datas[fd] || !auto_create) {
-            return m_datas[fd];
-        }
+    // 快速路径：只读一个原子标志，不加锁
+    if(SY_LIKELY(ctx->m_inUse.load(std::memory_order_acquire))) {
+        return ctx;
+    }
+    if(!auto_create) {
+        return nullptr;
     }
-    lock.unlock();
-	
-    RWMUtexType::WriteLock locK2(m_mutex);
-    // 创建新的FdCtx
-    FdCtx::ptr ctx(new FdCtx(fd));
-    // fd比集合下标大，扩充
-    if (fd >= (int)m_datas.size()) {
-        m_datas.resize(fd * 1.5);
+    // 创建很少发生，用记录自己的锁防止并发初始化
+    FdCtx::MutexType::Lock lock(ctx->mutex);
+    if(!ctx->m_inUse.load(std::memory_order_relaxed)) {
+        ctx->m_isInit = false;
+        ctx->init();
+        ctx->m_inUse.store(true, std::memory_order_release);
     }
-    // 放入集合中
-    m_datas[fd] = ctx;
     return ctx;
 }
 
 void FdManager::del(int fd) {
-    RWMutexType::WriteLock lock(m_mutex);
-    if((int)m_datas.size() <= fd) {
+    FdCtx* ctx = lookup(fd, false);
+    if(!ctx) {
         return;
     }
-    m_datas[fd].reset();
+    FdCtx::MutexType::Lock lock(ctx->mutex);
+    ctx->m_inUse.store(false, std::memory_order_release);
+    ++ctx->generation;
 }
 
 }
@@ -1,27 +1,81 @@
 #ifndef __FD_MANAGER_H__
 #define __FD_MANAGER_H__
 
+#include <atomic>
+#include <functional>
 #include <memory>
-#include <vector>
+#include "fiber.h"
+#include "macro.h"
 #include "thread.h"
 #include "singleton.h"
+#include "timer.h"
 
 namespace sy {
 
-class FdCtx : public std::enable_shared_from_this<FdCtx> {
+class IOManager;
+class Scheduler;
+struct UringRequest;
+
+// 每个fd一条记录，hook的句柄状态和IOManager的事件状态合在一起
+// 记录按cache line对齐，hook和注册事件时用到的字段都在第一个cache line里，读写事件上下文放在后面
+// 记录由FdManager分段分配，进程生命周期内不会释放，fd号被复用时记录也复用，所以可以直接持有裸指针
+class alignas(64) FdCtx {
+friend class FdManager;
 public:
-    typedef std::shared_ptr<FdCtx> ptr;
-    // 通过文件句柄构造FdCtx
-    FdCtx(int fd);
-    
+    // 记录永不释放，不需要引用计数
+    typedef FdCtx* ptr;
+    // 保护事件状态，临界区很短，使用自旋锁
+    typedef Spinlock MutexType;
+
+    // 事件上下文类
+    // fd的每个事件都有一个事件上下文，保存这个事件的回调函数以及执行回调函数的调度器
+    struct EventContext {
+        // 执行事件的调度器
+        Scheduler* scheduler = nullptr;
+        // 事件协程
+        Fiber::ptr fiber;
+        /// 事件执行的回调函数
+        std::function<void()> cb;
+        // 事件触发后在哪个线程上执行，-1表示任意线程
+        int thread = -1;
+    };
+
+    // 带超时的事件等待(IOManager::waitEvent)的状态，访问需持有mutex
+    // 检查超时的定时器节点是懒删除的：等待提前结束时不摘下，到期时按当前的超时时间点决定超时还是重新挂上
+    // 这样同一个fd反复带超时等待时只有第一次和每个超时周期各操作一次时间轮
+    struct Deadline {
+        // 检查超时的定时器节点
+        TimerHandle timer;
+        // 当前等待的超时时间点(绝对毫秒)，~0ull表示没有在等待
+        uint64_t when = ~0ull;
+        // 节点挂上时的执行时间
+        uint64_t armedAt = 0;
+        // 挂上节点的IOManager及其id，id不会复用，IOManager析构后节点自然失效
+        IOManager* iom = nullptr;
+        uint64_t owner = 0;
+        // 所属的记录和事件
+        FdCtx* ctx = nullptr;
+        int event = 0;
+        // 节点是否挂在时间轮上
+        bool armed = false;
+        // 上一次等待是否因为超时结束
+        bool timedOut = false;
+    };
+
     ~FdCtx();
 
+    // 文件句柄
+    int getFd() const { return m_fd;}
+
     // 是否初始化完成
     bool isInit() const { return m_isInit;}
 
     // 是否socket
     bool isSocket() const { return m_isSocket;}
 
+    // 是否普通文件
+    bool isFile() const { return m_isFile;}
+
     // 是否已关闭
     bool isClose() const { return m_isClosed;}
 
@@ -46,6 +100,9 @@ public:
     // 返回： 超时时间毫秒
     uint64_t getTimeout(int type);
 private:
+    // 通过文件句柄构造，只由FdManager在分配段时调用
+    FdCtx(int fd);
+
     // 初始化
     bool init();
 private:
@@ -53,39 +110,98 @@ private:
     bool m_isInit: 1;
     // 是否socket
     bool m_isSocket: 1;
+    // 是否普通文件
+    bool m_isFile: 1;
     // 是否hook非阻塞
     bool m_sysNonblock: 1;
     // 是否用户主动设置非阻塞
     bool m_userNonblock: 1;
     // 是否关闭
     bool m_isClosed: 1;
+    // 是否被hook管理，get(fd, true)时置为true，del时置为false
+    std::atomic<bool> m_inUse;
     // 文件句柄
     int m_fd;
     // 读超时时间毫秒
     uint64_t m_recvTimeout;
     // 写超时时间毫秒
     uint64_t m_sendTimeout;
+
+public:
+    // 以下是IOManager的事件状态，访问时需持有mutex
+    // 事件的锁
+    MutexType mutex;
+    // 该fd添加了哪些事件的回调函数，或者说该fd已经注册的事件(IOManager::Event)
+    int events = 0;
+    // 每线程reactor模式下fd所属的IO线程序号，-1表示还未分配
+    int owner = -1;
+    // io_uring模式下正在等待读/写的请求，用于cancelEvent/cancelAll
+    UringRequest* uringRead = nullptr;
+    UringRequest* uringWrite = nullptr;
+    // 读事件上下文
+    EventContext read;
+    // 写事件上下文
+    EventContext write;
+    // 读/写等待的超时状态
+    Deadline readDeadline;
+    Deadline writeDeadline;
+
+    // 普通文件的顺序预读状态(FileIO)，访问需持有mutex
+    struct ReadAhead {
+        // 下一次顺序读的偏移
+        uint64_t next = 0;
+        // 当前的预读窗口，0表示不是顺序读
+        uint64_t window = 0;
+        // 已经发起预读的结束偏移
+        uint64_t issued = 0;
+    };
+    ReadAhead readAhead;
+    // 记录每次被del时加一，fd号复用后异步任务据此判断是不是原来的文件，访问需持有mutex
+    uint64_t generation = 0;
 };
 
+// fd记录表：分段、只增长的数组，第i段保存[i * SEGMENT_SIZE, (i + 1) * SEGMENT_SIZE)的记录
+// 段指针数组大小固定，段第一次用到时才分配并用CAS发布，之后不再移动和释放，读者不需要加锁
 class FdManager {
 public:
-    typedef RWMutex RWMutexType;
-    
+    // 每段的记录数
+    static const int SEGMENT_SHIFT = 10;
+    static const int SEGMENT_SIZE = 1 << SEGMENT_SHIFT;
+    // 段的数量，支持的fd上限为MAX_SEGMENTS * SEGMENT_SIZE
+    static const int MAX_SEGMENTS = 4096;
+
     FdManager();
 
     // 获取/创建文件句柄类FdCtx
     // fd 文件句柄
     // auto_create 是否自动创建FdCtx
-    // 返回对应文件句柄类FdCtx::ptr
+    // 返回对应文件句柄类FdCtx::ptr，没有被hook管理并且不自动创建时返回nullptr
     FdCtx::ptr get(int fd, bool auto_create = false);
 
     // 删除文件句柄类
     void del(int fd);
+
+    // 获取fd的记录，不管它是否被hook管理，IOManager注册事件时使用
+    // auto_create 段不存在时是否分配，fd超出上限返回nullptr
+    FdCtx* lookup(int fd, bool auto_create) {
+        if(SY_UNLIKELY(fd < 0 || fd >= MAX_SEGMENTS * SEGMENT_SIZE)) {
+            return nullptr;
+        }
+        FdCtx* seg = m_segments[fd >> SEGMENT_SHIFT].load(std::memory_order_acquire);
+        if(SY_UNLIKELY(!seg)) {
+            if(!auto_create) {
+                return nullptr;
+            }
+            seg = allocSegment(fd >> SEGMENT_SHIFT);
+        }
+        return &seg[fd & (SEGMENT_SIZE - 1)];
+    }
+private:
+    // 分配并发布第index段，并发分配时只有一个能发布成功，返回已发布的段
+    FdCtx* allocSegment(int index);
 private:
-    // 读写锁
-    RWMutexType m_mutex;
-    // 文件句柄集合
-    std::vector<FdCtx::ptr> m_datas;
+    // 段指针数组
+    std::atomic<FdCtx*> m_segments[MAX_SEGMENTS];
 };
 
 // 文件句柄单例
@@ -3,7 +3,13 @@
 #include "macro.h"
 #include "log.h"
 #include "scheduler.h"
+#include "stack_allocator.h"
+#include <algorithm>
 #include <atomic>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
 
 namespace sy {
 
@@ -25,14 +31,94 @@ static thread_local Fiber::ptr t_threadFiber = nullptr;
 static ConfigVar<uint32_t>::ptr g_fiber_stack_size =
     Config::Lookup<uint32_t>("fiber.stack_size", 128 * 1024, "fiber stack size");
 
-// malloc栈内存分配器：创建/释放协程运行栈
-class MallocStackAllocator {
-public:
-    static void* Alloc(size_t size) { return malloc(size); }
-    static void Dealloc(void* vp, size_t size) { return free(vp); }
+// MaybeYield的时间片，0表示MaybeYield从不让出
+static ConfigVar<uint32_t>::ptr g_fiber_yield_slice =
+    Config::Lookup<uint32_t>("fiber.yield_slice_ms", 10, "fiber time slice(ms) for Fiber::MaybeYield");
+
+static std::atomic<uint64_t> s_fiber_yield_slice_us = {10 * 1000};
+
+struct _FiberIniter {
+    _FiberIniter() {
+        s_fiber_yield_slice_us = g_fiber_yield_slice->getValue() * 1000ull;
+        g_fiber_yield_slice->addListener([](const uint32_t& old_value, const uint32_t& new_value){
+            SY_LOG_INFO(g_logger) << "fiber yield slice changed from "
+                                  << old_value << " to " << new_value;
+            s_fiber_yield_slice_us = new_value * 1000ull;
+        });
+    }
+};
+
+static _FiberIniter s_fiber_initer;
+
+// 共享栈模式：每个线程的共享栈大小和数量，线程第一次运行共享栈协程时读取
+static ConfigVar<uint32_t>::ptr g_fiber_shared_stack_size =
+    Config::Lookup<uint32_t>("fiber.shared_stack.size", 1024 * 1024, "fiber shared stack size");
+static ConfigVar<uint32_t>::ptr g_fiber_shared_stack_count =
+    Config::Lookup<uint32_t>("fiber.shared_stack.count", 4, "fiber shared stack count per thread");
+
+// 共享栈，同一线程上绑定它的协程轮流在上面运行
+struct SharedStack {
+    char* stack = nullptr;
+    size_t size = 0;
+    // 栈上当前是哪个协程的内容，nullptr表示没有有效内容(协程已结束)
+    Fiber* occupant = nullptr;
+    // occupant是否在当前的resume链上(它resume了其他协程，还没有yield)
+    // 这时它的栈帧是活的，m_ctx.sp也不是最新的，不能被换出
+    bool active = false;
 };
 
-using StackAllocator = MallocStackAllocator;
+// 线程的共享栈，线程退出时释放，之后绑定它们的协程不能再恢复
+struct ThreadSharedStacks {
+    std::vector<SharedStack> stacks;
+    size_t next = 0;
+    int thread = -1;
+
+    // 为新协程选一个共享栈：优先选空的，否则轮流选，不选resume链上的协程所在的栈
+    SharedStack* get() {
+        if(stacks.empty()) {
+            init();
+        }
+        for(auto& i : stacks) {
+            if(!i.occupant) {
+                return &i;
+            }
+        }
+        for(size_t i = 0; i < stacks.size(); ++i) {
+            SharedStack* s = &stacks[next];
+            next = (next + 1) % stacks.size();
+            if(!s->active) {
+                return s;
+            }
+        }
+        SY_ASSERT2(false, "all shared stacks are in the resume chain, count=" << stacks.size()
+                << ", increase fiber.shared_stack.count");
+        return nullptr;
+    }
+
+    void init() {
+        static size_t s_page_size = sysconf(_SC_PAGESIZE);
+        size_t size = g_fiber_shared_stack_size->getValue();
+        size = (size + s_page_size - 1) / s_page_size * s_page_size;
+        // 至少两个，嵌套resume时切入的协程不会和调用者抢同一个栈
+        size_t count = std::max<size_t>(g_fiber_shared_stack_count->getValue(), 2);
+        stacks.resize(count);
+        for(auto& i : stacks) {
+            i.stack = (char*)PooledStackAllocator::MapStack(size);
+            SY_ASSERT2(i.stack, "map shared stack fail, size=" << size);
+            i.size = size;
+        }
+        thread = GetThreadId();
+        SY_LOG_DEBUG(g_logger) << "init shared stacks count=" << count << " size=" << size;
+    }
+
+    ~ThreadSharedStacks() {
+        for(auto& i : stacks) {
+            PooledStackAllocator::UnmapStack(i.stack, i.size);
+        }
+    }
+};
+
+static thread_local ThreadSharedStacks t_shared_stacks;
 
 uint64_t Fiber::GetFiberId() {
     if(t_fiber) {
@@ -41,13 +127,33 @@ uint64_t Fiber::GetFiberId() {
     return 0;
 }
 
+bool Fiber::MaybeYield() {
+    uint64_t slice = s_fiber_yield_slice_us.load(std::memory_order_relaxed);
+    uint64_t start = Scheduler::GetTaskStartUs();
+    if(!slice || !start) {
+        return false;
+    }
+    // 粗粒度时钟可能比开始时间(精确时钟)略小
+    uint64_t now = GetMonotonicCoarseUS();
+    if(now < start + slice) {
+        return false;
+    }
+    // 调度器中嵌套resume的子协程不参与调度，不能重新入队
+    if(!t_fiber || !t_fiber->m_runInScheduler
+            || (!t_fiber->m_stack && !t_fiber->m_useSharedStack)) {
+        return false;
+    }
+    Scheduler::YieldToQueue();
+    return true;
+}
+
 // 无参构造函数只用于创建线程的第一个协程，也就是线程主函数对应的协程，这个协程只能由GetThis()方法调用，所以定义成私有方法
 Fiber::Fiber() {
     SetThis(this);
     m_state = RUNNING;
     
     // 获取当前协程的上下文信息保存到m_ctx中
-    if (getcontext(&m_ctx)) {
+    if (!InitMainContext(&m_ctx)) {
         SY_ASSERT2(false, "getcontext");
     }
  
@@ -75,24 +181,29 @@ Fiber::ptr Fiber::GetThis() {
 
 // 有参构造函数，用于创建其他协程（用户协程）
 // 增加m_runInScheduler成员，表示当前协程是否参与调度器调度
-Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool run_in_scheduler)
+Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool run_in_scheduler, bool shared_stack)
     : m_id(s_fiber_id++)
-    , m_cb(cb) 
+    , m_cb(std::move(cb)) 
     , m_runInScheduler(run_in_scheduler){
     ++s_fiber_count;
+#ifdef SY_FIBER_ASM_CONTEXT
+    // 共享栈协程在第一次resume时才绑定栈、构造初始栈帧
+    if(shared_stack) {
+        m_useSharedStack = true;
+        SY_LOG_DEBUG(g_logger) << "Fiber::Fiber() shared stack id = " << m_id;
+        return;
+    }
+#endif
     m_stacksize = stacksize ? stacksize : g_fiber_stack_size->getValue();
-    m_stack     = StackAllocator::Alloc(m_stacksize);
+    // 栈分配器由配置fiber.stack_allocator决定，见stack_allocator.h
+    m_allocator = StackAllocator::GetDefault();
+    m_stack     = m_allocator->alloc(m_stacksize);
+    SY_ASSERT2(m_stack, "alloc fiber stack fail, size=" << m_stacksize);
  
-    if (getcontext(&m_ctx)) {
-        SY_ASSERT2(false, "getcontext");
+    if (!MakeContext(&m_ctx, m_stack, m_stacksize, &Fiber::MainFunc)) {
+        SY_ASSERT2(false, "makecontext");
     }
  
-    m_ctx.uc_link          = nullptr;
-    m_ctx.uc_stack.ss_sp   = m_stack;
-    m_ctx.uc_stack.ss_size = m_stacksize;
- 
-    makecontext(&m_ctx, &Fiber::MainFunc, 0);
- 
     SY_LOG_DEBUG(g_logger) << "Fiber::Fiber() id = " << m_id;
 }
 
@@ -104,9 +215,12 @@ Fiber::~Fiber() {
     if(m_stack) {
         SY_ASSERT(m_state == TERM);
         // 释放运行栈
-        StackAllocator::Dealloc(m_stack, m_stacksize);
+        m_allocator->dealloc(m_stack, m_stacksize);
         SY_LOG_DEBUG(g_logger) << "dealloc stack, id = " << m_id;
-    } 
+    } else if(m_useSharedStack) {
+        SY_ASSERT(m_state == TERM);
+        free(m_saveBuf);
+    }
     // 没有栈，说明是线程的主协程
     else {
         // 主协程的释放要保证：主协程没有任务cb，并且主协程当前正在运行
@@ -124,18 +238,22 @@ Fiber::~Fiber() {
 // 这里强制只有TERM状态的协程才可以重置，但其实刚创建好但没执行过的协程也应该允许重置的
 // 重置协程就是重复利用已结束的协程，复用其栈空间，创建新协程
 void Fiber::reset(std::function<void()> cb) {
-    SY_ASSERT(m_stack);
+    SY_ASSERT(m_stack || m_useSharedStack);
     SY_ASSERT(m_state == TERM);
-    m_cb = cb;
-    if (getcontext(&m_ctx)) {
-        SY_ASSERT2(false, "getcontext");
+    m_cb = std::move(cb);
+    // 共享栈协程保留绑定的栈，下次切入时再构造初始栈帧
+    if(m_useSharedStack) {
+#ifdef SY_FIBER_ASM_CONTEXT
+        m_ctx.sp = nullptr;
+#endif
+        m_saveSize = 0;
+        m_state = READY;
+        return;
+    }
+    // 汇编后端只是在栈顶重建初始栈帧，ucontext后端需要getcontext+makecontext
+    if (!MakeContext(&m_ctx, m_stack, m_stacksize, &Fiber::MainFunc)) {
+        SY_ASSERT2(false, "makecontext");
     }
- 
-    m_ctx.uc_link          = nullptr;
-    m_ctx.uc_stack.ss_sp   = m_stack;
-    m_ctx.uc_stack.ss_size = m_stacksize;
- 
-    makecontext(&m_ctx, &Fiber::MainFunc, 0);
     m_state = READY;
 }
 
@@ -143,26 +261,81 @@ void Fiber::reset(std::function<void()> cb) {
 // 当前协程和正在运行的协程进行交换，前者状态变为RUNNING，后者状态变为READY
 void Fiber::resume() {
     SY_ASSERT(m_state != TERM && m_state != RUNNING);
+    if(m_useSharedStack) {
+        switchInSharedStack();
+        m_sharedStack->active = true;
+    }
     SetThis(this);
     m_state = RUNNING;
  
     // 如果协程参与调度器调度，那么应该和调度器的主协程进行swap，而不是线程主协程
     if (m_runInScheduler) {
-        if (swapcontext(&(Scheduler::GetMainFiber()->m_ctx), &m_ctx)) {
+        if (!SwapContext(&(Scheduler::GetMainFiber()->m_ctx), &m_ctx)) {
             SY_ASSERT2(false, "swapcontext");
         }
     } else {
-        if (swapcontext(&(t_thread_fiber->m_ctx), &m_ctx)) {
+        if (!SwapContext(&(t_thread_fiber->m_ctx), &m_ctx)) {
             SY_ASSERT2(false, "swapcontext");
         }
     }
 }
  
+// 在调用者的栈上执行，共享栈上的协程不在resume链上时已经切出，可以安全地拷贝
+void Fiber::switchInSharedStack() {
+#ifdef SY_FIBER_ASM_CONTEXT
+    if(!m_sharedStack) {
+        m_sharedStack = t_shared_stacks.get();
+        m_sharedThread = t_shared_stacks.thread;
+    }
+    SharedStack* s = m_sharedStack;
+    SY_ASSERT2(m_sharedThread == t_shared_stacks.thread
+            ,"shared stack fiber resumed on another thread, id=" << m_id);
+    if(s->occupant != this) {
+        if(s->occupant) {
+            // 栈上的协程还在resume链上(直接或间接resume了本协程)，栈帧是活的不能换出
+            // 已经绑定的协程也不能换到别的栈上，只能拒绝
+            SY_ASSERT2(!s->active
+                ,"shared stack fiber resumed while its stack is in the resume chain, id=" << m_id
+                << " occupant=" << s->occupant->getId());
+            s->occupant->saveSharedStack();
+        }
+        if(m_ctx.sp && m_saveSize) {
+            memcpy(s->stack + s->size - m_saveSize, m_saveBuf, m_saveSize);
+        }
+        s->occupant = this;
+    }
+    // 新协程或者reset过的协程
+    if(!m_ctx.sp) {
+        AsmMakeContext(&m_ctx, s->stack, s->size, &Fiber::MainFunc);
+    }
+#endif
+}
+
+void Fiber::saveSharedStack() {
+#ifdef SY_FIBER_ASM_CONTEXT
+    // 切出时寄存器已经压在栈上，[sp, 栈顶)就是要保存的全部内容
+    char* top = m_sharedStack->stack + m_sharedStack->size;
+    uint32_t used = top - (char*)m_ctx.sp;
+    // 保存区按实际大小分配，比需要的大一倍以上时缩小，常驻协程只占用真正用到的栈
+    if(used > m_saveCap || used * 2 < m_saveCap) {
+        free(m_saveBuf);
+        m_saveBuf = (char*)malloc(used);
+        SY_ASSERT2(m_saveBuf, "malloc shared stack save buffer fail, size=" << used);
+        m_saveCap = used;
+    }
+    memcpy(m_saveBuf, m_ctx.sp, used);
+    m_saveSize = used;
+#endif
+}
+
 // 当前协程让出执行权
 // 当前协程与上次resume时退到后台的协程进行交换，前者状态变为READY，后者状态变为RUNNING
 void Fiber::yield() {
     /// 协程运行完之后会自动yield一次，用于回到主协程，此时状态已为结束状态
     SY_ASSERT(m_state == RUNNING || m_state == TERM);
+    if(m_sharedStack) {
+        m_sharedStack->active = false;
+    }
     SetThis(t_thread_fiber.get());
     if (m_state != TERM) {
         m_state = READY;
@@ -170,11 +343,11 @@ void Fiber::yield() {
  
     // 如果协程参与调度器调度，那么应该和调度器的主协程进行swap，而不是线程主协程
     if (m_runInScheduler) {
-        if (swapcontext(&m_ctx, &(Scheduler::GetMainFiber()->m_ctx))) {
+        if (!SwapContext(&m_ctx, &(Scheduler::GetMainFiber()->m_ctx))) {
             SY_ASSERT2(false, "swapcontext");
         }
     } else {
-        if (swapcontext(&m_ctx, &(t_thread_fiber->m_ctx))) {
+        if (!SwapContext(&m_ctx, &(t_thread_fiber->m_ctx))) {
             SY_ASSERT2(false, "swapcontext");
         }
     }
@@ -188,6 +361,10 @@ void Fiber::MainFunc() {
     cur->m_cb(); // 这里真正执行协程的入口函数
     cur->m_cb    = nullptr;
     cur->m_state = TERM;
+    // 结束的协程的栈内容不需要保存，共享栈直接让给下一个协程
+    if(cur->m_sharedStack) {
+        cur->m_sharedStack->occupant = nullptr;
+    }
  
     auto raw_ptr = cur.get(); // 手动让t_fiber的引用计数减1
     cur.reset();
@@ -3,12 +3,14 @@
 
 #include <memory>
 #include <functional>
-#include <ucontext.h>
+#include "fiber_context.h"
 #include "thread.h"
 
 namespace sy {
 
 class Scheduler;
+class StackAllocator;
+struct SharedStack;
 
 // 协程类
 class Fiber : public std::enable_shared_from_this<Fiber> {
@@ -33,7 +35,14 @@ private:
 public:
     // 构造子协程（用户协程）：初始化子协程的ucontext_t上下文和栈空间
     // cb 协程入口函数，stacksize 协程栈大小，run_in_scheduler 本协程是否参与调度器调度，默认为true
-    Fiber(std::function<void()> cb, size_t stacksize = 0, bool run_in_scheduler = true);
+    // shared_stack 使用共享栈(拷贝栈)模式，此时忽略stacksize：
+    // 协程不单独分配栈，第一次resume时绑定当前线程的一个共享栈(fiber.shared_stack.size/count)，
+    // 同一共享栈上的协程轮流运行，被换下时只把用到的部分拷到按需分配的保存区，适合大量常驻的连接协程
+    // 限制：协程切出后它栈上的地址可能被别的协程覆盖，不能把栈上对象的指针交给其他协程或线程
+    // (协程同步原语、Future的等待节点都在栈上，所以不能在共享栈协程里使用)；协程只能在绑定的线程上恢复，
+    // 调度器会自动把它调度回这个线程；只有汇编上下文后端支持，ucontext后端忽略此参数
+    Fiber(std::function<void()> cb, size_t stacksize = 0, bool run_in_scheduler = true
+          ,bool shared_stack = false);
 
     // 释放协程运行栈
     ~Fiber();
@@ -54,6 +63,12 @@ public:
 
     // 获取协程状态
     State getState() const { return m_state;}
+
+    // 是否使用共享栈
+    bool isSharedStack() const { return m_useSharedStack;}
+
+    // 共享栈协程绑定的线程，没有绑定(还没运行过或者不是共享栈协程)返回-1
+    int getSharedStackThread() const { return m_sharedThread;}
 public:
 
     // 设设置当前正在运行的协程，即设置线程局部变量t_fiber的值
@@ -73,6 +88,19 @@ public:
 
     // 获取当前协程的id
     static uint64_t GetFiberId();
+
+    // 协作式抢占点：当前任务本次已经连续运行超过fiber.yield_slice_ms时让出执行权，
+    // 重新排队，让同一线程上的其他协程(accept、定时器回调等)先执行
+    // 没超时的时候只读一次粗粒度时钟，CPU密集的长循环里可以频繁调用
+    // 持有线程锁(Mutex/RWMutex/Spinlock)时不能调用，让出后同线程的其他协程拿同一把锁会卡死线程
+    // 返回是否让出了，不在调度器的任务协程里时什么都不做
+    static bool MaybeYield();
+private:
+    // 共享栈协程切入前的准备：第一次运行时绑定共享栈，栈上是别的协程时先把它拷出，再恢复自己的内容
+    void switchInSharedStack();
+
+    // 共享栈协程被换下：把栈上用到的部分拷到保存区
+    void saveSharedStack();
 private:
     // 协程id
     uint64_t m_id = 0;
@@ -80,14 +108,25 @@ private:
     uint32_t m_stacksize = 0;
     // 协程状态
     State m_state = READY;
-    // 协程上下文
-    ucontext_t m_ctx;
+    // 协程上下文，后端(汇编/ucontext)在编译时选择，见fiber_context.h
+    FiberContext m_ctx;
     // 协程运行栈指针
     void* m_stack = nullptr;
+    // 分配运行栈的分配器，析构时归还给同一个分配器
+    StackAllocator* m_allocator = nullptr;
     // 协程运行函数
     std::function<void()> m_cb;
     // 本协程是否参与调度器调度
     bool m_runInScheduler;
+    // 是否使用共享栈
+    bool m_useSharedStack = false;
+    // 绑定的共享栈及其所属线程，第一次resume时绑定
+    SharedStack* m_sharedStack = nullptr;
+    int m_sharedThread = -1;
+    // 被换下共享栈时拷出的栈内容，大小按实际用到的栈分配
+    char* m_saveBuf = nullptr;
+    uint32_t m_saveSize = 0;
+    uint32_t m_saveCap = 0;
 };
 
 }
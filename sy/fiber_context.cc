@@ -0,0 +1,138 @@
+#include "fiber_context.h"
+
+namespace sy {
+
+#if defined(__x86_64__)
+// System V AMD64 ABI：callee-saved寄存器为rbx, rbp, r12-r15，另外保存mxcsr和x87控制字
+// 切出时栈上的布局(从低地址到高地址)：
+//   [mxcsr|x87cw] r12 r13 r14 r15 rbx rbp [返回地址]
+asm(R"(
+    .text
+    .globl sy_swap_context
+    .hidden sy_swap_context
+    .type sy_swap_context, @function
+    .align 16
+sy_swap_context:
+    pushq %rbp
+    pushq %rbx
+    pushq %r15
+    pushq %r14
+    pushq %r13
+    pushq %r12
+    subq $8, %rsp
+    stmxcsr (%rsp)
+    fnstcw 4(%rsp)
+    movq %rsp, (%rdi)
+    movq %rsi, %rsp
+    ldmxcsr (%rsp)
+    fldcw 4(%rsp)
+    addq $8, %rsp
+    popq %r12
+    popq %r13
+    popq %r14
+    popq %r15
+    popq %rbx
+    popq %rbp
+    ret
+    .size sy_swap_context, .-sy_swap_context
+
+    .globl sy_context_trampoline
+    .hidden sy_context_trampoline
+    .type sy_context_trampoline, @function
+    .align 16
+sy_context_trampoline:
+    callq *%rbx
+    ud2
+    .size sy_context_trampoline, .-sy_context_trampoline
+)");
+
+void AsmMakeContext(AsmContext* ctx, void* stack, size_t size, ContextEntry entry) {
+    // 栈顶按16字节对齐，返回地址放在top - 8，这样跳板里call之前rsp是16字节对齐的
+    uintptr_t top = ((uintptr_t)stack + size) & ~(uintptr_t)15;
+    uint64_t* sp = (uint64_t*)(top - 8);
+    *sp = (uint64_t)&sy_context_trampoline; // 返回地址
+    *--sp = 0;                              // rbp
+    *--sp = (uint64_t)entry;                // rbx
+    *--sp = 0;                              // r15
+    *--sp = 0;                              // r14
+    *--sp = 0;                              // r13
+    *--sp = 0;                              // r12
+    --sp;
+    // mxcsr和x87控制字使用默认值
+    ((uint32_t*)sp)[0] = 0x1F80;
+    ((uint32_t*)sp)[1] = 0x037F;
+    ctx->sp = sp;
+}
+
+#elif defined(__aarch64__)
+// AAPCS64：callee-saved寄存器为x19-x28, x29(fp), x30(lr), d8-d15，共160字节
+asm(R"(
+    .text
+    .globl sy_swap_context
+    .hidden sy_swap_context
+    .type sy_swap_context, %function
+    .align 4
+sy_swap_context:
+    sub sp, sp, #160
+    stp x19, x20, [sp, #0]
+    stp x21, x22, [sp, #16]
+    stp x23, x24, [sp, #32]
+    stp x25, x26, [sp, #48]
+    stp x27, x28, [sp, #64]
+    stp x29, x30, [sp, #80]
+    stp d8, d9, [sp, #96]
+    stp d10, d11, [sp, #112]
+    stp d12, d13, [sp, #128]
+    stp d14, d15, [sp, #144]
+    mov x9, sp
+    str x9, [x0]
+    mov sp, x1
+    ldp x19, x20, [sp, #0]
+    ldp x21, x22, [sp, #16]
+    ldp x23, x24, [sp, #32]
+    ldp x25, x26, [sp, #48]
+    ldp x27, x28, [sp, #64]
+    ldp x29, x30, [sp, #80]
+    ldp d8, d9, [sp, #96]
+    ldp d10, d11, [sp, #112]
+    ldp d12, d13, [sp, #128]
+    ldp d14, d15, [sp, #144]
+    add sp, sp, #160
+    ret
+    .size sy_swap_context, .-sy_swap_context
+
+    .globl sy_context_trampoline
+    .hidden sy_context_trampoline
+    .type sy_context_trampoline, %function
+    .align 4
+sy_context_trampoline:
+    blr x19
+    brk #0
+    .size sy_context_trampoline, .-sy_context_trampoline
+)");
+
+void AsmMakeContext(AsmContext* ctx, void* stack, size_t size, ContextEntry entry) {
+    uintptr_t top = ((uintptr_t)stack + size) & ~(uintptr_t)15;
+    uint64_t* sp = (uint64_t*)(top - 160);
+    for(int i = 0; i < 20; ++i) {
+        sp[i] = 0;
+    }
+    sp[0] = (uint64_t)entry;                  // x19
+    sp[11] = (uint64_t)&sy_context_trampoline; // x30
+    ctx->sp = sp;
+}
+
+#endif
+
+bool UcontextMakeContext(ucontext_t* ctx, void* stack, size_t size, ContextEntry entry) {
+    if(getcontext(ctx)) {
+        return false;
+    }
+    ctx->uc_link          = nullptr;
+    ctx->uc_stack.ss_sp   = stack;
+    ctx->uc_stack.ss_size = size;
+    makecontext(ctx, entry, 0);
+    return true;
+}
+
+}
@@ -0,0 +1,100 @@
+// 协程上下文切换
+#ifndef __SY_FIBER_CONTEXT_H__
+#define __SY_FIBER_CONTEXT_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <ucontext.h>
+
+// x86-64 / aarch64 提供手写汇编的上下文切换，只保存callee-saved寄存器，不做rt_sigprocmask系统调用
+#if defined(__x86_64__) || defined(__aarch64__)
+#define SY_HAS_ASM_CONTEXT 1
+#endif
+
+// 编译时选择协程上下文后端：默认使用汇编实现，定义SY_FIBER_USE_UCONTEXT(cmake -DFIBER_USE_UCONTEXT=ON)或平台不支持时回退到ucontext
+#if defined(SY_HAS_ASM_CONTEXT) && !defined(SY_FIBER_USE_UCONTEXT)
+#define SY_FIBER_ASM_CONTEXT 1
+#endif
+
+#ifdef SY_HAS_ASM_CONTEXT
+extern "C" {
+// 保存当前callee-saved寄存器到当前栈上，栈指针写入*from_sp，然后切换到to_sp并恢复其寄存器
+void sy_swap_context(void** from_sp, void* to_sp);
+// 新上下文第一次被切入时的跳板，负责调用入口函数
+void sy_context_trampoline();
+}
+#endif
+
+namespace sy {
+
+// 协程入口函数类型
+typedef void (*ContextEntry)();
+
+// 汇编上下文：只保存切出时的栈指针，寄存器都保存在协程自己的栈上
+struct AsmContext {
+    void* sp = nullptr;
+};
+
+// 汇编后端：在[stack, stack + size)上构造初始栈帧，第一次切入时执行entry
+// entry不能返回
+void AsmMakeContext(AsmContext* ctx, void* stack, size_t size, ContextEntry entry);
+
+// ucontext后端：在[stack, stack + size)上构造上下文，第一次切入时执行entry
+bool UcontextMakeContext(ucontext_t* ctx, void* stack, size_t size, ContextEntry entry);
+
+#ifdef SY_HAS_ASM_CONTEXT
+// 汇编后端：保存当前上下文到from，切换到to
+inline void AsmSwapContext(AsmContext* from, AsmContext* to) {
+    sy_swap_context(&from->sp, to->sp);
+}
+#endif
+
+// 协程使用的上下文，由编译选项决定后端
+#ifdef SY_FIBER_ASM_CONTEXT
+typedef AsmContext FiberContext;
+#else
+typedef ucontext_t FiberContext;
+#endif
+
+// 初始化线程主协程的上下文：汇编后端无需任何操作，ucontext后端调用getcontext
+inline bool InitMainContext(FiberContext* ctx) {
+#ifdef SY_FIBER_ASM_CONTEXT
+    ctx->sp = nullptr;
+    return true;
+#else
+    return !getcontext(ctx);
+#endif
+}
+
+// 初始化子协程的上下文
+inline bool MakeContext(FiberContext* ctx, void* stack, size_t size, ContextEntry entry) {
+#ifdef SY_FIBER_ASM_CONTEXT
+    AsmMakeContext(ctx, stack, size, entry);
+    return true;
+#else
+    return UcontextMakeContext(ctx, stack, size, entry);
+#endif
+}
+
+// 保存当前上下文到from，切换到to
+inline bool SwapContext(FiberContext* from, FiberContext* to) {
+#ifdef SY_FIBER_ASM_CONTEXT
+    AsmSwapContext(from, to);
+    return true;
+#else
+    return !swapcontext(from, to);
+#endif
+}
+
+// 当前使用的上下文后端名称
+inline const char* ContextBackendName() {
+#ifdef SY_FIBER_ASM_CONTEXT
+    return "asm";
+#else
+    return "ucontext";
+#endif
+}
+
+}
+
+#endif
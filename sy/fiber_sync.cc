@@ -0,0 +1,248 @@
+// 协程同步原语的实现
+#include "fiber_sync.h"
+#include "config.h"
+#include "log.h"
+#include "macro.h"
+
+namespace sy {
+
+static sy::Logger::ptr g_logger = SY_LOG_NAME("system");
+
+// 拿不到锁时挂起前的自旋次数，0表示直接挂起
+static ConfigVar<uint32_t>::ptr g_fiber_sync_spin =
+    Config::Lookup("fiber.sync_spin", (uint32_t)64, "fiber mutex/channel spin count before parking");
+
+static std::atomic<uint32_t> s_fiber_sync_spin = {64};
+
+struct _FiberSyncIniter {
+    _FiberSyncIniter() {
+        s_fiber_sync_spin = g_fiber_sync_spin->getValue();
+        g_fiber_sync_spin->addListener([](const uint32_t& old_value, const uint32_t& new_value){
+            SY_LOG_INFO(g_logger) << "fiber sync spin changed from "
+                                  << old_value << " to " << new_value;
+            s_fiber_sync_spin = new_value;
+        });
+    }
+};
+
+static _FiberSyncIniter s_fiber_sync_initer;
+
+FiberWaiter::FiberWaiter()
+    :scheduler(Scheduler::GetThis())
+    ,fiber(Fiber::GetThis())
+    ,thread(sy::GetThreadId()) {
+    SY_ASSERT2(scheduler, "fiber sync primitives must be used inside a scheduler");
+    // 等待节点在栈上，共享栈协程切出后栈上的地址会被其他协程覆盖
+    SY_ASSERT2(!fiber->isSharedStack(), "fiber sync primitives can not be used in shared stack fibers");
+}
+
+void FiberWaiter::wake() {
+    Scheduler* s = scheduler;
+    Fiber::ptr f = std::move(fiber);
+    int t = thread;
+    // 调度之后等待者随时可能恢复并销毁节点，不能再访问this
+    s->schedule(std::move(f), t);
+}
+
+uint32_t FiberSync::GetSpinCount() {
+    return s_fiber_sync_spin.load(std::memory_order_relaxed);
+}
+
+void FiberSync::Park() {
+    Fiber::GetThis()->yield();
+}
+
+FiberMutex::~FiberMutex() {
+    SY_ASSERT(m_waiters.empty());
+}
+
+void FiberMutex::lock() {
+    if(tryLock()) {
+        return;
+    }
+    // 被唤醒过的等待者再次失败时排回队首，等待者之间保持FIFO
+    bool woken = false;
+    while(true) {
+        for(uint32_t i = 0, n = FiberSync::GetSpinCount(); i < n; ++i) {
+            FiberSync::Pause();
+            if(tryLock()) {
+                return;
+            }
+        }
+        FiberWaiter w;
+        {
+            Spinlock::Lock lock(m_mutex);
+            // 先登记再重试，和unlock的"先释放再检查等待者"配对，两边至少有一方能看到对方
+            m_waiterCount.fetch_add(1);
+            bool expected = false;
+            if(m_locked.compare_exchange_strong(expected, true)) {
+                m_waiterCount.fetch_sub(1);
+                return;
+            }
+            if(woken) {
+                m_waiters.pushFront(&w);
+            } else {
+                m_waiters.push(&w);
+            }
+        }
+        FiberSync::Park();
+        woken = true;
+    }
+}
+
+void FiberMutex::unlock() {
+    m_locked.store(false);
+    if(m_waiterCount.load() == 0) {
+        return;
+    }
+    // 不直接把锁交给等待者：等待者被调度回来之前锁是空闲的，正在运行的协程可以继续拿锁，避免锁护送
+    FiberWaiter* w = nullptr;
+    {
+        Spinlock::Lock lock(m_mutex);
+        w = m_waiters.pop();
+        if(w) {
+            m_waiterCount.fetch_sub(1);
+        }
+    }
+    if(w) {
+        w->wake();
+    }
+}
+
+FiberRWMutex::~FiberRWMutex() {
+    SY_ASSERT(m_waiters.empty());
+}
+
+bool FiberRWMutex::tryRdlock() {
+    Spinlock::Lock lock(m_mutex);
+    if(m_writer || m_waitingWriters) {
+        return false;
+    }
+    ++m_readers;
+    return true;
+}
+
+bool FiberRWMutex::tryWrlock() {
+    Spinlock::Lock lock(m_mutex);
+    if(m_writer || m_readers) {
+        return false;
+    }
+    m_writer = true;
+    return true;
+}
+
+void FiberRWMutex::rdlock() {
+    for(uint32_t i = 0, n = FiberSync::GetSpinCount(); i < n; ++i) {
+        if(tryRdlock()) {
+            return;
+        }
+        FiberSync::Pause();
+    }
+    FiberWaiter w;
+    w.type = READ;
+    {
+        Spinlock::Lock lock(m_mutex);
+        if(!m_writer && !m_waitingWriters) {
+            ++m_readers;
+            return;
+        }
+        m_waiters.push(&w);
+    }
+    FiberSync::Park();
+}
+
+void FiberRWMutex::wrlock() {
+    for(uint32_t i = 0, n = FiberSync::GetSpinCount(); i < n; ++i) {
+        if(tryWrlock()) {
+            return;
+        }
+        FiberSync::Pause();
+    }
+    FiberWaiter w;
+    w.type = WRITE;
+    {
+        Spinlock::Lock lock(m_mutex);
+        if(!m_writer && !m_readers) {
+            m_writer = true;
+            return;
+        }
+        ++m_waitingWriters;
+        m_waiters.push(&w);
+    }
+    FiberSync::Park();
+}
+
+void FiberRWMutex::unlock() {
+    // 被唤醒的等待者串成链表，解锁后再调度
+    FiberWaiter* head = nullptr;
+    {
+        Spinlock::Lock lock(m_mutex);
+        if(m_writer) {
+            m_writer = false;
+        } else {
+            SY_ASSERT(m_readers > 0);
+            --m_readers;
+        }
+        if(m_writer || m_readers || m_waiters.empty()) {
+            return;
+        }
+        if(m_waiters.front()->type == WRITE) {
+            head = m_waiters.pop();
+            m_writer = true;
+            --m_waitingWriters;
+        } else {
+            // 队首连续的读者一起拿到读锁
+            FiberWaiter* tail = nullptr;
+            while(!m_waiters.empty() && m_waiters.front()->type == READ) {
+                FiberWaiter* w = m_waiters.pop();
+                ++m_readers;
+                if(tail) {
+                    tail->next = w;
+                } else {
+                    head = w;
+                }
+                tail = w;
+            }
+        }
+    }
+    FiberWaitQueue::WakeAll(head);
+}
+
+FiberCondition::~FiberCondition() {
+    SY_ASSERT(m_waiters.empty());
+}
+
+void FiberCondition::wait(FiberMutex& mutex) {
+    FiberWaiter w;
+    {
+        Spinlock::Lock lock(m_mutex);
+        m_waiters.push(&w);
+    }
+    // 先入队再释放mutex，释放之后的notify不会丢失
+    // 即使notify在yield之前调度了本协程，它也只会在本线程yield之后才被恢复
+    mutex.unlock();
+    FiberSync::Park();
+    mutex.lock();
+}
+
+void FiberCondition::notify() {
+    FiberWaiter* w = nullptr;
+    {
+        Spinlock::Lock lock(m_mutex);
+        w = m_waiters.pop();
+    }
+    if(w) {
+        w->wake();
+    }
+}
+
+void FiberCondition::notifyAll() {
+    FiberWaiter* head = nullptr;
+    {
+        Spinlock::Lock lock(m_mutex);
+        head = m_waiters.popAll();
+    }
+    FiberWaitQueue::WakeAll(head);
+}
+
+}
@@ -0,0 +1,426 @@
+// 协程同步原语：协程互斥锁，协程读写锁，协程条件变量，通道
+#ifndef __SY_FIBER_SYNC_H__
+#define __SY_FIBER_SYNC_H__
+
+#include <atomic>
+#include <deque>
+#include <utility>
+#include "fiber.h"
+#include "macro.h"
+#include "mutex.h"
+#include "noncopyable.h"
+#include "scheduler.h"
+
+namespace sy {
+
+// 以下原语拿不到时挂起的是协程而不是线程，线程继续执行其他协程，持有时可以做hook的IO
+// 拿不到时先自旋fiber.sync_spin次再挂起，挂起的协程由释放者调度回原来的线程
+// 因为挂起的协程只在原线程上恢复，释放者在它yield之前就调度它也不会被其他线程提前resume
+// 必须在调度器的协程里使用，可以跨调度器：等待者记录自己的调度器
+
+// 挂起的协程，节点放在等待协程的栈上，挂入等待队列不分配内存
+struct FiberWaiter {
+    // 等待者的调度器、协程和线程
+    Scheduler* scheduler = nullptr;
+    Fiber::ptr fiber;
+    int thread = -1;
+    // 等待队列的下一个节点
+    FiberWaiter* next = nullptr;
+    // 原语自定义的数据：读写锁的读写类型，通道的数据指针
+    void* data = nullptr;
+    int type = 0;
+    // 唤醒结果
+    bool ok = false;
+
+    // 用当前协程初始化
+    FiberWaiter();
+
+    // 把等待者调度回原来的线程，调用后节点可能已经失效
+    void wake();
+};
+
+// 等待队列：FIFO的侵入式单链表，由原语的自旋锁保护
+class FiberWaitQueue {
+public:
+    bool empty() const { return !m_head;}
+
+    FiberWaiter* front() const { return m_head;}
+
+    void push(FiberWaiter* w) {
+        w->next = nullptr;
+        if(m_tail) {
+            m_tail->next = w;
+        } else {
+            m_head = w;
+        }
+        m_tail = w;
+    }
+
+    void pushFront(FiberWaiter* w) {
+        w->next = m_head;
+        m_head = w;
+        if(!m_tail) {
+            m_tail = w;
+        }
+    }
+
+    FiberWaiter* pop() {
+        FiberWaiter* w = m_head;
+        if(w) {
+            m_head = w->next;
+            if(!m_head) {
+                m_tail = nullptr;
+            }
+            w->next = nullptr;
+        }
+        return w;
+    }
+
+    // 从队列中摘下w，w不在队列中返回false
+    bool remove(FiberWaiter* w) {
+        FiberWaiter* prev = nullptr;
+        for(FiberWaiter* it = m_head; it; prev = it, it = it->next) {
+            if(it != w) {
+                continue;
+            }
+            if(prev) {
+                prev->next = w->next;
+            } else {
+                m_head = w->next;
+            }
+            if(m_tail == w) {
+                m_tail = prev;
+            }
+            w->next = nullptr;
+            return true;
+        }
+        return false;
+    }
+
+    // 取出全部节点，返回链表头
+    FiberWaiter* popAll() {
+        FiberWaiter* w = m_head;
+        m_head = m_tail = nullptr;
+        return w;
+    }
+
+    // 唤醒链表上的所有节点，在原语的锁外调用
+    static void WakeAll(FiberWaiter* w) {
+        while(w) {
+            // 唤醒之后节点可能已经失效，先取出下一个
+            FiberWaiter* next = w->next;
+            w->wake();
+            w = next;
+        }
+    }
+private:
+    FiberWaiter* m_head = nullptr;
+    FiberWaiter* m_tail = nullptr;
+};
+
+// 协程同步原语的公共函数
+struct FiberSync {
+    // 挂起前的自旋次数(fiber.sync_spin)
+    static uint32_t GetSpinCount();
+
+    // 自旋等待时让出CPU流水线
+    static void Pause() {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__)
+        asm volatile("yield");
+#endif
+    }
+
+    // 挂起当前协程，等待FiberWaiter::wake
+    static void Park();
+};
+
+// 协程互斥锁：拿不到锁时挂起协程，释放时唤醒队首的等待者重新抢锁
+class FiberMutex : Noncopyable {
+public:
+    typedef ScopedLockImpl<FiberMutex> Lock;
+
+    FiberMutex() {}
+
+    ~FiberMutex();
+
+    // 不挂起，拿到锁返回true
+    bool tryLock() {
+        bool expected = false;
+        return !m_locked.load(std::memory_order_relaxed)
+            && m_locked.compare_exchange_strong(expected, true, std::memory_order_acquire);
+    }
+
+    void lock();
+
+    void unlock();
+private:
+    // 是否被持有
+    std::atomic<bool> m_locked = {false};
+    // 挂起(和正在挂起)的等待者数量，没有等待者时unlock不加自旋锁
+    std::atomic<uint32_t> m_waiterCount = {0};
+    // 保护等待队列
+    Spinlock m_mutex;
+    FiberWaitQueue m_waiters;
+};
+
+// 协程读写锁：写优先，有写者在等待时新的读者也要排队，避免写者饿死
+// 释放时按队列顺序把锁交给队首的一个写者或者连续的一批读者
+class FiberRWMutex : Noncopyable {
+public:
+    typedef ReadScopedLockImpl<FiberRWMutex> ReadLock;
+    typedef WriteScopedLockImpl<FiberRWMutex> WriteLock;
+
+    FiberRWMutex() {}
+
+    ~FiberRWMutex();
+
+    bool tryRdlock();
+
+    bool tryWrlock();
+
+    void rdlock();
+
+    void wrlock();
+
+    void unlock();
+private:
+    // 读锁/写锁等待者
+    enum {
+        READ = 0,
+        WRITE = 1
+    };
+private:
+    Spinlock m_mutex;
+    // 持有读锁的数量
+    uint32_t m_readers = 0;
+    // 是否有写者持有
+    bool m_writer = false;
+    // 排队的写者数量
+    uint32_t m_waitingWriters = 0;
+    FiberWaitQueue m_waiters;
+};
+
+// 协程条件变量，配合FiberMutex使用
+class FiberCondition : Noncopyable {
+public:
+    FiberCondition() {}
+
+    ~FiberCondition();
+
+    // 释放mutex并挂起，被唤醒后重新拿到mutex再返回，调用者需要自己检查条件(可能被虚假唤醒)
+    void wait(FiberMutex& mutex);
+
+    // 等到pred()为true
+    template<class Predicate>
+    void wait(FiberMutex& mutex, Predicate pred) {
+        while(!pred()) {
+            wait(mutex);
+        }
+    }
+
+    // 唤醒一个等待者
+    void notify();
+
+    // 唤醒所有等待者
+    void notifyAll();
+private:
+    Spinlock m_mutex;
+    FiberWaitQueue m_waiters;
+};
+
+// Go风格的通道
+// capacity为缓冲区大小：0为无缓冲，发送者要等到接收者取走数据；UNBOUNDED为不限大小，发送永不挂起
+// 关闭后发送失败；接收者先取完缓冲区剩余的数据，之后接收失败
+template<class T>
+class Channel : Noncopyable {
+public:
+    typedef std::shared_ptr<Channel> ptr;
+
+    static const size_t UNBOUNDED = ~(size_t)0;
+
+    Channel(size_t capacity = 0)
+        :m_capacity(capacity) {
+    }
+
+    ~Channel() {
+        SY_ASSERT(m_senders.empty() && m_receivers.empty());
+    }
+
+    // 发送，缓冲区满时挂起，通道关闭返回false
+    bool send(const T& v) {
+        T tmp(v);
+        return send(std::move(tmp));
+    }
+
+    bool send(T&& v) {
+        int rt = 0;
+        for(uint32_t i = 0, n = FiberSync::GetSpinCount(); i < n; ++i) {
+            rt = doTrySend(v);
+            if(rt >= 0) {
+                return rt;
+            }
+            FiberSync::Pause();
+        }
+        FiberWaiter w;
+        {
+            Spinlock::Lock lock(m_mutex);
+            rt = trySendLocked(v, lock);
+            if(rt >= 0) {
+                return rt;
+            }
+            // 挂起，接收者或者close唤醒
+            w.data = &v;
+            m_senders.push(&w);
+        }
+        FiberSync::Park();
+        return w.ok;
+    }
+
+    // 不挂起的发送，发送成功返回true，缓冲区满或者通道关闭返回false，失败时v不会被移走
+    bool trySend(T&& v) {
+        return doTrySend(v) == 1;
+    }
+
+    bool trySend(const T& v) {
+        T tmp(v);
+        return trySend(std::move(tmp));
+    }
+
+    // 接收，没有数据时挂起，通道关闭并且没有剩余数据时返回false
+    bool recv(T& v) {
+        int rt = 0;
+        for(uint32_t i = 0, n = FiberSync::GetSpinCount(); i < n; ++i) {
+            rt = doTryRecv(v);
+            if(rt >= 0) {
+                return rt;
+            }
+            FiberSync::Pause();
+        }
+        FiberWaiter w;
+        {
+            Spinlock::Lock lock(m_mutex);
+            rt = tryRecvLocked(v, lock);
+            if(rt >= 0) {
+                return rt;
+            }
+            // 挂起，发送者或者close唤醒
+            w.data = &v;
+            m_receivers.push(&w);
+        }
+        FiberSync::Park();
+        return w.ok;
+    }
+
+    // 不挂起的接收，取到数据返回true
+    bool tryRecv(T& v) {
+        return doTryRecv(v) == 1;
+    }
+
+    // 关闭通道，唤醒所有挂起的发送者和接收者
+    void close() {
+        FiberWaiter* senders = nullptr;
+        FiberWaiter* receivers = nullptr;
+        {
+            Spinlock::Lock lock(m_mutex);
+            if(m_closed) {
+                return;
+            }
+            m_closed = true;
+            senders = m_senders.popAll();
+            receivers = m_receivers.popAll();
+        }
+        FiberWaitQueue::WakeAll(senders);
+        FiberWaitQueue::WakeAll(receivers);
+    }
+
+    bool isClosed() {
+        Spinlock::Lock lock(m_mutex);
+        return m_closed;
+    }
+
+    // 缓冲区中的数据量
+    size_t size() {
+        Spinlock::Lock lock(m_mutex);
+        return m_buffer.size();
+    }
+
+    size_t getCapacity() const { return m_capacity;}
+private:
+    // 返回1成功，0通道关闭，-1需要等待
+    int doTrySend(T& v) {
+        Spinlock::Lock lock(m_mutex);
+        return trySendLocked(v, lock);
+    }
+
+    int doTryRecv(T& v) {
+        Spinlock::Lock lock(m_mutex);
+        return tryRecvLocked(v, lock);
+    }
+
+    // 成功时可能会解锁lock去唤醒对端
+    int trySendLocked(T& v, Spinlock::Lock& lock) {
+        if(m_closed) {
+            return 0;
+        }
+        // 有接收者在等，说明缓冲区是空的，直接交给它
+        FiberWaiter* r = m_receivers.pop();
+        if(r) {
+            *(T*)r->data = std::move(v);
+            r->ok = true;
+            lock.unlock();
+            r->wake();
+            return 1;
+        }
+        if(m_buffer.size() < m_capacity) {
+            m_buffer.push_back(std::move(v));
+            return 1;
+        }
+        return -1;
+    }
+
+    int tryRecvLocked(T& v, Spinlock::Lock& lock) {
+        FiberWaiter* s = nullptr;
+        if(!m_buffer.empty()) {
+            v = std::move(m_buffer.front());
+            m_buffer.pop_front();
+            // 缓冲区腾出了位置，挂起的发送者把数据放进来
+            s = m_senders.pop();
+            if(s) {
+                m_buffer.push_back(std::move(*(T*)s->data));
+            }
+        } else {
+            // 无缓冲通道直接从发送者手上取
+            s = m_senders.pop();
+            if(s) {
+                v = std::move(*(T*)s->data);
+            } else if(m_closed) {
+                return 0;
+            } else {
+                return -1;
+            }
+        }
+        if(s) {
+            s->ok = true;
+            lock.unlock();
+            s->wake();
+        }
+        return 1;
+    }
+private:
+    Spinlock m_mutex;
+    // 缓冲区大小
+    size_t m_capacity;
+    // 缓冲的数据
+    std::deque<T> m_buffer;
+    // 挂起的发送者，data指向要发送的数据
+    FiberWaitQueue m_senders;
+    // 挂起的接收者，data指向接收数据的位置
+    FiberWaitQueue m_receivers;
+    bool m_closed = false;
+};
+
+}
+
+#endif
@@ -0,0 +1,244 @@
+#include "file_io.h"
+#include "config.h"
+#include "fd_manager.h"
+#include "fiber_sync.h"
+#include "hook.h"
+#include "iomanager.h"
+#include "log.h"
+#include <algorithm>
+#include <atomic>
+#include <errno.h>
+#include <fcntl.h>
+#include <mutex>
+#include <sys/sendfile.h>
+#include <unistd.h>
+
+namespace sy {
+
+static sy::Logger::ptr g_logger = SY_LOG_NAME("system");
+
+static sy::ConfigVar<bool>::ptr g_file_io_enable =
+    sy::Config::Lookup("file_io.enable", true, "offload regular file io to the file io thread pool");
+static sy::ConfigVar<uint32_t>::ptr g_file_io_threads =
+    sy::Config::Lookup("file_io.threads", (uint32_t)4, "file io thread pool size");
+static sy::ConfigVar<uint32_t>::ptr g_file_io_max_pending =
+    sy::Config::Lookup("file_io.max_pending", (uint32_t)1024, "max queued file io calls");
+static sy::ConfigVar<uint32_t>::ptr g_file_io_readahead_max =
+    sy::Config::Lookup("file_io.readahead_max", (uint32_t)(1024 * 1024), "max sequential readahead window(bytes), 0 disables");
+
+static std::atomic<bool> s_file_io_enable = {true};
+static std::atomic<uint32_t> s_max_pending = {1024};
+static std::atomic<uint32_t> s_readahead_max = {1024 * 1024};
+
+struct _FileIOIniter {
+    _FileIOIniter() {
+        s_file_io_enable = g_file_io_enable->getValue();
+        s_max_pending = g_file_io_max_pending->getValue();
+        s_readahead_max = g_file_io_readahead_max->getValue();
+        g_file_io_enable->addListener([](const bool& old_value, const bool& new_value){
+            s_file_io_enable = new_value;
+        });
+        g_file_io_max_pending->addListener([](const uint32_t& old_value, const uint32_t& new_value){
+            s_max_pending = new_value;
+        });
+        g_file_io_readahead_max->addListener([](const uint32_t& old_value, const uint32_t& new_value){
+            s_readahead_max = new_value;
+        });
+    }
+};
+
+static _FileIOIniter s_file_io_initer;
+
+// 顺序读的最小预读窗口
+static const uint64_t READAHEAD_MIN = 64 * 1024;
+// sendfile每段的大小，每段先预读再发送
+static const size_t SENDFILE_CHUNK = 1024 * 1024;
+
+// 线程池，创建后不再释放
+// 用IOManager而不是Scheduler：空闲线程阻塞在epoll上，Scheduler的idle会一直yield占满CPU
+static std::atomic<IOManager*> s_pool = {nullptr};
+// 线程池里排队和正在执行的调用数
+static std::atomic<uint32_t> s_pending = {0};
+
+IOManager* FileIO::GetPool() {
+    static std::once_flag s_once;
+    std::call_once(s_once, []() {
+        size_t threads = std::max(g_file_io_threads->getValue(), (uint32_t)1);
+        IOManager* pool = new IOManager(threads, false, "file_io");
+        s_pool = pool;
+        SY_LOG_INFO(g_logger) << "file io pool started, threads=" << threads;
+    });
+    return s_pool;
+}
+
+bool FileIO::CanOffload() {
+    return s_file_io_enable && Scheduler::GetTaskStartUs()
+        && Scheduler::GetThis() != s_pool.load(std::memory_order_relaxed)
+        && !Fiber::GetThis()->isSharedStack();
+}
+
+ssize_t FileIO::Call(const std::function<ssize_t()>& f) {
+    if(!CanOffload() || s_pending.load(std::memory_order_relaxed) >= s_max_pending) {
+        return f();
+    }
+    Scheduler* pool = GetPool();
+    ++s_pending;
+    // 调用者挂起到任务执行完，任务可以直接引用调用者栈上的变量
+    FiberWaiter waiter;
+    ssize_t rt = -1;
+    int error = 0;
+    pool->schedule([&f, &rt, &error, &waiter]() {
+        rt = f();
+        error = errno;
+        --s_pending;
+        waiter.wake();
+    });
+    FiberSync::Park();
+    errno = error;
+    return rt;
+}
+
+// 读完[offset, offset + n)后更新fd的顺序预读状态，窗口向前推进时在线程池里预读后面的数据
+static void UpdateReadAhead(int fd, uint64_t offset, ssize_t n) {
+    uint64_t max = s_readahead_max;
+    if(n <= 0 || max == 0) {
+        return;
+    }
+    FdCtx::ptr ctx = FdMgr::GetInstance()->get(fd);
+    if(!ctx || !ctx->isFile()) {
+        return;
+    }
+    uint64_t end = offset + n;
+    uint64_t start = 0;
+    uint64_t len = 0;
+    uint64_t generation = 0;
+    {
+        FdCtx::MutexType::Lock lock(ctx->mutex);
+        generation = ctx->generation;
+        FdCtx::ReadAhead& ra = ctx->readAhead;
+        if(offset == ra.next) {
+            // 连续的顺序读，窗口翻倍
+            ra.window = ra.window ? std::min(ra.window * 2, max)
+                : std::min(std::max((uint64_t)n * 2, READAHEAD_MIN), max);
+            if(end + ra.window > ra.issued) {
+                start = std::max(ra.issued, end);
+                len = end + ra.window - start;
+                ra.issued = end + ra.window;
+            }
+        } else {
+            ra.window = 0;
+            ra.issued = 0;
+        }
+        ra.next = end;
+    }
+    // 预读只是提示，不等待；排队太多时放弃
+    // 任务执行前fd可能已经关闭并被别的文件复用，记录的generation变了就不再预读
+    if(len && s_pending.load(std::memory_order_relaxed) < s_max_pending) {
+        FileIO::GetPool()->schedule([ctx, fd, generation, start, len]() {
+            {
+                FdCtx::MutexType::Lock lock(ctx->mutex);
+                if(ctx->generation != generation
+                        || FdMgr::GetInstance()->get(fd) != ctx) {
+                    return;
+                }
+            }
+            readahead(fd, start, len);
+        });
+    }
+}
+
+int FileIO::Open(const char* path, int flags, mode_t mode) {
+    int fd = (int)Call([path, flags, mode]() {
+        return (ssize_t)open(path, flags, mode);
+    });
+    if(fd >= 0) {
+        Register(fd);
+    }
+    return fd;
+}
+
+bool FileIO::Register(int fd) {
+    FdCtx::ptr ctx = FdMgr::GetInstance()->get(fd, true);
+    return ctx && ctx->isFile();
+}
+
+int FileIO::Close(int fd) {
+    return close(fd);
+}
+
+ssize_t FileIO::Read(int fd, void* buf, size_t count) {
+    off_t offset = -1;
+    ssize_t n = Call([fd, buf, count, &offset]() {
+        offset = lseek(fd, 0, SEEK_CUR);
+        return read_f(fd, buf, count);
+    });
+    if(offset >= 0) {
+        int error = errno;
+        UpdateReadAhead(fd, offset, n);
+        errno = error;
+    }
+    return n;
+}
+
+ssize_t FileIO::Pread(int fd, void* buf, size_t count, off_t offset) {
+    ssize_t n = Call([fd, buf, count, offset]() {
+        return pread_f(fd, buf, count, offset);
+    });
+    int error = errno;
+    UpdateReadAhead(fd, offset, n);
+    errno = error;
+    return n;
+}
+
+ssize_t FileIO::Write(int fd, const void* buf, size_t count) {
+    return Call([fd, buf, count]() {
+        return write_f(fd, buf, count);
+    });
+}
+
+ssize_t FileIO::Pwrite(int fd, const void* buf, size_t count, off_t offset) {
+    return Call([fd, buf, count, offset]() {
+        return pwrite_f(fd, buf, count, offset);
+    });
+}
+
+int FileIO::Fsync(int fd) {
+    return (int)Call([fd]() {
+        return (ssize_t)fsync_f(fd);
+    });
+}
+
+int FileIO::Fdatasync(int fd) {
+    return (int)Call([fd]() {
+        return (ssize_t)fdatasync_f(fd);
+    });
+}
+
+ssize_t FileIO::SendFile(int sock, int fd, off_t offset, size_t count) {
+    size_t sent = 0;
+    while(sent < count) {
+        size_t chunk = std::min(count - sent, SENDFILE_CHUNK);
+        // 这一段读进页缓存，sendfile从页缓存拷贝到socket时不再读磁盘
+        if(CanOffload()) {
+            Call([fd, offset, chunk]() {
+                return readahead(fd, offset, chunk);
+            });
+        }
+        // hook的sendfile在socket不可写时挂起协程等待
+        ssize_t n = sendfile(sock, fd, &offset, chunk);
+        if(n < 0) {
+            if(sent) {
+                break;
+            }
+            return -1;
+        }
+        // 文件已经结束
+        if(n == 0) {
+            break;
+        }
+        sent += n;
+    }
+    return sent;
+}
+
+}
@@ -0,0 +1,53 @@
+// 协程里的文件IO
+#ifndef __SY_FILE_IO_H__
+#define __SY_FILE_IO_H__
+
+#include <functional>
+#include <stdint.h>
+#include <sys/types.h>
+#include "iomanager.h"
+
+namespace sy {
+
+// 普通文件的IO没有就绪事件，hook的read/write对它们直接执行，磁盘IO会阻塞IO线程
+// FileIO把普通文件的阻塞调用交给一个固定线程数的文件IO线程池(file_io.threads)执行，发起的协程挂起等待完成
+// 线程池排队的调用超过file_io.max_pending时不再排队，由调用者直接执行，相当于背压
+// 通过Open打开(或Register登记)的文件，hook的read/write/pread/pwrite/fsync也会交给线程池
+// 顺序读会按窗口(最大file_io.readahead_max)在线程池里提前预读后面的数据
+class FileIO {
+public:
+    // 当前上下文是否把调用交给线程池：开启了file_io.enable，在调度器的任务协程里，不在线程池自己的线程上
+    // 共享栈协程挂起时栈会被换出，线程池不能读写它栈上的缓冲区，也直接执行
+    static bool CanOffload();
+
+    // 在线程池里执行f并等待完成，返回f的返回值，errno为f执行后的errno；不能交给线程池时直接执行
+    static ssize_t Call(const std::function<ssize_t()>& f);
+
+    // 打开文件并登记到FdMgr，之后hook的IO调用也交给线程池
+    static int Open(const char* path, int flags, mode_t mode = 0644);
+
+    // 登记已经打开的fd，普通文件返回true
+    static bool Register(int fd);
+
+    static int Close(int fd);
+
+    // 以下接口对任何fd都可以使用，读接口会更新顺序预读的状态
+    static ssize_t Read(int fd, void* buf, size_t count);
+    static ssize_t Pread(int fd, void* buf, size_t count, off_t offset);
+    static ssize_t Write(int fd, const void* buf, size_t count);
+    static ssize_t Pwrite(int fd, const void* buf, size_t count, off_t offset);
+    static int Fsync(int fd);
+    static int Fdatasync(int fd);
+
+    // 把文件fd的[offset, offset + count)用sendfile零拷贝发送到socket，返回发送的字节数，出错返回-1
+    // 每次发送一段前先在线程池里预读这一段，IO线程上的sendfile不会因为缺页阻塞在磁盘上
+    // socket发送缓冲区满时按hook的方式等待可写，超时为socket的SO_SNDTIMEO
+    static ssize_t SendFile(int sock, int fd, off_t offset, size_t count);
+
+    // 文件IO线程池，第一次使用时创建，线程空闲时阻塞等待不占CPU
+    static IOManager* GetPool();
+};
+
+}
+
+#endif
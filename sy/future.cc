@@ -0,0 +1,112 @@
+// Future/Promise的实现
+#include "future.h"
+#include "iomanager.h"
+
+namespace sy {
+
+TimerManager* GetThisTimerManager() {
+    return IOManager::GetThis();
+}
+
+FutureStateBase::~FutureStateBase() {
+    SY_ASSERT(m_waiters.empty());
+}
+
+namespace {
+// 带超时等待的上下文，放在等待协程的栈上
+struct WaitContext {
+    Spinlock* mutex;
+    FiberWaitQueue* waiters;
+    FiberWaiter* waiter;
+    bool timedOut;
+};
+}
+
+uint64_t FutureStateBase::OnWaitTimeout(void* arg) {
+    WaitContext* ctx = (WaitContext*)arg;
+    {
+        Spinlock::Lock lock(*ctx->mutex);
+        // 已经被complete取走，由complete唤醒
+        if(!ctx->waiters->remove(ctx->waiter)) {
+            return 0;
+        }
+        ctx->timedOut = true;
+    }
+    ctx->waiter->wake();
+    return 0;
+}
+
+bool FutureStateBase::wait(uint64_t timeout_ms, TimerManager* timer_manager) {
+    if(isReady()) {
+        return true;
+    }
+    if(timeout_ms == 0) {
+        return false;
+    }
+    FiberWaiter w;
+    {
+        Spinlock::Lock lock(m_mutex);
+        if(isReady()) {
+            return true;
+        }
+        m_waiters.push(&w);
+    }
+    if(timeout_ms == ~0ull) {
+        FiberSync::Park();
+        return true;
+    }
+    if(!timer_manager) {
+        timer_manager = GetThisTimerManager();
+    }
+    SY_ASSERT2(timer_manager, "Future::wait with timeout needs a TimerManager");
+    WaitContext ctx = {&m_mutex, &m_waiters, &w, false};
+    // 定时器放在协程栈上，不分配内存
+    TimerHandle timer;
+    timer_manager->addTimer(timer, timeout_ms, &FutureStateBase::OnWaitTimeout, &ctx);
+    FiberSync::Park();
+    // cancel返回后回调不会再执行，ctx可以安全销毁
+    timer.cancel();
+    return isReady();
+}
+
+void FutureStateBase::addCallback(std::function<void()> cb) {
+    {
+        Spinlock::Lock lock(m_mutex);
+        if(!isReady()) {
+            m_callbacks.push_back(std::move(cb));
+            return;
+        }
+    }
+    cb();
+}
+
+bool FutureStateBase::setError(int error) {
+    Spinlock::Lock lock(m_mutex);
+    if(isReady()) {
+        return false;
+    }
+    complete(ERROR, error, lock);
+    return true;
+}
+
+void FutureStateBase::releasePromise() {
+    if(--m_promises == 0 && !isReady()) {
+        setError(FutureBase::BROKEN_PROMISE);
+    }
+}
+
+void FutureStateBase::complete(Status status, int error, Spinlock::Lock& lock) {
+    m_error = error;
+    m_status.store(status, std::memory_order_release);
+    FiberWaiter* waiters = m_waiters.popAll();
+    std::vector<std::function<void()> > cbs;
+    cbs.swap(m_callbacks);
+    lock.unlock();
+
+    FiberWaitQueue::WakeAll(waiters);
+    for(auto& cb : cbs) {
+        cb();
+    }
+}
+
+}
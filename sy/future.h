@@ -0,0 +1,337 @@
+// 协程的Future/Promise
+#ifndef __SY_FUTURE_H__
+#define __SY_FUTURE_H__
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "fiber_sync.h"
+#include "macro.h"
+#include "mutex.h"
+#include "noncopyable.h"
+#include "scheduler.h"
+#include "timer.h"
+
+namespace sy {
+
+// Future的错误码，也可以用Promise::setError设置自定义的错误码(不能为0)
+class FutureBase {
+public:
+    enum Error {
+        OK = 0,
+        // 等待超时(withTimeout)
+        TIMEOUT = -1,
+        // 所有Promise都析构了也没有设置结果
+        BROKEN_PROMISE = -2,
+    };
+};
+
+// Future和Promise的共享状态中与值类型无关的部分
+// 结果只能设置一次，设置后唤醒所有等待的协程，并在设置结果的上下文中依次执行回调
+class FutureStateBase : Noncopyable {
+public:
+    enum Status {
+        PENDING = 0,
+        VALUE = 1,
+        ERROR = 2,
+    };
+
+    virtual ~FutureStateBase();
+
+    // 是否已经有结果(值或者错误)
+    bool isReady() const { return m_status.load(std::memory_order_acquire) != PENDING;}
+
+    Status getStatus() const { return (Status)m_status.load(std::memory_order_acquire);}
+
+    // 错误码，没有结果或者结果是值时为0
+    int getError() const { return isReady() ? m_error : 0;}
+
+    // 当前协程等待结果，timeout_ms为超时时间(~0ull不超时)，需要所在调度器是TimerManager(IOManager)
+    // 返回是否已经有结果
+    bool wait(uint64_t timeout_ms = ~0ull, TimerManager* timer_manager = nullptr);
+
+    // 添加结果回调，已经有结果时在当前上下文直接执行
+    void addCallback(std::function<void()> cb);
+
+    // 设置错误，已经有结果返回false
+    bool setError(int error);
+
+    // Promise引用计数，最后一个Promise析构时还没有结果就设置为BROKEN_PROMISE
+    void addPromise() { ++m_promises;}
+    void releasePromise();
+protected:
+    FutureStateBase() {}
+
+    // 设置结果并解锁，唤醒等待者，执行回调；调用时需持有m_mutex并已写入值
+    void complete(Status status, int error, Spinlock::Lock& lock);
+private:
+    // wait的超时回调，在收割定时器的线程上执行
+    static uint64_t OnWaitTimeout(void* arg);
+protected:
+    Spinlock m_mutex;
+private:
+    std::atomic<int> m_status = {PENDING};
+    int m_error = 0;
+    std::atomic<uint32_t> m_promises = {0};
+    // 等待结果的协程
+    FiberWaitQueue m_waiters;
+    // 结果回调
+    std::vector<std::function<void()> > m_callbacks;
+};
+
+// 共享状态，保存值
+template<class T>
+class FutureState : public FutureStateBase {
+public:
+    typedef std::shared_ptr<FutureState> ptr;
+
+    FutureState() {}
+
+    ~FutureState() {
+        if(getStatus() == VALUE) {
+            value().~T();
+        }
+    }
+
+    template<class V>
+    bool setValue(V&& v) {
+        Spinlock::Lock lock(m_mutex);
+        if(isReady()) {
+            return false;
+        }
+        new (&m_storage) T(std::forward<V>(v));
+        complete(VALUE, 0, lock);
+        return true;
+    }
+
+    // 值，调用前需确认getStatus() == VALUE
+    T& value() { return *reinterpret_cast<T*>(&m_storage);}
+private:
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type m_storage;
+};
+
+template<class T>
+class Promise;
+
+// 异步结果，可以复制，所有副本共享同一个结果
+// 等待(wait/get)挂起的是协程，必须在调度器的协程里调用
+template<class T>
+class Future : public FutureBase {
+template<class U> friend class Promise;
+public:
+    typedef T value_type;
+
+    Future() {}
+
+    // 是否关联了共享状态
+    bool valid() const { return (bool)m_state;}
+
+    bool isReady() const { return m_state->isReady();}
+
+    // 是否得到了值
+    bool hasValue() const { return m_state->getStatus() == FutureStateBase::VALUE;}
+
+    // 错误码，没有结果或者得到了值时为0
+    int getError() const { return m_state->getError();}
+
+    // 等待结果，timeout_ms为超时时间(~0ull不超时)，返回是否已经有结果
+    // 超时只是不再等待，不会改变结果；要让结果本身超时用withTimeout
+    bool wait(uint64_t timeout_ms = ~0ull) const {
+        return m_state->wait(timeout_ms);
+    }
+
+    // 等待并返回值，调用前需确认结果是值(hasValue)
+    T& get() const {
+        m_state->wait();
+        SY_ASSERT2(hasValue(), "future has no value, error=" << getError());
+        return m_state->value();
+    }
+
+    // 有结果时调用cb(*this)，已经有结果时直接调用，否则在设置结果的上下文中调用
+    template<class F>
+    void onReady(F cb) const {
+        Future self = *this;
+        m_state->addCallback([self, cb]() mutable {
+            cb(self);
+        });
+    }
+
+    // 有结果时调用f(*this)，返回f返回值的Future，f在设置结果的上下文中执行，应该很短
+    template<class F>
+    auto then(F f) const -> Future<decltype(f(std::declval<Future<T> >()))> {
+        typedef decltype(f(std::declval<Future<T> >())) R;
+        Promise<R> p;
+        Future<R> rt = p.getFuture();
+        onReady([p, f](Future<T> self) mutable {
+            p.setValue(f(self));
+        });
+        return rt;
+    }
+
+    // 返回一个新的Future：原结果在timeout_ms内就绪时与原结果相同，否则为TIMEOUT错误
+    // 定时器在timer_manager上，默认为当前的IOManager
+    Future withTimeout(uint64_t timeout_ms, TimerManager* timer_manager = nullptr) const;
+private:
+    typename FutureState<T>::ptr m_state;
+};
+
+// 设置结果的一方，可以复制，最后一个副本析构时还没有设置结果则结果为BROKEN_PROMISE
+template<class T>
+class Promise {
+public:
+    Promise()
+        :m_state(std::make_shared<FutureState<T> >()) {
+        m_state->addPromise();
+    }
+
+    Promise(const Promise& o)
+        :m_state(o.m_state) {
+        m_state->addPromise();
+    }
+
+    Promise& operator=(const Promise& o) {
+        if(m_state != o.m_state) {
+            o.m_state->addPromise();
+            m_state->releasePromise();
+            m_state = o.m_state;
+        }
+        return *this;
+    }
+
+    ~Promise() {
+        m_state->releasePromise();
+    }
+
+    Future<T> getFuture() const {
+        Future<T> f;
+        f.m_state = m_state;
+        return f;
+    }
+
+    // 设置值，已经有结果返回false
+    template<class V>
+    bool setValue(V&& v) {
+        return m_state->setValue(std::forward<V>(v));
+    }
+
+    // 设置错误，error不能为0，已经有结果返回false
+    bool setError(int error) {
+        SY_ASSERT(error != 0);
+        return m_state->setError(error);
+    }
+
+    // 复制另一个已经有结果的Future的结果
+    bool setFrom(const Future<T>& f) {
+        if(f.hasValue()) {
+            return setValue(f.get());
+        }
+        return setError(f.getError());
+    }
+
+    bool isReady() const { return m_state->isReady();}
+private:
+    typename FutureState<T>::ptr m_state;
+};
+
+// 当前的IOManager(没有返回nullptr)，用于默认的TimerManager
+TimerManager* GetThisTimerManager();
+
+template<class T>
+Future<T> Future<T>::withTimeout(uint64_t timeout_ms, TimerManager* timer_manager) const {
+    if(isReady() || timeout_ms == ~0ull) {
+        return *this;
+    }
+    if(!timer_manager) {
+        timer_manager = GetThisTimerManager();
+    }
+    SY_ASSERT2(timer_manager, "Future::withTimeout needs a TimerManager");
+    Promise<T> p;
+    // 定时器回调作为任务调度，不在时间轮的锁里执行，可以安全地执行结果回调
+    Timer::ptr timer = timer_manager->addTimer(timeout_ms, [p]() mutable {
+        p.setError(TIMEOUT);
+    });
+    onReady([p, timer](Future<T> self) mutable {
+        timer->cancel();
+        p.setFrom(self);
+    });
+    return p.getFuture();
+}
+
+// 已经有值的Future
+template<class T>
+Future<typename std::decay<T>::type> MakeReadyFuture(T&& v) {
+    Promise<typename std::decay<T>::type> p;
+    p.setValue(std::forward<T>(v));
+    return p.getFuture();
+}
+
+// 已经有错误的Future
+template<class T>
+Future<T> MakeErrorFuture(int error) {
+    Promise<T> p;
+    p.setError(error);
+    return p.getFuture();
+}
+
+// 在调度器s上新起一个任务执行f()，返回f返回值的Future
+template<class F>
+auto Async(F f, Scheduler* s = Scheduler::GetThis(), int thread = -1)
+        -> Future<decltype(f())> {
+    typedef decltype(f()) R;
+    SY_ASSERT(s);
+    Promise<R> p;
+    Future<R> rt = p.getFuture();
+    s->schedule([p, f]() mutable {
+        p.setValue(f());
+    }, thread);
+    return rt;
+}
+
+// 所有Future都有结果时就绪，值为传入的futures
+template<class T>
+Future<std::vector<Future<T> > > WhenAll(const std::vector<Future<T> >& futures) {
+    typedef std::vector<Future<T> > Vec;
+    if(futures.empty()) {
+        return MakeReadyFuture(Vec());
+    }
+    Promise<Vec> p;
+    Future<Vec> rt = p.getFuture();
+    // 所有回调共享一份futures和剩余计数
+    struct Context {
+        Vec futures;
+        std::atomic<size_t> left;
+    };
+    std::shared_ptr<Context> ctx = std::make_shared<Context>();
+    ctx->futures = futures;
+    ctx->left = futures.size();
+    for(auto& f : futures) {
+        f.onReady([p, ctx](const Future<T>&) mutable {
+            if(--ctx->left == 0) {
+                p.setValue(std::move(ctx->futures));
+            }
+        });
+    }
+    return rt;
+}
+
+// 任意一个Future有结果(值或错误)时就绪，值为它在futures中的下标；futures不能为空
+template<class T>
+Future<size_t> WhenAny(const std::vector<Future<T> >& futures) {
+    SY_ASSERT(!futures.empty());
+    Promise<size_t> p;
+    Future<size_t> rt = p.getFuture();
+    for(size_t i = 0; i < futures.size(); ++i) {
+        // 只有第一个能设置成功
+        futures[i].onReady([p, i](const Future<T>&) mutable {
+            p.setValue(i);
+        });
+    }
+    return rt;
+}
+
+}
+
+#endif
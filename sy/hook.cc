@@ -1,11 +1,17 @@
 #include "hook.h"
 #include <dlfcn.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <vector>
 
 #include "config.h"
 #include "log.h"
 #include "fiber.h"
 #include "iomanager.h"
 #include "fd_manager.h"
+#include "file_io.h"
+#include "io_uring.h"
 #include "macro.h"
 
 sy::Logger::ptr g_logger = SY_LOG_NAME("system");
@@ -25,17 +31,29 @@ static thread_local bool t_hook_enable = false;
     XX(socket) \
     XX(connect) \
     XX(accept) \
+    XX(accept4) \
     XX(read) \
     XX(readv) \
     XX(recv) \
     XX(recvfrom) \
     XX(recvmsg) \
+    XX(recvmmsg) \
+    XX(pread) \
     XX(write) \
     XX(writev) \
     XX(send) \
     XX(sendto) \
     XX(sendmsg) \
+    XX(sendmmsg) \
+    XX(pwrite) \
+    XX(sendfile) \
+    XX(fsync) \
+    XX(fdatasync) \
     XX(close) \
+    XX(poll) \
+    XX(ppoll) \
+    XX(select) \
+    XX(epoll_wait) \
     XX(fcntl) \
     XX(ioctl) \
     XX(getsockopt) \
@@ -82,10 +100,63 @@ void set_hook_enable(bool flag) {
 
 }
 
-// 定时器超时条件
-struct timer_info {
-    int cancelled = 0;
-};
+// io_uring后端下可以直接提交给内核执行的操作，按原始函数的类型填写sqe
+// 没有对应重载的操作返回false，只在ring上等待fd就绪，然后重新执行系统调用
+template<typename OriginFun, typename... Args>
+static bool uring_prep(io_uring_sqe* sqe, OriginFun fun, uint32_t event, int fd, Args&&... args) {
+    return false;
+}
+
+static bool uring_prep(io_uring_sqe* sqe, read_fun fun, uint32_t event, int fd, void* buf, size_t count) {
+    sy::IoUring::PrepRead(sqe, fd, buf, count);
+    return true;
+}
+
+static bool uring_prep(io_uring_sqe* sqe, write_fun fun, uint32_t event, int fd, const void* buf, size_t count) {
+    sy::IoUring::PrepWrite(sqe, fd, buf, count);
+    return true;
+}
+
+// readv和writev的函数类型相同，通过事件区分
+static bool uring_prep(io_uring_sqe* sqe, readv_fun fun, uint32_t event, int fd, const struct iovec* iov, int iovcnt) {
+    if(event == sy::IOManager::READ) {
+        sy::IoUring::PrepReadv(sqe, fd, iov, iovcnt);
+    } else {
+        sy::IoUring::PrepWritev(sqe, fd, iov, iovcnt);
+    }
+    return true;
+}
+
+static bool uring_prep(io_uring_sqe* sqe, recv_fun fun, uint32_t event, int fd, void* buf, size_t len, int flags) {
+    sy::IoUring::PrepRecv(sqe, fd, buf, len, flags);
+    return true;
+}
+
+static bool uring_prep(io_uring_sqe* sqe, send_fun fun, uint32_t event, int fd, const void* msg, size_t len, int flags) {
+    sy::IoUring::PrepSend(sqe, fd, msg, len, flags);
+    return true;
+}
+
+static bool uring_prep(io_uring_sqe* sqe, recvmsg_fun fun, uint32_t event, int fd, struct msghdr* msg, int flags) {
+    sy::IoUring::PrepRecvmsg(sqe, fd, msg, flags);
+    return true;
+}
+
+static bool uring_prep(io_uring_sqe* sqe, sendmsg_fun fun, uint32_t event, int fd, const struct msghdr* msg, int flags) {
+    sy::IoUring::PrepSendmsg(sqe, fd, msg, flags);
+    return true;
+}
+
+static bool uring_prep(io_uring_sqe* sqe, accept_fun fun, uint32_t event, int fd, struct sockaddr* addr, socklen_t* addrlen) {
+    sy::IoUring::PrepAccept(sqe, fd, addr, addrlen, 0);
+    return true;
+}
+
+// 把带捕获的lambda转成IOManager::UringPrep函数指针
+template<class Prep>
+static bool uring_prep_call(io_uring_sqe* sqe, void* arg) {
+    return (*(Prep*)arg)(sqe);
+}
 
 // fd文件描述符，fun原始函数，hook_fun_name	hook的函数名称，timeout_so超时时间类型，args可变参数
 template<typename OriginFun, typename... Args>
@@ -106,11 +177,16 @@ static ssize_t do_io(int fd, OriginFun fun, const char* hook_fun_name,
     }
 
     if(!ctx->isSocket() || ctx->getUserNonblock()) { // 不是socket 或 用户设置了非阻塞
+        // 普通文件没有就绪事件，交给文件IO线程池执行，协程挂起等待，不阻塞IO线程
+        if(ctx->isFile() && sy::FileIO::CanOffload()) {
+            return sy::FileIO::Call([&]() {
+                return (ssize_t)fun(fd, std::forward<Args>(args)...);
+            });
+        }
         return fun(fd, std::forward<Args>(args)...);
     }
 
     uint64_t to = ctx->getTimeout(timeout_so); // 获得超时时间
-    std::shared_ptr<timer_info> tinfo(new timer_info); // 设置超时条件
 
 retry:
     ssize_t n = fun(fd, std::forward<Args>(args)...); // 先执行fun 读数据或写数据 若函数返回值有效就直接返回
@@ -120,50 +196,176 @@ retry:
     if(n == -1 && errno == EAGAIN) { // 若为阻塞状态
         errno = 0; // 重置EAGIN(errno = 11)，此处已处理，不再向上返回该错误
         sy::IOManager* iom = sy::IOManager::GetThis(); // 获得当前IO调度器
-        sy::Timer::ptr timer; // 定时器
-        std::weak_ptr<timer_info> winfo(tinfo); // tinfo的弱指针，可以判断tinfo是否已经销毁
-
-        if(to != (uint64_t)-1) { // 设置了超时时间
-            timer = iom->addConditionTimer(to, [winfo, fd, iom, event]() { // 添加条件定时器
-                auto t = winfo.lock();
-                if(!t || t->cancelled) { // 定时器失效了
-                    return;
-                }
-                t->cancelled = ETIMEDOUT; // 没错误的话设置为超时而失败
-                iom->cancelEvent(fd, (sy::IOManager::Event)(event)); // 取消事件强制唤醒
-            }, winfo);
-        }
-
-        int rt = iom->addEvent(fd, (sy::IOManager::Event)(event));
-        // addEvent失败， 取消上面加的定时器
-        if(SY_UNLIKELY(rt)) {
-            SY_LOG_ERROR(g_logger) << hook_fun_name << " addEvent("
-                << fd << ", " << event << ")";
-            if(timer) {
-                timer->cancel();
+        // io_uring后端：fd就绪后由内核直接执行操作，协程从完成事件拿到结果，不需要addEvent和再次系统调用
+        if(iom->isUring()) {
+            bool direct = false;
+            auto prep = [&](io_uring_sqe* sqe) {
+                direct = uring_prep(sqe, fun, event, fd, args...);
+                return direct;
+            };
+            int res = iom->uringIo(fd, (sy::IOManager::Event)event, to
+                                   ,&uring_prep_call<decltype(prep)>, &prep);
+            if(res == -ETIMEDOUT) {
+                errno = ETIMEDOUT;
+                return -1;
             }
-            return -1;
-        } 
-        // addEvent成功，把执行时间让出来
-        // 只有两种情况会从这回来：
-        // 1) 超时了， timer cancelEvent triggerEvent会唤醒回来
-        // 2) addEvent数据回来了会唤醒回来
-        else {
-            sy::Fiber::GetThis()->yield();
-            if(timer) {
-                timer->cancel();
+            // 被cancelEvent取消、内核返回EAGAIN、或者只等待了就绪，都重新执行一次系统调用
+            if(res == -ECANCELED || res == -EAGAIN || (res >= 0 && !direct)) {
+                goto retry;
             }
-            if(tinfo->cancelled) { // 从定时任务唤醒，超时失败
-                errno = tinfo->cancelled;
+            if(res < 0) {
+                errno = -res;
                 return -1;
             }
-            goto retry;  // 数据来了就直接重新去操作
+            return res;
+        }
+        // 等待fd就绪，超时由fd记录里的定时器节点检查，不分配内存
+        // 只有两种情况会从这回来：
+        // 1) 超时了，返回-1，errno为ETIMEDOUT
+        // 2) 数据来了或者事件被取消，重新去操作
+        if(iom->waitEvent(fd, (sy::IOManager::Event)(event), to)) {
+            if(errno != ETIMEDOUT) {
+                SY_LOG_ERROR(g_logger) << hook_fun_name << " addEvent("
+                    << fd << ", " << event << ")";
+            }
+            return -1;
         }
+        goto retry;
     }
     
     return n;
 }
 
+// 当前是否可以把阻塞的poll类调用转成协程等待：开启了hook，在IOManager的任务协程里(不是idle/主协程)
+static bool can_fiber_wait() {
+    return sy::t_hook_enable && sy::Scheduler::GetTaskStartUs() && sy::IOManager::GetThis();
+}
+
+namespace {
+
+// 一次poll等待的共享状态，fd事件和定时器的回调共同持有，只有第一个回调把协程调度回原来的线程
+struct PollWaiter {
+    std::atomic<bool> woken = {false};
+    sy::Fiber::ptr fiber;
+    sy::Scheduler* scheduler = nullptr;
+    int thread = -1;
+
+    void wake() {
+        if(woken.exchange(true)) {
+            return;
+        }
+        sy::Fiber::ptr f;
+        f.swap(fiber);
+        scheduler->schedule(std::move(f), thread);
+    }
+};
+
+// wait_fds注册的回调，删除事件时按waiter认出是不是自己注册的
+struct PollEventCb {
+    std::shared_ptr<PollWaiter> waiter;
+
+    void operator()() const {
+        waiter->wake();
+    }
+};
+
+}
+
+// 把fds关心的事件注册到IOManager，挂起协程直到任意一个fd就绪或者timeout_ms毫秒(-1不超时)
+// 返回后由调用者重新poll得到就绪状态；fd上已经有其他协程在等待同一个事件等无法注册时返回false
+static bool wait_fds(struct pollfd* fds, nfds_t nfds, int timeout_ms) {
+    sy::IOManager* iom = sy::IOManager::GetThis();
+    std::shared_ptr<PollWaiter> waiter = std::make_shared<PollWaiter>();
+    waiter->fiber = sy::Fiber::GetThis();
+    waiter->scheduler = sy::Scheduler::GetThis();
+    waiter->thread = sy::GetThreadId();
+    std::function<void()> cb = PollEventCb{waiter};
+
+    std::vector<std::pair<int, sy::IOManager::Event> > added;
+    bool ok = true;
+    for(nfds_t i = 0; i < nfds && ok; ++i) {
+        if(fds[i].fd < 0) {
+            continue;
+        }
+        if(fds[i].events & (POLLIN | POLLPRI | POLLRDNORM | POLLRDBAND)) {
+            if(iom->tryAddEvent(fds[i].fd, sy::IOManager::READ, cb)) {
+                ok = false;
+                break;
+            }
+            added.push_back(std::make_pair(fds[i].fd, sy::IOManager::READ));
+        }
+        if(fds[i].events & (POLLOUT | POLLWRNORM | POLLWRBAND)) {
+            if(iom->tryAddEvent(fds[i].fd, sy::IOManager::WRITE, cb)) {
+                ok = false;
+                break;
+            }
+            added.push_back(std::make_pair(fds[i].fd, sy::IOManager::WRITE));
+        }
+    }
+
+    sy::Timer::ptr timer;
+    if(ok && timeout_ms >= 0) {
+        timer = iom->addTimer(timeout_ms, cb);
+    }
+    // 没有可等待的fd也没有超时，挂起后永远不会被唤醒
+    bool wait = ok && (timer || !added.empty());
+    if(wait) {
+        sy::Fiber::GetThis()->yield();
+    }
+    if(timer) {
+        timer->cancel();
+    }
+    // 只删除还是自己注册的事件：已经触发的事件可能已被其他协程重新注册
+    auto mine = [&waiter](const std::function<void()>& f) {
+        const PollEventCb* p = f.target<PollEventCb>();
+        return p && p->waiter == waiter;
+    };
+    for(auto& i : added) {
+        iom->delEventIf(i.first, i.second, mine);
+    }
+    // 没有挂起时，前面注册的事件可能已经触发并调度了本协程，删不掉已触发的事件
+    // 这次唤醒必须在这里挂起一次消耗掉，否则协程之后会在别的等待中途被错误地恢复
+    if(!wait && waiter->woken.exchange(true)) {
+        sy::Fiber::GetThis()->yield();
+    }
+    return wait;
+}
+
+// poll的协程版本：先不阻塞地poll一次，没有就绪时挂起协程等待，醒来后重新poll
+// 无法注册到IOManager(其他协程在等待同一个fd事件)时，协程睡眠一小段后再不阻塞地poll，间隔从1ms翻倍到50ms
+static int do_poll(struct pollfd* fds, nfds_t nfds, int timeout_ms) {
+    uint64_t deadline = timeout_ms < 0 ? ~0ull : sy::GetMonotonicUS() / 1000 + timeout_ms;
+    int backoff_ms = 1;
+    while(true) {
+        int n = poll_f(fds, nfds, 0);
+        if(n != 0 || timeout_ms == 0) {
+            return n;
+        }
+        int wait = -1;
+        if(deadline != ~0ull) {
+            uint64_t now = sy::GetMonotonicUS() / 1000;
+            if(now >= deadline) {
+                return 0;
+            }
+            wait = deadline - now;
+        }
+        if(!wait_fds(fds, nfds, wait)) {
+            int ms = wait < 0 ? backoff_ms : std::min(wait, backoff_ms);
+            // hook的usleep，只挂起协程
+            usleep(ms * 1000);
+            backoff_ms = std::min(backoff_ms * 2, 50);
+        }
+    }
+}
+
+// fd是否是登记过的普通文件，并且当前可以把它的IO交给文件IO线程池
+static bool is_offload_file(int fd) {
+    if(!sy::t_hook_enable || !sy::FileIO::CanOffload()) {
+        return false;
+    }
+    sy::FdCtx::ptr ctx = sy::FdMgr::GetInstance()->get(fd);
+    return ctx && ctx->isFile() && !ctx->isClose();
+}
 
 extern "C" {
 #define XX(name) name ## _fun name ## _f = nullptr;// 声明变量
@@ -178,8 +380,8 @@ unsigned int sleep(unsigned int seconds) {
     sy::Fiber::ptr fiber = sy::Fiber::GetThis();
     sy::IOManager* iom = sy::IOManager::GetThis();
     iom->addTimer(seconds * 1000, std::bind((void(sy::Scheduler::*)
-            (sy::Fiber::ptr, int thread))&sy::IOManager::schedule
-            ,iom, fiber, -1));
+            (sy::Fiber::ptr, int thread, sy::Scheduler::Priority))&sy::IOManager::schedule
+            ,iom, fiber, -1, sy::Scheduler::NORMAL));
     sy::Fiber::GetThis()->yield();
     return 0;
 }
@@ -191,8 +393,8 @@ int usleep(useconds_t usec) {
     sy::Fiber::ptr fiber = sy::Fiber::GetThis();
     sy::IOManager* iom = sy::IOManager::GetThis();
     iom->addTimer(usec / 1000, std::bind((void(sy::Scheduler::*)
-            (sy::Fiber::ptr, int thread))&sy::IOManager::schedule
-            ,iom, fiber, -1));
+            (sy::Fiber::ptr, int thread, sy::Scheduler::Priority))&sy::IOManager::schedule
+            ,iom, fiber, -1, sy::Scheduler::NORMAL));
     sy::Fiber::GetThis()->yield();
     return 0;
 }
@@ -206,8 +408,8 @@ int nanosleep(const struct timespec *req, struct timespec *rem) {
     sy::Fiber::ptr fiber = sy::Fiber::GetThis();
     sy::IOManager* iom = sy::IOManager::GetThis();
     iom->addTimer(timeout_ms, std::bind((void(sy::Scheduler::*)
-            (sy::Fiber::ptr, int thread))&sy::IOManager::schedule
-            ,iom, fiber, -1));
+            (sy::Fiber::ptr, int thread, sy::Scheduler::Priority))&sy::IOManager::schedule
+            ,iom, fiber, -1, sy::Scheduler::NORMAL));
     sy::Fiber::GetThis()->yield();
     return 0;
 }
@@ -255,46 +457,27 @@ int connect_with_timeout(int fd, const struct sockaddr* addr, socklen_t addrlen,
     }
 	
     sy::IOManager* iom = sy::IOManager::GetThis();
-    sy::Timer::ptr timer;
-    std::shared_ptr<timer_info> tinfo(new timer_info);
-    std::weak_ptr<timer_info> winfo(tinfo);
-
-    // 设置了超时时间
-    if (timeout_ms != (uint64_t)-1) {
-        // 加条件定时器
-        timer = iom->addConditionTimer(timeout_ms, [iom, fd, winfo]() {
-            auto t = winfo.lock();
-            if (!t || t->cancelled) {
-                return;
-            }
-            t->cancelled = ETIMEDOUT;
-            iom->cancelEvent(fd, sy::IOManager::WRITE);
-            }, winfo);
-    }
-    
-    // 添加一个写事件
-    int rt = iom->addEvent(fd, sy::IOManager::WRITE);
-    if (rt == 0) {
-        /* 	只有两种情况唤醒：
-         * 	1. 超时，从定时器唤醒
-         *	2. 连接成功，从epoll_wait拿到事件 */
-        sy::Fiber::GetThis()->yield();
-        if (timer) {
-            timer->cancel();
-        }
-        // 从定时器唤醒，超时失败
-        if (tinfo->cancelled) {
-            errno = tinfo->cancelled;
+    if(iom->isUring()) {
+        // io_uring后端：在本线程的ring上等待可写
+        int res = iom->uringIo(fd, sy::IOManager::WRITE, timeout_ms, nullptr, nullptr);
+        if(res < 0) {
+            errno = -res;
             return -1;
         }
-      // 添加事件失败
     } else {
-        if (timer) {
-            timer->cancel();
+        /* 	只有两种情况唤醒：
+         * 	1. 超时，从定时器唤醒
+         *	2. 连接成功，从epoll_wait拿到事件 */
+        if(iom->waitEvent(fd, sy::IOManager::WRITE, timeout_ms)) {
+            // 从定时器唤醒，超时失败
+            if(errno == ETIMEDOUT) {
+                return -1;
+            }
+            // 添加事件失败
+            SY_LOG_ERROR(sy::g_logger) << "connect addEvent(" << fd << ", WRITE) error";
         }
-        SY_LOG_ERROR(sy::g_logger) << "connect addEvent(" << fd << ", WRITE) error";
     }
-	
+
     int error = 0;
     socklen_t len = sizeof(int);
     // 获取套接字的错误状态
@@ -325,8 +508,20 @@ int accept(int s, struct sockaddr *addr, socklen_t *addrlen) {
     return fd;
 }
 
+int accept4(int s, struct sockaddr *addr, socklen_t *addrlen, int flags) {
+    int fd = do_io(s, accept4_f, "accept4", sy::IOManager::READ, SO_RCVTIMEO, addr, addrlen, flags);
+    if(fd >= 0) {
+        sy::FdMgr::GetInstance()->get(fd, true);
+    }
+    return fd;
+}
+
 // 后续一系列发送和接收
 ssize_t read(int fd, void *buf, size_t count) {
+    // 普通文件的读还要维护顺序预读
+    if(is_offload_file(fd)) {
+        return sy::FileIO::Read(fd, buf, count);
+    }
     return do_io(fd, read_f, "read", sy::IOManager::READ, SO_RCVTIMEO, buf, count);
 }
 
@@ -346,6 +541,19 @@ ssize_t recvmsg(int sockfd, struct msghdr *msg, int flags) {
     return do_io(sockfd, recvmsg_f, "recvmsg", sy::IOManager::READ, SO_RCVTIMEO, msg, flags);
 }
 
+// 批量接收，非阻塞的socket上没有数据报时按读事件等待
+int recvmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags, struct timespec *timeout) {
+    return do_io(sockfd, recvmmsg_f, "recvmmsg", sy::IOManager::READ, SO_RCVTIMEO, msgvec, vlen, flags, timeout);
+}
+
+// 带偏移的读写只用于文件
+ssize_t pread(int fd, void *buf, size_t count, off_t offset) {
+    if(is_offload_file(fd)) {
+        return sy::FileIO::Pread(fd, buf, count, offset);
+    }
+    return pread_f(fd, buf, count, offset);
+}
+
 ssize_t write(int fd, const void *buf, size_t count) {
     return do_io(fd, write_f, "write", sy::IOManager::WRITE, SO_SNDTIMEO, buf, count);
 }
@@ -366,6 +574,36 @@ ssize_t sendmsg(int s, const struct msghdr *msg, int flags) {
     return do_io(s, sendmsg_f, "sendmsg", sy::IOManager::WRITE, SO_SNDTIMEO, msg, flags);
 }
 
+int sendmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags) {
+    return do_io(sockfd, sendmmsg_f, "sendmmsg", sy::IOManager::WRITE, SO_SNDTIMEO, msgvec, vlen, flags);
+}
+
+ssize_t pwrite(int fd, const void *buf, size_t count, off_t offset) {
+    if(is_offload_file(fd)) {
+        return sy::FileIO::Pwrite(fd, buf, count, offset);
+    }
+    return pwrite_f(fd, buf, count, offset);
+}
+
+// 文件到socket的零拷贝，按socket的写事件等待
+ssize_t sendfile(int out_fd, int in_fd, off_t *offset, size_t count) {
+    return do_io(out_fd, sendfile_f, "sendfile", sy::IOManager::WRITE, SO_SNDTIMEO, in_fd, offset, count);
+}
+
+int fsync(int fd) {
+    if(is_offload_file(fd)) {
+        return sy::FileIO::Fsync(fd);
+    }
+    return fsync_f(fd);
+}
+
+int fdatasync(int fd) {
+    if(is_offload_file(fd)) {
+        return sy::FileIO::Fdatasync(fd);
+    }
+    return fdatasync_f(fd);
+}
+
 // 关闭socket
 int close(int fd) {
     if(!sy::t_hook_enable) {
@@ -383,6 +621,111 @@ int close(int fd) {
     return close_f(fd);
 }
 
+// 第三方客户端库(数据库驱动、DNS解析等)自己调用poll/select/epoll_wait等待socket
+// 在协程里时转成IOManager上的事件等待，不阻塞调度线程
+int poll(struct pollfd *fds, nfds_t nfds, int timeout) {
+    if(!can_fiber_wait()) {
+        return poll_f(fds, nfds, timeout);
+    }
+    return do_poll(fds, nfds, timeout);
+}
+
+int ppoll(struct pollfd *fds, nfds_t nfds, const struct timespec *tmo_p, const sigset_t *sigmask) {
+    // 协程等待无法原子地替换信号掩码，带sigmask的调用保持原语义
+    if(!can_fiber_wait() || sigmask) {
+        return ppoll_f(fds, nfds, tmo_p, sigmask);
+    }
+    int timeout_ms = -1;
+    if(tmo_p) {
+        // 向上取整，避免不到1毫秒的超时变成不等待的忙轮询
+        timeout_ms = tmo_p->tv_sec * 1000 + (tmo_p->tv_nsec + 999999) / 1000000;
+    }
+    return do_poll(fds, nfds, timeout_ms);
+}
+
+int select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds, struct timeval *timeout) {
+    if(!can_fiber_wait() || nfds < 0 || nfds > FD_SETSIZE) {
+        return select_f(nfds, readfds, writefds, exceptfds, timeout);
+    }
+    int timeout_ms = -1;
+    if(timeout) {
+        timeout_ms = timeout->tv_sec * 1000 + (timeout->tv_usec + 999) / 1000;
+    }
+    // fd_set转成pollfd数组
+    std::vector<struct pollfd> fds;
+    for(int fd = 0; fd < nfds; ++fd) {
+        short events = 0;
+        if(readfds && FD_ISSET(fd, readfds)) {
+            events |= POLLIN;
+        }
+        if(writefds && FD_ISSET(fd, writefds)) {
+            events |= POLLOUT;
+        }
+        if(exceptfds && FD_ISSET(fd, exceptfds)) {
+            events |= POLLPRI;
+        }
+        if(events) {
+            struct pollfd pfd = {fd, events, 0};
+            fds.push_back(pfd);
+        }
+    }
+    int rt = do_poll(fds.empty() ? nullptr : &fds[0], fds.size(), timeout_ms);
+    if(rt < 0) {
+        return rt;
+    }
+    for(auto& i : fds) {
+        if(i.revents & POLLNVAL) {
+            errno = EBADF;
+            return -1;
+        }
+    }
+    // 就绪状态写回fd_set，返回值是三个集合中置位的总数
+    rt = 0;
+    for(auto& i : fds) {
+        bool r = (i.events & POLLIN) && (i.revents & (POLLIN | POLLHUP | POLLERR));
+        bool w = (i.events & POLLOUT) && (i.revents & (POLLOUT | POLLERR));
+        bool e = (i.events & POLLPRI) && (i.revents & POLLPRI);
+        if(readfds && (i.events & POLLIN)) {
+            r ? FD_SET(i.fd, readfds) : FD_CLR(i.fd, readfds);
+        }
+        if(writefds && (i.events & POLLOUT)) {
+            w ? FD_SET(i.fd, writefds) : FD_CLR(i.fd, writefds);
+        }
+        if(exceptfds && (i.events & POLLPRI)) {
+            e ? FD_SET(i.fd, exceptfds) : FD_CLR(i.fd, exceptfds);
+        }
+        rt += r + w + e;
+    }
+    return rt;
+}
+
+// 等待epfd本身可读(有事件就绪)，醒来后不阻塞地取出事件
+int epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout) {
+    if(!can_fiber_wait() || timeout == 0) {
+        return epoll_wait_f(epfd, events, maxevents, timeout);
+    }
+    uint64_t deadline = timeout < 0 ? ~0ull : sy::GetMonotonicUS() / 1000 + timeout;
+    while(true) {
+        int n = epoll_wait_f(epfd, events, maxevents, 0);
+        if(n != 0) {
+            return n;
+        }
+        int wait = -1;
+        if(deadline != ~0ull) {
+            uint64_t now = sy::GetMonotonicUS() / 1000;
+            if(now >= deadline) {
+                return 0;
+            }
+            wait = deadline - now;
+        }
+        struct pollfd pfd = {epfd, POLLIN, 0};
+        // 另一个线程抢先取走了事件时重新等待
+        if(do_poll(&pfd, 1, wait) < 0) {
+            return -1;
+        }
+    }
+}
+
 // 修改文件状态：对用户反馈是否是用户设置了非阻塞模式
 int fcntl(int fd, int cmd, ... /* arg */ ) {
     va_list va;
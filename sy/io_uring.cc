@@ -0,0 +1,265 @@
+#include "io_uring.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifndef __NR_io_uring_setup
+#define __NR_io_uring_setup 425
+#endif
+#ifndef __NR_io_uring_enter
+#define __NR_io_uring_enter 426
+#endif
+
+namespace sy {
+
+static int sys_io_uring_setup(unsigned entries, io_uring_params* p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete
+                              ,unsigned flags, void* arg, size_t argsz) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+IoUring::IoUring() {
+}
+
+IoUring::~IoUring() {
+    unmap();
+    if(m_fd >= 0) {
+        close(m_fd);
+    }
+}
+
+void IoUring::unmap() {
+    if(m_sqes) {
+        munmap(m_sqes, m_sqesSize);
+        m_sqes = nullptr;
+    }
+    if(m_cqPtr && m_cqPtr != m_sqPtr) {
+        munmap(m_cqPtr, m_cqSize);
+    }
+    m_cqPtr = nullptr;
+    if(m_sqPtr) {
+        munmap(m_sqPtr, m_sqSize);
+        m_sqPtr = nullptr;
+    }
+}
+
+bool IoUring::init(unsigned entries) {
+    io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CLAMP;
+    int fd = sys_io_uring_setup(entries, &p);
+    if(fd < 0) {
+        return false;
+    }
+    m_fd = fd;
+
+    m_sqSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    m_cqSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    // 5.4以后提交队列和完成队列可以一次mmap
+    bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if(single) {
+        m_sqSize = m_cqSize = std::max(m_sqSize, m_cqSize);
+    }
+    m_sqPtr = mmap(nullptr, m_sqSize, PROT_READ | PROT_WRITE
+                   ,MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if(m_sqPtr == MAP_FAILED) {
+        m_sqPtr = nullptr;
+        return false;
+    }
+    if(single) {
+        m_cqPtr = m_sqPtr;
+    } else {
+        m_cqPtr = mmap(nullptr, m_cqSize, PROT_READ | PROT_WRITE
+                       ,MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if(m_cqPtr == MAP_FAILED) {
+            m_cqPtr = nullptr;
+            return false;
+        }
+    }
+    m_sqesSize = p.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE
+                      ,MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if(sqes == MAP_FAILED) {
+        return false;
+    }
+    m_sqes = (io_uring_sqe*)sqes;
+
+    char* sq = (char*)m_sqPtr;
+    m_sqHead = (unsigned*)(sq + p.sq_off.head);
+    m_sqTail = (unsigned*)(sq + p.sq_off.tail);
+    m_sqMask = (unsigned*)(sq + p.sq_off.ring_mask);
+    m_sqEntries = (unsigned*)(sq + p.sq_off.ring_entries);
+    m_sqArray = (unsigned*)(sq + p.sq_off.array);
+    m_sqeTail = *m_sqTail;
+
+    char* cq = (char*)m_cqPtr;
+    m_cqHead = (unsigned*)(cq + p.cq_off.head);
+    m_cqTail = (unsigned*)(cq + p.cq_off.tail);
+    m_cqMask = (unsigned*)(cq + p.cq_off.ring_mask);
+    m_cqes = (io_uring_cqe*)(cq + p.cq_off.cqes);
+    return true;
+}
+
+unsigned IoUring::space() const {
+    unsigned head = __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+    return *m_sqEntries - (m_sqeTail - head);
+}
+
+io_uring_sqe* IoUring::getSqe() {
+    if(space() == 0) {
+        return nullptr;
+    }
+    io_uring_sqe* sqe = &m_sqes[m_sqeTail & *m_sqMask];
+    ++m_sqeTail;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+unsigned IoUring::flush() {
+    unsigned tail = *m_sqTail;
+    unsigned n = m_sqeTail - tail;
+    for(unsigned i = 0; i < n; ++i) {
+        m_sqArray[tail & *m_sqMask] = tail & *m_sqMask;
+        ++tail;
+    }
+    __atomic_store_n(m_sqTail, tail, __ATOMIC_RELEASE);
+    return tail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+}
+
+int IoUring::submit(unsigned to_submit, unsigned wait_nr, uint64_t timeout_ms) {
+    unsigned flags = wait_nr ? IORING_ENTER_GETEVENTS : 0;
+    io_uring_getevents_arg arg;
+    __kernel_timespec ts;
+    void* parg = nullptr;
+    size_t argsz = 0;
+    if(wait_nr && timeout_ms != ~0ull) {
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = (timeout_ms % 1000) * 1000000;
+        memset(&arg, 0, sizeof(arg));
+        arg.sigmask_sz = _NSIG / 8;
+        arg.ts = (uint64_t)&ts;
+        flags |= IORING_ENTER_EXT_ARG;
+        parg = &arg;
+        argsz = sizeof(arg);
+    }
+    int rt = 0;
+    do {
+        rt = sys_io_uring_enter(m_fd, to_submit, wait_nr, flags, parg, argsz);
+    } while(rt < 0 && errno == EINTR);
+    return rt < 0 ? -errno : rt;
+}
+
+bool IoUring::IsSupported() {
+    static int s_supported = -1;
+    if(s_supported < 0) {
+        io_uring_params p;
+        memset(&p, 0, sizeof(p));
+        int fd = sys_io_uring_setup(2, &p);
+        if(fd < 0) {
+            s_supported = 0;
+        } else {
+            s_supported = (p.features & IORING_FEAT_EXT_ARG)
+                            && (p.features & IORING_FEAT_NODROP);
+            close(fd);
+        }
+    }
+    return s_supported;
+}
+
+void IoUring::PrepPollAdd(io_uring_sqe* sqe, int fd, unsigned poll_mask) {
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+#if __BYTE_ORDER == __BIG_ENDIAN
+    // 大端机器上poll32_events的高低16位是交换的
+    poll_mask = (poll_mask << 16) | (poll_mask >> 16);
+#endif
+    sqe->poll32_events = poll_mask;
+}
+
+void IoUring::PrepCancel(io_uring_sqe* sqe, uint64_t user_data) {
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = user_data;
+}
+
+void IoUring::PrepRead(io_uring_sqe* sqe, int fd, void* buf, unsigned len) {
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)buf;
+    sqe->len = len;
+    sqe->off = (uint64_t)-1;
+}
+
+void IoUring::PrepWrite(io_uring_sqe* sqe, int fd, const void* buf, unsigned len) {
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)buf;
+    sqe->len = len;
+    sqe->off = (uint64_t)-1;
+}
+
+void IoUring::PrepReadv(io_uring_sqe* sqe, int fd, const iovec* iov, unsigned iovcnt) {
+    sqe->opcode = IORING_OP_READV;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)iov;
+    sqe->len = iovcnt;
+    sqe->off = (uint64_t)-1;
+}
+
+void IoUring::PrepWritev(io_uring_sqe* sqe, int fd, const iovec* iov, unsigned iovcnt) {
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)iov;
+    sqe->len = iovcnt;
+    sqe->off = (uint64_t)-1;
+}
+
+void IoUring::PrepRecv(io_uring_sqe* sqe, int fd, void* buf, size_t len, int flags) {
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)buf;
+    sqe->len = len;
+    sqe->msg_flags = flags;
+}
+
+void IoUring::PrepSend(io_uring_sqe* sqe, int fd, const void* buf, size_t len, int flags) {
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)buf;
+    sqe->len = len;
+    sqe->msg_flags = flags;
+}
+
+void IoUring::PrepRecvmsg(io_uring_sqe* sqe, int fd, msghdr* msg, unsigned flags) {
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)msg;
+    sqe->len = 1;
+    sqe->msg_flags = flags;
+}
+
+void IoUring::PrepSendmsg(io_uring_sqe* sqe, int fd, const msghdr* msg, unsigned flags) {
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)msg;
+    sqe->len = 1;
+    sqe->msg_flags = flags;
+}
+
+void IoUring::PrepAccept(io_uring_sqe* sqe, int fd, sockaddr* addr, socklen_t* addrlen, int flags) {
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)addr;
+    sqe->addr2 = (uint64_t)addrlen;
+    sqe->accept_flags = flags;
+}
+
+}
@@ -0,0 +1,99 @@
+// io_uring封装
+#ifndef __SY_IO_URING_H__
+#define __SY_IO_URING_H__
+
+#include <linux/io_uring.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "noncopyable.h"
+
+namespace sy {
+
+// 一个io_uring实例，直接使用io_uring_setup/io_uring_enter系统调用，不依赖liburing
+// 提交队列不是线程安全的，getSqe/flush需要调用者加锁；完成队列只能由一个线程reap
+class IoUring : Noncopyable {
+public:
+    IoUring();
+    ~IoUring();
+
+    // 创建ring，entries为提交队列长度，内核不支持或者被禁用时返回false
+    bool init(unsigned entries);
+
+    bool isValid() const { return m_fd >= 0;}
+
+    int getFd() const { return m_fd;}
+
+    // 取一个空闲的sqe(已清零)，提交队列已满返回nullptr
+    io_uring_sqe* getSqe();
+
+    // 提交队列剩余的空闲sqe数量
+    unsigned space() const;
+
+    // 把getSqe取出的sqe发布给内核，返回可以提交的数量
+    unsigned flush();
+
+    // 提交已发布的sqe，wait_nr>0时等待至少wait_nr个完成事件，timeout_ms为等待超时(~0ull不超时)
+    // 返回提交的数量，失败返回-errno(等待超时为-ETIME)
+    int submit(unsigned to_submit, unsigned wait_nr = 0, uint64_t timeout_ms = ~0ull);
+
+    // 取出所有已完成的事件，每个cqe调用一次cb，返回处理的数量
+    template<class Callback>
+    unsigned reap(Callback cb) {
+        unsigned head = *m_cqHead;
+        unsigned tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+        unsigned n = 0;
+        while(head != tail) {
+            cb(&m_cqes[head & *m_cqMask]);
+            ++head;
+            ++n;
+        }
+        __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+        return n;
+    }
+
+    // 运行时探测内核是否支持本项目用到的特性(IORING_FEAT_EXT_ARG/NODROP，即5.11及以上)，结果会缓存
+    static bool IsSupported();
+
+    static void PrepPollAdd(io_uring_sqe* sqe, int fd, unsigned poll_mask);
+    static void PrepCancel(io_uring_sqe* sqe, uint64_t user_data);
+    static void PrepRead(io_uring_sqe* sqe, int fd, void* buf, unsigned len);
+    static void PrepWrite(io_uring_sqe* sqe, int fd, const void* buf, unsigned len);
+    static void PrepReadv(io_uring_sqe* sqe, int fd, const iovec* iov, unsigned iovcnt);
+    static void PrepWritev(io_uring_sqe* sqe, int fd, const iovec* iov, unsigned iovcnt);
+    static void PrepRecv(io_uring_sqe* sqe, int fd, void* buf, size_t len, int flags);
+    static void PrepSend(io_uring_sqe* sqe, int fd, const void* buf, size_t len, int flags);
+    static void PrepRecvmsg(io_uring_sqe* sqe, int fd, msghdr* msg, unsigned flags);
+    static void PrepSendmsg(io_uring_sqe* sqe, int fd, const msghdr* msg, unsigned flags);
+    static void PrepAccept(io_uring_sqe* sqe, int fd, sockaddr* addr, socklen_t* addrlen, int flags);
+private:
+    void unmap();
+private:
+    // ring句柄
+    int m_fd = -1;
+    // 本地已经取出但还未发布的sqe位置
+    unsigned m_sqeTail = 0;
+    // 提交队列
+    unsigned* m_sqHead = nullptr;
+    unsigned* m_sqTail = nullptr;
+    unsigned* m_sqMask = nullptr;
+    unsigned* m_sqEntries = nullptr;
+    unsigned* m_sqArray = nullptr;
+    io_uring_sqe* m_sqes = nullptr;
+    // 完成队列
+    unsigned* m_cqHead = nullptr;
+    unsigned* m_cqTail = nullptr;
+    unsigned* m_cqMask = nullptr;
+    io_uring_cqe* m_cqes = nullptr;
+    // mmap的内存
+    void* m_sqPtr = nullptr;
+    size_t m_sqSize = 0;
+    void* m_cqPtr = nullptr;
+    size_t m_cqSize = 0;
+    size_t m_sqesSize = 0;
+};
+
+}
+
+#endif
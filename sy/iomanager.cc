@@ -1,10 +1,16 @@
 #include "iomanager.h"
+#include "config.h"
+#include "hook.h"
+#include "io_uring.h"
 #include "macro.h"
 #include "log.h"
 
+#include <algorithm>
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <string.h>
 #include <unistd.h>
 
@@ -12,6 +18,23 @@ namespace sy {
 
 static sy::Logger::ptr g_logger = SY_LOG_NAME("system");
 
+// 每个IO线程一个epoll，fd及其事件、协程固定在所属线程上
+static sy::ConfigVar<bool>::ptr g_per_thread_reactor =
+    sy::Config::Lookup("iomanager.per_thread_reactor", false, "one epoll reactor per io thread");
+
+// IO后端：epoll / io_uring，内核不支持io_uring时回退到epoll
+static sy::ConfigVar<std::string>::ptr g_iomanager_backend =
+    sy::Config::Lookup("iomanager.backend", std::string("epoll"), "iomanager backend, epoll|io_uring");
+
+// 每个线程的io_uring提交队列长度
+static sy::ConfigVar<uint32_t>::ptr g_uring_entries =
+    sy::Config::Lookup("iomanager.uring_entries", (uint32_t)256, "io_uring entries per io thread");
+
+// io_uring完成事件的user_data：小于8的是内部标记，其余是UringRequest的地址，最低位为1表示链接请求中的poll
+static const uint64_t URING_WAKE   = 1;
+static const uint64_t URING_EPOLL  = 2;
+static const uint64_t URING_CANCEL = 3;
+
 enum EpollCtlOp {
 };
 
@@ -59,45 +82,66 @@ static std::ostream& operator<< (std::ostream& os, EPOLL_EVENTS events) {
     return os;
 }
 
-IOManager::FdContext::EventContext& IOManager::FdContext::getContext(IOManager::Event event) {
+IOManager::FdContext::EventContext& IOManager::getContext(FdContext* fd_ctx, Event event) {
     switch(event) {
         case IOManager::READ:
-            return read;
+            return fd_ctx->read;
         case IOManager::WRITE:
-            return write;
+            return fd_ctx->write;
         default:
             SY_ASSERT2(false, "getContext");
     }
     throw std::invalid_argument("getContext invalid event");
 }
 
-void IOManager::FdContext::resetContext(EventContext& ctx) {
+IOManager::FdContext::Deadline& IOManager::getDeadline(FdContext* fd_ctx, Event event) {
+    return event == READ ? fd_ctx->readDeadline : fd_ctx->writeDeadline;
+}
+
+void IOManager::resetContext(FdContext::EventContext& ctx) {
     ctx.scheduler = nullptr;
     ctx.fiber.reset();
     ctx.cb = nullptr;
+    ctx.thread = -1;
 }
 
-void IOManager::FdContext::triggerEvent(IOManager::Event event) {
-    SY_ASSERT(events & event);
+void IOManager::triggerEvent(FdContext* fd_ctx, Event event, Batch* batch) {
+    SY_ASSERT(fd_ctx->events & event);
     // 触发该事件就将该事件从注册事件中删掉
-    events = (Event)(events & ~event);
-    EventContext& ctx = getContext(event);
-    if(ctx.cb) {
+    fd_ctx->events &= ~event;
+    // 等待结束，懒删除的超时节点到期时看到这里就不会再超时
+    getDeadline(fd_ctx, event).when = ~0ull;
+    FdContext::EventContext& ctx = getContext(fd_ctx, event);
+    // IO就绪唤醒的协程多半在处理请求，放到高优先级，不被积压的后台任务拖慢
+    if(batch && ctx.scheduler == this) {
+        if(ctx.cb) {
+            batch->add(&ctx.cb, ctx.thread, Scheduler::HIGH);
+        } else {
+            batch->add(&ctx.fiber, ctx.thread, Scheduler::HIGH);
+        }
+    } else if(ctx.cb) {
         // 使用地址传入就会将cb的引用计数-1
-        ctx.scheduler->schedule(&ctx.cb);
+        ctx.scheduler->schedule(&ctx.cb, ctx.thread, Scheduler::HIGH);
     } else {
         // 使用地址传入就会将fiber的引用计数-1
-        ctx.scheduler->schedule(&ctx.fiber);
+        ctx.scheduler->schedule(&ctx.fiber, ctx.thread, Scheduler::HIGH);
     }
     // 执行完毕将协程调度器置空
     ctx.scheduler = nullptr;
+    ctx.thread = -1;
     return;
 }
 
 // 改造协程调度器，使其支持epoll，并重载tickle和idle，实现通知调度协程和IO协程调度功能
 
-IOManager::IOManager(size_t threads, bool use_caller, const std::string& name)
-    :Scheduler(threads, use_caller, name) {
+// IOManager的id，不会复用
+static std::atomic<uint64_t> s_iomanager_id = {0};
+
+IOManager::IOManager(size_t threads, bool use_caller, const std::string& name
+                     ,const ThreadAffinity& affinity)
+    :Scheduler(threads, use_caller, name, affinity)
+    ,m_id(++s_iomanager_id) {
+    m_perThreadReactor = g_per_thread_reactor->getValue();
     // 创建epoll实例
     m_epfd = epoll_create(5000);
     SY_ASSERT(m_epfd > 0);  // 成功时，这些系统调用将返回非负文件描述符。如果出错，则返回-1，并且将errno设置为指示错误。
@@ -123,13 +167,63 @@ IOManager::IOManager(size_t threads, bool use_caller, const std::string& name)
     rt = epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_tickleFds[0], &event);
     SY_ASSERT(!rt);
 
-    contextResize(32);// 初始化socket事件上下文vector
+    // 每个调度线程一个eventfd，空闲时挂起在上面，实现定向唤醒
+    m_wakers.resize(getWorkerCount());
+    for(size_t i = 0; i < m_wakers.size(); ++i) {
+        m_wakers[i] = new Waker;
+        m_wakers[i]->eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        SY_ASSERT(m_wakers[i]->eventFd >= 0);
+    }
+
+    // io_uring后端：每个调度线程一个ring，任意一个创建失败就整体回退到epoll
+    std::string backend = g_iomanager_backend->getValue();
+    if(backend == "io_uring") {
+        m_uring = IoUring::IsSupported();
+        for(size_t i = 0; m_uring && i < m_wakers.size(); ++i) {
+            m_wakers[i]->ring = new IoUring;
+            m_uring = m_wakers[i]->ring->init(g_uring_entries->getValue());
+        }
+        if(!m_uring) {
+            SY_LOG_WARN(g_logger) << "name=" << getName() << " io_uring not supported, errno="
+                << errno << " errstr=" << strerror(errno) << ", fall back to epoll";
+            for(auto& i : m_wakers) {
+                delete i->ring;
+                i->ring = nullptr;
+            }
+        }
+    } else if(backend != "epoll") {
+        SY_LOG_ERROR(g_logger) << "invalid iomanager.backend=" << backend << ", use epoll";
+    }
+    if(m_uring) {
+        m_perThreadReactor = false;
+    }
+
+    for(size_t i = 0; i < m_wakers.size(); ++i) {
+        if(m_perThreadReactor) {
+            // 每线程reactor模式：线程空闲时阻塞在自己的epoll上，eventfd注册进去作为邮箱
+            m_wakers[i]->epfd = epoll_create1(EPOLL_CLOEXEC);
+            SY_ASSERT(m_wakers[i]->epfd >= 0);
+            epoll_event ev;
+            memset(&ev, 0, sizeof(ev));
+            ev.events = EPOLLIN | EPOLLET;
+            ev.data.fd = m_wakers[i]->eventFd;
+            rt = epoll_ctl(m_wakers[i]->epfd, EPOLL_CTL_ADD, m_wakers[i]->eventFd, &ev);
+            SY_ASSERT(!rt);
+        }
+    }
+    m_parked.reserve(m_wakers.size());
+
+    // 每个线程各自等待的模式下，定时器也按线程分开，线程只收割自己添加的定时器
+    if(m_perThreadReactor || m_uring) {
+        setThreadWheels(getWorkerCount());
+    }
 
     // 这里直接启动了schedule，也就是说IOManager创建即可调度协程
     start();
 }
 
-// 析构：等Scheduler调度完所有的任务，然后再关闭epoll句柄和pipe句柄，然后释放所有的FdContext
+// 析构：等Scheduler调度完所有的任务，然后再关闭epoll句柄和pipe句柄
+// fd记录属于FdManager，不在这里释放
 IOManager::~IOManager() {
     // 停止调度器
     stop();
@@ -139,40 +233,221 @@ IOManager::~IOManager() {
     close(m_tickleFds[0]);
     close(m_tickleFds[1]);
 
-    // 释放 m_fdContexts 内存
-    for(size_t i = 0; i < m_fdContexts.size(); ++i) {
-        if(m_fdContexts[i]) {
-            delete m_fdContexts[i];
+    for(auto& i : m_wakers) {
+        if(i->ring) {
+            delete i->ring;
         }
+        if(i->epfd >= 0) {
+            close(i->epfd);
+        }
+        close(i->eventFd);
+        delete i;
     }
 }
 
-void IOManager::contextResize(size_t size) {
-    m_fdContexts.resize(size);
+//获得当前IO调度器
+IOManager* IOManager::GetThis() {
+    return dynamic_cast<IOManager*>(Scheduler::GetThis());
+}
 
-    for(size_t i = 0; i < m_fdContexts.size(); ++i) {
-         // 没有才new新的
-        if(!m_fdContexts[i]) {
-            m_fdContexts[i] = new FdContext;
-            m_fdContexts[i]->fd = i;
+int IOManager::getEpfd(FdContext* fd_ctx) const {
+    if(m_perThreadReactor && fd_ctx->owner >= 0) {
+        return m_wakers[fd_ctx->owner]->epfd;
+    }
+    return m_epfd;
+}
+
+void IOManager::getReactorThreadRange(size_t& begin, size_t& end) const {
+    end = getWorkerCount();
+    begin = (isUseCaller() && end > 1) ? 1 : 0;
+}
+
+size_t IOManager::getReactorThreadCount() const {
+    size_t begin = 0;
+    size_t end = 0;
+    getReactorThreadRange(begin, end);
+    return end - begin;
+}
+
+bool IOManager::waitReactorThreads(std::vector<int>& threads, uint64_t timeout_ms) const {
+    size_t begin = 0;
+    size_t end = 0;
+    getReactorThreadRange(begin, end);
+    threads.clear();
+    uint64_t deadline = sy::GetMonotonicUS() + timeout_ms * 1000;
+    for(size_t i = begin; i < end; ++i) {
+        // 共用一个截止时间，前面的线程等得久后面的就等得少
+        uint64_t now = sy::GetMonotonicUS();
+        int thread = waitWorkerThreadId(i, now < deadline ? (deadline - now) / 1000 : 0);
+        if(thread == -1) {
+            SY_LOG_ERROR(g_logger) << "name=" << getName() << " io thread " << i
+                << " not running after " << timeout_ms << "ms";
+            threads.clear();
+            return false;
         }
+        threads.push_back(thread);
     }
+    return true;
 }
 
-//获得当前IO调度器
-IOManager* IOManager::GetThis() {
-    return dynamic_cast<IOManager*>(Scheduler::GetThis());
+int IOManager::pickOwner() {
+    size_t begin = 0;
+    size_t end = 0;
+    getReactorThreadRange(begin, end);
+    return begin + (m_nextOwner++ % (end - begin));
+}
+
+int IOManager::assignFd(int fd) {
+    if(!m_perThreadReactor || fd < 0) {
+        return -1;
+    }
+    FdContext* fd_ctx = getFdContext(fd, true);
+    FdContext::MutexType::Lock lock(fd_ctx->mutex);
+    if(fd_ctx->owner < 0) {
+        fd_ctx->owner = pickOwner();
+    }
+    return fd_ctx->owner;
+}
+
+void IOManager::scheduleFd(int fd, std::function<void()> cb) {
+    int owner = assignFd(fd);
+    if(owner < 0) {
+        schedule(std::move(cb));
+        return;
+    }
+    // 目标线程还没进入run时线程id为-1，退化为任意线程
+    schedule(std::move(cb), getWorkerThreadId(owner));
 }
 
 // 通知调度器有任务要调度
+// 优先唤醒一个挂起的follower直接去执行任务，poller可以继续epoll_wait；没有follower时才唤醒poller
+// 所有线程都在忙，或者已经有一个唤醒还没被处理时，本次tickle被合并掉
 void IOManager::tickle() {
+    ++m_tickleRequested;
     // 如果当前没有空闲调度线程，那就没必要发通知
     if(!hasIdleThreads()) {
         return;
     }
-    // 有任务来了，就往 pipe 里发送1个字节的数据，这样 epoll_wait 就会唤醒。待idle协程yield之后Scheduler::run就可以调度其他任务
+    if(unparkOne()) {
+        return;
+    }
+    wakePoller();
+}
+
+// 通知指定线程：指定线程的任务只能由它自己执行，唤醒其他线程没有意义
+void IOManager::tickleWorker(int index) {
+    ++m_tickleRequested;
+    if(index < 0 || index >= (int)m_wakers.size()) {
+        tickle();
+        return;
+    }
+    if(unpark(index)) {
+        return;
+    }
+    if(m_poller == index) {
+        wakePoller();
+    }
+}
+
+bool IOManager::wakePoller() {
+    if(m_poller == -1 || m_pollerNotified.exchange(true)) {
+        return false;
+    }
+    // 往 pipe 里发送1个字节的数据，这样 epoll_wait 就会唤醒。待idle协程yield之后Scheduler::run就可以调度其他任务
     int rt = write(m_tickleFds[1], "T", 1);
     SY_ASSERT(rt == 1);
+    ++m_tickleSent;
+    return true;
+}
+
+bool IOManager::unparkOne() {
+    int index = -1;
+    {
+        Spinlock::Lock lock(m_parkMutex);
+        if(m_parked.empty()) {
+            return false;
+        }
+        index = m_parked.back();
+        m_parked.pop_back();
+        m_wakers[index]->parked = false;
+    }
+    uint64_t one = 1;
+    int rt = write(m_wakers[index]->eventFd, &one, sizeof(one));
+    SY_ASSERT(rt == sizeof(one));
+    ++m_tickleSent;
+    return true;
+}
+
+bool IOManager::unpark(int index) {
+    {
+        Spinlock::Lock lock(m_parkMutex);
+        Waker* w = m_wakers[index];
+        if(!w->parked) {
+            return false;
+        }
+        w->parked = false;
+        m_parked.erase(std::find(m_parked.begin(), m_parked.end(), index));
+    }
+    uint64_t one = 1;
+    int rt = write(m_wakers[index]->eventFd, &one, sizeof(one));
+    SY_ASSERT(rt == sizeof(one));
+    ++m_tickleSent;
+    return true;
+}
+
+void IOManager::unparkAll() {
+    while(unparkOne());
+}
+
+// follower挂起：先登记到挂起列表，再检查一次是否有任务或者没有poller，避免与tickle竞争导致唤醒丢失
+void IOManager::park(int index) {
+    Waker* w = m_wakers[index];
+    {
+        Spinlock::Lock lock(m_parkMutex);
+        w->parked = true;
+        m_parked.push_back(index);
+    }
+
+    if(!hasRunnableTask() && m_poller != -1 && !stopping()) {
+        // 最多挂起5秒，和epoll_wait的最大超时时间一致
+        pollfd pfd;
+        pfd.fd = w->eventFd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        int rt = 0;
+        uint64_t begin = sy::GetMonotonicUS();
+        do {
+            rt = poll_f(&pfd, 1, 5000);
+        } while(rt < 0 && errno == EINTR);
+        addPollTime(sy::GetMonotonicUS() - begin);
+    }
+
+    {
+        Spinlock::Lock lock(m_parkMutex);
+        if(w->parked) {
+            // 超时或者自己放弃挂起，从挂起列表中移除
+            w->parked = false;
+            m_parked.erase(std::find(m_parked.begin(), m_parked.end(), index));
+        }
+    }
+    uint64_t dummy;
+    while(read(w->eventFd, &dummy, sizeof(dummy)) > 0);
+}
+
+const char* IOManager::getBackendName() const {
+    if(m_uring) {
+        return "io_uring";
+    }
+    return m_perThreadReactor ? "epoll_per_thread" : "epoll";
+}
+
+std::ostream& IOManager::dump(std::ostream& os) {
+    Scheduler::dump(os);
+    os << std::endl << "    backend=" << getBackendName()
+       << " tickle_requested=" << m_tickleRequested
+       << " tickle_sent=" << m_tickleSent
+       << " pending_event_count=" << m_pendingEventCount;
+    return os;
 }
 
 // 对于IOManager而言，必须等所有待调度的IO事件都执行完了才可以退出
@@ -180,13 +455,27 @@ bool IOManager::stopping() {
     return m_pendingEventCount == 0 && Scheduler::stopping();
 }
 
+bool IOManager::stopping(uint64_t& timeout) {
+    timeout = getNextTimer();
+    return timeout == ~0ull && stopping();
+}
+
 // idle协程：调度器无任务时执行
 // 对于IO协程调度来说，应阻塞在等待IO事件上，idle退出的时机是epoll_wait返回，对应的操作是tickle或注册的IO事件就绪
 // 调度器无调度任务时会阻塞idle协程上，对IO调度器而言，idle状态应该关注两件事
 // 一是有没有新的调度任务，对应Schduler::schedule()，如果有新的调度任务，那应该立即退出idle状态，并执行对应的任务；
 // 二是关注当前注册的所有IO事件有没有触发，如果有触发，那么应该执行IO事件对应的回调函数
+// 同一时刻只有一个空闲线程(poller)阻塞在epoll_wait上，其余空闲线程挂起在自己的eventfd上等待定向唤醒
 void IOManager::idle() {
     SY_LOG_DEBUG(g_logger) << "idle";
+    if(m_uring) {
+        idleUring();
+        return;
+    }
+    if(m_perThreadReactor) {
+        idleReactor();
+        return;
+    }
 
     // 一次epoll_wait最多检测256个就绪事件，如果就绪事件超过了这个数，那么会在下轮epoll_wait继续处理
     const uint64_t MAX_EVNETS = 256;
@@ -194,97 +483,61 @@ void IOManager::idle() {
     std::shared_ptr<epoll_event> shared_events(events, [](epoll_event* ptr){
         delete[] ptr;
     });
+    int index = getWorkerIndex();
+    // 一轮唤醒的任务一次性入队，在idle协程里重复使用
+    Batch batch;
 
     while(true) {
         // 获取下一个定时器的超时时间，顺便判断调度器是否停止
         uint64_t next_timeout = 0;
-        if( SYLAR_UNLIKELY(stopping(next_timeout))) {
-            SYLAR_LOG_DEBUG(g_logger) << "name=" << getName() << "idle stopping exit";
+        if(SY_UNLIKELY(stopping(next_timeout))) {
+            SY_LOG_DEBUG(g_logger) << "name=" << getName() << " idle stopping exit";
+            // 让挂起的线程也检查到停止条件
+            unparkAll();
             break;
         }
+        // 弹性模式下本线程要退出，唤醒一个挂起的线程，没有poller时由它接替epoll_wait
+        if(SY_UNLIKELY(retiring())) {
+            unparkOne();
+            break;
+        }
+
+        // 已经有其他线程在epoll_wait，本线程作为follower挂起，被唤醒后回到调度协程取任务
+        int expected = -1;
+        if(!m_poller.compare_exchange_strong(expected, index)) {
+            park(index);
+            Fiber::GetThis()->yield();
+            continue;
+        }
+
+        // 成为poller之后再检查一次任务，避免错过成为poller之前的tickle
+        if(hasRunnableTask()) {
+            m_poller = -1;
+            Fiber::GetThis()->yield();
+            continue;
+        }
 
         // 阻塞在epoll_wait上，等待事件发生或定时器超时
-        int rt = 0;
-        do{
-            // 默认超时时间5秒，如果下一个定时器的超时时间大于5秒，仍以5秒来计算超时，避免定时器超时时间太大时，epoll_wait一直阻塞
-            static const int MAX_TIMEOUT = 5000;
-            if(next_timeout != ~0ull) {
-                next_timeout = std::min((int)next_timeout, MAX_TIMEOUT);
-            } else {
-                next_timeout = MAX_TIMEOUT;
-            }
-            rt = epoll_wait(m_epfd, events, MAX_EVNETS, (int)next_timeout);
-            if(rt < 0 && errno == EINTR) {
-                continue;
-            } else {
-                break;
-            }
-        } while(true);
-
-        // 收集所有已超时的定时器，执行回调函数
-        std::vector<std::function<void()>> cbs;
-        listExpiredCb(cbs);
-        if(!cbs.empty()) {
-            for(const auto &cb : cbs) {
-                schedule(cb);
-            }
-            cbs.clear();
-        }
-        
-        // 遍历所有发生的事件，根据epoll_event的私有指针找到对应的FdContext，进行事件处理
-        for(int i = 0; i < rt; ++i) {
-            epoll_event& event = events[i];// 从 events 中拿一个 event
-            if(event.data.fd == m_tickleFds[0]) { // 如果获得的这个信息时来自 pipe
-                uint8_t dummy[256];
-                while(read(m_tickleFds[0], dummy, sizeof(dummy)) > 0);// 将 pipe 发来的1个字节数据读掉
-                continue;
-            }
+        int rt = waitEvents(m_epfd, events, MAX_EVNETS, next_timeout);
+        m_poller = -1;
 
-            // 通过epoll_event的私有指针获取FdContext
-            FdContext* fd_ctx = (FdContext*)event.data.ptr;
-            FdContext::MutexType::Lock lock(fd_ctx->mutex);
-            // EPOLLERR: 出错，比如写读端已经关闭的pipe
-            // EPOLLHUP: 套接字对端关闭
-            // 出现这两种事件，应该同时触发fd的读和写事件，否则有可能出现注册的事件永远执行不到的情况
-            if(event.events & (EPOLLERR | EPOLLHUP)) {
-                event.events |= (EPOLLIN | EPOLLOUT) & fd_ctx->events;
-            }
-            int real_events = NONE;
-            // 读事件
-            if(event.events & EPOLLIN) {
-                real_events |= READ;
-            }
-            // 写事件
-            if(event.events & EPOLLOUT) {
-                real_events |= WRITE;
-            }
-            // 没事件
-            if((fd_ctx->events & real_events) == NONE) {
-                continue;
-            }
-            // 剔除已经发生的事件，将剩下的事件重新加入epoll_wait，
-            int left_events = (fd_ctx->events & ~real_events);
-            int op = left_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL; // 如果执行完该事件还有事件则修改，若无事件则删除
-            event.events = EPOLLET | left_events;// 更新新的事件
-
-            // 重新注册事件
-            int rt2 = epoll_ctl(m_epfd, op, fd_ctx->fd, &event);
-            if(rt2) {
-                SY_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
-                    << (EpollCtlOp)op << ", " << fd_ctx->fd << ", " << (EPOLL_EVENTS)event.events << "):"
-                    << rt2 << " (" << errno << ") (" << strerror(errno) << ")";
-                continue;
-            }
+        // 收集所有已超时的定时器回调和就绪事件唤醒的任务，一次性入队
+        size_t scheduled = scheduleExpiredTimers(batch);
+        bool notified = false;
+        scheduled += dispatchEvents(m_epfd, events, rt, m_tickleFds[0], notified, batch);
+        schedule(batch);
+        if(notified) {
+            m_pollerNotified = false;
+        }
 
-            // 处理已经发生的事件，也就是让调度器调度指定的函数或协程  
-            if(real_events & READ) { // 读事件好了，执行读事件 
-                fd_ctx->triggerEvent(READ);
-                --m_pendingEventCount;
-            }
-            if(real_events & WRITE) { // 写事件好了，执行写事件
-                fd_ctx->triggerEvent(WRITE);
-                --m_pendingEventCount;
-            }
+        // 没有产生新任务(超时或只是被tickle)，继续当poller
+        if(!scheduled && !hasRunnableTask()) {
+            continue;
+        }
+
+        // 本线程要去执行任务了，还有IO事件或定时器需要等待时，唤醒一个follower接替epoll_wait
+        if(m_pendingEventCount > 0 || hasTimer()) {
+            unparkOne();
         }
 
         // 执行完epoll_wait返回的事件
@@ -292,10 +545,347 @@ void IOManager::idle() {
         // 上面triggerEvent实际也只是把对应的fiber重新加入调度，要执行的话还要等idle协程退出
         Fiber::ptr cur = Fiber::GetThis(); // 获得当前协程
         auto raw_ptr = cur.get(); // 获得裸指针
-        cur.reset(); // 将当前idle协程指向空指针，状态为INIT
+        cur.reset(); // 释放引用，避免idle协程永远无法析构
+
+        raw_ptr->yield(); // 执行完返回scheduler的MainFiber 继续下一轮
+    }
+}
+
+// 每线程reactor模式的idle：没有leader/follower，每个线程阻塞在自己的epoll上
+// 阻塞前登记到挂起列表，其他线程投递任务时通过unpark/unparkOne写本线程的eventfd(邮箱)唤醒
+void IOManager::idleReactor() {
+    const uint64_t MAX_EVNETS = 256;
+    epoll_event* events = new epoll_event[MAX_EVNETS]();
+    std::shared_ptr<epoll_event> shared_events(events, [](epoll_event* ptr){
+        delete[] ptr;
+    });
+    int index = getWorkerIndex();
+    Waker* w = m_wakers[index];
+    Batch batch;
+
+    while(true) {
+        uint64_t next_timeout = 0;
+        if(SY_UNLIKELY(stopping(next_timeout))) {
+            SY_LOG_DEBUG(g_logger) << "name=" << getName() << " idle stopping exit";
+            unparkAll();
+            break;
+        }
+
+        // 先登记再检查任务，和park一样避免与投递任务的线程竞争导致唤醒丢失
+        {
+            Spinlock::Lock lock(m_parkMutex);
+            w->parked = true;
+            m_parked.push_back(index);
+        }
+        int rt = 0;
+        if(!hasRunnableTask()) {
+            rt = waitEvents(w->epfd, events, MAX_EVNETS, next_timeout);
+        }
+        {
+            Spinlock::Lock lock(m_parkMutex);
+            if(w->parked) {
+                w->parked = false;
+                m_parked.erase(std::find(m_parked.begin(), m_parked.end(), index));
+            }
+        }
+
+        size_t scheduled = scheduleExpiredTimers(batch);
+        bool notified = false;
+        scheduled += dispatchEvents(w->epfd, events, rt, w->eventFd, notified, batch);
+        schedule(batch);
+        if(!scheduled && !hasRunnableTask()) {
+            continue;
+        }
+
+        Fiber::ptr cur = Fiber::GetThis();
+        auto raw_ptr = cur.get();
+        cur.reset();
+
+        raw_ptr->yield();
+    }
+}
+
+// io_uring模式的idle：本线程的邮箱(eventfd)和共享epoll都以poll请求挂在ring上
+// 每轮把本线程协程积累的sqe一次性提交，同时等待完成事件，一次io_uring_enter完成提交和等待
+void IOManager::idleUring() {
+    const uint64_t MAX_EVNETS = 256;
+    epoll_event* events = new epoll_event[MAX_EVNETS]();
+    std::shared_ptr<epoll_event> shared_events(events, [](epoll_event* ptr){
+        delete[] ptr;
+    });
+    int index = getWorkerIndex();
+    Waker* w = m_wakers[index];
+    Batch batch;
+    uringArm(index, w->eventFd, URING_WAKE);
+    uringArm(index, m_epfd, URING_EPOLL);
+
+    while(true) {
+        uint64_t next_timeout = 0;
+        if(SY_UNLIKELY(stopping(next_timeout))) {
+            SY_LOG_DEBUG(g_logger) << "name=" << getName() << " idle stopping exit";
+            unparkAll();
+            break;
+        }
+
+        {
+            Spinlock::Lock lock(m_parkMutex);
+            w->parked = true;
+            m_parked.push_back(index);
+        }
+        unsigned wait_nr = hasRunnableTask() ? 0 : 1;
+        unsigned to_submit = 0;
+        {
+            Spinlock::Lock lock(w->ringMutex);
+            to_submit = w->ring->flush();
+        }
+        uint64_t begin = sy::GetMonotonicUS();
+        int rt = w->ring->submit(to_submit, wait_nr, std::min(next_timeout, (uint64_t)5000));
+        addPollTime(sy::GetMonotonicUS() - begin);
+        if(rt < 0 && rt != -ETIME && rt != -EBUSY) {
+            SY_LOG_ERROR(g_logger) << "io_uring_enter(" << w->ring->getFd() << ", "
+                << to_submit << ", " << wait_nr << "):" << rt << " (" << strerror(-rt) << ")";
+        }
+        {
+            Spinlock::Lock lock(m_parkMutex);
+            if(w->parked) {
+                w->parked = false;
+                m_parked.erase(std::find(m_parked.begin(), m_parked.end(), index));
+            }
+        }
+
+        size_t scheduled = scheduleExpiredTimers(batch);
+        scheduled += reapUring(index, events, MAX_EVNETS, batch);
+        schedule(batch);
+        if(!scheduled && !hasRunnableTask()) {
+            continue;
+        }
+
+        Fiber::ptr cur = Fiber::GetThis();
+        auto raw_ptr = cur.get();
+        cur.reset();
+
+        raw_ptr->yield();
+    }
+}
+
+size_t IOManager::reapUring(int index, epoll_event* events, int max_events, Batch& batch) {
+    Waker* w = m_wakers[index];
+    size_t scheduled = 0;
+    w->ring->reap([&](io_uring_cqe* cqe) {
+        uint64_t ud = cqe->user_data;
+        if(ud == URING_WAKE) {
+            uint64_t dummy;
+            while(read(w->eventFd, &dummy, sizeof(dummy)) > 0);
+            uringArm(index, w->eventFd, URING_WAKE);
+        } else if(ud == URING_EPOLL) {
+            // addEvent注册到共享epoll上的事件
+            int n = epoll_wait_f(m_epfd, events, max_events, 0);
+            bool notified = false;
+            scheduled += dispatchEvents(m_epfd, events, n, m_tickleFds[0], notified, batch);
+            uringArm(index, m_epfd, URING_EPOLL);
+        } else if(ud == URING_CANCEL || (ud & 1)) {
+            // 取消请求本身、链接请求中的poll：结果以后面操作的完成事件为准
+        } else {
+            UringRequest* req = (UringRequest*)ud;
+            req->res = cqe->res;
+            --m_pendingEventCount;
+            batch.add(&req->fiber, req->thread, HIGH);
+            ++scheduled;
+        }
+    });
+    return scheduled;
+}
+
+void IOManager::uringArm(int index, int fd, uint64_t tag) {
+    Waker* w = m_wakers[index];
+    Spinlock::Lock lock(w->ringMutex);
+    io_uring_sqe* sqe = w->ring->getSqe();
+    if(!sqe) {
+        w->ring->submit(w->ring->flush());
+        sqe = w->ring->getSqe();
+    }
+    SY_ASSERT(sqe);
+    IoUring::PrepPollAdd(sqe, fd, POLLIN);
+    sqe->user_data = tag;
+}
+
+void IOManager::uringCancel(int index, uint64_t user_data) {
+    Waker* w = m_wakers[index];
+    Spinlock::Lock lock(w->ringMutex);
+    io_uring_sqe* sqe = w->ring->getSqe();
+    if(!sqe) {
+        w->ring->submit(w->ring->flush());
+        sqe = w->ring->getSqe();
+    }
+    SY_ASSERT(sqe);
+    IoUring::PrepCancel(sqe, user_data);
+    sqe->user_data = URING_CANCEL;
+    // 取消要立即生效，不等ring所属线程的下一轮idle
+    w->ring->submit(w->ring->flush());
+}
+
+int IOManager::uringIo(int fd, Event event, uint64_t timeout, UringPrep prep, void* arg) {
+    int index = getWorkerIndex();
+    SY_ASSERT(m_uring && index >= 0);
+    Waker* w = m_wakers[index];
+
+    UringRequest req;
+    req.fiber = Fiber::GetThis();
+    req.thread = sy::GetThreadId();
+    req.index = index;
+    io_uring_sqe op;
+    memset(&op, 0, sizeof(op));
+    bool linked = prep && prep(&op, arg);
+    // 取消时只取消poll，链接在后面的操作随之以-ECANCELED完成，协程总是等到操作的完成事件，保证缓冲区不会被内核晚写
+    req.key = linked ? ((uint64_t)&req | 1) : (uint64_t)&req;
+
+    FdContext* fd_ctx = getFdContext(fd, true);
+    {
+        FdContext::MutexType::Lock lock(fd_ctx->mutex);
+        (event == READ ? fd_ctx->uringRead : fd_ctx->uringWrite) = &req;
+    }
+    {
+        Spinlock::Lock lock(w->ringMutex);
+        if(w->ring->space() < 2) {
+            w->ring->submit(w->ring->flush());
+        }
+        io_uring_sqe* sqe = w->ring->getSqe();
+        SY_ASSERT(sqe);
+        IoUring::PrepPollAdd(sqe, fd, event == READ ? POLLIN : POLLOUT);
+        sqe->user_data = req.key;
+        if(linked) {
+            sqe->flags |= IOSQE_IO_LINK;
+            io_uring_sqe* sqe2 = w->ring->getSqe();
+            SY_ASSERT(sqe2);
+            *sqe2 = op;
+            sqe2->fd = fd;
+            sqe2->user_data = (uint64_t)&req;
+        }
+    }
+    ++m_pendingEventCount;
+
+    // 超时定时器放在协程栈上，不分配内存
+    struct UringTimeout {
+        IOManager* iom;
+        int index;
+        uint64_t key;
+        bool timedOut;
+    } ut = {this, index, req.key, false};
+    TimerHandle timer;
+    if(timeout != ~0ull) {
+        addTimer(timer, timeout, [](void* arg) -> uint64_t {
+            UringTimeout* t = (UringTimeout*)arg;
+            t->timedOut = true;
+            t->iom->uringCancel(t->index, t->key);
+            return 0;
+        }, &ut);
+    }
+
+    // 完成事件由本线程的idle收割，然后把协程调度回本线程
+    Fiber::GetThis()->yield();
+    // cancel返回后回调不会再执行，可以安全读取timedOut
+    timer.cancel();
+    {
+        FdContext::MutexType::Lock lock(fd_ctx->mutex);
+        UringRequest*& slot = event == READ ? fd_ctx->uringRead : fd_ctx->uringWrite;
+        if(slot == &req) {
+            slot = nullptr;
+        }
+    }
+    if(ut.timedOut && req.res == -ECANCELED) {
+        return -ETIMEDOUT;
+    }
+    return req.res;
+}
+
+int IOManager::waitEvents(int epfd, epoll_event* events, int max_events, uint64_t timeout) {
+    // 默认超时时间5秒，如果下一个定时器的超时时间大于5秒，仍以5秒来计算超时，避免定时器超时时间太大时，epoll_wait一直阻塞
+    static const uint64_t MAX_TIMEOUT = 5000;
+    if(timeout > MAX_TIMEOUT) {
+        timeout = MAX_TIMEOUT;
+    }
+    int rt = 0;
+    uint64_t begin = sy::GetMonotonicUS();
+    do {
+        rt = epoll_wait_f(epfd, events, max_events, (int)timeout);
+    } while(rt < 0 && errno == EINTR);
+    addPollTime(sy::GetMonotonicUS() - begin);
+    return rt;
+}
+
+size_t IOManager::scheduleExpiredTimers(Batch& batch) {
+    std::vector<std::function<void()>> cbs;
+    listExpiredCb(cbs);
+    // 线程时间轮的回调留在本线程执行
+    int thread = hasThreadWheels() ? GetThreadId() : -1;
+    for(auto& cb : cbs) {
+        batch.add(&cb, thread);
+    }
+    return cbs.size();
+}
+
+// 遍历所有发生的事件，根据epoll_event的私有指针找到对应的FdContext，进行事件处理
+size_t IOManager::dispatchEvents(int epfd, epoll_event* events, int n, int notify_fd, bool& notified
+                                 ,Batch& batch) {
+    size_t scheduled = 0;
+    for(int i = 0; i < n; ++i) {
+        epoll_event& event = events[i];// 从 events 中拿一个 event
+        if(event.data.fd == notify_fd) { // 如果获得的这个信息是唤醒通知(pipe或eventfd)
+            uint8_t dummy[256];
+            while(read(notify_fd, dummy, sizeof(dummy)) > 0);// 将通知数据读掉
+            notified = true;
+            continue;
+        }
+
+        // 通过epoll_event的私有指针获取FdContext
+        FdContext* fd_ctx = (FdContext*)event.data.ptr;
+        FdContext::MutexType::Lock lock(fd_ctx->mutex);
+        // EPOLLERR: 出错，比如写读端已经关闭的pipe
+        // EPOLLHUP: 套接字对端关闭
+        // 出现这两种事件，应该同时触发fd的读和写事件，否则有可能出现注册的事件永远执行不到的情况
+        if(event.events & (EPOLLERR | EPOLLHUP)) {
+            event.events |= (EPOLLIN | EPOLLOUT) & fd_ctx->events;
+        }
+        int real_events = NONE;
+        // 读事件
+        if(event.events & EPOLLIN) {
+            real_events |= READ;
+        }
+        // 写事件
+        if(event.events & EPOLLOUT) {
+            real_events |= WRITE;
+        }
+        // 没事件
+        if((fd_ctx->events & real_events) == NONE) {
+            continue;
+        }
+        // 剔除已经发生的事件，将剩下的事件重新加入epoll_wait，
+        int left_events = (fd_ctx->events & ~real_events);
+        int op = left_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL; // 如果执行完该事件还有事件则修改，若无事件则删除
+        event.events = EPOLLET | left_events;// 更新新的事件
+
+        // 重新注册事件
+        int rt2 = epoll_ctl(epfd, op, fd_ctx->getFd(), &event);
+        if(rt2) {
+            SY_LOG_ERROR(g_logger) << "epoll_ctl(" << epfd << ", "
+                << (EpollCtlOp)op << ", " << fd_ctx->getFd() << ", " << (EPOLL_EVENTS)event.events << "):"
+                << rt2 << " (" << errno << ") (" << strerror(errno) << ")";
+            continue;
+        }
 
-        raw_ptr->swapOut(); // 执行完返回scheduler的MainFiber 继续下一轮
+        // 处理已经发生的事件，也就是让调度器调度指定的函数或协程
+        if(real_events & READ) { // 读事件好了，执行读事件
+            triggerEvent(fd_ctx, READ, &batch);
+            --m_pendingEventCount;
+            ++scheduled;
+        }
+        if(real_events & WRITE) { // 写事件好了，执行写事件
+            triggerEvent(fd_ctx, WRITE, &batch);
+            --m_pendingEventCount;
+            ++scheduled;
+        }
     }
+    return scheduled;
 }
 
 // 添加事件回调addEvent，删除事件回调delEvent，取消事件回调cancelEvent，取消全部事件cancelAll
@@ -305,21 +895,43 @@ void IOManager::idle() {
 // 添加成功返回0,失败返回-1 
 int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
     // 初始化一个 FdContext：找到fd对应的FdContext，如果不存在，那就分配一个
-    FdContext* fd_ctx = nullptr;
-    RWMutexType::ReadLock lock(m_mutex);
-    // 从 m_fdContexts 中拿到对应的 FdContext
-    if((int)m_fdContexts.size() > fd) {
-        fd_ctx = m_fdContexts[fd];
-        lock.unlock();
-    } else {
-        lock.unlock();
-        RWMutexType::WriteLock lock2(m_mutex);
-        contextResize(fd * 1.5); // 不够就扩充
-        fd_ctx = m_fdContexts[fd];
+    FdContext* fd_ctx = getFdContext(fd, true);
+    if(SY_UNLIKELY(!fd_ctx)) {
+        errno = EBADF;
+        return -1;
     }
 
-    // 同一个fd不允许重复添加相同的事件
     FdContext::MutexType::Lock lock2(fd_ctx->mutex);
+    if(addEventLocked(fd_ctx, event, std::move(cb))) {
+        return -1;
+    }
+    // 不带超时的等待，清掉上一次等待留下的超时时间点
+    getDeadline(fd_ctx, event).when = ~0ull;
+    return 0;
+}
+
+int IOManager::tryAddEvent(int fd, Event event, std::function<void()> cb) {
+    FdContext* fd_ctx = getFdContext(fd, true);
+    if(SY_UNLIKELY(!fd_ctx)) {
+        errno = EBADF;
+        return -1;
+    }
+
+    FdContext::MutexType::Lock lock2(fd_ctx->mutex);
+    if(fd_ctx->events & event) {
+        errno = EEXIST;
+        return -1;
+    }
+    if(addEventLocked(fd_ctx, event, std::move(cb))) {
+        return -1;
+    }
+    getDeadline(fd_ctx, event).when = ~0ull;
+    return 0;
+}
+
+int IOManager::addEventLocked(FdContext* fd_ctx, Event event, std::function<void()> cb) {
+    int fd = fd_ctx->getFd();
+    // 同一个fd不允许重复添加相同的事件
     if(SY_UNLIKELY(fd_ctx->events & event)) {
         SY_LOG_ERROR(g_logger) << "addEvent assert fd=" << fd
                     << " event=" << (EPOLL_EVENTS)event
@@ -327,6 +939,13 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
         SY_ASSERT(!(fd_ctx->events & event));
     }
 
+    // 每线程reactor模式：还没有归属的fd归当前IO线程所有，外部线程添加的则轮询分配
+    if(m_perThreadReactor && fd_ctx->owner < 0) {
+        int index = getWorkerIndex();
+        fd_ctx->owner = index >= 0 ? index : pickOwner();
+    }
+    int epfd = getEpfd(fd_ctx);
+
     // 将新的事件加入epoll_wait，使用epoll_event的私有指针存储FdContext的位置
     int op = fd_ctx->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD; // 若已经有注册的事件则为修改操作，若没有则为添加操作
     epoll_event epevent;
@@ -334,9 +953,9 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
     epevent.data.ptr = fd_ctx; // 将fd_ctx存到data的指针中
 
     // 注册事件
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
+    int rt = epoll_ctl(epfd, op, fd, &epevent);
     if(rt) {
-        SY_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
+        SY_LOG_ERROR(g_logger) << "epoll_ctl(" << epfd << ", "
             << (EpollCtlOp)op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
             << rt << " (" << errno << ") (" << strerror(errno) << ") fd_ctx->events="
             << (EPOLL_EVENTS)fd_ctx->events;
@@ -346,8 +965,8 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
     // 待执行IO事件数加1
     ++m_pendingEventCount;
     // 找到这个fd的event事件对应的EventContext，对其中的scheduler, cb, fiber进行赋值
-    fd_ctx->events = (Event)(fd_ctx->events | event);// 将 fd_ctx 的注册事件更新
-    FdContext::EventContext& event_ctx = fd_ctx->getContext(event);// 获得对应事件的 EventContext
+    fd_ctx->events |= event;// 将 fd_ctx 的注册事件更新
+    FdContext::EventContext& event_ctx = getContext(fd_ctx, event);// 获得对应事件的 EventContext
     // EventContext的成员应该都为空
     SY_ASSERT(!event_ctx.scheduler
                 && !event_ctx.fiber
@@ -355,6 +974,10 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
 
     // 获得当前调度器
     event_ctx.scheduler = Scheduler::GetThis();
+    // 每线程reactor模式：事件触发后回到fd所属的线程执行
+    if(m_perThreadReactor && event_ctx.scheduler == this) {
+        event_ctx.thread = getWorkerThreadId(fd_ctx->owner);
+    }
     // 如果有回调就执行回调，没有就执行该协程
     if(cb) {
         event_ctx.cb.swap(cb);
@@ -366,17 +989,99 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
     return 0;
 }
 
+int IOManager::waitEvent(int fd, Event event, uint64_t timeout) {
+    FdContext* fd_ctx = getFdContext(fd, true);
+    if(SY_UNLIKELY(!fd_ctx)) {
+        errno = EBADF;
+        return -1;
+    }
+    FdContext::Deadline& dl = getDeadline(fd_ctx, event);
+    bool arm = false;
+    {
+        FdContext::MutexType::Lock lock(fd_ctx->mutex);
+        if(addEventLocked(fd_ctx, event, nullptr)) {
+            return -1;
+        }
+        dl.timedOut = false;
+        dl.when = ~0ull;
+        if(timeout != ~0ull) {
+            dl.when = GetCurrentMS() + timeout;
+            // 节点还挂在本IOManager的时间轮上并且不晚于新的超时时间点，到期时会重新挂上，不需要操作时间轮
+            if(!dl.armed || dl.owner != m_id || dl.armedAt > dl.when) {
+                arm = true;
+                dl.armed = true;
+                dl.armedAt = dl.when;
+                dl.iom = this;
+                dl.owner = m_id;
+                dl.ctx = fd_ctx;
+                dl.event = event;
+            }
+        }
+    }
+    // 到期回调会加fd的锁，所以在锁外操作时间轮
+    if(arm) {
+        addTimer(dl.timer, timeout, &IOManager::OnDeadline, &dl);
+    }
+
+    // 只有两种情况会从这回来：
+    // 1) 超时了，OnDeadline取消事件唤醒回来
+    // 2) 事件就绪或者被cancelEvent/cancelAll取消
+    Fiber::GetThis()->yield();
+    if(dl.timedOut) {
+        errno = ETIMEDOUT;
+        return -1;
+    }
+    return 0;
+}
+
+uint64_t IOManager::OnDeadline(void* arg) {
+    FdContext::Deadline* dl = (FdContext::Deadline*)arg;
+    FdContext* fd_ctx = dl->ctx;
+    FdContext::MutexType::Lock lock(fd_ctx->mutex);
+    // 等待已经结束，节点不再挂上
+    if(dl->when == ~0ull || !(fd_ctx->events & dl->event)) {
+        dl->armed = false;
+        return 0;
+    }
+    // 节点挂上之后等待被续期了，按新的超时时间点重新挂上
+    if(dl->when > GetCurrentMS()) {
+        dl->armedAt = dl->when;
+        return dl->when;
+    }
+    // 超时，取消事件唤醒等待的协程
+    dl->armed = false;
+    dl->timedOut = true;
+    dl->iom->cancelEventLocked(fd_ctx, (Event)dl->event);
+    return 0;
+}
+
 // 删除事件：不会触发事件
 bool IOManager::delEvent(int fd, Event event) {
-    RWMutexType::ReadLock lock(m_mutex);
-    if((int)m_fdContexts.size() <= fd) {
+    // 拿到 fd 对应的 FdContext
+    FdContext* fd_ctx = getFdContext(fd, false);
+    if(!fd_ctx) {
         return false;
     }
-    // 拿到 fd 对应的 FdContext
-    FdContext* fd_ctx = m_fdContexts[fd];
-    lock.unlock();
 
     FdContext::MutexType::Lock lock2(fd_ctx->mutex);
+    return delEventLocked(fd_ctx, event);
+}
+
+bool IOManager::delEventIf(int fd, Event event, const std::function<bool(const std::function<void()>&)>& pred) {
+    FdContext* fd_ctx = getFdContext(fd, false);
+    if(!fd_ctx) {
+        return false;
+    }
+
+    FdContext::MutexType::Lock lock2(fd_ctx->mutex);
+    if(!(fd_ctx->events & event) || !pred(getContext(fd_ctx, event).cb)) {
+        return false;
+    }
+    return delEventLocked(fd_ctx, event);
+}
+
+bool IOManager::delEventLocked(FdContext* fd_ctx, Event event) {
+    int fd = fd_ctx->getFd();
     // 若没有要删除的事件
     if (!(fd_ctx->events & event)) {
         return false;
@@ -390,9 +1095,10 @@ bool IOManager::delEvent(int fd, Event event) {
     epevent.data.ptr = fd_ctx;// ptr 关联 fd_ctx
 
     // 注册事件
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
+    int epfd = getEpfd(fd_ctx);
+    int rt = epoll_ctl(epfd, op, fd, &epevent);
     if(rt) {
-        SY_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
+        SY_LOG_ERROR(g_logger) << "epoll_ctl(" << epfd << ", "
             << (EpollCtlOp)op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
             << rt << " (" << errno << ") (" << strerror(errno) << ")";
         return false;
@@ -402,23 +1108,36 @@ bool IOManager::delEvent(int fd, Event event) {
     --m_pendingEventCount;
     // 更新事件
     fd_ctx->events = new_events;
-    FdContext::EventContext& event_ctx = fd_ctx->getContext(event);// 拿到对应事件的EventContext
-    fd_ctx->resetContext(event_ctx);// 重置EventContext
+    FdContext::EventContext& event_ctx = getContext(fd_ctx, event);// 拿到对应事件的EventContext
+    resetContext(event_ctx);// 重置EventContext
+    getDeadline(fd_ctx, event).when = ~0ull;
     return true;
 }
 
 // 取消事件：如果该事件被注册过回调，那就触发一次回调事件
 bool IOManager::cancelEvent(int fd, Event event) {
-    RWMutexType::ReadLock lock(m_mutex);
-    if((int)m_fdContexts.size() <= fd) {
+    FdContext* fd_ctx = getFdContext(fd, false);
+    if(!fd_ctx) {
         return false;
     }
-    FdContext* fd_ctx = m_fdContexts[fd];
-    lock.unlock();
 
     FdContext::MutexType::Lock lock2(fd_ctx->mutex);
+    return cancelEventLocked(fd_ctx, event);
+}
+
+bool IOManager::cancelEventLocked(FdContext* fd_ctx, Event event) {
+    int fd = fd_ctx->getFd();
+    // io_uring模式下等待中的请求被取消后以-ECANCELED完成，唤醒等待的协程
+    bool uring_cancelled = false;
+    if(m_uring) {
+        UringRequest* req = event == READ ? fd_ctx->uringRead : fd_ctx->uringWrite;
+        if(req) {
+            uringCancel(req->index, req->key);
+            uring_cancelled = true;
+        }
+    }
     if(SY_UNLIKELY(!(fd_ctx->events & event))) {
-        return false;
+        return uring_cancelled;
     }
 
     // 删除事件
@@ -428,16 +1147,17 @@ bool IOManager::cancelEvent(int fd, Event event) {
     epevent.events = EPOLLET | new_events;
     epevent.data.ptr = fd_ctx;
 
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
+    int epfd = getEpfd(fd_ctx);
+    int rt = epoll_ctl(epfd, op, fd, &epevent);
     if(rt) {
-        SY_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
+        SY_LOG_ERROR(g_logger) << "epoll_ctl(" << epfd << ", "
             << (EpollCtlOp)op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
             << rt << " (" << errno << ") (" << strerror(errno) << ")";
         return false;
     }
 
     // 删除之前触发一次事件
-    fd_ctx->triggerEvent(event);
+    triggerEvent(fd_ctx, event);
     // 活跃事件数减1
     --m_pendingEventCount;
     return true;
@@ -445,16 +1165,25 @@ bool IOManager::cancelEvent(int fd, Event event) {
 
 // 取消所有事件：所有被注册的回调事件在cancel之前都会被执行一次
 bool IOManager::cancelAll(int fd) {
-    RWMutexType::ReadLock lock(m_mutex);
-    if((int)m_fdContexts.size() <= fd) {
+    FdContext* fd_ctx = getFdContext(fd, false);
+    if(!fd_ctx) {
         return false;
     }
-    FdContext* fd_ctx = m_fdContexts[fd];
-    lock.unlock();
 
     FdContext::MutexType::Lock lock2(fd_ctx->mutex);
+    bool uring_cancelled = false;
+    if(m_uring) {
+        for(UringRequest* req : {fd_ctx->uringRead, fd_ctx->uringWrite}) {
+            if(req) {
+                uringCancel(req->index, req->key);
+                uring_cancelled = true;
+            }
+        }
+    }
     if(!fd_ctx->events) {
-        return false;
+        // fd即将关闭或者不再使用，解除线程归属，fd号被复用时重新分配
+        fd_ctx->owner = -1;
+        return uring_cancelled;
     }
 
     // 删除全部事件
@@ -463,9 +1192,10 @@ bool IOManager::cancelAll(int fd) {
     epevent.events = 0;
     epevent.data.ptr = fd_ctx;
 
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
+    int epfd = getEpfd(fd_ctx);
+    int rt = epoll_ctl(epfd, op, fd, &epevent);
     if(rt) {
-        SY_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
+        SY_LOG_ERROR(g_logger) << "epoll_ctl(" << epfd << ", "
             << (EpollCtlOp)op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
             << rt << " (" << errno << ") (" << strerror(errno) << ")";
         return false;
@@ -474,21 +1204,27 @@ bool IOManager::cancelAll(int fd) {
     // 触发全部已注册的事件
     // 有读事件执行读事件
     if(fd_ctx->events & READ) {
-        fd_ctx->triggerEvent(READ);
+        triggerEvent(fd_ctx, READ);
         --m_pendingEventCount;
     }
     // 有写事件执行写事件
     if(fd_ctx->events & WRITE) {
-        fd_ctx->triggerEvent(WRITE);
+        triggerEvent(fd_ctx, WRITE);
         --m_pendingEventCount;
     }
 
     SY_ASSERT(fd_ctx->events == 0);
+    fd_ctx->owner = -1;
     return true;
 }
 
-void IOManager::onTimerInsertedAtFront() {
-    tickle();
+// 线程时间轮只需要唤醒它所属的线程
+void IOManager::onTimerInsertedAtFront(int wheel) {
+    if(wheel < 0) {
+        tickle();
+    } else {
+        tickleWorker(wheel);
+    }
 }
 
 }
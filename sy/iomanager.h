@@ -1,13 +1,39 @@
 #ifndef __SY_IOMANAGER_H__
 #define __SY_IOMANAGER_H__
 
+#include "fd_manager.h"
 #include "scheduler.h"
 #include "timer.h"
 
+struct epoll_event;
+struct io_uring_sqe;
+
 namespace sy {
 
+class IoUring;
+
+// io_uring模式下的一次IO请求，对象在等待的协程栈上，协程一定等到它的完成事件才返回
+struct UringRequest {
+    // 等待的协程
+    Fiber::ptr fiber;
+    // 协程所在的线程id，完成后调度回该线程
+    int thread = -1;
+    // 提交到哪个线程的ring
+    int index = -1;
+    // 操作结果，失败为-errno
+    int res = 0;
+    // 取消时使用的user_data
+    uint64_t key = 0;
+};
+
 // IO协程调度器
 // 继承TimerManager类的所有方法，从而可以管理定时器
+// 两种reactor模式，由配置iomanager.per_thread_reactor决定：
+// 1. 共享epoll(默认)：所有线程共用一个epoll，fd的事件可能在任意线程上处理
+// 2. 每线程reactor：每个IO线程一个epoll，fd归属于某个线程，它的事件和等待它的协程都只在该线程上执行，
+//    跨线程投递的任务进入目标线程的指定任务队列，再通过目标线程的邮箱(eventfd)唤醒它
+// 配置iomanager.backend=io_uring且内核支持时，hook的socket IO不再走epoll就绪通知，
+// 而是提交到当前线程的io_uring上直接完成，内核不支持时回退到epoll
 class IOManager : public Scheduler, public TimerManager {
 public:
     typedef std::shared_ptr<IOManager> ptr;
@@ -24,45 +50,13 @@ public:
         WRITE   = 0x4,
     };
 private:
-    // socket fd上下文类
-    // 每个socket fd都对应一个FdContext，包括fd的值，fd上的事件，以及fd的读写事件上下文
-    struct FdContext {
-        typedef Mutex MutexType;
-        // 事件上下文类
-        // fd的每个事件都有一个事件上下文，保存这个事件的回调函数以及执行回调函数的调度器
-        struct EventContext {
-            // 执行事件的调度器
-            Scheduler* scheduler = nullptr;
-            // 事件协程
-            Fiber::ptr fiber;
-            /// 事件执行的回调函数
-            std::function<void()> cb;
-        };
-
-        // 获取事件上下文：event 事件类型，返回对应事件的上下文
-        EventContext& getContext(Event event);
-
-        // 重置事件上下文：ctx 待重置的事件上下文对象
-        void resetContext(EventContext& ctx);
-
-        // 触发事件：根据事件类型调用对应上下文结构中的调度器去调度回调协程或回调函数
-        void triggerEvent(Event event);
-
-        // 读事件上下文
-        EventContext read;
-        // 写事件上下文
-        EventContext write;
-        // 事件关联的句柄
-        int fd = 0;
-        // 该fd添加了哪些事件的回调函数，或者说该fd已经注册的事件
-        Event events = NONE;
-        // 事件的Mutex
-        MutexType mutex;
-    };
+    // 每个fd的记录，和hook的FdCtx是同一条，由FdManager的无锁分段表分配
+    typedef FdCtx FdContext;
 
 public:
     // 构造函数：threads 线程数量，use_caller 是否将调用线程包含进去，name 调度器的名称
-    IOManager(size_t threads = 1, bool use_caller = true, const std::string& name = "");
+    IOManager(size_t threads = 1, bool use_caller = true, const std::string& name = ""
+              ,const ThreadAffinity& affinity = ThreadAffinity());
 
     // 析构函数
     ~IOManager();
@@ -70,9 +64,21 @@ public:
     // 添加事件:添加成功返回0,失败返回-1
     int addEvent(int fd, Event event, std::function<void()> cb = nullptr);
 
+    // 同addEvent，但fd上已经注册了该事件(其他协程在等待)时不断言，返回-1，errno为EEXIST
+    int tryAddEvent(int fd, Event event, std::function<void()> cb);
+
+    // 当前协程等待fd上的event事件，timeout为超时时间(毫秒，~0ull不超时)
+    // 事件就绪或者被cancelEvent/cancelAll取消返回0；超时返回-1，errno为ETIMEDOUT；添加事件失败返回-1
+    // 超时检查使用fd记录里懒删除的定时器节点，等待过程不分配内存，提前结束时也不需要取消定时器
+    int waitEvent(int fd, Event event, uint64_t timeout);
+
     // 删除事件:不会触发事件
     bool delEvent(int fd, Event event);
 
+    // 只在当前注册的回调满足pred时删除事件，用于删除自己注册的事件：
+    // 自己的事件已经触发、随后被其他协程重新注册时，不会误删别人的
+    bool delEventIf(int fd, Event event, const std::function<bool(const std::function<void()>&)>& pred);
+
     // 取消事件:如果事件存在则触发事件
     bool cancelEvent(int fd, Event event);
 
@@ -81,28 +87,183 @@ public:
 
     // 返回当前的IOManager
     static IOManager* GetThis();
+
+    // 是否每线程reactor模式
+    bool isPerThreadReactor() const { return m_perThreadReactor;}
+
+    // 承载fd的IO线程序号范围[begin, end)：use_caller时不含caller线程(它只在stop时才调度)，只有一个线程时就是它
+    // 新fd的归属(assignFd)和服务器reuseport的每线程socket都只分配在这个范围里
+    void getReactorThreadRange(size_t& begin, size_t& end) const;
+
+    // getReactorThreadRange范围内的IO线程数
+    size_t getReactorThreadCount() const;
+
+    // 等getReactorThreadRange范围内的IO线程都进入run，按序号返回它们的线程id
+    // 有线程在timeout_ms毫秒内没有启动时返回false
+    bool waitReactorThreads(std::vector<int>& threads, uint64_t timeout_ms = 1000) const;
+
+    // 每线程reactor模式下为fd分配所属的IO线程，已分配的直接返回，返回线程序号；共享epoll模式返回-1
+    int assignFd(int fd);
+
+    // 把cb调度到fd所属的IO线程上执行(没有归属时先分配)，共享epoll模式下等同于schedule(cb)
+    void scheduleFd(int fd, std::function<void()> cb);
+
+    // 是否使用io_uring
+    bool isUring() const { return m_uring;}
+
+    // 当前使用的IO后端名称
+    const char* getBackendName() const;
+
+    // 填写io_uring操作的回调，返回false表示该操作不能直接提交，只等待fd就绪
+    typedef bool (*UringPrep)(io_uring_sqe* sqe, void* arg);
+
+    // io_uring模式下在当前线程的ring上等待fd就绪(event)，prep不为空时就绪后紧接着执行prep填写的操作(IOSQE_IO_LINK)
+    // 当前协程挂起，直到操作完成、超时(timeout毫秒，~0ull不超时)或被cancelEvent/cancelAll取消
+    // 返回操作的结果，失败返回-errno，超时返回-ETIMEDOUT，被取消返回-ECANCELED
+    // 只能在本IOManager的调度线程的协程中调用；提交在本轮idle时批量进行
+    int uringIo(int fd, Event event, uint64_t timeout, UringPrep prep, void* arg);
+
+    // 输出调度器状态，包括tickle统计
+    std::ostream& dump(std::ostream& os) override;
+
+    // tickle被调用的次数
+    uint64_t getTickleRequested() const { return m_tickleRequested;}
+
+    // 真正写eventfd/pipe唤醒线程的次数
+    uint64_t getTickleSent() const { return m_tickleSent;}
 protected:
     void tickle() override;
+    void tickleWorker(int index) override;
     bool stopping() override;
     void idle() override;
-    void onTimerInsertedAtFront() override;
+    void onTimerInsertedAtFront(int wheel) override;
+    int getCurrentWheel() override { return getWorkerIndex();}
+    // io_uring后端的请求和超时节点放在协程栈上，并且内核直接写入栈上的缓冲区
+    bool supportSharedStack() const override { return !m_uring;}
+    // 每线程reactor和io_uring模式下fd和定时器按线程序号归属，线程不能退出
+    bool supportElastic() const override { return !m_perThreadReactor && !m_uring;}
+
+    // 获取fd对应的FdContext，无锁；auto_create为true时所在的段不存在就分配，否则返回nullptr
+    FdContext* getFdContext(int fd, bool auto_create) {
+        return FdMgr::GetInstance()->lookup(fd, auto_create);
+    }
+
+    // 获取事件上下文：event 事件类型，返回对应事件的上下文
+    FdContext::EventContext& getContext(FdContext* fd_ctx, Event event);
 
-    // 重置socket句柄上下文的容器大小
-    void contextResize(size_t size);
+    // 重置事件上下文：ctx 待重置的事件上下文对象
+    void resetContext(FdContext::EventContext& ctx);
+
+    // 触发事件：根据事件类型调用对应上下文结构中的调度器去调度回调协程或回调函数，调用时需持有fd_ctx->mutex
+    // batch不为空时，等待者属于本调度器的任务先放进batch，由调用者一次性入队
+    void triggerEvent(FdContext* fd_ctx, Event event, Batch* batch = nullptr);
+
+    // 获取事件的超时状态
+    FdContext::Deadline& getDeadline(FdContext* fd_ctx, Event event);
+
+    // 添加事件，调用时需持有fd_ctx->mutex
+    int addEventLocked(FdContext* fd_ctx, Event event, std::function<void()> cb);
+
+    // 取消事件，调用时需持有fd_ctx->mutex
+    bool cancelEventLocked(FdContext* fd_ctx, Event event);
+
+    // 删除事件，调用时需持有fd_ctx->mutex
+    bool delEventLocked(FdContext* fd_ctx, Event event);
+
+    // waitEvent的超时回调，在收割定时器的线程上执行
+    static uint64_t OnDeadline(void* arg);
+
+    // fd注册在哪个epoll上，调用时需持有fd_ctx->mutex
+    int getEpfd(FdContext* fd_ctx) const;
+
+    // 轮询选择一个IO线程作为新fd的归属，use_caller时尽量不选caller线程(它只在stop时才调度)
+    int pickOwner();
+
+    // 每线程reactor模式的idle：阻塞在本线程自己的epoll上
+    void idleReactor();
+
+    // io_uring模式的idle：提交本线程积累的sqe并等待完成事件
+    void idleUring();
+
+    // 处理本线程ring上的完成事件，唤醒的任务放入batch，返回任务数
+    size_t reapUring(int index, epoll_event* events, int max_events, Batch& batch);
+
+    // 在index线程的ring上提交一个取消请求
+    void uringCancel(int index, uint64_t user_data);
+
+    // 在ring上挂一个对fd的单次poll，完成事件的user_data为tag
+    void uringArm(int index, int fd, uint64_t tag);
+
+    // 阻塞在epfd上等待事件，timeout为下一个定时器的超时时间，最多等待5秒
+    int waitEvents(int epfd, epoll_event* events, int max_events, uint64_t timeout);
+
+    // 把所有已超时的定时器回调放入batch，返回任务数
+    size_t scheduleExpiredTimers(Batch& batch);
+
+    // 处理epoll_wait返回的事件，唤醒的任务放入batch，返回任务数；notify_fd为唤醒用的句柄，读到时把notified置为true
+    size_t dispatchEvents(int epfd, epoll_event* events, int n, int notify_fd, bool& notified, Batch& batch);
 
     // 判断是否可以停止:timeout 最近要出发的定时器事件间隔
     bool stopping(uint64_t& timeout);
+
+    // 当前线程挂起在自己的eventfd上，直到被唤醒或超时
+    void park(int index);
+
+    // 从挂起列表中取出一个线程并唤醒，没有挂起线程返回false
+    bool unparkOne();
+
+    // 唤醒指定线程，该线程没有挂起返回false
+    bool unpark(int index);
+
+    // 唤醒全部挂起的线程
+    void unparkAll();
+
+    // 唤醒正在epoll_wait的线程，已经有未处理的唤醒时不再重复写pipe
+    bool wakePoller();
 private:
+    // 每个调度线程的唤醒器
+    struct Waker {
+        // 线程挂起时等待的eventfd
+        int eventFd = -1;
+        // 是否在挂起列表中
+        bool parked = false;
+        // 每线程reactor模式下本线程的epoll，eventFd也注册在上面，作为本线程的邮箱
+        int epfd = -1;
+        // io_uring模式下本线程的ring
+        IoUring* ring = nullptr;
+        // 保护ring的提交队列，其他线程只会提交取消请求
+        Spinlock ringMutex;
+    };
     // epoll 文件句柄
     int m_epfd = 0;
     // pipe 文件句柄，fd[0]读端，fd[1]写端
     int m_tickleFds[2];
     // 当前等待执行的IO事件数量
     std::atomic<size_t> m_pendingEventCount = {0};
-    // IOManager的Mutex
-    RWMutexType m_mutex;
-    // socket事件上下文的容器
-    std::vector<FdContext*> m_fdContexts;
+    // 同一时刻只有一个线程阻塞在epoll_wait上(poller)，其余空闲线程挂起在各自的eventfd上(follower)
+    // 新任务到来时只唤醒一个follower，没有follower时才唤醒poller
+    // 当前epoll_wait的线程序号，-1表示没有
+    std::atomic<int> m_poller = {-1};
+    // poller是否已经被唤醒还未处理
+    std::atomic<bool> m_pollerNotified = {false};
+    // 每个调度线程的唤醒器，下标为线程序号
+    std::vector<Waker*> m_wakers;
+    // 挂起的线程序号
+    std::vector<int> m_parked;
+    // 保护m_parked和Waker::parked
+    Spinlock m_parkMutex;
+    // tickle被调用的次数
+    std::atomic<uint64_t> m_tickleRequested = {0};
+    // 真正唤醒线程的次数
+    std::atomic<uint64_t> m_tickleSent = {0};
+    // 是否每线程reactor模式，构造时确定
+    bool m_perThreadReactor = false;
+    // 是否使用io_uring，构造时确定
+    bool m_uring = false;
+    // 轮询分配fd归属的计数
+    std::atomic<uint32_t> m_nextOwner = {0};
+    // 本IOManager的id，用来识别fd记录里的超时节点是谁挂上的
+    uint64_t m_id;
 };
 
 }
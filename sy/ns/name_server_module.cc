@@ -273,8 +273,9 @@ void NameServerModule::set(sy::RockStream::ptr rs, NSClientInfo::ptr new_value)
         }
     }
 
+    // 通知扇出是后台任务，用低优先级，不拖慢请求处理
     //sy::WorkerMgr::GetInstance()->schedule("notify",
-    //        std::bind(&NameServerModule::doNotify, this, ds, nty));
+    //        std::bind(&NameServerModule::doNotify, this, ds, nty), -1, sy::Scheduler::LOW);
 
     sy::RWMutex::WriteLock lock(m_mutex);
     if(new_value) {
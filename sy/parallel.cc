@@ -0,0 +1,150 @@
+// 协程池并行算法的实现
+#include "parallel.h"
+#include "fiber_sync.h"
+#include "macro.h"
+#include "worker.h"
+#include <atomic>
+#include <memory>
+
+namespace sy {
+
+ParallelOptions::ParallelOptions(const std::string& worker, uint32_t c)
+    :scheduler(WorkerMgr::GetInstance()->get(worker).get())
+    ,concurrency(c) {
+}
+
+// 默认的辅助任务数
+static size_t GetHelpers(const ParallelOptions& opts) {
+    Scheduler* s = opts.getScheduler();
+    if(!s) {
+        return 0;
+    }
+    if(opts.concurrency) {
+        return opts.concurrency;
+    }
+    size_t n = s->getWorkerCount();
+    // 调用者自己占用了一个调度线程
+    return Scheduler::GetThis() == s && n ? n - 1 : n;
+}
+
+size_t ParallelOptions::getWidth() const {
+    return GetHelpers(*this) + 1;
+}
+
+namespace {
+
+// 一次并行执行的共享状态，由调用者和辅助任务共同持有
+// 辅助任务可能在所有分块都执行完之后才开始，这时领不到分块直接退出，不会访问已经返回的调用者
+struct ParallelJob {
+    const std::function<void(size_t, size_t)>* body = nullptr;
+    size_t begin = 0;
+    size_t count = 0;
+    size_t grain = 1;
+    size_t width = 1;
+    // 下一个没有领取的元素(相对begin)
+    std::atomic<size_t> next = {0};
+    // 已经执行完的元素数
+    std::atomic<size_t> done = {0};
+
+    // 以下由mutex保护
+    Spinlock mutex;
+    bool finished = false;
+    // 在协程里等待的调用者
+    FiberWaiter* waiter = nullptr;
+    // 不在协程里的调用者阻塞在信号量上
+    Semaphore sem;
+
+    // 领取一块，没有剩余时返回false
+    bool grab(size_t& b, size_t& e) {
+        size_t cur = next.load(std::memory_order_relaxed);
+        while(cur < count) {
+            size_t chunk = std::max(grain, (count - cur) / (width * 2));
+            size_t end = std::min(count, cur + chunk);
+            if(next.compare_exchange_weak(cur, end)) {
+                b = cur;
+                e = end;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // 领取并执行分块，直到没有剩余
+    void work() {
+        size_t b = 0;
+        size_t e = 0;
+        while(grab(b, e)) {
+            (*body)(begin + b, begin + e);
+            if(done.fetch_add(e - b) + (e - b) == count) {
+                finish();
+            }
+        }
+    }
+
+    // 最后一块执行完，唤醒调用者
+    void finish() {
+        FiberWaiter* w = nullptr;
+        {
+            Spinlock::Lock lock(mutex);
+            finished = true;
+            w = waiter;
+            waiter = nullptr;
+        }
+        if(w) {
+            w->wake();
+        }
+        sem.notify();
+    }
+
+    // 调用者等待所有分块执行完
+    void wait() {
+        // 在调度器的任务协程里挂起协程，共享栈协程不能把栈上的节点交给别人，只能阻塞线程
+        if(Scheduler::GetTaskStartUs() && !Fiber::GetThis()->isSharedStack()) {
+            FiberWaiter w;
+            {
+                Spinlock::Lock lock(mutex);
+                if(finished) {
+                    return;
+                }
+                waiter = &w;
+            }
+            FiberSync::Park();
+            return;
+        }
+        sem.wait();
+    }
+};
+
+}
+
+void ParallelForRange(size_t begin, size_t end, const std::function<void(size_t, size_t)>& f
+                      ,const ParallelOptions& opts) {
+    if(end <= begin) {
+        return;
+    }
+    size_t count = end - begin;
+    size_t helpers = GetHelpers(opts);
+    size_t width = helpers + 1;
+    size_t grain = opts.grain ? opts.grain : std::max<size_t>(1, count / (width * 32));
+    // 分块数不够时少起辅助任务
+    helpers = std::min(helpers, (count + grain - 1) / grain - 1);
+    if(helpers == 0) {
+        f(begin, end);
+        return;
+    }
+
+    std::shared_ptr<ParallelJob> job = std::make_shared<ParallelJob>();
+    job->body = &f;
+    job->begin = begin;
+    job->count = count;
+    job->grain = grain;
+    job->width = helpers + 1;
+    std::vector<std::function<void()> > tasks(helpers, [job]() {
+        job->work();
+    });
+    opts.getScheduler()->schedule(tasks.begin(), tasks.end(), opts.priority);
+    job->work();
+    job->wait();
+}
+
+}
@@ -0,0 +1,146 @@
+// 协程池上的并行算法：ParallelFor, ParallelReduce, ParallelTransform, ParallelSort
+#ifndef __SY_PARALLEL_H__
+#define __SY_PARALLEL_H__
+
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <string>
+#include <utility>
+#include <vector>
+#include "mutex.h"
+#include "scheduler.h"
+
+namespace sy {
+
+// 并行算法的执行参数
+struct ParallelOptions {
+    // 执行辅助任务的调度器，为空时用当前线程的调度器，都没有时由调用者串行执行
+    Scheduler* scheduler = nullptr;
+    // 最多同时执行的辅助任务数(不含调用者自己)，0表示调度线程数(调用者是该调度器的线程时减一)
+    uint32_t concurrency = 0;
+    // 每次领取的最少元素数，0表示自动(元素数 / (并行度 × 32))
+    size_t grain = 0;
+    // 辅助任务的优先级，后台的数据任务可以用LOW
+    Scheduler::Priority priority = Scheduler::NORMAL;
+
+    ParallelOptions() {}
+
+    ParallelOptions(Scheduler* s, uint32_t c = 0)
+        :scheduler(s)
+        ,concurrency(c) {
+    }
+
+    // 在WorkerMgr中名为worker的调度器上执行，不存在时由调用者串行执行
+    ParallelOptions(const std::string& worker, uint32_t c = 0);
+
+    // 实际使用的调度器
+    Scheduler* getScheduler() const { return scheduler ? scheduler : Scheduler::GetThis();}
+
+    // 并行度：辅助任务数加上调用者自己
+    size_t getWidth() const;
+};
+
+// 把[begin, end)分块并行执行f(块的begin, 块的end)，所有块执行完后返回
+// 调用者自己也领取分块，所以在调度器的协程里调用时，即使调度器的其他线程都在忙也能完成
+// 分块大小随剩余元素数递减(剩余数 / (并行度 × 2)，不小于grain)：开始时块大，领取次数少，结尾时块小，负载均衡
+// 在调度器的协程里调用时挂起协程等待，否则阻塞线程等待
+void ParallelForRange(size_t begin, size_t end, const std::function<void(size_t, size_t)>& f
+                      ,const ParallelOptions& opts = ParallelOptions());
+
+// 并行执行f(i)，i属于[begin, end)
+template<class F>
+void ParallelFor(size_t begin, size_t end, F f, const ParallelOptions& opts = ParallelOptions()) {
+    ParallelForRange(begin, end, [&f](size_t b, size_t e) {
+        for(size_t i = b; i < e; ++i) {
+            f(i);
+        }
+    }, opts);
+}
+
+// 并行归约：每块从identity开始依次 v = reduce(v, map(i))，再按块的顺序把各块的结果归约起来
+// reduce需要满足结合律，不要求交换律，结果和串行执行的顺序一致
+template<class T, class Map, class Reduce>
+T ParallelReduce(size_t begin, size_t end, const T& identity, Map map, Reduce reduce
+                 ,const ParallelOptions& opts = ParallelOptions()) {
+    typedef std::pair<size_t, T> Part;
+    std::vector<Part> parts;
+    Spinlock mutex;
+    ParallelForRange(begin, end, [&](size_t b, size_t e) {
+        T v = identity;
+        for(size_t i = b; i < e; ++i) {
+            v = reduce(v, map(i));
+        }
+        Spinlock::Lock lock(mutex);
+        parts.push_back(Part(b, std::move(v)));
+    }, opts);
+    std::sort(parts.begin(), parts.end(), [](const Part& a, const Part& b) {
+        return a.first < b.first;
+    });
+    T rt = identity;
+    for(auto& i : parts) {
+        rt = reduce(rt, i.second);
+    }
+    return rt;
+}
+
+// 并行执行 *(out + i) = f(*(first + i))，迭代器需要支持随机访问，返回输出的结束位置
+template<class InputIt, class OutputIt, class F>
+OutputIt ParallelTransform(InputIt first, InputIt last, OutputIt out, F f
+                           ,const ParallelOptions& opts = ParallelOptions()) {
+    size_t n = std::distance(first, last);
+    ParallelForRange(0, n, [&](size_t b, size_t e) {
+        std::transform(first + b, first + e, out + b, f);
+    }, opts);
+    return out + n;
+}
+
+// 每段少于这么多元素时不值得并行排序
+static const size_t PARALLEL_SORT_MIN_PART = 4096;
+
+// 并行排序(不稳定)：按并行度分段，各段并行std::sort，再逐轮并行地两两归并相邻的段
+template<class RandomIt, class Compare>
+void ParallelSort(RandomIt first, RandomIt last, Compare comp
+                  ,const ParallelOptions& opts = ParallelOptions()) {
+    size_t n = std::distance(first, last);
+    size_t parts = std::min(opts.getWidth(), n / PARALLEL_SORT_MIN_PART);
+    if(parts <= 1) {
+        std::sort(first, last, comp);
+        return;
+    }
+    std::vector<size_t> bounds(parts + 1);
+    for(size_t i = 0; i <= parts; ++i) {
+        bounds[i] = n * i / parts;
+    }
+    // 每个分段是一个整体，不再细分
+    ParallelOptions o = opts;
+    o.grain = 1;
+    ParallelForRange(0, parts, [&](size_t b, size_t e) {
+        for(size_t i = b; i < e; ++i) {
+            std::sort(first + bounds[i], first + bounds[i + 1], comp);
+        }
+    }, o);
+    for(size_t width = 1; width < parts; width *= 2) {
+        size_t pairs = (parts + width * 2 - 1) / (width * 2);
+        ParallelForRange(0, pairs, [&](size_t b, size_t e) {
+            for(size_t i = b; i < e; ++i) {
+                size_t lo = i * width * 2;
+                size_t mid = std::min(lo + width, parts);
+                size_t hi = std::min(lo + width * 2, parts);
+                if(mid < hi) {
+                    std::inplace_merge(first + bounds[lo], first + bounds[mid]
+                                       ,first + bounds[hi], comp);
+                }
+            }
+        }, o);
+    }
+}
+
+template<class RandomIt>
+void ParallelSort(RandomIt first, RandomIt last, const ParallelOptions& opts = ParallelOptions()) {
+    ParallelSort(first, last, std::less<typename std::iterator_traits<RandomIt>::value_type>(), opts);
+}
+
+}
+
+#endif
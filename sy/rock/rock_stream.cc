@@ -2,6 +2,8 @@
 #include "sy/log.h"
 #include "sy/config.h"
 #include "sy/worker.h"
+#include "sy/future.h"
+#include <algorithm>
 
 namespace sy {
 
@@ -225,6 +227,58 @@ RockResult::ptr RockSDLoadBalance::request(const std::string& domain, const std:
     if(!conn) {
         return std::make_shared<RockResult>(ILoadBalance::NO_CONNECTION, 0, nullptr, req);
     }
+    return DoRequest(conn, req, timeout_ms);
+}
+
+RockResult::ptr RockSDLoadBalance::requestAny(const std::string& domain, const std::string& service,
+                                              RockRequest::ptr req, uint32_t timeout_ms, uint32_t fanout) {
+    auto lb = get(domain, service);
+    if(!lb) {
+        return std::make_shared<RockResult>(ILoadBalance::NO_SERVICE, 0, nullptr, req);
+    }
+    // 随机取fanout个不同的连接，连接数不够时取到多少是多少
+    std::vector<LoadBalanceItem::ptr> conns;
+    for(uint32_t i = 0; i < fanout * 2 && conns.size() < fanout; ++i) {
+        auto conn = lb->get();
+        if(conn && std::find(conns.begin(), conns.end(), conn) == conns.end()) {
+            conns.push_back(conn);
+        }
+    }
+    if(conns.empty()) {
+        return std::make_shared<RockResult>(ILoadBalance::NO_CONNECTION, 0, nullptr, req);
+    }
+    if(conns.size() == 1) {
+        return DoRequest(conns[0], req, timeout_ms);
+    }
+    // 不在调度器里(没有地方跑并发的协程)或者在共享栈协程里(不能等待Future)时逐个请求
+    sy::Scheduler* sc = sy::Scheduler::GetThis();
+    if(!sc || sy::Fiber::GetThis()->isSharedStack()) {
+        RockResult::ptr r;
+        for(auto& conn : conns) {
+            r = DoRequest(conn, req, timeout_ms);
+            if(r->result == 0) {
+                break;
+            }
+        }
+        return r;
+    }
+
+    // 每个连接一个协程，第一个成功的设置结果；慢的请求在后台跑完，只记统计
+    sy::Promise<RockResult::ptr> promise;
+    auto failed = std::make_shared<std::atomic<size_t> >(0);
+    size_t total = conns.size();
+    for(auto& conn : conns) {
+        sc->schedule([promise, failed, total, conn, req, timeout_ms]() mutable {
+            auto r = DoRequest(conn, req, timeout_ms);
+            if(r->result == 0 || ++*failed == total) {
+                promise.setValue(r);
+            }
+        });
+    }
+    return promise.getFuture().get();
+}
+
+RockResult::ptr RockSDLoadBalance::DoRequest(LoadBalanceItem::ptr conn, RockRequest::ptr req, uint32_t timeout_ms) {
     uint64_t ts = sy::GetCurrentMS();
     auto& stats = conn->get(ts / 1000);
     stats.incDoing(1);
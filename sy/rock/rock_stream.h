@@ -111,6 +111,13 @@ public:
     RockResult::ptr request(const std::string& domain, const std::string& service,
                              RockRequest::ptr req, uint32_t timeout_ms, uint64_t idx = -1);
 
+    // 同时向最多fanout个不同的连接发送同一个请求，返回最先成功的结果，全部失败时返回最后一个失败的结果
+    // 用重复请求换尾延迟，请求需要是幂等的；不在调度器里或在共享栈协程里时退化为逐个请求
+    RockResult::ptr requestAny(const std::string& domain, const std::string& service,
+                               RockRequest::ptr req, uint32_t timeout_ms, uint32_t fanout = 2);
+private:
+    // 在conn上发送请求并记录统计
+    static RockResult::ptr DoRequest(LoadBalanceItem::ptr conn, RockRequest::ptr req, uint32_t timeout_ms);
 };
 
 }
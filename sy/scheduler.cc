@@ -1,8 +1,16 @@
 // 协程调度器的实现
 #include "scheduler.h"
+#include "config.h"
 #include "log.h"
 #include "macro.h"
 #include "hook.h"
+#include <algorithm>
+#include <execinfo.h>
+#include <iterator>
+#include <signal.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 namespace sy {
 
@@ -12,12 +20,186 @@ static sy::Logger::ptr g_logger = SY_LOG_NAME("system");
 static thread_local Scheduler *t_scheduler = nullptr;
 // 当前线程的调度协程，每个线程都独有一份
 static thread_local Fiber *t_scheduler_fiber = nullptr;
+// 当前线程在调度器中的序号，对应m_queues的下标，非调度线程为-1
+static thread_local int t_worker_index = -1;
+// 窃取轮次，用于错开每次窃取的起始位置
+static thread_local uint32_t t_steal_round = 0;
+// 当前任务本次开始执行的时间，不在执行任务时为0
+static thread_local uint64_t t_task_start_us = 0;
+// 当前任务调用了YieldToQueue，切回调度协程后重新入队
+static thread_local bool t_yield_to_queue = false;
+// 当前任务的优先级
+static thread_local int t_task_priority = Scheduler::NORMAL;
+// 本线程各优先级在当前轮转周期里剩余可以取的任务数
+static thread_local uint32_t t_lane_credits[Scheduler::PRIORITY_COUNT] = {0};
+
+// 每个轮转周期各优先级最多取的任务数：有任务的优先级都用完额度后开始下一个周期
+static const uint32_t s_lane_weights[Scheduler::PRIORITY_COUNT] = {16, 4, 1};
+
+// 每个调度线程缓存的已结束回调协程数量，0表示不复用
+static ConfigVar<uint32_t>::ptr g_fiber_pool_size =
+    Config::Lookup("scheduler.fiber_pool_size", (uint32_t)64, "cached TERM fibers per scheduler thread");
+
+static std::atomic<uint32_t> s_fiber_pool_size = {64};
+
+// 排队延迟采样间隔：每个线程每入队N个任务记录一个的入队时间，1为全部记录，0为不统计
+// 入队读时钟的开销和入队本身相当，采样统计的分位数和全量统计一致
+static ConfigVar<uint32_t>::ptr g_queue_delay_sample =
+    Config::Lookup("scheduler.queue_delay_sample", (uint32_t)16, "sample 1/N scheduled tasks for queue delay histogram");
+
+static std::atomic<uint32_t> s_queue_delay_sample = {16};
+
+// 协程连续运行超过多少毫秒时由watchdog输出协程id和调用栈，0表示关闭(默认)
+// 抓调用栈要向工作线程发SIGURG，线程里正在进行的不可重启的阻塞调用(poll/epoll_wait/nanosleep等)会返回EINTR
+static ConfigVar<uint32_t>::ptr g_watchdog_ms =
+    Config::Lookup("scheduler.watchdog_ms", (uint32_t)0, "report fibers running longer than this(ms), 0 disable");
+
+static std::atomic<uint32_t> s_watchdog_ms = {0};
+
+// 弹性线程池的检查间隔
+static ConfigVar<uint32_t>::ptr g_elastic_interval_ms =
+    Config::Lookup("scheduler.elastic_interval_ms", (uint32_t)100, "elastic scheduler check interval(ms)");
+
+static std::atomic<uint32_t> s_elastic_interval_ms = {100};
+
+// 最多记录的已退出线程id数
+static const size_t MAX_RETIRED_THREADS = 1024;
+
+// 本线程的入队计数，用于排队延迟采样
+static thread_local uint32_t t_enqueue_seq = 0;
+
+struct _SchedulerIniter {
+    _SchedulerIniter() {
+        s_fiber_pool_size = g_fiber_pool_size->getValue();
+        g_fiber_pool_size->addListener([](const uint32_t& old_value, const uint32_t& new_value){
+            SY_LOG_INFO(g_logger) << "scheduler fiber pool size changed from "
+                                  << old_value << " to " << new_value;
+            s_fiber_pool_size = new_value;
+        });
+        s_queue_delay_sample = g_queue_delay_sample->getValue();
+        g_queue_delay_sample->addListener([](const uint32_t& old_value, const uint32_t& new_value){
+            SY_LOG_INFO(g_logger) << "scheduler queue delay sample changed from "
+                                  << old_value << " to " << new_value;
+            s_queue_delay_sample = new_value;
+        });
+        s_watchdog_ms = g_watchdog_ms->getValue();
+        g_watchdog_ms->addListener([](const uint32_t& old_value, const uint32_t& new_value){
+            SY_LOG_INFO(g_logger) << "scheduler watchdog ms changed from "
+                                  << old_value << " to " << new_value;
+            s_watchdog_ms = new_value;
+            if(new_value) {
+                Scheduler::StartWatchdog();
+            }
+        });
+        s_elastic_interval_ms = std::max<uint32_t>(g_elastic_interval_ms->getValue(), 1);
+        g_elastic_interval_ms->addListener([](const uint32_t& old_value, const uint32_t& new_value){
+            SY_LOG_INFO(g_logger) << "scheduler elastic interval ms changed from "
+                                  << old_value << " to " << new_value;
+            s_elastic_interval_ms = std::max<uint32_t>(new_value, 1);
+        });
+    }
+};
+
+// 需要记录入队时间时返回当前时间，否则返回0
+static uint64_t SampleEnqueueTime() {
+    uint32_t n = s_queue_delay_sample.load(std::memory_order_relaxed);
+    if(n == 0 || ++t_enqueue_seq % n) {
+        return 0;
+    }
+    return sy::GetMonotonicUS();
+}
+
+static _SchedulerIniter s_scheduler_initer;
+
+// watchdog检查的调度器，进程退出时watchdog线程可能还在运行，不析构
+struct _WatchdogRegistry {
+    Mutex mutex;
+    std::vector<Scheduler*> schedulers;
+    Thread::ptr thread;
+};
+
+static _WatchdogRegistry* GetWatchdogRegistry() {
+    static _WatchdogRegistry* s_registry = new _WatchdogRegistry;
+    return s_registry;
+}
+
+// watchdog抓取其他线程调用栈用的信号
+// SIGURG默认忽略，只用于socket带外数据通知，框架里没有用到
+static const int WATCHDOG_SIGNAL = SIGURG;
+static const int WATCHDOG_FRAMES = 64;
+// 一次只抓一个线程：watchdog线程设置目标线程后发信号，目标线程在信号处理函数里写入调用栈地址
+static void* s_watchdog_frames[WATCHDOG_FRAMES];
+static std::atomic<int> s_watchdog_frame_count = {-1};
+static std::atomic<int> s_watchdog_target = {0};
+
+// 信号处理函数里只调用::backtrace(预先调用过一次，不会再加载libgcc分配内存)，符号化由watchdog线程做
+static void OnWatchdogSignal(int) {
+    int saved_errno = errno;
+    if(syscall(SYS_gettid) == s_watchdog_target) {
+        s_watchdog_frame_count = ::backtrace(s_watchdog_frames, WATCHDOG_FRAMES);
+    }
+    errno = saved_errno;
+}
+
+// 第一次抓调用栈时安装信号处理函数；用户已经为SIGURG设置了处理方式(包括SIG_IGN)时不覆盖，只报告不抓调用栈
+static bool WatchdogSignalReady() {
+    struct sigaction old;
+    if(sigaction(WATCHDOG_SIGNAL, nullptr, &old)) {
+        return false;
+    }
+    if(old.sa_flags & SA_SIGINFO) {
+        return false;
+    }
+    if(old.sa_handler == &OnWatchdogSignal) {
+        return true;
+    }
+    if(old.sa_handler != SIG_DFL) {
+        return false;
+    }
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = &OnWatchdogSignal;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    return sigaction(WATCHDOG_SIGNAL, &sa, nullptr) == 0;
+}
+
+// 抓取线程thread当前的调用栈，最多等待100毫秒，失败返回空串
+static std::string CaptureBacktrace(int thread) {
+    if(!WatchdogSignalReady()) {
+        return "";
+    }
+    s_watchdog_frame_count = -1;
+    s_watchdog_target = thread;
+    if(syscall(SYS_tgkill, getpid(), thread, WATCHDOG_SIGNAL)) {
+        s_watchdog_target = 0;
+        return "";
+    }
+    for(int i = 0; i < 100 && s_watchdog_frame_count < 0; ++i) {
+        usleep(1000);
+    }
+    s_watchdog_target = 0;
+    int n = s_watchdog_frame_count;
+    if(n <= 0) {
+        return "";
+    }
+    // 跳过信号处理函数和信号跳板
+    return BacktraceToString(s_watchdog_frames, n, 2, "    ");
+}
 
 // 初始化调度器
-Scheduler::Scheduler(size_t threads, bool use_caller, const std::string& name)
-    :m_useCaller(use_caller), m_name(name) {
+Scheduler::Scheduler(size_t threads, bool use_caller, const std::string& name
+                     ,const ThreadAffinity& affinity)
+    :m_name(name), m_affinity(affinity), m_useCaller(use_caller) {
     SY_ASSERT(threads > 0); // 确定线程数量要正确
 
+    // 每个调度线程(包括use_caller的caller线程)一个本地队列
+    m_queues.resize(threads);
+    for(size_t i = 0; i < threads; ++i) {
+        m_queues[i] = new WorkerQueue;
+        m_queues[i]->index = i;
+    }
+
     // 使用 caller 线程执行调度任务
     if(use_caller) { 
         --threads; // 线程数量-1
@@ -38,6 +220,9 @@ Scheduler::Scheduler(size_t threads, bool use_caller, const std::string& name)
         // 获得当前线程id
         m_rootThread = sy::GetThreadId();
         m_threadIds.push_back(m_rootThread);
+        // caller线程固定使用0号本地队列
+        t_worker_index = 0;
+        m_queues[0]->threadId = m_rootThread;
     } 
     // 不将当前线程纳入调度器
     else { 
@@ -49,8 +234,20 @@ Scheduler::Scheduler(size_t threads, bool use_caller, const std::string& name)
 Scheduler::~Scheduler() {
     SY_LOG_DEBUG(g_logger) << "Scheduler::~Scheduler()";
     SY_ASSERT(m_stopping); // 必须达到停止条件
+    {
+        _WatchdogRegistry* r = GetWatchdogRegistry();
+        MutexType::Lock lock(r->mutex);
+        auto it = std::find(r->schedulers.begin(), r->schedulers.end(), this);
+        if(it != r->schedulers.end()) {
+            r->schedulers.erase(it);
+        }
+    }
     if(GetThis() == this) {
         t_scheduler = nullptr;
+        t_worker_index = -1;
+    }
+    for(auto& i : m_queues) {
+        delete i;
     }
 }
 
@@ -62,27 +259,77 @@ Fiber* Scheduler::GetMainFiber() {
     return t_scheduler_fiber;
 }
 
+uint64_t Scheduler::GetTaskStartUs() {
+    return t_task_start_us;
+}
+
+Scheduler::Priority Scheduler::GetTaskPriority() {
+    return (Priority)t_task_priority;
+}
+
+void Scheduler::YieldToQueue() {
+    SY_ASSERT2(t_task_start_us, "YieldToQueue must be called in a scheduled task fiber");
+    t_yield_to_queue = true;
+    Fiber::ptr cur = Fiber::GetThis();
+    auto raw_ptr = cur.get();
+    cur.reset();
+    raw_ptr->yield();
+}
+
 // 启动调度器
 void Scheduler::start() {
     SY_LOG_DEBUG(g_logger) << "start";
     MutexType::Lock lock(m_mutex);
-    // 已经启动了
-    if(!m_stopping) {
+    // 已经停止了
+    if(m_stopping) {
         SY_LOG_ERROR(g_logger) << "Scheduler is stopped";
         return;
     }
     // 线程池为空
     SY_ASSERT(m_threads.empty());
-    // 创建线程池
+    // 创建线程池，弹性模式先只启动最少的线程
     m_threads.resize(m_threadCount);
-    for(size_t i = 0; i < m_threadCount; ++i) {
-         // 线程执行 run() 任务
-        m_threads[i].reset(new Thread(std::bind(&Scheduler::run, this)
-                            , m_name + "_" + std::to_string(i)));
-        m_threadIds.push_back(m_threads[i]->getId());
+    size_t count = m_elastic ? std::min(m_elasticOptions.minThreads, m_threadCount) : m_threadCount;
+    for(size_t i = 0; i < count; ++i) {
+        startThread(i);
+    }
+    lock.unlock();
+
+    // 登记到watchdog，需要时才创建watchdog线程
+    _WatchdogRegistry* r = GetWatchdogRegistry();
+    {
+        MutexType::Lock lock2(r->mutex);
+        r->schedulers.push_back(this);
+    }
+    if(s_watchdog_ms || m_elastic) {
+        StartWatchdog();
+    }
+}
+
+void Scheduler::StartWatchdog() {
+    _WatchdogRegistry* r = GetWatchdogRegistry();
+    MutexType::Lock lock(r->mutex);
+    if(!r->thread) {
+        // 预先调用一次::backtrace，信号处理函数里再调用时不会加载libgcc分配内存
+        void* frames[1];
+        ::backtrace(frames, 1);
+        r->thread.reset(new Thread(&Scheduler::WatchdogMain, "watchdog"));
     }
 }
 
+void Scheduler::startThread(size_t i) {
+    // 线程执行 run() 任务，先记下自己的本地队列序号
+    int index = i + (m_useCaller ? 1 : 0);
+    WorkerQueue* q = m_queues[index];
+    q->retire = false;
+    q->exited = false;
+    m_threads[i].reset(new Thread([this, index](){
+                            t_worker_index = index;
+                            run();
+                        }, m_name + "_" + std::to_string(i), m_affinity.forThread(i)));
+    m_threadIds.push_back(m_threads[i]->getId());
+}
+
 // 停止调度器
 void Scheduler::stop() {
     SY_LOG_DEBUG(g_logger) << "stop";
@@ -118,7 +365,10 @@ void Scheduler::stop() {
         thrs.swap(m_threads);
     }
     for (auto &i : thrs) {
-        i->join();
+        // 弹性模式下退出后已经回收的线程位置为空
+        if(i) {
+            i->join();
+        }
     }
 }
 
@@ -139,67 +389,85 @@ void Scheduler::run() {
         t_scheduler_fiber = sy::Fiber::GetThis().get();
     }
 
+    // 登记本地队列所属的线程，此后指定本线程的任务可以直接进入本地队列
+    WorkerQueue* local = getLocalQueue();
+    SY_ASSERT(local);
+    local->threadId = sy::GetThreadId();
+
     SY_LOG_DEBUG(g_logger) << "new idle_fiber";
 
     // 定义dile_fiber，当任务队列中的任务执行完之后，执行idle()
     Fiber::ptr idle_fiber(new Fiber(std::bind(&Scheduler::idle, this)));
     Fiber::ptr cb_fiber;
+    // 回调协程池：执行完(TERM)的协程放回池中，下一个回调任务直接reset复用，不再new Fiber和分配栈
+    std::vector<Fiber::ptr> fiber_pool;
+    // 池中协程的栈大小，只复用默认栈大小的协程
+    uint32_t pool_stacksize = 0;
 
+    // 任务开始执行的时间，连续执行任务时上一个任务的结束时间就是下一个任务的开始时间，每个任务只读一次时钟
+    // idle时间不单独计时(基类的idle是忙等，计时开销太大)，由线程运行时间减去执行任务的时间得到
+    uint64_t now = 0;
+    local->startUs = sy::GetMonotonicUS();
     ScheduleTask task;
     while(true) {
         task.reset();
         bool tickle_me = false;
-        {
-            // 从任务队列中拿fiber和cb
-            MutexType::Lock lock(m_mutex);
-            auto it = m_tasks.begin();
-            // 遍历所有调度任务
-            while (it != m_tasks.end()) {
-                if (it->thread != -1 && it->thread != sy::GetThreadId()) {
-                    // 指定了调度线程，但不是在当前线程上调度，标记一下需要通知其他线程进行调度，然后跳过这个任务，继续下一个
-                    ++it;
-                    tickle_me = true;
-                    continue;
-                }
-
-                // 找到一个未指定线程，或是指定了当前线程的任务
-                SY_ASSERT(it->fiber || it->cb);
-                if (it->fiber) {
-                    // 任务队列时的协程一定是READY状态，谁会把RUNNING或TERM状态的协程加入调度呢？
-                    SY_ASSERT(it->fiber->getState() == Fiber::READY);
-                }
-                // 当前调度线程找到一个任务，准备开始调度，将其从任务队列中剔除，活动线程数加1
-                task = *it;
-                m_tasks.erase(it++);
-                ++m_activeThreadCount;
-                break;
+        // 先把自己算作活动线程再取任务，任务从队列取出到开始执行之间stopping()也不会误判为可以停止
+        ++m_activeThreadCount;
+        if(dequeue(task)) {
+            SY_ASSERT(task.fiber || task.cb);
+            if (task.fiber) {
+                // 任务队列时的协程一定是READY状态，谁会把RUNNING或TERM状态的协程加入调度呢？
+                SY_ASSERT(task.fiber->getState() == Fiber::READY);
             }
-            // 当前线程拿完一个任务后，发现任务队列还有剩余，那么tickle一下其他线程
-            tickle_me |= (it != m_tasks.end());
+            // 当前线程拿完一个任务后，发现还有剩余任务并且有线程在idle，那么tickle一下其他线程来窃取
+            tickle_me = m_taskCount > 0 && hasIdleThreads();
+            t_task_priority = task.priority;
         }
 
-        // 取到任务tickle一下
         if(tickle_me) {
+            WorkerQueue::Add(local->tickles, 1);
             tickle();
         }
 
+        if(task.fiber || task.cb) {
+            if(!now) {
+                now = sy::GetMonotonicUS();
+            }
+            countTask(local, task, now);
+        }
+
         // 如果任务是fiber，并且任务处于可执行状态
         if (task.fiber) {
             // resume协程，resume返回时，协程要么执行完了，要么半路yield了，总之这个任务就算完成了，活跃线程数减一
+            beginRun(local, task.fiber.get(), now);
             task.fiber->resume();
             --m_activeThreadCount;
+            now = countBusy(local, now);
+            endRun(local, task.fiber);
+            // 之前yield出去的回调协程执行完了，也可以放回池中
+            recycleFiber(fiber_pool, task.fiber, pool_stacksize);
             task.reset();
         } else if (task.cb) {
-            if (cb_fiber) {
-                cb_fiber->reset(task.cb);
+            if (!fiber_pool.empty()) {
+                cb_fiber.swap(fiber_pool.back());
+                fiber_pool.pop_back();
+                cb_fiber->reset(std::move(task.cb));
             } else {
-                cb_fiber.reset(new Fiber(task.cb));
+                cb_fiber.reset(new Fiber(std::move(task.cb), 0, true
+                            ,m_sharedStack.load(std::memory_order_relaxed)));
+                pool_stacksize = cb_fiber->m_stacksize;
             }
             task.reset();
+            beginRun(local, cb_fiber.get(), now);
             cb_fiber->resume();
             --m_activeThreadCount;
-            cb_fiber.reset();
+            now = countBusy(local, now);
+            endRun(local, cb_fiber);
+            // 执行完了放回池中；半路yield了说明别处(如IO事件)持有它，这里释放引用即可
+            recycleFiber(fiber_pool, cb_fiber, pool_stacksize);
         } else {
+            --m_activeThreadCount;
             // 进到这个分支情况一定是任务队列空了，调度idle协程即可
             if (idle_fiber->getState() == Fiber::TERM) {
                 // 如果调度器没有调度任务，那么idle协程会不停地resume/yield，不会结束，如果idle协程结束了，那一定是调度器停止了
@@ -207,27 +475,821 @@ void Scheduler::run() {
                 break;
             }
             ++m_idleThreadCount;
+            WorkerQueue::Add(local->switches, 1);
             idle_fiber->resume();
+            now = 0;
             --m_idleThreadCount;
         }
     }
+    local->exitUs = sy::GetMonotonicUS();
+    if(local->retire) {
+        retireWorker(local);
+    }
     SY_LOG_DEBUG(g_logger) << "Scheduler::run() exit";
 }
 
+void Scheduler::countTask(WorkerQueue* local, const ScheduleTask& task, uint64_t now) {
+    WorkerQueue::Add(local->runTasks, 1);
+    WorkerQueue::Add(local->switches, 1);
+    if(!task.enqueueUs) {
+        return;
+    }
+    uint64_t delay = now > task.enqueueUs ? now - task.enqueueUs : 0;
+    size_t bucket = delay ? 64 - __builtin_clzll(delay) : 0;
+    if(bucket >= QUEUE_DELAY_BUCKETS) {
+        bucket = QUEUE_DELAY_BUCKETS - 1;
+    }
+    WorkerQueue::Add(local->queueDelay[bucket], 1);
+}
+
+void Scheduler::beginRun(WorkerQueue* local, Fiber* f, uint64_t now) {
+    t_task_start_us = now;
+    local->runningFiber.store(f->getId(), std::memory_order_relaxed);
+    local->runningSince.store(now, std::memory_order_relaxed);
+}
+
+void Scheduler::endRun(WorkerQueue* local, Fiber::ptr& f) {
+    t_task_start_us = 0;
+    local->runningSince.store(0, std::memory_order_relaxed);
+    int priority = t_task_priority;
+    t_task_priority = NORMAL;
+    if(SY_UNLIKELY(t_yield_to_queue)) {
+        t_yield_to_queue = false;
+        // 协程已经切回调度协程，放回队列之后被其他线程领走也是安全的
+        // 放到注入队列尾部而不是本地队列：本地队列不空时不会去看注入队列，反复让出的协程会让外部提交的任务饿死
+        ScheduleTask task(f, -1);
+        task.priority = priority;
+        task.enqueueUs = SampleEnqueueTime();
+        {
+            MutexType::Lock lock(m_mutex);
+            m_tasks.push_back(std::move(task));
+            ++m_taskCount;
+        }
+        if(hasIdleThreads()) {
+            countTickle();
+            tickle();
+        }
+    }
+}
+
+void Scheduler::WatchdogMain() {
+    while(true) {
+        uint64_t limit_ms = s_watchdog_ms;
+        // 默认按弹性线程池的检查间隔；开启watchdog时不超过阈值的1/4，限制在[10ms, 1s]
+        uint64_t interval_ms = s_elastic_interval_ms;
+        if(limit_ms) {
+            interval_ms = std::min<uint64_t>(interval_ms
+                    ,std::max<uint64_t>(10, std::min<uint64_t>(1000, limit_ms / 4)));
+        }
+        usleep(interval_ms * 1000);
+        uint64_t now = sy::GetMonotonicUS();
+        _WatchdogRegistry* r = GetWatchdogRegistry();
+        MutexType::Lock lock(r->mutex);
+        for(auto& i : r->schedulers) {
+            if(limit_ms) {
+                i->watchdogCheck(now, limit_ms * 1000);
+            }
+            if(i->m_elastic) {
+                i->elasticCheck(now);
+            }
+        }
+    }
+}
+
+bool Scheduler::setElastic(const ElasticOptions& options) {
+    if(!supportElastic() || m_sharedStack) {
+        SY_LOG_WARN(g_logger) << "scheduler " << m_name << " does not support elastic threads";
+        return false;
+    }
+    MutexType::Lock lock(m_mutex);
+    m_elasticOptions = options;
+    // 不使用caller线程时至少保留一个调度线程
+    size_t min_threads = m_useCaller ? 0 : 1;
+    m_elasticOptions.minThreads = std::min(std::max(options.minThreads, min_threads), m_threadCount);
+    m_elastic = true;
+    lock.unlock();
+    StartWatchdog();
+    return true;
+}
+
+size_t Scheduler::getThreadCount() {
+    MutexType::Lock lock(m_mutex);
+    size_t count = 0;
+    size_t offset = m_useCaller ? 1 : 0;
+    for(size_t i = 0; i < m_threads.size(); ++i) {
+        if(m_threads[i] && !m_queues[i + offset]->retire) {
+            ++count;
+        }
+    }
+    return count;
+}
+
+bool Scheduler::retiring() {
+    WorkerQueue* q = getLocalQueue();
+    return q && q->retire.load(std::memory_order_relaxed);
+}
+
+void Scheduler::elasticCheck(uint64_t now) {
+    ElasticState& st = m_elasticState;
+    if(now < st.lastCheckUs + s_elastic_interval_ms * 1000ull) {
+        return;
+    }
+    // 本周期的执行时间和排队延迟直方图
+    Stats stats = getStats();
+    uint64_t busy = 0;
+    for(auto& i : stats.workers) {
+        busy += i.busyUs;
+    }
+    Stats window;
+    uint64_t samples = 0;
+    for(size_t i = 0; i < QUEUE_DELAY_BUCKETS; ++i) {
+        window.queueDelay[i] = stats.queueDelay[i] - st.queueDelay[i];
+        samples += window.queueDelay[i];
+        st.queueDelay[i] = stats.queueDelay[i];
+    }
+    uint64_t busy_delta = busy - st.busyUs;
+    uint64_t period = st.lastCheckUs ? now - st.lastCheckUs : 0;
+    st.busyUs = busy;
+    st.lastCheckUs = now;
+    if(!period) {
+        return;
+    }
+
+    const ElasticOptions& opt = m_elasticOptions;
+    int retire_index = -1;
+    {
+        MutexType::Lock lock(m_mutex);
+        if(m_stopping) {
+            return;
+        }
+        reapRetired();
+        size_t offset = m_useCaller ? 1 : 0;
+        size_t threads = 0;
+        for(size_t i = 0; i < m_threads.size(); ++i) {
+            if(m_threads[i] && !m_queues[i + offset]->retire) {
+                ++threads;
+            }
+        }
+        // 样本太少时分位数没有意义
+        bool grow = (samples >= 8 && window.getQueueDelayPercentile(0.99) > opt.growDelayUs)
+                    || m_taskCount > opt.growBacklog * std::max<size_t>(threads, 1);
+        if(grow) {
+            st.shrinkSince = 0;
+            if(threads < m_threadCount) {
+                for(size_t i = 0; i < m_threads.size(); ++i) {
+                    if(!m_threads[i]) {
+                        startThread(i);
+                        ++m_elasticGrows;
+                        SY_LOG_INFO(g_logger) << "scheduler " << m_name << " grow to "
+                            << threads + 1 << " threads, task_count=" << m_taskCount;
+                        break;
+                    }
+                }
+            }
+            return;
+        }
+        // 少一个线程时剩下线程的利用率仍然不高
+        if(threads <= opt.minThreads
+                || busy_delta > (threads - 1) * period * opt.shrinkUtil) {
+            st.shrinkSince = 0;
+            return;
+        }
+        if(!st.shrinkSince) {
+            st.shrinkSince = now;
+            return;
+        }
+        if(now - st.shrinkSince < opt.shrinkIdleMs * 1000) {
+            return;
+        }
+        // 退出序号最大的线程，每过一个shrinkIdleMs最多退出一个
+        st.shrinkSince = now;
+        for(size_t i = m_threads.size(); i-- > 0;) {
+            WorkerQueue* q = m_queues[i + offset];
+            if(m_threads[i] && !q->retire) {
+                q->retire = true;
+                retire_index = q->index;
+                ++m_elasticShrinks;
+                SY_LOG_INFO(g_logger) << "scheduler " << m_name << " shrink to "
+                    << threads - 1 << " threads";
+                break;
+            }
+        }
+    }
+    // 唤醒要退出的线程，它在idle中发现要退出
+    if(retire_index >= 0) {
+        tickleWorker(retire_index);
+    }
+}
+
+void Scheduler::reapRetired() {
+    size_t offset = m_useCaller ? 1 : 0;
+    for(size_t i = 0; i < m_threads.size(); ++i) {
+        if(!m_threads[i] || !m_queues[i + offset]->exited) {
+            continue;
+        }
+        int tid = m_threads[i]->getId();
+        m_threads[i]->join();
+        m_threads[i].reset();
+        m_threadIds.erase(std::remove(m_threadIds.begin(), m_threadIds.end(), tid)
+                          ,m_threadIds.end());
+    }
+}
+
+void Scheduler::retireWorker(WorkerQueue* local) {
+    int tid = local->threadId;
+    size_t count = 0;
+    {
+        // 和takeFromInjection一样先拿m_mutex再拿本地队列的锁
+        MutexType::Lock lock(m_mutex);
+        m_retiredThreads.push_back(tid);
+        if(m_retiredThreads.size() > MAX_RETIRED_THREADS) {
+            m_retiredThreads.erase(m_retiredThreads.begin());
+        }
+        QueueMutexType::Lock lock2(local->mutex);
+        // 此后指定本线程的任务找不到本地队列，进入注入队列并由任意线程执行
+        local->threadId = -1;
+        for(auto& lane : local->pinned.lanes) {
+            for(auto& i : lane) {
+                i.thread = -1;
+                m_tasks.push_back(std::move(i));
+            }
+        }
+        for(auto& lane : local->tasks.lanes) {
+            for(auto& i : lane) {
+                m_tasks.push_back(std::move(i));
+            }
+        }
+        count = local->pinned.size() + local->tasks.size();
+        local->pinned.clear();
+        local->tasks.clear();
+    }
+    if(count) {
+        tickle();
+    }
+    local->exited = true;
+}
+
+void Scheduler::watchdogCheck(uint64_t now, uint64_t limit_us) {
+    for(auto& q : m_queues) {
+        uint64_t since = q->runningSince.load(std::memory_order_relaxed);
+        if(!since || now < since + limit_us || q->watchdogReported == since) {
+            continue;
+        }
+        q->watchdogReported = since;
+        int thread = q->threadId;
+        uint64_t fiber_id = q->runningFiber.load(std::memory_order_relaxed);
+        std::string bt = CaptureBacktrace(thread);
+        // 抓调用栈期间协程已经让出，调用栈不是它的了
+        if(q->runningSince.load(std::memory_order_relaxed) != since) {
+            bt.clear();
+        }
+        SY_LOG_WARN(g_logger) << "fiber running too long, scheduler=" << m_name
+            << " thread=" << thread
+            << " fiber_id=" << fiber_id
+            << " running=" << (now - since) / 1000 << "ms"
+            << " limit=" << limit_us / 1000 << "ms"
+            << std::endl << bt;
+    }
+}
+
+uint64_t Scheduler::countBusy(WorkerQueue* local, uint64_t begin) {
+    uint64_t now = sy::GetMonotonicUS();
+    WorkerQueue::Add(local->busyUs, now > begin ? now - begin : 0);
+    return now;
+}
+
+void Scheduler::countTickle() {
+    WorkerQueue* local = getLocalQueue();
+    if(local) {
+        WorkerQueue::Add(local->tickles, 1);
+    } else {
+        ++m_externalTickles;
+    }
+}
+
+void Scheduler::addPollTime(uint64_t us) {
+    WorkerQueue* local = getLocalQueue();
+    if(local) {
+        WorkerQueue::Add(local->pollUs, us);
+    }
+}
+
+Scheduler::WorkerQueue* Scheduler::getQueueByThread(int thread) {
+    for(auto& i : m_queues) {
+        if(i->threadId == thread) {
+            return i;
+        }
+    }
+    return nullptr;
+}
+
+void Scheduler::recycleFiber(std::vector<Fiber::ptr>& pool, Fiber::ptr& fiber, uint32_t stacksize) {
+    // 只复用：已结束、没有其他引用、参与调度、栈大小为默认值(共享栈协程为0)的协程
+    if(fiber->getState() == Fiber::TERM
+            && fiber.use_count() == 1
+            && (fiber->m_stack || fiber->m_useSharedStack)
+            && fiber->m_runInScheduler
+            && fiber->m_stacksize == stacksize
+            && pool.size() < s_fiber_pool_size) {
+        pool.push_back(std::move(fiber));
+    }
+    fiber.reset();
+}
+
+bool Scheduler::setSharedStack(bool v) {
+    // 共享栈在线程退出时释放，弹性模式下绑定它的协程无法恢复
+    if(v && (!supportSharedStack() || m_elastic)) {
+        SY_LOG_WARN(g_logger) << "scheduler " << m_name << " does not support shared stack fibers";
+        return false;
+    }
+    m_sharedStack = v;
+    return true;
+}
+
+int Scheduler::getWorkerIndex() const {
+    if(t_scheduler != this) {
+        return -1;
+    }
+    return t_worker_index;
+}
+
+int Scheduler::getWorkerThreadId(int index) const {
+    if(index < 0 || index >= (int)m_queues.size()) {
+        return -1;
+    }
+    return m_queues[index]->threadId;
+}
+
+int Scheduler::waitWorkerThreadId(int index, uint64_t timeout_ms) const {
+    if(index < 0 || index >= (int)m_queues.size()) {
+        return -1;
+    }
+    uint64_t deadline = sy::GetMonotonicUS() + timeout_ms * 1000;
+    while(true) {
+        int id = getWorkerThreadId(index);
+        if(id != -1 || sy::GetMonotonicUS() >= deadline) {
+            return id;
+        }
+        usleep(1000);
+    }
+}
+
+bool Scheduler::hasRunnableTask() {
+    if(m_taskCount == 0) {
+        return false;
+    }
+    WorkerQueue* local = getLocalQueue();
+    if(!local) {
+        return true;
+    }
+    {
+        QueueMutexType::Lock lock(local->mutex);
+        if(!local->pinned.empty() || !local->tasks.empty()) {
+            return true;
+        }
+    }
+    {
+        MutexType::Lock lock(m_mutex);
+        if(!m_tasks.empty()) {
+            return true;
+        }
+    }
+    for(auto& q : m_queues) {
+        if(q == local) {
+            continue;
+        }
+        QueueMutexType::Lock lock(q->mutex);
+        if(!q->tasks.empty()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+Scheduler::WorkerQueue* Scheduler::getLocalQueue() {
+    if(t_scheduler != this || t_worker_index < 0) {
+        return nullptr;
+    }
+    return m_queues[t_worker_index];
+}
+
+// 入队规则：
+// 1. 指定了线程的任务直接放入该线程的pinned队列，其他线程不会看到它
+// 2. 调度线程自己提交的任务放入自己的本地队列
+// 3. 其他线程提交的任务放入注入队列
+bool Scheduler::enqueue(ScheduleTask& task, int& target) {
+    WorkerQueue* q = nullptr;
+    target = -1;
+    task.enqueueUs = SampleEnqueueTime();
+    if(task.thread != -1) {
+        q = getQueueByThread(task.thread);
+        if(q) {
+            QueueMutexType::Lock lock(q->mutex);
+            // 查找和加锁之间目标线程可能已经退出(retireWorker把threadId置为-1并清空了队列)
+            if(q->threadId == task.thread) {
+                q->pinned.push_back(std::move(task));
+                ++m_taskCount;
+                target = q->index;
+                // 指定线程不是当前线程，需要唤醒它
+                return task.thread != sy::GetThreadId();
+            }
+        }
+        // 目标线程还没进入run或者已经退出，放入注入队列，由目标线程领取或者按已退出线程转给其他线程
+    } else {
+        q = getLocalQueue();
+        if(q) {
+            QueueMutexType::Lock lock(q->mutex);
+            q->tasks.push_back(std::move(task));
+            ++m_taskCount;
+            return hasIdleThreads();
+        }
+    }
+
+    MutexType::Lock lock(m_mutex);
+    bool need_tickle = m_tasks.empty();
+    m_tasks.push_back(std::move(task));
+    ++m_taskCount;
+    return need_tickle || hasIdleThreads();
+}
+
+void Scheduler::schedule(Batch& batch) {
+    if(batch.m_tasks.empty()) {
+        return;
+    }
+    std::vector<int> targets;
+    if(enqueue(batch.m_tasks, targets)) {
+        countTickle();
+        tickle();
+    }
+    for(auto i : targets) {
+        countTickle();
+        tickleWorker(i);
+    }
+    batch.m_tasks.clear();
+}
+
+bool Scheduler::enqueue(std::vector<ScheduleTask>& tasks, std::vector<int>& targets) {
+    // 一批任务同时入队，采样到时整批都记录
+    uint64_t now = SampleEnqueueTime();
+    int self = sy::GetThreadId();
+    WorkerQueue* local = getLocalQueue();
+    // 不指定线程的任务移到前面，最后一起入队；指定了还没进入run的线程的任务单独放入注入队列
+    size_t shared = 0;
+    std::vector<ScheduleTask> waiting;
+    for(size_t i = 0; i < tasks.size();) {
+        tasks[i].enqueueUs = now;
+        int thread = tasks[i].thread;
+        WorkerQueue* q = thread == -1 ? nullptr : getQueueByThread(thread);
+        if(!q) {
+            if(thread == -1) {
+                if(shared != i) {
+                    tasks[shared] = std::move(tasks[i]);
+                }
+                ++shared;
+            } else {
+                waiting.push_back(std::move(tasks[i]));
+            }
+            ++i;
+            continue;
+        }
+        // 连续指定同一线程的任务(如每线程reactor的一轮事件)只加一次锁
+        QueueMutexType::Lock lock(q->mutex);
+        // 目标线程在查找和加锁之间退出了，这些任务和还没进入run的一样走注入队列
+        if(q->threadId != thread) {
+            for(; i < tasks.size() && tasks[i].thread == thread; ++i) {
+                waiting.push_back(std::move(tasks[i]));
+            }
+            continue;
+        }
+        for(; i < tasks.size() && tasks[i].thread == thread; ++i) {
+            tasks[i].enqueueUs = now;
+            q->pinned.push_back(std::move(tasks[i]));
+            ++m_taskCount;
+        }
+        if(thread != self && std::find(targets.begin(), targets.end(), q->index) == targets.end()) {
+            targets.push_back(q->index);
+        }
+    }
+    tasks.resize(shared);
+
+    bool need_tickle = false;
+    if(!tasks.empty() && local) {
+        QueueMutexType::Lock lock(local->mutex);
+        for(auto& i : tasks) {
+            local->tasks.push_back(std::move(i));
+        }
+        m_taskCount += tasks.size();
+        need_tickle = hasIdleThreads();
+    }
+    if((!tasks.empty() && !local) || !waiting.empty()) {
+        MutexType::Lock lock(m_mutex);
+        need_tickle = need_tickle || m_tasks.empty();
+        if(!local) {
+            for(auto& i : tasks) {
+                m_tasks.push_back(std::move(i));
+            }
+            m_taskCount += tasks.size();
+        }
+        for(auto& i : waiting) {
+            m_tasks.push_back(std::move(i));
+        }
+        m_taskCount += waiting.size();
+        need_tickle = need_tickle || hasIdleThreads();
+    }
+    return need_tickle;
+}
+
+bool Scheduler::dequeue(ScheduleTask& task) {
+    WorkerQueue* local = getLocalQueue();
+    if(SY_UNLIKELY(!local)) {
+        return false;
+    }
+    if(m_taskCount == 0) {
+        return false;
+    }
+
+    {
+        QueueMutexType::Lock lock(local->mutex);
+        if(popLocal(local, task)) {
+            return true;
+        }
+    }
+
+    if(takeFromInjection(local, task)) {
+        return true;
+    }
+    return steal(local, task);
+}
+
+// 加权轮转：每个周期里各优先级最多取s_lane_weights个任务，从高到低取有任务且还有额度的优先级
+// 有任务的优先级都用完额度时重新分配，没有任务的优先级不占用周期，只有一个优先级有任务时就是FIFO
+bool Scheduler::popLocal(WorkerQueue* local, ScheduleTask& task) {
+    if(local->pinned.empty() && local->tasks.empty()) {
+        return false;
+    }
+    // 有任务的优先级
+    uint32_t mask = 0;
+    for(int i = 0; i < PRIORITY_COUNT; ++i) {
+        if(!local->pinned.lanes[i].empty() || !local->tasks.lanes[i].empty()) {
+            mask |= 1u << i;
+        }
+    }
+    int lane = -1;
+    if(!(mask & (mask - 1))) {
+        // 只有一个优先级有任务，不用轮转
+        lane = __builtin_ctz(mask);
+    }
+    for(int round = 0; round < 2 && lane < 0; ++round) {
+        for(int i = 0; i < PRIORITY_COUNT; ++i) {
+            if((mask & (1u << i)) && t_lane_credits[i]) {
+                --t_lane_credits[i];
+                lane = i;
+                break;
+            }
+        }
+        if(lane < 0) {
+            for(int i = 0; i < PRIORITY_COUNT; ++i) {
+                t_lane_credits[i] = s_lane_weights[i];
+            }
+        }
+    }
+    SY_ASSERT(lane >= 0);
+    (local->pinned.lanes[lane].empty() ? local->tasks : local->pinned).pop_front(lane, task);
+    --m_taskCount;
+    return true;
+}
+
+bool Scheduler::pushLocal(WorkerQueue* local, std::vector<ScheduleTask>& batch, ScheduleTask& task) {
+    if(batch.empty()) {
+        return false;
+    }
+    QueueMutexType::Lock lock(local->mutex);
+    for(auto& i : batch) {
+        // 指定了本线程的任务不能放进可以被窃取的队列
+        (i.thread == -1 ? local->tasks : local->pinned).push_back(std::move(i));
+    }
+    return popLocal(local, task);
+}
+
+bool Scheduler::takeFromInjection(WorkerQueue* local, ScheduleTask& task) {
+    std::vector<ScheduleTask> batch;
+    {
+        MutexType::Lock lock(m_mutex);
+        if(m_tasks.empty()) {
+            return false;
+        }
+        // 每个优先级都按线程数均分，避免一个线程把任务全拿走，也让低优先级任务进入本地队列参与轮转
+        batch.reserve(m_tasks.size() / m_queues.size() + PRIORITY_COUNT);
+        for(auto& lane : m_tasks.lanes) {
+            size_t n = lane.size() / m_queues.size() + 1;
+            size_t taken = 0;
+            auto it = lane.begin();
+            while(it != lane.end() && taken < n) {
+                if(it->thread != -1 && it->thread != sy::GetThreadId()) {
+                    // 指定了其他线程的任务，目标线程已启动就转移到它的pinned队列，否则留在注入队列
+                    WorkerQueue* q = getQueueByThread(it->thread);
+                    if(!q) {
+                        // 目标线程已经弹性退出，改由任意线程执行
+                        if(std::find(m_retiredThreads.begin(), m_retiredThreads.end(), it->thread)
+                                != m_retiredThreads.end()) {
+                            it->thread = -1;
+                            batch.push_back(std::move(*it));
+                            it = lane.erase(it);
+                            --m_tasks.count;
+                            ++taken;
+                            continue;
+                        }
+                        ++it;
+                        continue;
+                    }
+                    QueueMutexType::Lock lock2(q->mutex);
+                    q->pinned.push_back(std::move(*it));
+                    it = lane.erase(it);
+                    --m_tasks.count;
+                    continue;
+                }
+                batch.push_back(std::move(*it));
+                it = lane.erase(it);
+                --m_tasks.count;
+                ++taken;
+            }
+        }
+    }
+    return pushLocal(local, batch, task);
+}
+
+bool Scheduler::steal(WorkerQueue* local, ScheduleTask& task) {
+    size_t size = m_queues.size();
+    if(size <= 1) {
+        return false;
+    }
+    // 每个线程、每一轮从不同位置开始找，避免所有空闲线程都去窃取同一个线程
+    size_t begin = t_worker_index + (++t_steal_round);
+    std::vector<ScheduleTask> batch;
+    for(size_t i = 0; i < size; ++i) {
+        WorkerQueue* victim = m_queues[(begin + i) % size];
+        if(victim == local) {
+            continue;
+        }
+        QueueMutexType::Lock lock(victim->mutex);
+        if(victim->tasks.empty()) {
+            continue;
+        }
+        // 每个优先级窃取后一半，前面较早入队的任务仍由本线程按顺序执行
+        batch.reserve(victim->tasks.size() / 2 + PRIORITY_COUNT);
+        for(auto& lane : victim->tasks.lanes) {
+            size_t half = (lane.size() + 1) / 2;
+            batch.insert(batch.end(), std::make_move_iterator(lane.end() - half)
+                         ,std::make_move_iterator(lane.end()));
+            lane.erase(lane.end() - half, lane.end());
+            victim->tasks.count -= half;
+        }
+        break;
+    }
+    return pushLocal(local, batch, task);
+}
+
+uint64_t Scheduler::Stats::getQueueDelayPercentile(double p) const {
+    uint64_t total = 0;
+    for(auto& i : queueDelay) {
+        total += i;
+    }
+    if(total == 0) {
+        return 0;
+    }
+    uint64_t target = (uint64_t)(total * p);
+    uint64_t sum = 0;
+    for(size_t i = 0; i < QUEUE_DELAY_BUCKETS; ++i) {
+        sum += queueDelay[i];
+        if(sum > target || sum == total) {
+            return 1ull << i;
+        }
+    }
+    return 1ull << (QUEUE_DELAY_BUCKETS - 1);
+}
+
+std::ostream& Scheduler::Stats::dump(std::ostream& os) const {
+    WorkerStats sum;
+    for(auto& i : workers) {
+        os << std::endl << "    thread=" << i.thread
+           << " tasks=" << i.tasks
+           << " switches=" << i.switches
+           << " busy_us=" << i.busyUs
+           << " idle_us=" << i.idleUs
+           << " poll_us=" << i.pollUs
+           << " tickles=" << i.tickles;
+        sum.tasks += i.tasks;
+        sum.busyUs += i.busyUs;
+        sum.idleUs += i.idleUs;
+        sum.tickles += i.tickles;
+    }
+    uint64_t total_us = sum.busyUs + sum.idleUs;
+    os << std::endl << "    tasks=" << sum.tasks
+       << " busy=" << (total_us ? sum.busyUs * 100 / total_us : 0) << "%"
+       << " avg_run_us=" << (sum.tasks ? sum.busyUs / sum.tasks : 0)
+       << " tickles=" << sum.tickles + externalTickles
+       << " queue_delay_us p50<=" << getQueueDelayPercentile(0.5)
+       << " p99<=" << getQueueDelayPercentile(0.99)
+       << " p999<=" << getQueueDelayPercentile(0.999);
+    return os;
+}
+
+Scheduler::Stats Scheduler::getStats() const {
+    Stats stats;
+    uint64_t now = sy::GetMonotonicUS();
+    stats.externalTickles = m_externalTickles;
+    stats.workers.resize(m_queues.size());
+    for(size_t i = 0; i < m_queues.size(); ++i) {
+        WorkerQueue* q = m_queues[i];
+        WorkerStats& w = stats.workers[i];
+        w.thread = q->threadId;
+        w.tasks = q->runTasks.load(std::memory_order_relaxed);
+        w.switches = q->switches.load(std::memory_order_relaxed);
+        w.busyUs = q->busyUs.load(std::memory_order_relaxed);
+        uint64_t start = q->startUs.load(std::memory_order_relaxed);
+        uint64_t end = q->exitUs.load(std::memory_order_relaxed);
+        if(start) {
+            uint64_t run = (end ? end : now) - start;
+            w.idleUs = run > w.busyUs ? run - w.busyUs : 0;
+        }
+        w.pollUs = q->pollUs.load(std::memory_order_relaxed);
+        w.tickles = q->tickles.load(std::memory_order_relaxed);
+        for(size_t n = 0; n < QUEUE_DELAY_BUCKETS; ++n) {
+            stats.queueDelay[n] += q->queueDelay[n].load(std::memory_order_relaxed);
+        }
+    }
+    return stats;
+}
+
+std::ostream& Scheduler::dump(std::ostream& os) {
+    os << "[Scheduler name=" << m_name
+       << " size=" << m_threadCount
+       << " active_count=" << m_activeThreadCount
+       << " idle_count=" << m_idleThreadCount
+       << " stopping=" << m_stopping
+       << " task_count=" << m_taskCount
+       << " ]" << std::endl << "    ";
+    {
+        MutexType::Lock lock(m_mutex);
+        for(size_t i = 0; i < m_threadIds.size(); ++i) {
+            if(i) {
+                os << ", ";
+            }
+            os << m_threadIds[i];
+        }
+    }
+    if(m_elastic) {
+        os << std::endl << "    elastic min=" << m_elasticOptions.minThreads
+           << " max=" << m_threadCount
+           << " threads=" << getThreadCount()
+           << " grows=" << m_elasticGrows
+           << " shrinks=" << m_elasticShrinks;
+    }
+    getStats().dump(os);
+    return os;
+}
+
+std::ostream& Scheduler::dumpLayout(std::ostream& os) {
+    os << "[Scheduler name=" << m_name << " " << m_affinity.toString() << "]";
+    MutexType::Lock lock(m_mutex);
+    for(size_t i = 0; i < m_threadIds.size(); ++i) {
+        int tid = m_threadIds[i];
+        std::vector<int> cpus = Thread::GetCpus(tid);
+        // 允许运行的CPU跨了哪些NUMA节点
+        std::vector<int> nodes;
+        for(int c : cpus) {
+            int n = ThreadAffinity::GetCpuNode(c);
+            if(n >= 0 && std::find(nodes.begin(), nodes.end(), n) == nodes.end()) {
+                nodes.push_back(n);
+            }
+        }
+        std::sort(nodes.begin(), nodes.end());
+        os << std::endl << "    tid=" << tid
+           << (tid == m_rootThread ? " caller" : "")
+           << " cpus=" << ThreadAffinity::FormatCpuList(cpus)
+           << " nodes=" << (nodes.empty() ? "?" : ThreadAffinity::FormatCpuList(nodes));
+    }
+    return os;
+}
+
 void Scheduler::tickle() {
     SY_LOG_INFO(g_logger) << "tickle";
 }
 
+void Scheduler::tickleWorker(int index) {
+    tickle();
+}
+
 // 判断停止条件
 bool Scheduler::stopping() {
-    MutexType::Lock lock(m_mutex);
-    // 当正在停止 && 任务队列为空 && 活跃的线程数量为0
-    return m_stopping && m_tasks.empty() && m_activeThreadCount == 0;
+    // 当正在停止 && 所有任务队列为空 && 活跃的线程数量为0
+    // 先读活动线程数：执行中的任务唤醒的协程在它结束前已经计入任务数
+    return m_stopping && m_activeThreadCount == 0 && m_taskCount == 0;
 }
 
 void Scheduler::idle() {
     SY_LOG_INFO(g_logger) << "idle";
-    while(!stopping()) {
+    while(!stopping() && !retiring()) {
         sy::Fiber::GetThis()->yield();
     }
 }
@@ -4,21 +4,94 @@
 #include "fiber.h"
 #include "log.h"
 #include "thread.h"
+#include <atomic>
+#include <deque>
 #include <functional>
 #include <list>
 #include <memory>
+#include <ostream>
 #include <string>
+#include <vector>
 
 namespace sy {
 
 // 协程调度器
+// 每个调度线程有自己的本地任务队列，另有一个共享的注入队列接收调度器外部线程提交的任务
+// 调度线程优先执行本地队列的任务，本地为空时从注入队列批量领取，仍然没有就从其他线程的本地队列窃取一半
+// 每个队列按任务优先级分成几条通道，取任务时在有任务的通道间加权轮转，高优先级优先但低优先级不会饿死
 class Scheduler {
 public:
     typedef std::shared_ptr<Scheduler> ptr;
     typedef Mutex MutexType;
+    // 本地任务队列的锁，临界区很短，使用自旋锁
+    typedef Spinlock QueueMutexType;
+
+    // 排队延迟(任务入队到开始执行)直方图的桶数
+    // 0号桶统计小于1微秒，第i个桶统计[2^(i-1), 2^i)微秒，最后一个桶包含更大的值
+    static const size_t QUEUE_DELAY_BUCKETS = 24;
+
+    // 任务优先级
+    // 调度线程按 HIGH:NORMAL:LOW = 16:4:1 的比例在有任务的优先级之间轮转取任务，
+    // 高优先级任务积压时低优先级任务仍能按比例得到执行
+    enum Priority {
+        // 延迟敏感的任务，IO事件唤醒的协程默认为HIGH
+        HIGH = 0,
+        NORMAL = 1,
+        // 后台任务，如通知扇出、缓存刷新
+        LOW = 2,
+        PRIORITY_COUNT = 3,
+    };
+
+    // 调度线程的统计
+    struct WorkerStats {
+        // 线程id
+        int thread = -1;
+        // 执行的任务数
+        uint64_t tasks = 0;
+        // 调度协程切换到任务协程或idle协程的次数
+        uint64_t switches = 0;
+        // 执行任务的时间(微秒)，连续执行任务时包含任务之间取任务的时间
+        uint64_t busyUs = 0;
+        // 空闲时间(微秒)：线程运行时间减去busyUs
+        uint64_t idleUs = 0;
+        // 阻塞等待IO事件的时间(微秒)，包含在idleUs中
+        uint64_t pollUs = 0;
+        // 本线程发出的tickle次数
+        uint64_t tickles = 0;
+    };
+
+    // 调度器的统计快照
+    struct Stats {
+        std::vector<WorkerStats> workers;
+        // 非调度线程发出的tickle次数
+        uint64_t externalTickles = 0;
+        // 所有线程合计的排队延迟直方图(按scheduler.queue_delay_sample采样)
+        uint64_t queueDelay[QUEUE_DELAY_BUCKETS] = {0};
+
+        // 排队延迟的p分位(0~1)，返回所在桶的上界(微秒)
+        uint64_t getQueueDelayPercentile(double p) const;
+
+        std::ostream& dump(std::ostream& os) const;
+    };
+
+    // 弹性线程池参数，见setElastic
+    struct ElasticOptions {
+        // 最少保留的调度线程数(不含use_caller的caller线程)
+        size_t minThreads = 1;
+        // 最近一个检查周期内排队延迟的p99超过该值(微秒)时扩容
+        uint64_t growDelayUs = 5000;
+        // 待调度任务数超过 growBacklog × 调度线程数 时扩容
+        size_t growBacklog = 64;
+        // 连续shrinkIdleMs毫秒都满足缩容条件时退出一个线程
+        uint64_t shrinkIdleMs = 30000;
+        // 缩容条件：少一个线程时剩下线程的利用率仍不超过shrinkUtil
+        double shrinkUtil = 0.5;
+    };
 
     // 创建调度器：threads 线程数量，use_caller 是否使用当前线程作为调用线程，协程调度器名称
-    Scheduler(size_t threads = 1, bool use_caller = true, const std::string& name = "Scheduler");
+    // affinity 调度线程的CPU亲和性和NUMA内存策略，use_caller的caller线程不受影响
+    Scheduler(size_t threads = 1, bool use_caller = true, const std::string& name = "Scheduler"
+              ,const ThreadAffinity& affinity = ThreadAffinity());
 
     virtual ~Scheduler();
 
@@ -31,6 +104,16 @@ public:
     // 获取当前线程的主协程
     static Fiber* GetMainFiber();
 
+    // 当前线程正在执行的任务本次开始执行的时间(单调时钟微秒)，不在执行任务时为0
+    static uint64_t GetTaskStartUs();
+
+    // 当前线程正在执行的任务的优先级，不在执行任务时为NORMAL
+    static Priority GetTaskPriority();
+
+    // 当前协程让出执行权，排到注入队列的尾部，本线程队列中已有的任务和外部提交的任务先执行
+    // 只能在调度器执行的任务协程中调用
+    static void YieldToQueue();
+
     //启动调度器
     void start();
 
@@ -38,24 +121,106 @@ public:
     void stop();
 
     // 添加调度任务: FiberOrCb 调度任务类型，可以是协程对象或函数指针。fc 协程或函数，thread 协程执行的线程id,-1表示任意线程
+    // priority 任务优先级，协程调用YieldToQueue重新入队时保持原来的优先级
     template<class FiberOrCb>
-    void schedule(FiberOrCb fc, int thread = -1) {
-        bool need_tickle = false;
-        {
-            MutexType::Lock lock(m_mutex);
-            // 将任务加入到队列中，若任务队列中已经有任务了，则tickle（）
-            need_tickle = scheduleNoLock(fc, thread);
+    void schedule(FiberOrCb fc, int thread = -1, Priority priority = NORMAL) {
+        ScheduleTask task(std::move(fc), thread);
+        if(!task.fiber && !task.cb) {
+            return;
+        }
+        task.priority = priority;
+        // 将任务加入到对应的队列中，有空闲线程时tickle
+        int target = -1;
+        if(enqueue(task, target)) {
+            countTickle();
+            // 指定了线程的任务只唤醒目标线程
+            if(target >= 0) {
+                tickleWorker(target);
+            } else {
+                tickle(); // 唤醒idle协程
+            }
         }
+    }
 
-        if(need_tickle) {
-            tickle(); // 唤醒idle协程
+    // 批量添加调度任务：begin/end 协程或函数的迭代器，元素会被swap走
+    // 所有任务一次性加入队列，最多tickle一次
+    template<class InputIterator>
+    void schedule(InputIterator begin, InputIterator end, Priority priority = NORMAL) {
+        Batch batch;
+        while(begin != end) {
+            batch.add(&*begin, -1, priority);
+            ++begin;
         }
+        schedule(batch);
     }
 
+    // 一批待调度的任务，见schedule(Batch&)
+    class Batch;
+
+    // 把batch中的任务一次性加入队列并清空batch
+    // 不指定线程的任务只加一次锁、最多tickle一次；指定线程的任务按目标线程分组，每个其他目标线程唤醒一次
+    void schedule(Batch& batch);
+
+    // 是否有空闲线程
+    bool hasIdleThreads() { return m_idleThreadCount > 0;}
+
+    // 待调度的任务数量
+    size_t getTaskCount() const { return m_taskCount;}
+
+    // 调度线程数量(包括use_caller的caller线程)
+    size_t getWorkerCount() const { return m_queues.size();}
+
+    // 当前线程在本调度器中的序号，非本调度器的线程返回-1
+    int getWorkerIndex() const;
+
+    // 序号为index的调度线程id，线程还没进入run时返回-1
+    int getWorkerThreadId(int index) const;
+
+    // 等序号为index的调度线程进入run，返回它的线程id；timeout_ms毫秒内没有进入run返回-1
+    int waitWorkerThreadId(int index, uint64_t timeout_ms = 1000) const;
+
+    // 是否把调用线程作为调度线程(序号为0)
+    bool isUseCaller() const { return m_useCaller;}
+
+    // 回调任务的协程是否使用共享栈(见Fiber构造函数)，只影响之后新建的协程
+    // 共享栈协程里不能使用协程同步原语和Future的等待；不支持时(如io_uring后端)返回false
+    bool setSharedStack(bool v);
+
+    bool isSharedStack() const { return m_sharedStack;}
+
+    // 开启弹性模式：调度线程数(不含caller线程)在[minThreads, 构造时的线程数]之间按队列指标自动伸缩
+    // 后台线程每scheduler.elastic_interval_ms检查一次：本周期排队延迟的p99超过growDelayUs，
+    // 或者积压的任务超过growBacklog × 线程数时增加一个线程；连续shrinkIdleMs都可以少一个线程时退出一个线程
+    // 退出的线程把没执行的任务(包括指定给它的)交给其他线程
+    // start之前调用时只启动minThreads个线程，之后调用(如IOManager)则从全部线程开始收缩
+    // 共享栈模式和不支持的调度器(每线程reactor/io_uring的IOManager)返回false
+    bool setElastic(const ElasticOptions& options);
+
+    bool isElastic() const { return m_elastic;}
+
+    // 创建watchdog线程(只创建一次)，它负责watchdog检查和弹性线程池的伸缩
+    // 开启scheduler.watchdog_ms或者调度器开启弹性模式时自动调用，两者都没开启时进程里没有这个线程
+    static void StartWatchdog();
+
+    // 当前运行的调度线程数(不含caller线程和正在退出的线程)
+    size_t getThreadCount();
+
+    // 统计快照：计数由各调度线程自己写入，读取不加锁，各项之间不保证严格一致
+    Stats getStats() const;
+
+    // 输出调度器状态
+    virtual std::ostream& dump(std::ostream& os);
+
+    // 输出调度线程的布局：每个线程实际允许运行的CPU和所在的NUMA节点
+    std::ostream& dumpLayout(std::ostream& os);
+
 protected:
     // 通知调度器有任务了
     virtual void tickle();
 
+    // 通知指定序号的调度线程有任务了，默认等同于tickle()
+    virtual void tickleWorker(int index);
+
     // 协程调度函数
     void run();
 
@@ -68,17 +233,21 @@ protected:
     // 设置当前的协程调度器
     void setThis();
 
-private:
-    // 添加调度任务(无锁)
-    template <class FiberOrCb>
-    bool scheduleNoLock(FiberOrCb fc, int thread) {
-        bool need_tickle = m_tasks.empty();
-        ScheduleTask task(fc, thread);
-        if (task.fiber || task.cb) {
-            m_tasks.push_back(task);
-        }
-        return need_tickle;
-    }
+    // 当前调度线程是否有可以执行的任务：自己的本地/指定任务、注入队列、其他线程可窃取的任务
+    // 指定给其他线程的任务不算，避免空闲线程因为别人的任务空转
+    bool hasRunnableTask();
+
+    // 累加当前调度线程阻塞等待IO事件的时间，非调度线程忽略
+    void addPollTime(uint64_t us);
+
+    // 是否支持共享栈协程：IO等待时把协程栈上的地址交给其他线程或内核的调度器不支持
+    virtual bool supportSharedStack() const { return true;}
+
+    // 是否支持弹性线程数：按线程序号分配资源(fd、定时器)的调度器不支持
+    virtual bool supportElastic() const { return true;}
+
+    // 弹性模式下当前调度线程被要求退出，idle应该尽快返回
+    bool retiring();
 
 private:
     // 调度任务，协程/函数二选一，可指定在哪个线程上调度
@@ -86,46 +255,230 @@ private:
         Fiber::ptr fiber;
         std::function<void()> cb;
         int thread;
+        // 优先级(Priority)
+        int priority = NORMAL;
+        // 入队时间(单调时钟微秒)，用于统计排队延迟，没有被采样时为0
+        uint64_t enqueueUs = 0;
 
         ScheduleTask(Fiber::ptr f, int thr) {
-            fiber  = f;
-            thread = thr;
+            fiber.swap(f);
+            thread = PinThread(fiber, thr);
         }
         ScheduleTask(Fiber::ptr *f, int thr) {
             fiber.swap(*f);
-            thread = thr;
+            thread = PinThread(fiber, thr);
         }
         ScheduleTask(std::function<void()> f, int thr) {
-            cb     = f;
+            cb.swap(f);
+            thread = thr;
+        }
+        ScheduleTask(std::function<void()> *f, int thr) {
+            cb.swap(*f);
             thread = thr;
         }
         ScheduleTask() { thread = -1; }
 
+        // 共享栈协程的栈内容在它绑定线程的共享栈上，只能回到那个线程执行
+        static int PinThread(const Fiber::ptr& f, int thr) {
+            int t = f ? f->getSharedStackThread() : -1;
+            return t == -1 ? thr : t;
+        }
+
         void reset() {
             fiber  = nullptr;
             cb     = nullptr;
             thread = -1;
+            priority = NORMAL;
+        }
+    };
+
+public:
+    // 一批待调度的任务：一次产生很多任务时(如一轮epoll_wait就绪的事件和超时的定时器)先收集起来，
+    // 再用schedule(Batch&)一次性入队，避免每个任务都加一次锁、tickle一次；清空后可以重复使用
+    class Batch {
+    friend class Scheduler;
+    public:
+        // 参数同Scheduler::schedule，协程或函数为空时忽略
+        template<class FiberOrCb>
+        void add(FiberOrCb fc, int thread = -1, Priority priority = NORMAL) {
+            ScheduleTask task(std::move(fc), thread);
+            if(!task.fiber && !task.cb) {
+                return;
+            }
+            task.priority = priority;
+            m_tasks.push_back(std::move(task));
+        }
+
+        size_t size() const { return m_tasks.size();}
+        bool empty() const { return m_tasks.empty();}
+    private:
+        std::vector<ScheduleTask> m_tasks;
+    };
+private:
+    // 按优先级分开的任务队列，同一优先级内先进先出
+    struct TaskLanes {
+        std::deque<ScheduleTask> lanes[PRIORITY_COUNT];
+        // 所有优先级的任务总数
+        size_t count = 0;
+
+        bool empty() const { return count == 0;}
+        size_t size() const { return count;}
+
+        void push_back(ScheduleTask&& task) {
+            lanes[task.priority].push_back(std::move(task));
+            ++count;
+        }
+
+        // 取出priority通道的第一个任务，调用前需确认该通道不为空
+        void pop_front(int priority, ScheduleTask& task) {
+            task = std::move(lanes[priority].front());
+            lanes[priority].pop_front();
+            --count;
+        }
+
+        void clear() {
+            for(auto& i : lanes) {
+                i.clear();
+            }
+            count = 0;
+        }
+    };
+
+    // 每个调度线程的任务队列
+    struct WorkerQueue {
+        // 可以被其他线程窃取的任务
+        TaskLanes tasks;
+        // 指定在本线程执行的任务，不能被窃取
+        TaskLanes pinned;
+        // 调度线程id，线程进入run之后才设置，弹性模式下线程退出后恢复为-1
+        std::atomic<int> threadId = {-1};
+        // 弹性模式：线程被要求退出，线程已经退出run
+        std::atomic<bool> retire = {false};
+        std::atomic<bool> exited = {false};
+        // 在m_queues中的序号
+        int index = 0;
+        QueueMutexType mutex;
+
+        // 正在执行的任务本次开始执行的时间和协程id，没有在执行任务时为0，给watchdog检查长时间运行的协程
+        std::atomic<uint64_t> runningSince = {0};
+        std::atomic<uint64_t> runningFiber = {0};
+        // watchdog已经报告过的runningSince，同一次执行只报告一次，只由watchdog线程访问
+        uint64_t watchdogReported = 0;
+
+        // 统计计数和上面被其他线程频繁加锁的字段隔开，避免伪共享
+        char padding[64];
+        // 统计计数，只由所属线程写入(Add)，其他线程读取快照，不需要原子的读改写
+        std::atomic<uint64_t> runTasks = {0};
+        std::atomic<uint64_t> switches = {0};
+        std::atomic<uint64_t> busyUs = {0};
+        // 线程进入/退出run的时间(单调时钟微秒)
+        std::atomic<uint64_t> startUs = {0};
+        std::atomic<uint64_t> exitUs = {0};
+        std::atomic<uint64_t> pollUs = {0};
+        std::atomic<uint64_t> tickles = {0};
+        std::atomic<uint64_t> queueDelay[QUEUE_DELAY_BUCKETS];
+
+        WorkerQueue() {
+            for(auto& i : queueDelay) {
+                i = 0;
+            }
+        }
+
+        static void Add(std::atomic<uint64_t>& counter, uint64_t v) {
+            counter.store(counter.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
         }
     };
 
+    // 将任务加入队列，返回是否需要tickle，target 返回需要唤醒的线程序号，-1表示任意线程
+    bool enqueue(ScheduleTask& task, int& target);
+
+    // 批量加入队列，连续指定同一线程的任务和不指定线程的任务各只加一次锁
+    // 返回不指定线程的任务是否需要tickle，targets 返回需要唤醒的其他线程序号
+    bool enqueue(std::vector<ScheduleTask>& tasks, std::vector<int>& targets);
+
+    // 根据线程id找到对应的本地队列，找不到返回nullptr
+    WorkerQueue* getQueueByThread(int thread);
+
+    // 当前线程在本调度器中的本地队列，非调度线程返回nullptr
+    WorkerQueue* getLocalQueue();
+
+    // 创建线程池第i个线程，调用时需持有m_mutex
+    void startThread(size_t i);
+
+    // 弹性模式的检查，由后台线程定期调用
+    void elasticCheck(uint64_t now);
+
+    // 回收已经退出的线程，调用时需持有m_mutex
+    void reapRetired();
+
+    // 弹性模式下退出的调度线程在run返回前调用：把本地任务交还注入队列
+    void retireWorker(WorkerQueue* local);
+
+    // 为当前调度线程取一个任务：本地指定任务 -> 本地任务 -> 注入队列 -> 窃取
+    bool dequeue(ScheduleTask& task);
+
+    // 按优先级轮转从本地队列取一个任务，同一优先级内指定本线程的任务先执行，调用时需持有local->mutex
+    bool popLocal(WorkerQueue* local, ScheduleTask& task);
+
+    // 把一批任务放入本地队列并按优先级轮转取出一个，指定了本线程的任务放入pinned
+    bool pushLocal(WorkerQueue* local, std::vector<ScheduleTask>& batch, ScheduleTask& task);
+
+    // 从注入队列的每个优先级按比例领取一批任务放入本地队列，再按优先级轮转取出一个通过task返回
+    bool takeFromInjection(WorkerQueue* local, ScheduleTask& task);
+
+    // 从其他线程的本地队列窃取每个优先级的一半任务放入本地队列，再按优先级轮转取出一个通过task返回
+    bool steal(WorkerQueue* local, ScheduleTask& task);
+
+    // 记录开始执行一个任务和它的排队延迟，now为当前单调时钟微秒
+    void countTask(WorkerQueue* local, const ScheduleTask& task, uint64_t now);
+
+    // 累加从begin到现在执行任务的时间，返回现在的时间
+    uint64_t countBusy(WorkerQueue* local, uint64_t begin);
+
+    // 记录开始执行协程f，now为开始时间
+    void beginRun(WorkerQueue* local, Fiber* f, uint64_t now);
+
+    // 记录任务执行结束，协程调用了YieldToQueue时把它重新放回队列
+    void endRun(WorkerQueue* local, Fiber::ptr& f);
+
+    // watchdog线程：定期检查所有调度器中连续运行时间过长的协程
+    static void WatchdogMain();
+
+    // 检查本调度器中连续运行超过limit_us的协程，输出协程id和调用栈
+    void watchdogCheck(uint64_t now, uint64_t limit_us);
+
+    // 记录一次tickle：调度线程记在自己的计数上，其他线程记在m_externalTickles
+    void countTickle();
+
+    // 执行完的协程放回本线程的回调协程池，不满足复用条件的直接释放
+    void recycleFiber(std::vector<Fiber::ptr>& pool, Fiber::ptr& fiber, uint32_t stacksize);
+
 private:
     // 协程调度器名称
     std::string m_name;
-    // 互斥锁
+    // 互斥锁，保护注入队列和线程池
     MutexType m_mutex;
     // 线程池
     std::vector<Thread::ptr> m_threads;
-    // 任务队列
-    std::list<ScheduleTask> m_tasks;
+    // 注入队列：调度器外部线程提交的任务
+    TaskLanes m_tasks;
+    // 每个调度线程的本地队列，下标即线程序号(use_caller时caller线程为0)，构造后不再变化
+    std::vector<WorkerQueue*> m_queues;
     // 线程池的线程ID数组
     std::vector<int> m_threadIds;
     // 工作线程数量，不包含use_caller的主线程
     size_t m_threadCount = 0;
+    // 全部队列中待调度的任务总数
+    std::atomic<size_t> m_taskCount = {0};
     // 活跃线程数
     std::atomic<size_t> m_activeThreadCount = {0};
     // idle线程数
     std::atomic<size_t> m_idleThreadCount = {0};
+    // 非调度线程发出的tickle次数
+    std::atomic<uint64_t> m_externalTickles = {0};
 
+    // 调度线程的CPU亲和性和NUMA内存策略
+    ThreadAffinity m_affinity;
     // 是否use caller
     bool m_useCaller;
     // use_caller为true时，调度器所在线程的调度协程
@@ -135,6 +488,26 @@ private:
 
     // 是否正在停止
     bool m_stopping = false;
+
+    // 弹性模式
+    std::atomic<bool> m_elastic = {false};
+    ElasticOptions m_elasticOptions;
+    // 弹性模式的检查状态，只由后台检查线程访问
+    struct ElasticState {
+        // 上次检查的时间，和当时所有线程累计的执行时间、排队延迟直方图
+        uint64_t lastCheckUs = 0;
+        uint64_t busyUs = 0;
+        uint64_t queueDelay[QUEUE_DELAY_BUCKETS] = {0};
+        // 从什么时候开始一直满足缩容条件，0表示不满足
+        uint64_t shrinkSince = 0;
+    } m_elasticState;
+    // 扩容和缩容的次数
+    std::atomic<uint64_t> m_elasticGrows = {0};
+    std::atomic<uint64_t> m_elasticShrinks = {0};
+    // 弹性模式下已经退出的调度线程id，指定给它们的任务改由任意线程执行，由m_mutex保护
+    std::vector<int> m_retiredThreads;
+    // 回调任务的协程是否使用共享栈
+    std::atomic<bool> m_sharedStack = {false};
 };
 
 }
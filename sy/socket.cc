@@ -115,6 +115,16 @@ bool Socket::setOption(int level, int option, const void* result, socklen_t len)
     return true;
 }
 
+bool Socket::setReusePort(bool v) {
+    if(!isValid()) {
+        newSock();
+        if(SY_UNLIKELY(!isValid())) {
+            return false;
+        }
+    }
+    return setOption(SOL_SOCKET, SO_REUSEPORT, (int)v);
+}
+
 Socket::ptr Socket::accept() {
     Socket::ptr sock(new Socket(m_family, m_type, m_protocol));
     int newsock = ::accept(m_sock, nullptr, nullptr);
@@ -129,6 +139,42 @@ Socket::ptr Socket::accept() {
     return nullptr;
 }
 
+size_t Socket::acceptMulti(std::vector<Socket::ptr>& socks, size_t max) {
+    // 系统层面阻塞的监听socket取不到已排队的连接时会阻塞线程，只接收一个
+    FdCtx::ptr ctx = FdMgr::GetInstance()->get(m_sock);
+    if(!ctx || !ctx->getSysNonblock()) {
+        max = 1;
+    }
+    size_t count = 0;
+    while(count < max) {
+        int newsock = -1;
+        if(count == 0) {
+            // hook的accept4，没有连接时挂起等待
+            newsock = ::accept4(m_sock, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        } else {
+            newsock = accept4_f(m_sock, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if(newsock >= 0) {
+                FdMgr::GetInstance()->get(newsock, true);
+            }
+        }
+        if(newsock == -1) {
+            if(count == 0) {
+                SY_LOG_ERROR(g_logger) << "accept4(" << m_sock << ") errno="
+                    << errno << " errstr=" << strerror(errno);
+            }
+            break;
+        }
+        Socket::ptr sock(new Socket(m_family, m_type, m_protocol));
+        if(!sock->init(newsock)) {
+            ::close(newsock);
+            continue;
+        }
+        socks.push_back(sock);
+        ++count;
+    }
+    return count;
+}
+
 bool Socket::init(int sock) {
     FdCtx::ptr ctx = FdMgr::GetInstance()->get(sock);
     if(ctx && ctx->isSocket() && !ctx->isClose()) {
@@ -305,6 +351,20 @@ int Socket::recv(iovec* buffers, size_t length, int flags) {
     return -1;
 }
 
+int Socket::recvMulti(struct mmsghdr* msgs, unsigned int vlen, int flags) {
+    if(isConnected()) {
+        return ::recvmmsg(m_sock, msgs, vlen, flags, nullptr);
+    }
+    return -1;
+}
+
+int Socket::sendMulti(struct mmsghdr* msgs, unsigned int vlen, int flags) {
+    if(isConnected()) {
+        return ::sendmmsg(m_sock, msgs, vlen, flags);
+    }
+    return -1;
+}
+
 int Socket::recvFrom(void* buffer, size_t length, Address::ptr from, int flags) {
     if(isConnected()) {
         socklen_t len = from->getAddrLen();
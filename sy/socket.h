@@ -90,10 +90,17 @@ public:
         return setOption(level, option, &value, sizeof(T));
     }
 
+    // 设置SO_REUSEPORT，需在bind之前调用，socket句柄还没创建时先创建
+    bool setReusePort(bool v);
+
     // 接收connect链接
     // 成功返回新连接的socket,失败返回nullptr
     virtual Socket::ptr accept();
 
+    // 批量接收连接：等到第一个连接后，继续用accept4取出已经在队列里的连接，最多max个
+    // 新连接放入socks，返回接收的个数，第一个连接就失败时返回0
+    size_t acceptMulti(std::vector<Socket::ptr>& socks, size_t max);
+
     // 绑定地址
     virtual bool bind(const Address::ptr addr);
 
@@ -139,6 +146,13 @@ public:
     // 指定地址接收数据：多数据块
     virtual int recvFrom(iovec* buffers, size_t length, Address::ptr from, int flags = 0);
 
+    // 批量接收数据报(recvmmsg)：msgs 每个数据报的msghdr，vlen 个数
+    // 返回收到的数据报个数，每个的长度在msg_len中，<0 socket出错
+    int recvMulti(struct mmsghdr* msgs, unsigned int vlen, int flags = 0);
+
+    // 批量发送数据报(sendmmsg)，返回发送的数据报个数，<0 socket出错
+    int sendMulti(struct mmsghdr* msgs, unsigned int vlen, int flags = 0);
+
     Address::ptr getRemoteAddress();
 
     Address::ptr getLocalAddress();
@@ -0,0 +1,246 @@
+#include "stack_allocator.h"
+#include "config.h"
+#include "log.h"
+#include "macro.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+
+namespace sy {
+
+static Logger::ptr g_logger = SY_LOG_NAME("system");
+
+// 协程栈分配器：malloc 每次malloc/free，pooled 线程级缓存的mmap栈(带保护页)
+static ConfigVar<std::string>::ptr g_stack_allocator =
+    Config::Lookup<std::string>("fiber.stack_allocator", "malloc", "fiber stack allocator, malloc|pooled");
+
+// 每个线程最多缓存的协程栈数量
+static ConfigVar<uint32_t>::ptr g_stack_pool_max_cached =
+    Config::Lookup<uint32_t>("fiber.stack_pool.max_cached", 256, "max cached fiber stacks per thread");
+
+// 是否对协程栈启用透明大页
+static ConfigVar<bool>::ptr g_stack_pool_huge_page =
+    Config::Lookup<bool>("fiber.stack_pool.huge_page", false, "madvise fiber stacks with MADV_HUGEPAGE");
+
+static size_t s_page_size = sysconf(_SC_PAGESIZE);
+static std::atomic<StackAllocator*> s_default_allocator = {nullptr};
+static std::atomic<uint32_t> s_max_cached = {256};
+static std::atomic<bool> s_huge_page = {false};
+
+void* MallocStackAllocator::alloc(size_t size) {
+    return malloc(size);
+}
+
+void MallocStackAllocator::dealloc(void* vp, size_t size) {
+    free(vp);
+}
+
+// 本线程的栈缓存是否已经析构：之后线程退出/进程退出的析构函数里释放的协程(如单例持有的Fiber::ptr)
+// 不能再访问缓存，直接归还给系统。普通的bool不需要构造和析构，任何时候都可以读
+static thread_local bool t_stack_cache_destroyed = false;
+
+// 线程级栈缓存：每个尺寸等级一个空闲数组，线程退出时释放全部缓存
+struct ThreadStackCache {
+    std::vector<void*> free_list[PooledStackAllocator::MAX_CLASSES];
+    uint32_t count = 0;
+
+    void trim() {
+        auto& stats = PooledStackAllocator::GetStats();
+        for(size_t i = 0; i < PooledStackAllocator::MAX_CLASSES; ++i) {
+            size_t size = PooledStackAllocator::ClassSize(i);
+            for(auto& vp : free_list[i]) {
+                PooledStackAllocator::UnmapStack(vp, size);
+                --stats.cached;
+                stats.cached_bytes -= size;
+            }
+            free_list[i].clear();
+        }
+        count = 0;
+    }
+
+    ~ThreadStackCache() {
+        trim();
+        t_stack_cache_destroyed = true;
+    }
+};
+
+static thread_local ThreadStackCache t_stack_cache;
+
+PooledStackAllocator::Stats& PooledStackAllocator::GetStats() {
+    static Stats s_stats;
+    return s_stats;
+}
+
+size_t PooledStackAllocator::SizeClass(size_t size) {
+    size_t cls = 0;
+    while(cls < MAX_CLASSES && ClassSize(cls) < size) {
+        ++cls;
+    }
+    return cls;
+}
+
+size_t PooledStackAllocator::ClassSize(size_t cls) {
+    return (size_t)1 << (MIN_CLASS_SHIFT + cls);
+}
+
+void* PooledStackAllocator::MapStack(size_t size) {
+    // 多映射一个页作为保护页，栈从高地址向低地址增长，所以保护页放在最低处
+    size_t total = size + s_page_size;
+    void* base = mmap(nullptr, total, PROT_READ | PROT_WRITE
+                      ,MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if(base == MAP_FAILED) {
+        SY_LOG_ERROR(g_logger) << "mmap stack size=" << total
+            << " errno=" << errno << " errstr=" << strerror(errno);
+        return nullptr;
+    }
+    if(mprotect(base, s_page_size, PROT_NONE)) {
+        SY_LOG_ERROR(g_logger) << "mprotect guard page errno=" << errno
+            << " errstr=" << strerror(errno);
+        munmap(base, total);
+        return nullptr;
+    }
+#ifdef MADV_HUGEPAGE
+    if(s_huge_page) {
+        madvise((char*)base + s_page_size, size, MADV_HUGEPAGE);
+    }
+#endif
+    return (char*)base + s_page_size;
+}
+
+void PooledStackAllocator::UnmapStack(void* vp, size_t size) {
+    munmap((char*)vp - s_page_size, size + s_page_size);
+}
+
+void* PooledStackAllocator::alloc(size_t size) {
+    auto& stats = GetStats();
+    ++stats.allocs;
+    size_t cls = SizeClass(size);
+    // 超出最大尺寸等级的栈不缓存，按页对齐后直接mmap
+    if(SY_UNLIKELY(cls >= MAX_CLASSES)) {
+        size_t aligned = (size + s_page_size - 1) / s_page_size * s_page_size;
+        ++stats.mapped;
+        return MapStack(aligned);
+    }
+    if(SY_UNLIKELY(t_stack_cache_destroyed)) {
+        ++stats.mapped;
+        return MapStack(ClassSize(cls));
+    }
+
+    auto& fl = t_stack_cache.free_list[cls];
+    if(!fl.empty()) {
+        void* vp = fl.back();
+        fl.pop_back();
+        --t_stack_cache.count;
+        ++stats.reused;
+        --stats.cached;
+        stats.cached_bytes -= ClassSize(cls);
+        return vp;
+    }
+    ++stats.mapped;
+    return MapStack(ClassSize(cls));
+}
+
+void PooledStackAllocator::dealloc(void* vp, size_t size) {
+    if(!vp) {
+        return;
+    }
+    auto& stats = GetStats();
+    ++stats.deallocs;
+    size_t cls = SizeClass(size);
+    if(SY_UNLIKELY(cls >= MAX_CLASSES)) {
+        size_t aligned = (size + s_page_size - 1) / s_page_size * s_page_size;
+        ++stats.unmapped;
+        UnmapStack(vp, aligned);
+        return;
+    }
+
+    // 本线程缓存已满或者已经析构，直接归还给系统
+    if(SY_UNLIKELY(t_stack_cache_destroyed) || t_stack_cache.count >= s_max_cached) {
+        ++stats.unmapped;
+        UnmapStack(vp, ClassSize(cls));
+        return;
+    }
+    t_stack_cache.free_list[cls].push_back(vp);
+    ++t_stack_cache.count;
+    ++stats.cached;
+    stats.cached_bytes += ClassSize(cls);
+}
+
+void PooledStackAllocator::trimThreadCache() {
+    if(t_stack_cache_destroyed) {
+        return;
+    }
+    t_stack_cache.trim();
+}
+
+std::ostream& PooledStackAllocator::dump(std::ostream& os) const {
+    auto& stats = GetStats();
+    os << "[PooledStackAllocator allocs=" << stats.allocs
+       << " deallocs=" << stats.deallocs
+       << " reused=" << stats.reused
+       << " mapped=" << stats.mapped
+       << " unmapped=" << stats.unmapped
+       << " cached=" << stats.cached
+       << " cached_bytes=" << stats.cached_bytes
+       << " huge_page=" << s_huge_page
+       << " max_cached=" << s_max_cached
+       << "]";
+    return os;
+}
+
+StackAllocator* StackAllocator::Get(const std::string& name) {
+    static MallocStackAllocator s_malloc;
+    static PooledStackAllocator s_pooled;
+    if(name == "malloc") {
+        return &s_malloc;
+    } else if(name == "pooled") {
+        return &s_pooled;
+    }
+    return nullptr;
+}
+
+static StackAllocator* LookupAllocator(const std::string& name) {
+    StackAllocator* alloc = StackAllocator::Get(name);
+    if(SY_UNLIKELY(!alloc)) {
+        SY_LOG_ERROR(g_logger) << "invalid fiber.stack_allocator="
+            << name << ", use malloc";
+        return StackAllocator::Get("malloc");
+    }
+    return alloc;
+}
+
+// 配置值缓存到原子变量中，协程创建/析构时不再走ConfigVar的读锁
+struct _StackAllocatorIniter {
+    _StackAllocatorIniter() {
+        s_default_allocator = LookupAllocator(g_stack_allocator->getValue());
+        s_max_cached = g_stack_pool_max_cached->getValue();
+        s_huge_page = g_stack_pool_huge_page->getValue();
+
+        g_stack_allocator->addListener([](const std::string& old_value, const std::string& new_value){
+            SY_LOG_INFO(g_logger) << "fiber stack allocator changed from "
+                                  << old_value << " to " << new_value;
+            s_default_allocator = LookupAllocator(new_value);
+        });
+        g_stack_pool_max_cached->addListener([](const uint32_t& old_value, const uint32_t& new_value){
+            s_max_cached = new_value;
+        });
+        g_stack_pool_huge_page->addListener([](const bool& old_value, const bool& new_value){
+            s_huge_page = new_value;
+        });
+    }
+};
+
+static _StackAllocatorIniter s_stack_allocator_initer;
+
+StackAllocator* StackAllocator::GetDefault() {
+    StackAllocator* alloc = s_default_allocator;
+    if(SY_UNLIKELY(!alloc)) {
+        return Get("malloc");
+    }
+    return alloc;
+}
+
+}
@@ -0,0 +1,102 @@
+// 协程栈分配器
+#ifndef __SY_STACK_ALLOCATOR_H__
+#define __SY_STACK_ALLOCATOR_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <ostream>
+#include <string>
+
+namespace sy {
+
+// 协程栈分配器基类
+// 协程创建时通过alloc拿到运行栈，析构时通过dealloc归还，具体使用哪个分配器由配置fiber.stack_allocator决定
+class StackAllocator {
+public:
+    typedef std::shared_ptr<StackAllocator> ptr;
+
+    virtual ~StackAllocator() {}
+
+    // 分配size字节的运行栈，返回栈的低地址
+    virtual void* alloc(size_t size) = 0;
+
+    // 释放运行栈，size必须和alloc时传入的一致
+    virtual void dealloc(void* vp, size_t size) = 0;
+
+    // 分配器名称
+    virtual const char* getName() const = 0;
+
+    // 获取当前配置的分配器(进程内单例)
+    static StackAllocator* GetDefault();
+
+    // 按名称获取分配器：malloc / pooled，不存在返回nullptr
+    static StackAllocator* Get(const std::string& name);
+};
+
+// malloc栈内存分配器：每次都直接malloc/free，不做任何缓存
+class MallocStackAllocator : public StackAllocator {
+public:
+    void* alloc(size_t size) override;
+    void dealloc(void* vp, size_t size) override;
+    const char* getName() const override { return "malloc";}
+};
+
+// 池化的mmap栈内存分配器
+// 1. 栈内存通过mmap分配，在栈底(低地址)多映射一个PROT_NONE的保护页，栈溢出时直接SIGSEGV，而不是悄悄踩坏堆
+// 2. 栈大小按2的幂划分尺寸等级，每个线程对每个等级维护一个空闲链表，协程释放的栈优先缓存到本线程的链表中
+// 3. 每个线程缓存的栈总数有上限(fiber.stack_pool.max_cached)，超过上限的直接munmap
+// 4. 可选大页模式(fiber.stack_pool.huge_page)，对栈内存madvise(MADV_HUGEPAGE)
+class PooledStackAllocator : public StackAllocator {
+public:
+    // 统计信息，全部线程累加
+    struct Stats {
+        // alloc调用次数
+        std::atomic<uint64_t> allocs = {0};
+        // dealloc调用次数
+        std::atomic<uint64_t> deallocs = {0};
+        // 命中线程缓存，复用已有栈的次数
+        std::atomic<uint64_t> reused = {0};
+        // 新mmap出来的栈数量
+        std::atomic<uint64_t> mapped = {0};
+        // 真正munmap掉的栈数量
+        std::atomic<uint64_t> unmapped = {0};
+        // 当前所有线程缓存中的栈数量
+        std::atomic<int64_t> cached = {0};
+        // 当前所有线程缓存中的栈占用的字节数
+        std::atomic<int64_t> cached_bytes = {0};
+    };
+
+    // 尺寸等级数量：最小等级4KB(2^12)，最大等级(2^(12+MAX_CLASSES-1))
+    static const size_t MIN_CLASS_SHIFT = 12;
+    static const size_t MAX_CLASSES = 16;
+
+    void* alloc(size_t size) override;
+    void dealloc(void* vp, size_t size) override;
+    const char* getName() const override { return "pooled";}
+
+    // 清空当前线程的缓存
+    void trimThreadCache();
+
+    // 输出统计信息
+    std::ostream& dump(std::ostream& os) const;
+
+    static Stats& GetStats();
+
+    // 计算size对应的尺寸等级，超出最大等级返回MAX_CLASSES
+    static size_t SizeClass(size_t size);
+
+    // 尺寸等级对应的栈大小
+    static size_t ClassSize(size_t cls);
+
+    // 直接mmap一块带保护页的栈内存，size必须是页大小的整数倍
+    static void* MapStack(size_t size);
+
+    // 释放MapStack分配的栈内存
+    static void UnmapStack(void* vp, size_t size);
+};
+
+}
+
+#endif
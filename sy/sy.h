@@ -6,11 +6,16 @@
 #include "bytearray.h"
 #include "config.h"
 #include "daemon.h"
+#include "dns.h"
 #include "endian.h"
 #include "env.h"
 #include "fd_manager.h"
+#include "file_io.h"
 #include "fiber.h"
+#include "fiber_sync.h"
+#include "future.h"
 #include "hook.h"
+#include "io_uring.h"
 #include "iomanager.h"
 #include "library.h"
 #include "log.h"
@@ -18,14 +23,17 @@
 #include "module.h"
 #include "mutex.h"
 #include "noncopyable.h"
+#include "parallel.h"
 #include "protocol.h"
 #include "scheduler.h"
 #include "singleton.h"
 #include "socket.h"
+#include "stack_allocator.h"
 #include "stream.h"
 #include "tcp_server.h"
 #include "thread.h"
 #include "timer.h"
+#include "udp_server.h"
 #include "uri.h"
 #include "util.h"
 #include "worker.h"
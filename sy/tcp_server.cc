@@ -1,6 +1,13 @@
 #include "tcp_server.h"
 #include "config.h"
 #include "log.h"
+#include "thread.h"
+#include <algorithm>
+
+// 旧的内核头文件里没有的定义
+#ifndef SO_INCOMING_CPU
+#define SO_INCOMING_CPU 49
+#endif
 
 namespace sy {
 
@@ -28,8 +35,18 @@ TcpServer::~TcpServer() {
     m_socks.clear();
 }
 
+void TcpServer::setConf(TcpServerConf::ptr v) {
+    m_conf = v;
+    if(v) {
+        m_reusePort = v->reuseport;
+        m_acceptBatch = v->accept_batch > 0 ? v->accept_batch : 1;
+        m_incomingCpu = v->incoming_cpu;
+        m_deferAccept = v->defer_accept;
+    }
+}
+
 void TcpServer::setConf(const TcpServerConf& v) {
-    m_conf.reset(new TcpServerConf(v));
+    setConf(TcpServerConf::ptr(new TcpServerConf(v)));
 }
 
 bool TcpServer::bind(sy::Address::ptr addr, bool ssl) {
@@ -44,23 +61,49 @@ bool TcpServer::bind(const std::vector<Address::ptr>& addrs
                         ,std::vector<Address::ptr>& fails
                         ,bool ssl) {
     m_ssl = ssl;
+    // 共享epoll模式下协程被唤醒后可能换线程，接收循环和连接都留不在监听socket所属的线程上
+    if(m_reusePort && !m_ioWorker->isPerThreadReactor()) {
+        SY_LOG_WARN(g_logger) << "reuseport needs iomanager.per_thread_reactor, io_worker="
+            << m_ioWorker->getName() << " uses a shared epoll, fall back to one listener per address";
+        m_reusePort = false;
+    }
     for(auto& addr : addrs) {
-        Socket::ptr sock = ssl ? SSLSocket::CreateTCP(addr) : Socket::CreateTCP(addr); // 创建TCPsocket
-        if(!sock->bind(addr)) {
-            SY_LOG_ERROR(g_logger) << "bind fail errno="
-                << errno << " errstr=" << strerror(errno)
-                << " addr=[" << addr->toString() << "]";
-            fails.push_back(addr);
-            continue;
-        }
-        if(!sock->listen()) {
-            SY_LOG_ERROR(g_logger) << "listen fail errno="
-                << errno << " errstr=" << strerror(errno)
-                << " addr=[" << addr->toString() << "]";
-            fails.push_back(addr);
-            continue;
+        // reuseport只用于IP地址，每个IO线程一个监听socket
+        bool is_ip = !!std::dynamic_pointer_cast<IPAddress>(addr);
+        size_t count = (m_reusePort && is_ip) ? m_ioWorker->getReactorThreadCount() : 1;
+        // 端口为0时后面的socket绑定到第一个socket分配到的端口
+        Address::ptr bind_addr = addr;
+        for(size_t i = 0; i < count; ++i) {
+            Socket::ptr sock = ssl ? SSLSocket::CreateTCP(addr) : Socket::CreateTCP(addr); // 创建TCPsocket
+            if(count > 1 && !sock->setReusePort(true)) {
+                SY_LOG_ERROR(g_logger) << "set SO_REUSEPORT fail errno="
+                    << errno << " errstr=" << strerror(errno)
+                    << " addr=[" << addr->toString() << "]";
+                fails.push_back(addr);
+                break;
+            }
+            if(!sock->bind(bind_addr)) {
+                SY_LOG_ERROR(g_logger) << "bind fail errno="
+                    << errno << " errstr=" << strerror(errno)
+                    << " addr=[" << bind_addr->toString() << "]";
+                fails.push_back(addr);
+                break;
+            }
+            if(m_deferAccept > 0 && is_ip) {
+                sock->setOption(IPPROTO_TCP, TCP_DEFER_ACCEPT, m_deferAccept);
+            }
+            if(!sock->listen()) {
+                SY_LOG_ERROR(g_logger) << "listen fail errno="
+                    << errno << " errstr=" << strerror(errno)
+                    << " addr=[" << bind_addr->toString() << "]";
+                fails.push_back(addr);
+                break;
+            }
+            if(i == 0) {
+                bind_addr = sock->getLocalAddress();
+            }
+            m_socks.push_back(sock);
         }
-        m_socks.push_back(sock);
     }
 
     if(!fails.empty()) { // 有绑定失败的地址，清空监听socket数组
@@ -72,21 +115,50 @@ bool TcpServer::bind(const std::vector<Address::ptr>& addrs
         SY_LOG_INFO(g_logger) << "type=" << m_type
             << " name=" << m_name
             << " ssl=" << m_ssl
+            << " reuseport=" << m_reusePort
             << " server bind success: " << *i;
     }
     return true;
 }
 
 void TcpServer::startAccept(Socket::ptr sock) {
+    // 内核优先把在本线程所在CPU上收到的连接交给这个监听socket
+    if(m_reusePort && m_incomingCpu) {
+        std::vector<int> cpus = Thread::GetCpus(sy::GetThreadId());
+        if(cpus.size() == 1) {
+            sock->setOption(SOL_SOCKET, SO_INCOMING_CPU, cpus[0]);
+        } else {
+            SY_LOG_WARN(g_logger) << "incoming_cpu ignored, thread " << sy::GetThreadId()
+                << " is not bound to a single cpu, sock=" << *sock;
+        }
+    }
+    std::vector<Socket::ptr> clients;
     while(!m_isStop) {
-        Socket::ptr client = sock->accept();
-        if(client) {
-            client->setRecvTimeout(m_recvTimeout);
-            m_ioWorker->schedule(std::bind(&TcpServer::handleClient,
-                        shared_from_this(), client));
+        clients.clear();
+        // SSL的accept要在新socket上握手，逐个接收
+        if(m_ssl) {
+            Socket::ptr client = sock->accept();
+            if(client) {
+                clients.push_back(client);
+            }
         } else {
+            sock->acceptMulti(clients, m_acceptBatch);
+        }
+        if(clients.empty()) {
             SY_LOG_ERROR(g_logger) << "accept errno=" << errno
                 << " errstr=" << strerror(errno);
+            continue;
+        }
+        for(auto& client : clients) {
+            client->setRecvTimeout(m_recvTimeout);
+            auto cb = std::bind(&TcpServer::handleClient, shared_from_this(), client);
+            if(m_reusePort) {
+                // 连接留在接收它的IO线程上处理
+                m_ioWorker->schedule(cb, sy::GetThreadId());
+            } else {
+                // 每线程reactor模式下连接固定在一个IO线程上处理，共享epoll模式等同于schedule
+                m_ioWorker->scheduleFd(client->getSocket(), cb);
+            }
         }
     }
 }
@@ -96,6 +168,21 @@ bool TcpServer::start() {
         return true;
     }
     m_isStop = false;
+    if(m_reusePort) {
+        // 第i个监听socket的接收循环放在第i个IO线程上，同一地址的监听socket分到不同线程
+        // 接收循环第一次等待时监听socket归属于这个线程，之后一直在这个线程上被唤醒
+        std::vector<int> threads;
+        if(!m_ioWorker->waitReactorThreads(threads)) {
+            SY_LOG_ERROR(g_logger) << "start fail, io_worker=" << m_ioWorker->getName();
+            m_isStop = true;
+            return false;
+        }
+        for(size_t i = 0; i < m_socks.size(); ++i) {
+            m_ioWorker->schedule(std::bind(&TcpServer::startAccept,
+                        shared_from_this(), m_socks[i]), threads[i % threads.size()]);
+        }
+        return true;
+    }
     for(auto& sock : m_socks) {
         m_acceptWorker->schedule(std::bind(&TcpServer::startAccept,
                     shared_from_this(), sock));
@@ -137,7 +224,9 @@ std::string TcpServer::toString(const std::string& prefix) {
        << " name=" << m_name << " ssl=" << m_ssl
        << " worker=" << (m_worker ? m_worker->getName() : "")
        << " accept=" << (m_acceptWorker ? m_acceptWorker->getName() : "")
-       << " recv_timeout=" << m_recvTimeout << "]" << std::endl;
+       << " recv_timeout=" << m_recvTimeout
+       << " reuseport=" << m_reusePort
+       << " accept_batch=" << m_acceptBatch << "]" << std::endl;
     std::string pfx = prefix.empty() ? "    " : prefix;
     for(auto& i : m_socks) {
         ss << pfx << pfx << *i << std::endl;
@@ -28,6 +28,15 @@ struct TcpServerConf {
     std::string io_worker;
     std::string process_worker;
     std::map<std::string, std::string> args;
+    // 每个IO线程一个SO_REUSEPORT监听socket，在本线程接收并处理自己的连接，不使用accept_worker
+    // io_worker需要开启iomanager.per_thread_reactor，否则退回每个地址一个监听socket
+    int reuseport = 0;
+    // 每次最多连续接收的连接数
+    int accept_batch = 16;
+    // reuseport时按监听线程绑定的CPU设置SO_INCOMING_CPU，IO线程需要各自绑定到一个CPU
+    int incoming_cpu = 0;
+    // TCP_DEFER_ACCEPT秒数，连接有数据到达才接收，0不设置
+    int defer_accept = 0;
 
     bool isValid() const {
         return !address.empty();
@@ -46,7 +55,11 @@ struct TcpServerConf {
             && process_worker == oth.process_worker
             && args == oth.args
             && id == oth.id
-            && type == oth.type;
+            && type == oth.type
+            && reuseport == oth.reuseport
+            && accept_batch == oth.accept_batch
+            && incoming_cpu == oth.incoming_cpu
+            && defer_accept == oth.defer_accept;
     }
 };
 
@@ -67,6 +80,10 @@ public:
         conf.accept_worker = node["accept_worker"].as<std::string>();
         conf.io_worker = node["io_worker"].as<std::string>();
         conf.process_worker = node["process_worker"].as<std::string>();
+        conf.reuseport = node["reuseport"].as<int>(conf.reuseport);
+        conf.accept_batch = node["accept_batch"].as<int>(conf.accept_batch);
+        conf.incoming_cpu = node["incoming_cpu"].as<int>(conf.incoming_cpu);
+        conf.defer_accept = node["defer_accept"].as<int>(conf.defer_accept);
         conf.args = LexicalCast<std::string
             ,std::map<std::string, std::string> >()(node["args"].as<std::string>(""));
         if(node["address"].IsDefined()) {
@@ -94,6 +111,10 @@ public:
         node["accept_worker"] = conf.accept_worker;
         node["io_worker"] = conf.io_worker;
         node["process_worker"] = conf.process_worker;
+        node["reuseport"] = conf.reuseport;
+        node["accept_batch"] = conf.accept_batch;
+        node["incoming_cpu"] = conf.incoming_cpu;
+        node["defer_accept"] = conf.defer_accept;
         node["args"] = YAML::Load(LexicalCast<std::map<std::string, std::string>
             , std::string>()(conf.args));
         for(auto& i : conf.address) {
@@ -142,12 +163,22 @@ public:
 
     void setRecvTimeout(uint64_t v) { m_recvTimeout = v;}
 
+    // 以下监听设置需在bind之前调用，setConf也会设置
+    bool isReusePort() const { return m_reusePort;}
+    void setReusePort(bool v) { m_reusePort = v;}
+    size_t getAcceptBatch() const { return m_acceptBatch;}
+    void setAcceptBatch(size_t v) { m_acceptBatch = v ? v : 1;}
+    bool isIncomingCpu() const { return m_incomingCpu;}
+    void setIncomingCpu(bool v) { m_incomingCpu = v;}
+    int getDeferAccept() const { return m_deferAccept;}
+    void setDeferAccept(int v) { m_deferAccept = v;}
+
     virtual void setName(const std::string& v) { m_name = v;}
 
     bool isStop() const { return m_isStop;}
 
     TcpServerConf::ptr getConf() const { return m_conf;}
-    void setConf(TcpServerConf::ptr v) { m_conf = v;}
+    void setConf(TcpServerConf::ptr v);
     void setConf(const TcpServerConf& v);
 
     virtual std::string toString(const std::string& prefix = "");
@@ -159,6 +190,7 @@ protected:
     virtual void handleClient(Socket::ptr client);
 
     // 开始接受连接：前提是bind成功
+    // reuseport模式下在监听socket所在的IO线程上执行，连接也在这个线程上处理
     virtual void startAccept(Socket::ptr sock);
 protected:
     // 监听Socket数组
@@ -179,6 +211,15 @@ protected:
 
     bool m_ssl = false;
 
+    // SO_REUSEPORT多监听模式
+    bool m_reusePort = false;
+    // 每次最多连续接收的连接数
+    size_t m_acceptBatch = 16;
+    // 设置SO_INCOMING_CPU
+    bool m_incomingCpu = false;
+    // TCP_DEFER_ACCEPT秒数
+    int m_deferAccept = 0;
+
     TcpServerConf::ptr m_conf;
 };
 
@@ -1,6 +1,16 @@
 #include "thread.h"
 #include "log.h"
 #include "util.h"
+#include <ctype.h>
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
 
 namespace sy {
 
@@ -12,6 +22,113 @@ static thread_local std::string t_thread_name = "UNKNOW"; // 指向线程名称
 
 static sy::Logger::ptr g_logger = SY_LOG_NAME("system");
 
+// numaif.h中的MPOL_PREFERRED，直接用系统调用，不依赖libnuma
+static const int SY_MPOL_PREFERRED = 1;
+// 支持的最大NUMA节点数
+static const int MAX_NUMA_NODES = 1024;
+
+ThreadAffinity ThreadAffinity::forThread(size_t index) const {
+    ThreadAffinity rt = *this;
+    if(perCore && !cpus.empty()) {
+        rt.cpus.assign(1, cpus[index % cpus.size()]);
+    }
+    return rt;
+}
+
+std::string ThreadAffinity::toString() const {
+    std::stringstream ss;
+    ss << "cpus=" << (cpus.empty() ? "any" : FormatCpuList(cpus))
+       << " numa_node=" << numaNode
+       << " per_core=" << perCore;
+    return ss.str();
+}
+
+bool ThreadAffinity::ParseCpuList(const std::string& str, std::vector<int>& cpus) {
+    std::vector<int> rt;
+    std::stringstream ss(str);
+    std::string item;
+    while(std::getline(ss, item, ',')) {
+        item.erase(std::remove_if(item.begin(), item.end(), ::isspace), item.end());
+        if(item.empty()) {
+            continue;
+        }
+        int first = -1;
+        int last = -1;
+        char dash = 0;
+        char extra = 0;
+        int n = sscanf(item.c_str(), "%d%c%d%c", &first, &dash, &last, &extra);
+        if(n == 1) {
+            last = first;
+        } else if(n != 3 || dash != '-') {
+            return false;
+        }
+        if(first < 0 || last < first) {
+            return false;
+        }
+        for(int i = first; i <= last; ++i) {
+            rt.push_back(i);
+        }
+    }
+    std::sort(rt.begin(), rt.end());
+    rt.erase(std::unique(rt.begin(), rt.end()), rt.end());
+    cpus.swap(rt);
+    return true;
+}
+
+std::string ThreadAffinity::FormatCpuList(const std::vector<int>& cpus) {
+    std::stringstream ss;
+    for(size_t i = 0; i < cpus.size();) {
+        // 连续的一段合并成a-b
+        size_t j = i;
+        while(j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1) {
+            ++j;
+        }
+        if(i) {
+            ss << ",";
+        }
+        ss << cpus[i];
+        if(j > i) {
+            ss << "-" << cpus[j];
+        }
+        i = j + 1;
+    }
+    return ss.str();
+}
+
+std::vector<int> ThreadAffinity::GetNodeCpus(int node) {
+    std::vector<int> cpus;
+    std::ifstream ifs("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+    std::string line;
+    if(!ifs || !std::getline(ifs, line) || !ParseCpuList(line, cpus)) {
+        cpus.clear();
+    }
+    return cpus;
+}
+
+int ThreadAffinity::GetCpuNode(int cpu) {
+    // 第一次调用时读取所有节点的CPU，之后查表
+    static std::vector<int> s_cpu_nodes = [](){
+        std::vector<int> v;
+        // 在线的节点，格式同cpulist
+        std::vector<int> nodes;
+        std::ifstream ifs("/sys/devices/system/node/online");
+        std::string line;
+        if(!ifs || !std::getline(ifs, line) || !ParseCpuList(line, nodes)) {
+            return v;
+        }
+        for(int node : nodes) {
+            for(int i : GetNodeCpus(node)) {
+                if(i >= (int)v.size()) {
+                    v.resize(i + 1, -1);
+                }
+                v[i] = node;
+            }
+        }
+        return v;
+    }();
+    return cpu >= 0 && cpu < (int)s_cpu_nodes.size() ? s_cpu_nodes[cpu] : -1;
+}
+
 // 每个线程都有两个线程局部变量，一个用于存储当前线程的Thread指针，另一个存储线程名称
 // 通过Thread::GetThis()可以获取当前的线程指针，Thread::GetName()获取当前的线程名称
 Thread* Thread::GetThis() {
@@ -33,14 +150,45 @@ void Thread::SetName(const std::string& name) {
 }
 
 // 构造函数初始化 cb 线程执行函数，name 线程名称，并创建新线程
-Thread::Thread(std::function<void()> cb, const std::string& name)
+Thread::Thread(std::function<void()> cb, const std::string& name
+               ,const ThreadAffinity& affinity)
     :m_cb(cb)
-    ,m_name(name) {
+    ,m_name(name)
+    ,m_affinity(affinity) {
     if(name.empty()) {
         m_name = "UNKNOW";
     }
+    // 只指定了NUMA节点时绑定到该节点的全部CPU
+    if(m_affinity.cpus.empty() && m_affinity.numaNode >= 0) {
+        m_affinity.cpus = ThreadAffinity::GetNodeCpus(m_affinity.numaNode);
+        if(m_affinity.cpus.empty()) {
+            SY_LOG_WARN(g_logger) << "thread " << m_name << " numa node "
+                << m_affinity.numaNode << " not found, cpu affinity not set";
+        }
+    }
+    // 在创建时设置亲和性，线程从一开始就运行在指定的CPU上
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    if(!m_affinity.cpus.empty()) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for(int i : m_affinity.cpus) {
+            if(i < CPU_SETSIZE) {
+                CPU_SET(i, &set);
+            }
+        }
+        pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+    }
     // 创建新线程，并将其与Thread::run方法关联，创建的新线程对象this作为参数传给run方法
-    int rt = pthread_create(&m_thread, nullptr, &Thread::run, this);
+    int rt = pthread_create(&m_thread, &attr, &Thread::run, this);
+    if(rt == EINVAL && !m_affinity.cpus.empty()) {
+        // 指定的CPU都不可用(不存在或者不在cpuset内)，不绑定CPU
+        SY_LOG_ERROR(g_logger) << "thread " << m_name << " invalid cpus "
+            << ThreadAffinity::FormatCpuList(m_affinity.cpus) << ", cpu affinity not set";
+        m_affinity.cpus.clear();
+        rt = pthread_create(&m_thread, nullptr, &Thread::run, this);
+    }
+    pthread_attr_destroy(&attr);
     if(rt) {
         SY_LOG_ERROR(g_logger) << "pthread_create thread fail, rt=" << rt
             << " name=" << name;
@@ -70,6 +218,42 @@ void Thread::join() {
     }
 }
 
+std::vector<int> Thread::GetCpus(pid_t tid) {
+    std::vector<int> cpus;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if(sched_getaffinity(tid, sizeof(set), &set)) {
+        return cpus;
+    }
+    for(int i = 0; i < CPU_SETSIZE; ++i) {
+        if(CPU_ISSET(i, &set)) {
+            cpus.push_back(i);
+        }
+    }
+    return cpus;
+}
+
+void Thread::applyMemoryPolicy() {
+    int node = m_affinity.numaNode;
+    if(node < 0) {
+        return;
+    }
+    if(node >= MAX_NUMA_NODES) {
+        SY_LOG_WARN(g_logger) << "thread " << m_name << " invalid numa node " << node;
+        return;
+    }
+#ifdef SYS_set_mempolicy
+    const int BITS = sizeof(unsigned long) * 8;
+    unsigned long mask[MAX_NUMA_NODES / BITS] = {0};
+    mask[node / BITS] = 1ul << (node % BITS);
+    // maxnode按内核的约定比位数多1
+    if(syscall(SYS_set_mempolicy, SY_MPOL_PREFERRED, mask, MAX_NUMA_NODES + 1)) {
+        SY_LOG_WARN(g_logger) << "thread " << m_name << " set_mempolicy node=" << node
+            << " errno=" << errno << " errstr=" << strerror(errno);
+    }
+#endif
+}
+
 // 线程执行
 void* Thread::run(void* arg) {
     // 拿到新创建的Thread对象
@@ -82,6 +266,8 @@ void* Thread::run(void* arg) {
     thread->m_id = sy::GetThreadId();
     // 设置线程名称
     pthread_setname_np(pthread_self(), thread->m_name.substr(0, 15).c_str());
+    // 之后本线程首次访问的内存(协程栈、线程缓存、fd记录等)优先分配在指定节点上
+    thread->applyMemoryPolicy();
 
     // pthread_creat时返回引用 防止函数有智能指针,
     std::function<void()> cb;
@@ -1,16 +1,49 @@
 #ifndef __SY_THREAD_H__
 #define __SY_THREAD_H__
 
+#include <string>
+#include <vector>
 #include "mutex.h"
 
 namespace sy {
 
+// 线程的CPU亲和性和NUMA内存策略，在线程创建时设置
+struct ThreadAffinity {
+    // 允许运行的CPU，空表示不限制；只指定了numaNode时为该节点的全部CPU
+    std::vector<int> cpus;
+    // 线程的内存优先从这个NUMA节点分配(MPOL_PREFERRED)，-1表示不设置
+    int numaNode = -1;
+    // 线程池的每个线程只绑定cpus中的一个(按线程序号轮流)，否则绑定整个集合
+    bool perCore = false;
+
+    bool empty() const { return cpus.empty() && numaNode < 0;}
+
+    // 线程池中序号为index的线程的设置
+    ThreadAffinity forThread(size_t index) const;
+
+    std::string toString() const;
+
+    // 解析CPU列表，格式同/sys下的cpulist，如"0-3,8,10-11"，格式错误返回false
+    static bool ParseCpuList(const std::string& str, std::vector<int>& cpus);
+
+    // CPU列表格式化为"0-3,8"
+    static std::string FormatCpuList(const std::vector<int>& cpus);
+
+    // NUMA节点的CPU，节点不存在返回空
+    static std::vector<int> GetNodeCpus(int node);
+
+    // cpu所在的NUMA节点，不知道时返回-1
+    static int GetCpuNode(int cpu);
+};
+
 // 线程类
 class Thread : Noncopyable {
 public:
     typedef std::shared_ptr<Thread> ptr;
 
-    Thread(std::function<void()> cb, const std::string& name);
+    // affinity 线程创建时设置的CPU亲和性和NUMA内存策略
+    Thread(std::function<void()> cb, const std::string& name
+           ,const ThreadAffinity& affinity = ThreadAffinity());
 
     ~Thread();
 
@@ -18,6 +51,12 @@ public:
 
     const std::string& getName() const { return m_name;}
 
+    // 创建时指定的亲和性
+    const ThreadAffinity& getAffinity() const { return m_affinity;}
+
+    // 线程实际允许运行的CPU(sched_getaffinity，包含cpuset等外部限制)
+    static std::vector<int> GetCpus(pid_t tid);
+
     void join();
 
     static Thread* GetThis();
@@ -27,6 +66,9 @@ public:
     static void SetName(const std::string& name);
 private:
     static void* run(void* arg);
+
+    // 在新线程中设置NUMA内存策略
+    void applyMemoryPolicy();
 private:
     // 线程id
     pid_t m_id = -1;
@@ -38,6 +80,8 @@ private:
     std::string m_name;
     // 信号量
     Semaphore m_semaphore;
+    // CPU亲和性和NUMA内存策略
+    ThreadAffinity m_affinity;
 };
 
 }
@@ -1,71 +1,291 @@
 #include "timer.h"
 #include "util.h"
+#include <algorithm>
 
 namespace sy {
 
-bool Timer::Comparator::operator()(const Timer::ptr& lhs
-                        ,const Timer::ptr& rhs) const {
-    if(!lhs && !rhs) {
-        return false;
+// 分层时间轮，精度为1毫秒
+// 第0层256个槽，每槽1毫秒；第1~3层各64个槽，每槽分别为2^8、2^14、2^20毫秒，最远约18.6小时
+// 更远的定时器先放在第3层最远的槽，降级时再重新计算
+// 下层转完一圈时把上层当前槽里的定时器降级(cascade)，重新放到下层
+class TimerWheel {
+public:
+    typedef Mutex MutexType;
+
+    static const int LEVELS = 4;
+    static const int L0_BITS = 8;
+    static const int L0_SIZE = 1 << L0_BITS;
+    static const int LN_BITS = 6;
+    static const int LN_SIZE = 1 << LN_BITS;
+    // 最后一个槽存放已经过了处理时间才添加的定时器，下次收割时立即执行
+    static const int OVERDUE = L0_SIZE + (LEVELS - 1) * LN_SIZE;
+    static const int SLOTS = OVERDUE + 1;
+    static const int BITMAP_WORDS = (SLOTS + 63) / 64;
+    static const uint64_t MAX_SPAN = 1ull << (L0_BITS + (LEVELS - 1) * LN_BITS);
+
+    TimerWheel(int index)
+        :m_index(index) {
+        m_current = GetCurrentMS();
+        m_previouseTime = m_current;
+        for(int i = 0; i < SLOTS; ++i) {
+            m_slots[i] = nullptr;
+        }
+        for(int i = 0; i < BITMAP_WORDS; ++i) {
+            m_bitmap[i] = 0;
+        }
     }
-    if(!lhs) {
-        return true;
+
+    // 按执行时间把节点挂到对应的槽上
+    void link(TimerNode* node) {
+        uint64_t expire = node->m_next;
+        uint64_t delta = expire - m_current;
+        int slot = 0;
+        if(expire < m_current) {
+            slot = OVERDUE;
+        } else if(delta < (uint64_t)L0_SIZE) {
+            slot = expire & (L0_SIZE - 1);
+        } else {
+            if(delta >= MAX_SPAN) {
+                expire = m_current + MAX_SPAN - 1;
+                delta = MAX_SPAN - 1;
+            }
+            int level = 1;
+            int shift = L0_BITS;
+            while(level < LEVELS - 1 && delta >= (1ull << (shift + LN_BITS))) {
+                ++level;
+                shift += LN_BITS;
+            }
+            slot = L0_SIZE + (level - 1) * LN_SIZE + ((expire >> shift) & (LN_SIZE - 1));
+        }
+        TimerNode* head = m_slots[slot];
+        node->m_prevNode = nullptr;
+        node->m_nextNode = head;
+        if(head) {
+            head->m_prevNode = node;
+        }
+        m_slots[slot] = node;
+        m_bitmap[slot >> 6] |= 1ull << (slot & 63);
+        node->m_slot = slot;
+        ++m_count;
     }
-    if(!rhs) {
-        return false;
+
+    // 从槽上摘下节点
+    void unlink(TimerNode* node) {
+        int slot = node->m_slot;
+        if(node->m_prevNode) {
+            node->m_prevNode->m_nextNode = node->m_nextNode;
+        } else {
+            m_slots[slot] = node->m_nextNode;
+        }
+        if(node->m_nextNode) {
+            node->m_nextNode->m_prevNode = node->m_prevNode;
+        }
+        if(!m_slots[slot]) {
+            m_bitmap[slot >> 6] &= ~(1ull << (slot & 63));
+        }
+        node->m_prevNode = nullptr;
+        node->m_nextNode = nullptr;
+        node->m_slot = -1;
+        --m_count;
     }
-    if(lhs->m_next < rhs->m_next) {
-        return true;
+
+    // 最早需要处理的时间(毫秒)：第0层是准确的执行时间，上层是降级的时间，没有定时器返回~0ull
+    uint64_t nextTick() const {
+        if(m_count == 0) {
+            return ~0ull;
+        }
+        if(m_slots[OVERDUE]) {
+            return 0;
+        }
+        uint64_t next = ~0ull;
+        int d = FindNextSet(m_bitmap, L0_SIZE, m_current & (L0_SIZE - 1));
+        if(d >= 0) {
+            next = m_current + d;
+        }
+        int shift = L0_BITS;
+        for(int level = 1; level < LEVELS; ++level, shift += LN_BITS) {
+            // 上层的槽只在时间是2^shift的整数倍时降级
+            uint64_t base = (m_current + (1ull << shift) - 1) >> shift;
+            d = FindNextSet(&m_bitmap[(L0_SIZE >> 6) + level - 1], LN_SIZE, base & (LN_SIZE - 1));
+            if(d >= 0) {
+                next = std::min(next, (base + d) << shift);
+            }
+        }
+        return next;
     }
-    if(rhs->m_next < lhs->m_next) {
-        return false;
+
+    // 收割now及之前到期的节点，每个节点调用一次fn，调用时节点已经摘下
+    // rollover为true时(时钟被大幅回拨)全部节点都视为到期
+    template<class Fn>
+    void expire(uint64_t now, bool rollover, Fn fn) {
+        if(rollover) {
+            m_current = now + 1;
+            for(int i = 0; i < SLOTS; ++i) {
+                consume(detach(i), fn);
+            }
+            return;
+        }
+        consume(detach(OVERDUE), fn);
+        while(m_current <= now) {
+            if(m_count == 0) {
+                m_current = now + 1;
+                break;
+            }
+            uint64_t t = m_current;
+            if(!(t & (L0_SIZE - 1))) {
+                // 第0层转完一圈，逐层降级，某层的下标不为0时上面的层还不需要降级
+                int shift = L0_BITS;
+                for(int level = 1; level < LEVELS; ++level, shift += LN_BITS) {
+                    int idx = (t >> shift) & (LN_SIZE - 1);
+                    TimerNode* node = detach(L0_SIZE + (level - 1) * LN_SIZE + idx);
+                    while(node) {
+                        TimerNode* next = node->m_nextNode;
+                        link(node);
+                        node = next;
+                    }
+                    if(idx) {
+                        break;
+                    }
+                }
+            }
+            TimerNode* list = detach(t & (L0_SIZE - 1));
+            // 先推进时间再执行，循环定时器重新挂上去时不会落回刚处理过的槽
+            m_current = t + 1;
+            if(m_current <= now) {
+                // 跳过中间没有定时器到期也不需要降级的时间
+                m_current = std::min(std::max(nextTick(), m_current), now + 1);
+            }
+            consume(list, fn);
+        }
+    }
+
+    // 取出全部节点，每个节点调用一次fn
+    template<class Fn>
+    void clear(Fn fn) {
+        for(int i = 0; i < SLOTS; ++i) {
+            consume(detach(i), fn);
+        }
+    }
+
+    // 检测服务器时间是否被调后了
+    bool detectClockRollover(uint64_t now_ms) {
+        bool rollover = false;
+        // 如果当前时间比上次执行时间还小 并且 小于一个小时的时间，相当于时间倒流了
+        if(now_ms < m_previouseTime &&
+            now_ms < (m_previouseTime - 60 * 60 * 1000)) {
+            // 服务器时间被调过了
+            rollover = true;
+        }
+        // 重新更新时间
+        m_previouseTime = now_ms;
+        return rollover;
+    }
+private:
+    // 从start开始循环查找第一个置位的位，返回与start的距离，没有返回-1；nbits为64的整数倍
+    static int FindNextSet(const uint64_t* bits, int nbits, int start) {
+        int words = nbits >> 6;
+        int w = start >> 6;
+        uint64_t cur = bits[w] & (~0ull << (start & 63));
+        for(int i = 0; i <= words; ++i) {
+            if(cur) {
+                int pos = (w << 6) + __builtin_ctzll(cur);
+                return (pos - start + nbits) % nbits;
+            }
+            w = (w + 1) % words;
+            cur = bits[w];
+        }
+        return -1;
     }
-    return lhs.get() < rhs.get();
-}
 
+    // 摘下整个槽，返回链表头，节点的m_slot置为-1
+    TimerNode* detach(int slot) {
+        TimerNode* list = m_slots[slot];
+        if(!list) {
+            return nullptr;
+        }
+        m_slots[slot] = nullptr;
+        m_bitmap[slot >> 6] &= ~(1ull << (slot & 63));
+        for(TimerNode* n = list; n; n = n->m_nextNode) {
+            n->m_slot = -1;
+            --m_count;
+        }
+        return list;
+    }
+
+    // 依次处理detach出来的链表，fn里可能把节点重新挂上去，所以先保存后继
+    template<class Fn>
+    static void consume(TimerNode* node, Fn& fn) {
+        while(node) {
+            TimerNode* next = node->m_nextNode;
+            node->m_prevNode = nullptr;
+            node->m_nextNode = nullptr;
+            fn(node);
+            node = next;
+        }
+    }
+public:
+    // 保护整个时间轮
+    MutexType m_mutex;
+    // 线程时间轮的序号，-1为共享时间轮
+    int m_index;
+    // 时间轮上的定时器数量
+    std::atomic<size_t> m_count = {0};
+    // 收割线程计划醒来的时间，比它早的定时器需要通知
+    uint64_t m_deadline = ~0ull;
+    // 是否已经通知过，getNextTimer时清除
+    bool m_tickled = false;
+private:
+    // 下一个要处理的时间(毫秒)，早于它的定时器都已经收割
+    uint64_t m_current;
+    // 上次收割的时间
+    uint64_t m_previouseTime;
+    // 每个槽的链表头
+    TimerNode* m_slots[SLOTS];
+    // 非空槽的位图
+    uint64_t m_bitmap[BITMAP_WORDS];
+};
 
 Timer::Timer(uint64_t ms, std::function<void()> cb,
              bool recurring, TimerManager* manager)
     :m_recurring(recurring)
     ,m_ms(ms)
-    ,m_cb(cb)
+    ,m_cb(std::move(cb))
     ,m_manager(manager) {
     m_next = sy::GetCurrentMS() + m_ms; // 执行时间为当前时间+执行周期
 }
 
-Timer::Timer(uint64_t next)
-    :m_next(next) {
-}
-
 bool Timer::cancel() {
-    TimerManager::RWMutexType::WriteLock lock(m_manager->m_mutex);
+    TimerWheel* wheel = m_wheel;
+    if(!wheel) {
+        return false;
+    }
+    // 时间轮持有的引用在解锁之后才释放
+    Timer::ptr self;
+    TimerWheel::MutexType::Lock lock(wheel->m_mutex);
     if(m_cb) {
         m_cb = nullptr;
-        // 在set中找到自身定时器
-        auto it = m_manager->m_timers.find(shared_from_this());
-        // 找到删除
-        m_manager->m_timers.erase(it);
+        if(m_slot >= 0) {
+            wheel->unlink(this);
+        }
+        self.swap(m_self);
         return true;
     }
     return false;
 }
 
 bool Timer::refresh() {
-    TimerManager::RWMutexType::WriteLock lock(m_manager->m_mutex);
-    if(!m_cb) {
+    TimerWheel* wheel = m_wheel;
+    if(!wheel) {
         return false;
     }
-    // 在set中找到自身定时器
-    auto it = m_manager->m_timers.find(shared_from_this());
-    if (it == m_manager->m_timers.end()) {
+    TimerWheel::MutexType::Lock lock(wheel->m_mutex);
+    if(!m_cb || m_slot < 0) {
         return false;
     }
-    // 删除
-    m_manager->m_timers.erase(it);
-    // 更新执行时间
-    m_next = sylar::GetCurrentMS() + m_ms;
-    // 重新插入，这样能按最新的时间排序
-    m_manager->m_timers.insert(shared_from_this());
+    // 摘下来按新的执行时间重新挂上去
+    wheel->unlink(this);
+    m_next = sy::GetCurrentMS() + m_ms;
+    wheel->link(this);
     return true;
 }
 
@@ -74,51 +294,115 @@ bool Timer::reset(uint64_t ms, bool from_now) {
     if (m_ms == ms && !from_now) {
         return true;
     }
-    TimerManager::RWMutexType::WriteLock lock(m_manager->m_mutex);
-    if (!m_cb) {
+    TimerWheel* wheel = m_wheel;
+    if(!wheel) {
         return false;
     }
-    // 在set中找到自身定时器
-    auto it = m_manager->m_timers.find(shared_from_this());
-    if (it == m_manager->m_timers.end()) {
+    TimerWheel::MutexType::Lock lock(wheel->m_mutex);
+    if (!m_cb || m_slot < 0) {
         return false;
     }
-    
-    // 删除定时器
-    m_manager->m_timers.erase(it);
+    wheel->unlink(this);
     // 起始时间
     uint64_t start = 0;
     // 从现在开始计算
     if (from_now) {
         // 更新起始时间
-        start = sylar::GetCurrentMS();
+        start = sy::GetCurrentMS();
     } else {
         /* 起始时间为当时创建时的起始时间
-         * m_next = sylar::GetCurrentMS() + m_ms; */
+         * m_next = sy::GetCurrentMS() + m_ms; */
         start = m_next - m_ms;
     }
-    // 更新数据 
+    // 更新数据
     m_ms = ms;
     m_next = m_ms + start;
-    // 重新加入set中
-    m_manager->addTimer(shared_from_this(), lock);
+    // 重新挂到时间轮上
+    m_manager->addNode(this, lock);
+    return true;
+}
+
+bool TimerHandle::cancel() {
+    TimerWheel* wheel = m_wheel;
+    if(!wheel) {
+        return false;
+    }
+    // 到期回调是持有锁执行的，加锁之后回调一定已经执行完
+    TimerWheel::MutexType::Lock lock(wheel->m_mutex);
+    if(m_slot < 0) {
+        return false;
+    }
+    wheel->unlink(this);
     return true;
 }
 
 TimerManager::TimerManager() {
-    m_previouseTime = sy::GetCurrentMS();
+    m_wheels.push_back(new TimerWheel(-1));
 }
 
 TimerManager::~TimerManager() {
+    std::vector<Timer::ptr> released;
+    for(auto& wheel : m_wheels) {
+        {
+            TimerWheel::MutexType::Lock lock(wheel->m_mutex);
+            wheel->clear([&released](TimerNode* node) {
+                node->m_wheel = nullptr;
+                if(!node->m_isHandle) {
+                    released.push_back(std::move(static_cast<Timer*>(node)->m_self));
+                }
+            });
+        }
+        delete wheel;
+    }
+}
+
+void TimerManager::setThreadWheels(size_t count) {
+    for(size_t i = 0; i < count; ++i) {
+        m_wheels.push_back(new TimerWheel(i));
+    }
+}
+
+TimerWheel* TimerManager::getWheel() {
+    if(!hasThreadWheels()) {
+        return m_wheels[0];
+    }
+    int index = getCurrentWheel() + 1;
+    if(index <= 0 || index >= (int)m_wheels.size()) {
+        return m_wheels[0];
+    }
+    return m_wheels[index];
+}
+
+void TimerManager::addNode(TimerNode* node, Mutex::Lock& lock) {
+    TimerWheel* wheel = node->m_wheel;
+    wheel->link(node);
+    // 比收割线程计划醒来的时间早，并且还没有通知过
+    // 线程时间轮模式下共享时间轮可能被任意线程等待，总是通知
+    bool at_front = (node->m_next < wheel->m_deadline && !wheel->m_tickled)
+                    || (wheel->m_index < 0 && hasThreadWheels());
+    if(at_front) {
+        wheel->m_tickled = true;
+    }
+    int index = wheel->m_index;
+    lock.unlock();
+
+    // 触发onTimerInsertedAtFront()
+    // onTimerInsertedAtFront()在IOManager中就是做了一次tickle()的操作
+    // 线程自己往自己的时间轮添加时它是醒着的，睡眠之前会重新计算超时时间，不需要通知
+    if(at_front && (index < 0 || index != getCurrentWheel())) {
+        onTimerInsertedAtFront(index);
+    }
 }
 
 Timer::ptr TimerManager::addTimer(uint64_t ms, std::function<void()> cb
                                   ,bool recurring) {
     // 创建定时器
-    Timer::ptr timer(new Timer(ms, cb, recurring, this));
-    RWMutexType::WriteLock lock(m_mutex);
-    // 添加到set中
-    addTimer(timer, lock);
+    Timer::ptr timer(new Timer(ms, std::move(cb), recurring, this));
+    timer->m_wheel = getWheel();
+    TimerWheel::MutexType::Lock lock(timer->m_wheel->m_mutex);
+    timer->m_self = timer;
+    // 挂到时间轮上
+    addNode(timer.get(), lock);
     return timer;
 }
 
@@ -140,114 +424,97 @@ Timer::ptr TimerManager::addConditionTimer(uint64_t ms, std::function<void()> cb
     return addTimer(ms, std::bind(&OnTimer, weak_cond, cb), recurring);
 }
 
+void TimerManager::addTimer(TimerHandle& handle, uint64_t ms
+                            ,TimerHandle::Callback cb, void* arg) {
+    handle.cancel();
+    handle.m_cb = cb;
+    handle.m_arg = arg;
+    handle.m_next = sy::GetCurrentMS() + ms;
+    handle.m_wheel = getWheel();
+    TimerWheel::MutexType::Lock lock(handle.m_wheel->m_mutex);
+    addNode(&handle, lock);
+}
+
 uint64_t TimerManager::getNextTimer() {
-    RWMutexType::ReadLock lock(m_mutex);
-    // 不触发 onTimerInsertedAtFront
-    m_tickled = false;
+    uint64_t next = ~0ull;
+    auto check = [&next](TimerWheel* wheel) {
+        TimerWheel::MutexType::Lock lock(wheel->m_mutex);
+        // 不触发 onTimerInsertedAtFront
+        wheel->m_tickled = false;
+        wheel->m_deadline = wheel->nextTick();
+        next = std::min(next, wheel->m_deadline);
+    };
+    TimerWheel* local = getWheel();
+    if(local == m_wheels[0] || m_wheels[0]->m_count) {
+        check(m_wheels[0]);
+    }
+    if(local != m_wheels[0]) {
+        check(local);
+    }
     // 如果没有定时器，返回一个最大值
-    if (m_timers.empty()) {
+    if(next == ~0ull) {
         return ~0ull;
     }
-    // 拿到第一个定时器
-    const Timer::ptr& next = *m_timers.begin();
     // 现在的时间
-    uint64_t now_ms = sylar::GetCurrentMS();
+    uint64_t now_ms = sy::GetCurrentMS();
     // 如果当前时间 >= 该定时器的执行时间，说明该定时器已经超时了，该执行了
-    if (now_ms >= next->m_next) {
+    if(now_ms >= next) {
         return 0;
-    } else {
-        // 还没超时，返回还要多久执行
-        return next->m_next - now_ms;
     }
+    // 还没超时，返回还要多久执行
+    return next - now_ms;
 }
 
 void TimerManager::listExpiredCb(std::vector<std::function<void()> >& cbs) {
     // 获得当前时间
-    uint64_t now_ms = sylar::GetCurrentMS();
+    uint64_t now_ms = sy::GetCurrentMS();
+    // 非循环定时器触发后释放时间轮持有的引用，解锁之后再释放
     std::vector<Timer::ptr> expired;
-    {
-        RWMutexType::ReadLock lock(m_mutex);
+    auto collect = [&](TimerWheel* wheel) {
         // 没有定时器
-        if (m_timers.empty()) {
+        if(wheel->m_count == 0) {
             return;
         }
-    }
-    RWMutexType::WriteLock lock(m_mutex);
-    if (m_timers.empty()) {
-        return;
-    }
-    // 判断服务器时间是否调后了
-    bool rollover = detectClockRollover(now_ms);
-    // 如果服务器时间没问题，并且第一个定时器都没有到执行时间，就说明没有任务需要执行
-    if (!rollover && ((*m_timers.begin())->m_next > now_ms)) {
-        return;
-    }
-	
-    // 定义一个当前时间的定时器
-    Timer::ptr now_timer(new Timer(now_ms));
-    /* 若系统时间改动则将m_timers的所有Timer视为过期的
-     * 否则返回第一个 >= now_ms的迭代器，在此迭代器之前的定时器全都已经超时 */
-    auto it = rollover ? m_timers.end() : m_timers.lower_bound(now_timer);
-    // 筛选出当前时间等于next时间执行的Timer
-    while (it != m_timers.end() && (*it)->m_next == now_ms) {
-        ++it;
-    }
-    // 小于当前时间的Timer都是已经过了时间的Timer，it是当前时间要执行的Timer
-    // 将这些Timer都加入到expired中
-    expired.insert(expired.begin(), m_timers.begin(), it);
-    // 将已经放入expired的定时器删掉 
-    m_timers.erase(m_timers.begin(), it);
-    cbs.reserve(expired.size());
-
-    // 将expired的timer放入到cbs中
-    for (auto& timer : expired) {
-        cbs.push_back(timer->m_cb);
-        // 如果是循环定时器，则再次放入定时器集合中
-        if (timer->m_recurring) {
-            timer->m_next = now_ms + timer->m_ms;
-            m_timers.insert(timer);
-        } else {
-            timer->m_cb = nullptr;
-        }
-    }
-}
-
-protected:
-void TimerManager::addTimer(Timer::ptr val, RWMutexType::WriteLock& lock) {
-    // 添加到set中并且拿到迭代器
-    auto it = m_timers.insert(val).first;
-    // 如果该定时器是超时时间最短 并且 没有设置触发onTimerInsertedAtFront
-    bool at_front = (it == m_timers.begin() && !m_tickled);
-    // 设置触发onTimerInsertedAtFront
-    if (at_front) {
-        m_tickled = true;
-    }
-    lock.unlock();
-	
-    // 触发onTimerInsertedAtFront()
-	// onTimerInsertedAtFront()在IOManager中就是做了一次tickle()的操作 
-    if (at_front) {
-        onTimerInsertedAtFront();
+        TimerWheel::MutexType::Lock lock(wheel->m_mutex);
+        // 判断服务器时间是否调后了，调后了则所有定时器都视为过期
+        bool rollover = wheel->detectClockRollover(now_ms);
+        wheel->expire(now_ms, rollover, [&](TimerNode* node) {
+            if(node->m_isHandle) {
+                TimerHandle* handle = static_cast<TimerHandle*>(node);
+                uint64_t next = handle->m_cb(handle->m_arg);
+                if(next) {
+                    handle->m_next = next;
+                    wheel->link(handle);
+                }
+                return;
+            }
+            Timer* timer = static_cast<Timer*>(node);
+            // 如果是循环定时器，则再次挂到时间轮上
+            if(timer->m_recurring) {
+                cbs.push_back(timer->m_cb);
+                timer->m_next = now_ms + timer->m_ms;
+                wheel->link(timer);
+            } else {
+                cbs.push_back(std::move(timer->m_cb));
+                timer->m_cb = nullptr;
+                expired.push_back(std::move(timer->m_self));
+            }
+        });
+    };
+    TimerWheel* local = getWheel();
+    collect(m_wheels[0]);
+    if(local != m_wheels[0]) {
+        collect(local);
     }
 }
 
-bool TimerManager::detectClockRollover(uint64_t now_ms) {
-    bool rollover = false;
-    // 如果当前时间比上次执行时间还小 并且 小于一个小时的时间，相当于时间倒流了
-    if (now_ms < m_previouseTime &&
-        now_ms < (m_previouseTime - 60 * 60 * 1000)) {
-        // 服务器时间被调过了
-        rollover = true;
-    }
-    
-    // 重新更新时间
-    m_previouseTime = now_ms;
-    return rollover;
-}
-
 bool TimerManager::hasTimer() {
-    RWMutexType::ReadLock lock(m_mutex);
-    return !m_timers.empty();
+    for(auto& wheel : m_wheels) {
+        if(wheel->m_count) {
+            return true;
+        }
+    }
+    return false;
 }
 
 }
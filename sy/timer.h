@@ -1,17 +1,41 @@
 #ifndef __SY_TIMER_H__
 #define __SY_TIMER_H__
 
+#include <atomic>
+#include <functional>
 #include <memory>
 #include <vector>
-#include <set>
+#include "noncopyable.h"
 #include "thread.h"
 
 namespace sy {
 
 class TimerManager;
+class TimerWheel;
+
+// 时间轮上的节点，Timer和TimerHandle的公共部分
+// 节点通过侵入式双向链表挂在时间轮的槽上，添加和删除都是O(1)
+class TimerNode {
+friend class TimerWheel;
+friend class TimerManager;
+protected:
+    // 精确的执行时间（毫秒）
+    uint64_t m_next = 0;
+    // 所属的时间轮，添加时确定，之后不再改变
+    TimerWheel* m_wheel = nullptr;
+    // 槽链表的前后节点
+    TimerNode* m_prevNode = nullptr;
+    TimerNode* m_nextNode = nullptr;
+    // 所在的槽，-1表示不在时间轮上
+    int m_slot = -1;
+    // 是否TimerHandle：到期时在收割线程上直接执行回调
+    bool m_isHandle = false;
+};
+
 // 定时器
-class Timer : public std::enable_shared_from_this<Timer> {
+class Timer : public TimerNode, public std::enable_shared_from_this<Timer> {
 friend class TimerManager;
+friend class TimerWheel;
 public:
     // 定时器的智能指针类型：lhs和rhs
     typedef std::shared_ptr<Timer> ptr;
@@ -29,33 +53,50 @@ private:
     // 构造函数私有：只能通过TimerManager类来创建Timer对象
     Timer(uint64_t ms, std::function<void()> cb,
           bool recurring, TimerManager* manager);
-    Timer(uint64_t next);
 private:
     // 是否循环定时器
     bool m_recurring = false;
     // 执行周期:定时器执行间隔时间(毫秒)
     uint64_t m_ms = 0;
-    // 精确的执行时间（毫秒）
-    uint64_t m_next = 0;
     // 回调函数
     std::function<void()> m_cb;
     // 定时器的管理器
     TimerManager* m_manager = nullptr;
+    // 在时间轮上时持有自己，用户不保存Timer::ptr也能触发；触发或取消后释放
+    Timer::ptr m_self;
+};
+
+// 不分配内存的定时器句柄，由调用者持有(比如放在协程栈上或者fd记录里)，析构时自动取消
+// 到期时回调在收割定时器的线程上、持有时间轮的锁直接执行，所以回调必须很短，并且不能再操作定时器
+// 回调返回0表示结束，返回非0则以返回值(绝对毫秒)为新的执行时间重新挂上
+// cancel返回后可以保证回调不会再执行，也没有正在执行
+class TimerHandle : public TimerNode, Noncopyable {
+friend class TimerManager;
+friend class TimerWheel;
+public:
+    typedef uint64_t (*Callback)(void* arg);
+
+    TimerHandle() { m_isHandle = true;}
+
+    ~TimerHandle() { cancel();}
+
+    // 取消定时器，返回是否在到期之前取消成功
+    bool cancel();
 private:
-    // 定时器比较仿函数：比较定时器的智能指针的大小，按照执行时间的先后对定时器排序
-    // 这样方便定时器的管理器来确定下一个要执行的定时器是谁
-    struct Comparator {
-        bool operator()(const Timer::ptr& lhs, const Timer::ptr& rhs) const;
-    };
+    // 到期回调
+    Callback m_cb = nullptr;
+    // 回调参数
+    void* m_arg = nullptr;
 };
 
 // 定时器管理器：管理所有的Timer对象
+// 定时器按执行时间挂在分层时间轮上，添加和取消都是O(1)
+// 默认只有一个共享的时间轮；setThreadWheels之后每个线程有自己的时间轮，线程添加的定时器只由它自己收割，
+// getCurrentWheel返回-1的线程(非调度线程)仍使用共享时间轮，所有线程都会检查共享时间轮
 class TimerManager {
 friend class Timer;
+friend class TimerHandle;
 public:
-    // 读写锁类型
-    typedef RWMutex RWMutexType;
-
     // 构造函数
     TimerManager();
 
@@ -67,10 +108,14 @@ public:
 
     // 添加条件定时器
     // weak_cond 条件
-    Timer::ptr addConditionTimer(uint64_t ms, std::function<void()> cb, bool recurring = false
-                        ,std::weak_ptr<void> weak_cond);
+    Timer::ptr addConditionTimer(uint64_t ms, std::function<void()> cb
+                        ,std::weak_ptr<void> weak_cond, bool recurring = false);
 
-    // 到最近一个定时器执行的时间间隔(毫秒)
+    // 添加不分配内存的定时器：ms毫秒后在收割线程上执行cb(arg)，handle已经在时间轮上时先取消
+    void addTimer(TimerHandle& handle, uint64_t ms, TimerHandle::Callback cb, void* arg);
+
+    // 到最近一个定时器执行的时间间隔(毫秒)，没有定时器返回~0ull
+    // 较远的定时器返回的是它在时间轮上降级的时间，不会晚于真正的执行时间
     uint64_t getNextTimer();
 
     // 获取需要执行的定时器的回调函数列表
@@ -80,25 +125,29 @@ public:
     // 是否有定时器
     bool hasTimer();
 protected:
+    // 创建count个线程时间轮，必须在任何线程添加定时器之前调用
+    void setThreadWheels(size_t count);
+
+    // 是否使用线程时间轮
+    bool hasThreadWheels() const { return m_wheels.size() > 1;}
+
+    // 当前线程使用的线程时间轮序号，-1表示共享时间轮
+    virtual int getCurrentWheel() { return -1;}
+
     // 当有新的定时器插入到定时器的首部，执行该函数
     // 通知继承了 TimerManager 的类（如 IOManager）立即更新当前的 epoll_wait 超时时间
     // 这样可以确保在新定时器插入时，及时更新事件循环的超时时间，以便及时处理新的定时器事件
-    virtual void onTimerInsertedAtFront() = 0;
-
-    // 将定时器添加到管理器中
-    void addTimer(Timer::ptr val, RWMutexType::WriteLock& lock);
+    // wheel 插入的时间轮序号，-1为共享时间轮
+    virtual void onTimerInsertedAtFront(int wheel) = 0;
 private:
-    // 检测服务器时间是否被调后了
-    bool detectClockRollover(uint64_t now_ms);
+    // 当前线程添加定时器使用的时间轮
+    TimerWheel* getWheel();
+
+    // 把节点挂到时间轮上，调用时需持有时间轮的锁；插入到首部时通过lock解锁后通知
+    void addNode(TimerNode* node, Mutex::Lock& lock);
 private:
-    // Mutex
-    RWMutexType m_mutex;
-    // 定时器集合：由于set会自动对定时器对象按照执行时间的先后顺序进行排序，因此管理器可以很快确定下一个要执行的定时器
-    std::set<Timer::ptr, Timer::Comparator> m_timers;
-    // 是否触发onTimerInsertedAtFront
-    bool m_tickled = false;
-    // 上次执行时间
-    uint64_t m_previouseTime = 0;
+    // 时间轮：下标0为共享时间轮，i + 1为线程i的时间轮，构造后不再改变
+    std::vector<TimerWheel*> m_wheels;
 };
 
 }
@@ -0,0 +1,391 @@
+#include "udp_server.h"
+#include "config.h"
+#include "log.h"
+#include <algorithm>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <string.h>
+
+// 旧的内核头文件里没有的定义
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+
+namespace sy {
+
+static sy::ConfigVar<uint32_t>::ptr g_udp_server_batch =
+    sy::Config::Lookup("udp_server.batch", (uint32_t)32,
+            "udp server max datagrams per recvmmsg");
+static sy::ConfigVar<uint32_t>::ptr g_udp_server_buffer_size =
+    sy::Config::Lookup("udp_server.buffer_size", (uint32_t)2048,
+            "udp server receive buffer size per datagram");
+static sy::ConfigVar<bool>::ptr g_udp_server_gso =
+    sy::Config::Lookup("udp_server.gso", false, "udp server send with UDP_SEGMENT");
+static sy::ConfigVar<bool>::ptr g_udp_server_gro =
+    sy::Config::Lookup("udp_server.gro", false, "udp server receive with UDP_GRO");
+static sy::ConfigVar<bool>::ptr g_udp_server_reuseport =
+    sy::Config::Lookup("udp_server.reuseport", false,
+            "udp server one SO_REUSEPORT socket per io thread, needs iomanager.per_thread_reactor");
+
+static sy::Logger::ptr g_logger = SY_LOG_NAME("system");
+
+// GSO一条消息最多的段数和字节数
+static const size_t GSO_MAX_SEGMENTS = 64;
+static const size_t GSO_MAX_BYTES = 65000;
+// GRO合并后的最大长度
+static const size_t GRO_BUFFER_SIZE = 65536;
+
+UdpSendBatch::UdpSendBatch(bool gso)
+    :m_gso(gso) {
+}
+
+void UdpSendBatch::add(const void* data, size_t len, const sockaddr* addr, socklen_t addrlen) {
+    m_items.resize(m_items.size() + 1);
+    Item& item = m_items.back();
+    item.data = (const char*)data;
+    item.len = len;
+    item.addrlen = std::min(addrlen, (socklen_t)sizeof(item.addr));
+    memcpy(&item.addr, addr, item.addrlen);
+}
+
+static bool same_addr(const sockaddr_storage& a, socklen_t alen
+                        ,const sockaddr_storage& b, socklen_t blen) {
+    return alen == blen && memcmp(&a, &b, alen) == 0;
+}
+
+void UdpSendBatch::build(size_t begin) {
+    m_msgs.clear();
+    m_iovs.clear();
+    m_first.clear();
+    // 消息指向m_iovs和m_control，构造过程中不能重新分配
+    m_iovs.reserve(m_items.size());
+    m_control.assign(m_items.size() * CMSG_SPACE(sizeof(uint16_t)), 0);
+
+    size_t i = begin;
+    while(i < m_items.size()) {
+        Item& head = m_items[i];
+        size_t j = i + 1;
+        // 段长为0时内核拒绝UDP_SEGMENT(EINVAL)，空数据报不合并
+        if(m_gso && head.len > 0) {
+            size_t total = head.len;
+            // 除最后一段外每段长度都等于第一段
+            while(j < m_items.size() && j - i < GSO_MAX_SEGMENTS
+                    && m_items[j - 1].len == head.len
+                    && m_items[j].len <= head.len
+                    && total + m_items[j].len <= GSO_MAX_BYTES
+                    && same_addr(head.addr, head.addrlen, m_items[j].addr, m_items[j].addrlen)) {
+                total += m_items[j].len;
+                ++j;
+            }
+        }
+
+        size_t iov = m_iovs.size();
+        for(size_t k = i; k < j; ++k) {
+            iovec v;
+            v.iov_base = (void*)m_items[k].data;
+            v.iov_len = m_items[k].len;
+            m_iovs.push_back(v);
+        }
+
+        mmsghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_hdr.msg_name = &head.addr;
+        msg.msg_hdr.msg_namelen = head.addrlen;
+        msg.msg_hdr.msg_iov = &m_iovs[iov];
+        msg.msg_hdr.msg_iovlen = j - i;
+        if(j - i > 1) {
+            msg.msg_hdr.msg_control = &m_control[m_msgs.size() * CMSG_SPACE(sizeof(uint16_t))];
+            msg.msg_hdr.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+            cmsghdr* cm = CMSG_FIRSTHDR(&msg.msg_hdr);
+            cm->cmsg_level = SOL_UDP;
+            cm->cmsg_type = UDP_SEGMENT;
+            cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+            uint16_t seg = head.len;
+            memcpy(CMSG_DATA(cm), &seg, sizeof(seg));
+        }
+        m_msgs.push_back(msg);
+        m_first.push_back(i);
+        i = j;
+    }
+}
+
+// socket本身出错，后面的消息也发不出去
+static bool is_socket_error(int err) {
+    return err == EBADF || err == ENOTSOCK || err == ECANCELED
+        || err == ETIMEDOUT || err == EAGAIN || err == EWOULDBLOCK;
+}
+
+int UdpSendBatch::flush(Socket::ptr sock) {
+    size_t dropped = 0;
+    size_t begin = 0;
+    while(begin < m_items.size()) {
+        build(begin);
+        size_t done = 0;
+        bool rebuild = false;
+        while(done < m_msgs.size()) {
+            int n = sock->sendMulti(&m_msgs[done], m_msgs.size() - done);
+            if(n > 0) {
+                done += n;
+                continue;
+            }
+            // 网卡或内核不支持UDP_SEGMENT，关闭GSO后从这条消息开始重新构造
+            if(m_gso && m_msgs[done].msg_hdr.msg_controllen
+                    && (errno == EIO || errno == EINVAL || errno == ENOPROTOOPT)) {
+                SY_LOG_WARN(g_logger) << "udp gso unsupported, disabled errno=" << errno
+                    << " errstr=" << strerror(errno) << " sock=" << sock->getSocket();
+                m_gso = false;
+                rebuild = true;
+                break;
+            }
+            if(is_socket_error(errno)) {
+                dropped += m_items.size() - m_first[done];
+                SY_LOG_DEBUG(g_logger) << "sendmmsg errno=" << errno
+                    << " errstr=" << strerror(errno) << " sock=" << sock->getSocket()
+                    << " dropped=" << (m_items.size() - m_first[done]);
+                done = m_msgs.size();
+                break;
+            }
+            // 只是这一条发不出去(如EMSGSIZE、对端不可达)，丢弃它，继续发后面的
+            size_t end = done + 1 < m_msgs.size() ? m_first[done + 1] : m_items.size();
+            dropped += end - m_first[done];
+            SY_LOG_DEBUG(g_logger) << "sendmmsg errno=" << errno
+                << " errstr=" << strerror(errno) << " sock=" << sock->getSocket()
+                << " dropped=" << (end - m_first[done]);
+            ++done;
+        }
+        if(!rebuild) {
+            break;
+        }
+        begin = m_first[done];
+    }
+    size_t sent = m_items.size() - dropped;
+    m_items.clear();
+    if(sent == 0 && dropped) {
+        return -1;
+    }
+    return sent;
+}
+
+UdpServer::UdpServer(sy::IOManager* io_worker)
+    :m_ioWorker(io_worker)
+    ,m_batch(std::max(g_udp_server_batch->getValue(), (uint32_t)1))
+    ,m_bufferSize(g_udp_server_buffer_size->getValue())
+    ,m_gso(g_udp_server_gso->getValue())
+    ,m_gro(g_udp_server_gro->getValue())
+    ,m_reusePort(g_udp_server_reuseport->getValue())
+    ,m_name("sy/1.0.0")
+    ,m_isStop(true) {
+}
+
+UdpServer::~UdpServer() {
+    for(auto& i : m_socks) {
+        i->close();
+    }
+    m_socks.clear();
+}
+
+bool UdpServer::bind(sy::Address::ptr addr) {
+    std::vector<Address::ptr> addrs;
+    std::vector<Address::ptr> fails;
+    addrs.push_back(addr);
+    return bind(addrs, fails);
+}
+
+bool UdpServer::bind(const std::vector<Address::ptr>& addrs
+                        ,std::vector<Address::ptr>& fails) {
+    // 共享epoll模式下接收循环被唤醒后可能换线程，做不到每个线程一个socket
+    if(m_reusePort && !m_ioWorker->isPerThreadReactor()) {
+        SY_LOG_WARN(g_logger) << "udp reuseport needs iomanager.per_thread_reactor, io_worker="
+            << m_ioWorker->getName() << " uses a shared epoll, fall back to one socket per address";
+        m_reusePort = false;
+    }
+    size_t count = m_reusePort ? m_ioWorker->getReactorThreadCount() : 1;
+    for(auto& addr : addrs) {
+        // 端口为0时后面的socket绑定到第一个socket分配到的端口
+        Address::ptr bind_addr = addr;
+        for(size_t i = 0; i < count; ++i) {
+            Socket::ptr sock = Socket::CreateUDP(addr);
+            if(m_reusePort) {
+                sock->setOption(SOL_SOCKET, SO_REUSEPORT, (int)1);
+            }
+            if(m_gro && !sock->setOption(SOL_UDP, UDP_GRO, (int)1)) {
+                SY_LOG_WARN(g_logger) << "udp gro unsupported errno=" << errno
+                    << " errstr=" << strerror(errno);
+            }
+            if(!sock->bind(bind_addr)) {
+                SY_LOG_ERROR(g_logger) << "bind fail errno="
+                    << errno << " errstr=" << strerror(errno)
+                    << " addr=[" << bind_addr->toString() << "]";
+                fails.push_back(addr);
+                break;
+            }
+            if(i == 0) {
+                bind_addr = sock->getLocalAddress();
+            }
+            m_socks.push_back(sock);
+        }
+    }
+
+    if(!fails.empty()) {
+        m_socks.clear();
+        return false;
+    }
+
+    for(auto& i : m_socks) {
+        SY_LOG_INFO(g_logger) << "type=udp name=" << m_name
+            << " batch=" << m_batch
+            << " gso=" << m_gso
+            << " gro=" << m_gro
+            << " server bind success: " << *i;
+    }
+    return true;
+}
+
+void UdpServer::startRecv(Socket::ptr sock) {
+    size_t bufsize = m_gro ? std::max(m_bufferSize, GRO_BUFFER_SIZE) : m_bufferSize;
+    size_t ctrlsize = CMSG_SPACE(sizeof(int));
+    // 这个接收循环的缓冲区，整个循环期间复用
+    std::vector<char> buffers(m_batch * bufsize);
+    std::vector<char> control(m_batch * ctrlsize);
+    std::vector<sockaddr_storage> addrs(m_batch);
+    std::vector<iovec> iovs(m_batch);
+    std::vector<mmsghdr> msgs(m_batch);
+    std::vector<Datagram> dgrams;
+    dgrams.reserve(m_batch);
+    UdpSendBatch out(m_gso);
+
+    for(size_t i = 0; i < m_batch; ++i) {
+        iovs[i].iov_base = &buffers[i * bufsize];
+        iovs[i].iov_len = bufsize;
+    }
+
+    while(!m_isStop) {
+        // 内核会改写名字和控制信息的长度，每次接收前重置
+        for(size_t i = 0; i < m_batch; ++i) {
+            msghdr& hdr = msgs[i].msg_hdr;
+            memset(&hdr, 0, sizeof(hdr));
+            hdr.msg_name = &addrs[i];
+            hdr.msg_namelen = sizeof(addrs[i]);
+            hdr.msg_iov = &iovs[i];
+            hdr.msg_iovlen = 1;
+            if(m_gro) {
+                hdr.msg_control = &control[i * ctrlsize];
+                hdr.msg_controllen = ctrlsize;
+            }
+            msgs[i].msg_len = 0;
+        }
+        int n = sock->recvMulti(&msgs[0], m_batch);
+        if(n <= 0) {
+            if(!m_isStop) {
+                SY_LOG_ERROR(g_logger) << "recvmmsg errno=" << errno
+                    << " errstr=" << strerror(errno);
+            }
+            continue;
+        }
+
+        dgrams.clear();
+        for(int i = 0; i < n; ++i) {
+            msghdr& hdr = msgs[i].msg_hdr;
+            if(hdr.msg_flags & MSG_TRUNC) {
+                SY_LOG_DEBUG(g_logger) << "udp datagram truncated, buffer_size=" << bufsize;
+                continue;
+            }
+            char* data = (char*)iovs[i].iov_base;
+            size_t len = msgs[i].msg_len;
+            size_t seg = len;
+            if(m_gro) {
+                for(cmsghdr* cm = CMSG_FIRSTHDR(&hdr); cm; cm = CMSG_NXTHDR(&hdr, cm)) {
+                    if(cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO) {
+                        int v = 0;
+                        memcpy(&v, CMSG_DATA(cm), sizeof(v));
+                        if(v > 0) {
+                            seg = v;
+                        }
+                    }
+                }
+            }
+            // GRO合并的数据报按段长切开；长度为0的数据报也是有效的，作为一个空数据报交给处理函数
+            size_t off = 0;
+            do {
+                Datagram d;
+                d.data = data + off;
+                d.len = std::min(seg, len - off);
+                d.addr = (const sockaddr*)&addrs[i];
+                d.addrlen = hdr.msg_namelen;
+                dgrams.push_back(d);
+                off += seg;
+            } while(off < len);
+        }
+        if(dgrams.empty()) {
+            continue;
+        }
+        handleDatagrams(sock, &dgrams[0], dgrams.size(), out);
+        if(!out.empty()) {
+            out.flush(sock);
+        }
+    }
+}
+
+bool UdpServer::start() {
+    if(!m_isStop) {
+        return true;
+    }
+    m_isStop = false;
+    if(!m_reusePort) {
+        for(auto& sock : m_socks) {
+            m_ioWorker->schedule(std::bind(&UdpServer::startRecv,
+                        shared_from_this(), sock));
+        }
+        return true;
+    }
+    // 接收循环第一次等待时socket归属于所在的线程，之后一直在这个线程上被唤醒
+    std::vector<int> threads;
+    if(!m_ioWorker->waitReactorThreads(threads)) {
+        SY_LOG_ERROR(g_logger) << "start fail, io_worker=" << m_ioWorker->getName();
+        m_isStop = true;
+        return false;
+    }
+    for(size_t i = 0; i < m_socks.size(); ++i) {
+        m_ioWorker->schedule(std::bind(&UdpServer::startRecv,
+                    shared_from_this(), m_socks[i]), threads[i % threads.size()]);
+    }
+    return true;
+}
+
+void UdpServer::stop() {
+    m_isStop = true;
+    auto self = shared_from_this();
+    m_ioWorker->schedule([this, self]() {
+        for(auto& sock : m_socks) {
+            sock->cancelAll();
+            sock->close();
+        }
+        m_socks.clear();
+    });
+}
+
+void UdpServer::handleDatagrams(Socket::ptr sock, Datagram* msgs, size_t n, UdpSendBatch& out) {
+    SY_LOG_DEBUG(g_logger) << "handleDatagrams: " << *sock << " n=" << n;
+}
+
+std::string UdpServer::toString(const std::string& prefix) {
+    std::stringstream ss;
+    ss << prefix << "[type=udp name=" << m_name
+       << " io_worker=" << (m_ioWorker ? m_ioWorker->getName() : "")
+       << " batch=" << m_batch << " buffer_size=" << m_bufferSize
+       << " gso=" << m_gso << " gro=" << m_gro
+       << " reuseport=" << m_reusePort << "]" << std::endl;
+    std::string pfx = prefix.empty() ? "    " : prefix;
+    for(auto& i : m_socks) {
+        ss << pfx << pfx << *i << std::endl;
+    }
+    return ss.str();
+}
+
+}
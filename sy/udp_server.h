@@ -0,0 +1,127 @@
+#ifndef __SY_UDP_SERVER_H__
+#define __SY_UDP_SERVER_H__
+
+#include <memory>
+#include <vector>
+#include <sys/socket.h>
+#include "address.h"
+#include "iomanager.h"
+#include "socket.h"
+#include "noncopyable.h"
+
+namespace sy {
+
+// 一批待发送的数据报，flush时用一次sendmmsg发出
+// 开启GSO时，发往同一地址、长度相同的连续数据报(最后一个可以更短)合并为一条消息，
+// 由内核按UDP_SEGMENT切分，最多64段、64KB；内核不支持时自动关闭GSO逐个发送
+// add只保存数据指针，数据在flush之前必须有效
+class UdpSendBatch : Noncopyable {
+public:
+    UdpSendBatch(bool gso = false);
+
+    void add(const void* data, size_t len, const sockaddr* addr, socklen_t addrlen);
+
+    // 发送所有数据报并清空，返回发送成功的数据报个数，一个都没发出且出错返回-1
+    // 某一条发送失败(如EMSGSIZE、对端不可达)只丢弃这一条，socket本身出错时丢弃剩下的全部
+    int flush(Socket::ptr sock);
+
+    size_t size() const { return m_items.size();}
+    bool empty() const { return m_items.empty();}
+    bool isGso() const { return m_gso;}
+private:
+    // 从第begin个数据报开始构造sendmmsg的消息数组
+    void build(size_t begin);
+private:
+    struct Item {
+        const char* data;
+        size_t len;
+        sockaddr_storage addr;
+        socklen_t addrlen;
+    };
+    std::vector<Item> m_items;
+    // 以下数组跨flush复用，避免每批分配内存
+    std::vector<mmsghdr> m_msgs;
+    std::vector<iovec> m_iovs;
+    std::vector<char> m_control;
+    // 每条消息的第一个数据报序号
+    std::vector<size_t> m_first;
+    bool m_gso;
+};
+
+// 批量收发的UDP服务器
+// 开启reuseport时每个地址为每个IO线程创建一个SO_REUSEPORT的socket，接收循环固定在对应线程上，
+// 内核按四元组把数据报分到各个socket，线程之间不竞争同一个接收队列；
+// 固定线程需要IO调度器开启iomanager.per_thread_reactor，否则退回每个地址一个socket
+// 每个接收循环持有一组预先分配的缓冲区，每次recvmmsg最多收batch个数据报；
+// 开启GRO时内核合并的数据报按UDP_GRO给出的段长切分后再交给handleDatagrams
+class UdpServer : public std::enable_shared_from_this<UdpServer>
+                    , Noncopyable {
+public:
+    typedef std::shared_ptr<UdpServer> ptr;
+
+    // 收到的一个数据报，data指向接收缓冲区，只在handleDatagrams返回前有效
+    struct Datagram {
+        char* data;
+        size_t len;
+        const sockaddr* addr;
+        socklen_t addrlen;
+    };
+
+    UdpServer(sy::IOManager* io_worker = sy::IOManager::GetThis());
+
+    virtual ~UdpServer();
+
+    virtual bool bind(sy::Address::ptr addr);
+
+    // 绑定多个地址，有失败的地址时返回false
+    virtual bool bind(const std::vector<Address::ptr>& addrs
+                        ,std::vector<Address::ptr>& fails);
+
+    // 启动服务，reuseport时第i个socket的接收循环固定在第i个IO线程上，会等IO线程启动
+    virtual bool start();
+
+    virtual void stop();
+
+    // 以下设置需在bind之前调用
+    size_t getBatch() const { return m_batch;}
+    void setBatch(size_t v) { m_batch = v ? v : 1;}
+    size_t getBufferSize() const { return m_bufferSize;}
+    void setBufferSize(size_t v) { m_bufferSize = v;}
+    bool isGso() const { return m_gso;}
+    void setGso(bool v) { m_gso = v;}
+    bool isGro() const { return m_gro;}
+    void setGro(bool v) { m_gro = v;}
+    bool isReusePort() const { return m_reusePort;}
+    void setReusePort(bool v) { m_reusePort = v;}
+
+    std::string getName() const { return m_name;}
+    virtual void setName(const std::string& v) { m_name = v;}
+
+    bool isStop() const { return m_isStop;}
+
+    virtual std::string toString(const std::string& prefix = "");
+
+    std::vector<Socket::ptr> getSocks() const { return m_socks;}
+protected:
+    // 处理一批收到的数据报，回复加入out，返回后由接收循环flush
+    virtual void handleDatagrams(Socket::ptr sock, Datagram* msgs, size_t n, UdpSendBatch& out);
+
+    // 接收循环
+    virtual void startRecv(Socket::ptr sock);
+protected:
+    std::vector<Socket::ptr> m_socks;
+    IOManager* m_ioWorker;
+    // 每次recvmmsg最多接收的数据报个数
+    size_t m_batch;
+    // 每个数据报的接收缓冲区大小，开启GRO时至少64KB
+    size_t m_bufferSize;
+    bool m_gso;
+    bool m_gro;
+    bool m_reusePort;
+    std::string m_name;
+    bool m_isStop;
+};
+
+}
+
+#endif
@@ -4,6 +4,7 @@
 #include <string.h>
 #include <execinfo.h>
 #include <sys/time.h>
+#include <time.h>
 #include <dirent.h>
 #include <signal.h> // for kill()
 #include <unistd.h>
@@ -51,10 +52,7 @@ static std::string demangle(const char* str) {
     return str;
 }
 
-void Backtrace(std::vector<std::string>& bt, int size, int skip) {
-    void** array = (void**)malloc((sizeof(void*) * size));
-    size_t s = ::backtrace(array, size);
-
+static void BacktraceSymbols(std::vector<std::string>& bt, void** array, size_t s, int skip) {
     char** strings = backtrace_symbols(array, s);
     if(strings == NULL) {
         SY_LOG_ERROR(g_logger) << "backtrace_synbols error";
@@ -66,6 +64,12 @@ void Backtrace(std::vector<std::string>& bt, int size, int skip) {
     }
 
     free(strings);
+}
+
+void Backtrace(std::vector<std::string>& bt, int size, int skip) {
+    void** array = (void**)malloc((sizeof(void*) * size));
+    size_t s = ::backtrace(array, size);
+    BacktraceSymbols(bt, array, s, skip);
     free(array);
 }
 
@@ -79,6 +83,16 @@ std::string BacktraceToString(int size, int skip, const std::string& prefix) {
     return ss.str();
 }
 
+std::string BacktraceToString(void** frames, int size, int skip, const std::string& prefix) {
+    std::vector<std::string> bt;
+    BacktraceSymbols(bt, frames, size, skip);
+    std::stringstream ss;
+    for(size_t i = 0; i < bt.size(); ++i) {
+        ss << prefix << bt[i] << std::endl;
+    }
+    return ss.str();
+}
+
 uint64_t GetCurrentMS() {
     struct timeval tv;
     gettimeofday(&tv, NULL);
@@ -91,6 +105,18 @@ uint64_t GetCurrentUS() {
     return tv.tv_sec * 1000 * 1000ul  + tv.tv_usec;
 }
 
+uint64_t GetMonotonicUS() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 * 1000ul + ts.tv_nsec / 1000;
+}
+
+uint64_t GetMonotonicCoarseUS() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec * 1000 * 1000ul + ts.tv_nsec / 1000;
+}
+
 std::string Time2Str(time_t ts, const std::string& format) {
     struct tm tm;
     localtime_r(&ts, &tm);
@@ -34,12 +34,21 @@ void Backtrace(std::vector<std::string>& bt, int size = 64, int skip = 1);
 // 获取当前栈信息的字符串：size 栈的最大层数，skip 跳过栈顶的层数，prefix 栈信息前输出的内容
 std::string BacktraceToString(int size = 64, int skip = 2, const std::string& prefix = "");
 
+// 把::backtrace得到的调用栈地址转成字符串，用于在别处(如信号处理函数)抓取的调用栈
+std::string BacktraceToString(void** frames, int size, int skip = 0, const std::string& prefix = "");
+
 // 获取当前时间的毫秒
 uint64_t GetCurrentMS();
 
 // 获取当前时间的微秒
 uint64_t GetCurrentUS();
 
+// 单调时钟的微秒，不受系统时间调整影响，用于统计耗时
+uint64_t GetMonotonicUS();
+
+// 粗粒度单调时钟的微秒，精度为一个时钟节拍(1~4毫秒)，开销约为GetMonotonicUS的五分之一
+uint64_t GetMonotonicCoarseUS();
+
 // 获取线程名称，参考pthread_getname_np
 std::string GetThreadName();
 
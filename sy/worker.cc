@@ -1,9 +1,12 @@
 #include "worker.h"
 #include "config.h"
 #include "util.h"
+#include <sstream>
 
 namespace sy {
 
+static sy::Logger::ptr g_logger = SY_LOG_NAME("system");
+
 static sy::ConfigVar<std::map<std::string, std::map<std::string, std::string> > >::ptr g_worker_config
     = sy::Config::Lookup("workers", std::map<std::string, std::map<std::string, std::string> >(), "worker config");
 
@@ -66,18 +69,48 @@ bool WorkerManager::init(const std::map<std::string, std::map<std::string, std::
         std::string name = i.first;
         int32_t thread_num = sy::GetParamValue(i.second, "thread_num", 1);
         int32_t worker_num = sy::GetParamValue(i.second, "worker_num", 1);
+        bool shared_stack = sy::GetParamValue(i.second, "shared_stack", 0);
+        // CPU亲和性和NUMA节点：cpus为cpulist格式(如"0-7,16-23")，cpu_bind为core时每个线程绑定一个CPU
+        ThreadAffinity affinity;
+        std::string cpus = sy::GetParamValue<std::string>(i.second, "cpus");
+        if(!cpus.empty() && !ThreadAffinity::ParseCpuList(cpus, affinity.cpus)) {
+            SY_LOG_ERROR(g_logger) << "worker " << name << " invalid cpus: " << cpus;
+            return false;
+        }
+        affinity.numaNode = sy::GetParamValue(i.second, "numa_node", -1);
+        affinity.perCore = sy::GetParamValue<std::string>(i.second, "cpu_bind") == "core";
+        // 弹性线程数：配置了elastic_min时thread_num为上限，线程数按队列指标在两者之间伸缩
+        int32_t elastic_min = sy::GetParamValue(i.second, "elastic_min", -1);
+        Scheduler::ElasticOptions elastic;
+        if(elastic_min >= 0) {
+            elastic.minThreads = elastic_min;
+            elastic.growDelayUs = sy::GetParamValue(i.second, "elastic_delay_us", elastic.growDelayUs);
+            elastic.growBacklog = sy::GetParamValue(i.second, "elastic_backlog", elastic.growBacklog);
+            elastic.shrinkIdleMs = sy::GetParamValue(i.second, "elastic_idle_ms", elastic.shrinkIdleMs);
+        }
 
         for(int32_t x = 0; x < worker_num; ++x) {
             Scheduler::ptr s;
             if(!x) {
-                s = std::make_shared<IOManager>(thread_num, false, name);
+                s = std::make_shared<IOManager>(thread_num, false, name, affinity);
             } else {
-                s = std::make_shared<IOManager>(thread_num, false, name + "-" + std::to_string(x));
+                s = std::make_shared<IOManager>(thread_num, false, name + "-" + std::to_string(x)
+                                                ,affinity);
+            }
+            if(shared_stack) {
+                s->setSharedStack(true);
+            }
+            if(elastic_min >= 0) {
+                s->setElastic(elastic);
             }
             add(s);
         }
     }
     m_stop = m_datas.empty();
+    // 启动时输出线程到CPU的布局
+    std::stringstream ss;
+    dumpLayout(ss);
+    SY_LOG_INFO(g_logger) << "worker thread layout:" << std::endl << ss.str();
     return true;
 }
 
@@ -104,6 +137,15 @@ uint32_t WorkerManager::getCount() {
     return m_datas.size();
 }
 
+std::ostream& WorkerManager::dumpLayout(std::ostream& os) {
+    for(auto& i : m_datas) {
+        for(auto& n : i.second) {
+            n->dumpLayout(os) << std::endl;
+        }
+    }
+    return os;
+}
+
 std::ostream& WorkerManager::dump(std::ostream& os) {
     for(auto& i : m_datas) {
         for(auto& n : i.second) {
@@ -5,6 +5,7 @@
 #include "singleton.h"
 #include "log.h"
 #include "iomanager.h"
+#include "parallel.h"
 
 namespace sy {
 
@@ -20,6 +21,9 @@ public:
 
     void schedule(std::function<void()> cb, int thread = -1);
     void waitAll();
+
+    // 并行算法(parallel.h)的参数：在本组的调度器上执行，每次调用最多batch_size个辅助任务
+    ParallelOptions getParallelOptions() const { return ParallelOptions(m_scheduler, m_batchSize);}
 private:
     void doWork(std::function<void()> cb);
 private:
@@ -37,10 +41,11 @@ public:
     IOManager::ptr getAsIOManager(const std::string& name);
 
     template<class FiberOrCb>
-    void schedule(const std::string& name, FiberOrCb fc, int thread = -1) {
+    void schedule(const std::string& name, FiberOrCb fc, int thread = -1
+                  ,Scheduler::Priority priority = Scheduler::NORMAL) {
         auto s = get(name);
         if(s) {
-            s->schedule(fc, thread);
+            s->schedule(fc, thread, priority);
         } else {
             static sy::Logger::ptr s_logger = SY_LOG_NAME("system");
             SY_LOG_ERROR(s_logger) << "schedule name=" << name
@@ -49,10 +54,11 @@ public:
     }
 
     template<class Iter>
-    void schedule(const std::string& name, Iter begin, Iter end) {
+    void schedule(const std::string& name, Iter begin, Iter end
+                  ,Scheduler::Priority priority = Scheduler::NORMAL) {
         auto s = get(name);
         if(s) {
-            s->schedule(begin, end);
+            s->schedule(begin, end, priority);
         } else {
             static sy::Logger::ptr s_logger = SY_LOG_NAME("system");
             SY_LOG_ERROR(s_logger) << "schedule name=" << name
@@ -67,6 +73,9 @@ public:
     bool isStoped() const { return m_stop;}
     std::ostream& dump(std::ostream& os);
 
+    // 输出所有调度线程实际的CPU和NUMA节点布局
+    std::ostream& dumpLayout(std::ostream& os);
+
     uint32_t getCount();
 private:
     std::map<std::string, std::vector<Scheduler::ptr> > m_datas;
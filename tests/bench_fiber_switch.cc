@@ -0,0 +1,83 @@
+#include "sy/sy.h"
+#include "sy/fiber_context.h"
+
+static sy::Logger::ptr g_logger = SY_LOG_ROOT();
+
+static const size_t STACK_SIZE = 64 * 1024;
+
+static ucontext_t s_uc_main;
+static ucontext_t s_uc_fiber;
+
+static void uc_entry() {
+    while(true) {
+        swapcontext(&s_uc_fiber, &s_uc_main);
+    }
+}
+
+// ucontext后端：每次切换都会调用rt_sigprocmask
+void bench_ucontext(uint64_t count) {
+    std::vector<char> stack(STACK_SIZE);
+    sy::UcontextMakeContext(&s_uc_fiber, &stack[0], STACK_SIZE, &uc_entry);
+    uint64_t begin = sy::GetCurrentUS();
+    for(uint64_t i = 0; i < count; ++i) {
+        swapcontext(&s_uc_main, &s_uc_fiber);
+    }
+    uint64_t used = sy::GetCurrentUS() - begin;
+    SY_LOG_INFO(g_logger) << "backend=ucontext switches=" << count * 2
+        << " used=" << used << "us"
+        << " switches/s=" << (used ? count * 2 * 1000000ull / used : 0);
+}
+
+#ifdef SY_HAS_ASM_CONTEXT
+static sy::AsmContext s_asm_main;
+static sy::AsmContext s_asm_fiber;
+
+static void asm_entry() {
+    while(true) {
+        sy::AsmSwapContext(&s_asm_fiber, &s_asm_main);
+    }
+}
+
+// 汇编后端：只保存callee-saved寄存器
+void bench_asm(uint64_t count) {
+    std::vector<char> stack(STACK_SIZE);
+    sy::AsmMakeContext(&s_asm_fiber, &stack[0], STACK_SIZE, &asm_entry);
+    uint64_t begin = sy::GetCurrentUS();
+    for(uint64_t i = 0; i < count; ++i) {
+        sy::AsmSwapContext(&s_asm_main, &s_asm_fiber);
+    }
+    uint64_t used = sy::GetCurrentUS() - begin;
+    SY_LOG_INFO(g_logger) << "backend=asm switches=" << count * 2
+        << " used=" << used << "us"
+        << " switches/s=" << (used ? count * 2 * 1000000ull / used : 0);
+}
+#endif
+
+// sy::Fiber的resume/yield，使用编译时选择的后端
+void bench_fiber(uint64_t count) {
+    sy::Fiber::GetThis();
+    sy::Fiber::ptr fiber(new sy::Fiber([count](){
+        for(uint64_t i = 0; i < count; ++i) {
+            sy::Fiber::GetThis()->yield();
+        }
+    }, 0, false));
+    uint64_t begin = sy::GetCurrentUS();
+    for(uint64_t i = 0; i <= count; ++i) {
+        fiber->resume();
+    }
+    uint64_t used = sy::GetCurrentUS() - begin;
+    SY_LOG_INFO(g_logger) << "sy::Fiber backend=" << sy::ContextBackendName()
+        << " switches=" << count * 2
+        << " used=" << used << "us"
+        << " switches/s=" << (used ? count * 2 * 1000000ull / used : 0);
+}
+
+int main(int argc, char** argv) {
+    uint64_t count = argc > 1 ? atoll(argv[1]) : 10000000;
+    bench_ucontext(count);
+#ifdef SY_HAS_ASM_CONTEXT
+    bench_asm(count);
+#endif
+    bench_fiber(count);
+    return 0;
+}
@@ -0,0 +1,153 @@
+#include "sy/sy.h"
+
+static sy::Logger::ptr g_logger = SY_LOG_ROOT();
+
+static size_t s_fibers = 1000;
+static size_t s_iters = 1000;
+static size_t s_threads = 4;
+
+// 启动s_fibers个协程执行cb，等全部结束后输出每秒操作数
+static void run_fibers(const std::string& name, uint64_t ops, std::function<void()> cb) {
+    sy::Scheduler sc(s_threads, false, "bench");
+    sc.start();
+    uint64_t begin = sy::GetCurrentUS();
+    for(size_t i = 0; i < s_fibers; ++i) {
+        sc.schedule(cb);
+    }
+    sc.stop();
+    uint64_t used = sy::GetCurrentUS() - begin;
+    SY_LOG_INFO(g_logger) << name
+        << " fibers=" << s_fibers
+        << " threads=" << s_threads
+        << " used=" << used << "us"
+        << " ops/s=" << (used ? ops * 1000000ull / used : 0);
+}
+
+// 1k协程争一把锁，临界区很短，这时线程锁不会挂住其他协程，比较两者的开销
+template<class MutexType>
+static void bench_mutex(const std::string& name) {
+    MutexType mutex;
+    uint64_t counter = 0;
+    run_fibers(name, s_fibers * s_iters, [&mutex, &counter]() {
+        for(size_t i = 0; i < s_iters; ++i) {
+            typename MutexType::Lock lock(mutex);
+            ++counter;
+        }
+    });
+    SY_ASSERT(counter == s_fibers * s_iters);
+}
+
+// 读多写少：每16次操作一次写
+template<class RWMutexType>
+static void bench_rwmutex(const std::string& name) {
+    RWMutexType mutex;
+    uint64_t value = 0;
+    std::atomic<uint64_t> sum = {0};
+    run_fibers(name, s_fibers * s_iters, [&mutex, &value, &sum]() {
+        uint64_t local = 0;
+        for(size_t i = 0; i < s_iters; ++i) {
+            if(i % 16 == 0) {
+                typename RWMutexType::WriteLock lock(mutex);
+                ++value;
+            } else {
+                typename RWMutexType::ReadLock lock(mutex);
+                local += value;
+            }
+        }
+        sum += local;
+    });
+}
+
+// 持有锁时协程被挂起(比如做了hook的IO)，线程锁会挂住整个线程，这里只能测协程锁
+// 临界区里用一个空的通道往返模拟挂起
+static void bench_fiber_mutex_park() {
+    sy::FiberMutex mutex;
+    uint64_t counter = 0;
+    run_fibers("FiberMutex(park in cs)", s_fibers * (s_iters / 10), [&mutex, &counter]() {
+        sy::Channel<int> chan(0);
+        for(size_t i = 0; i < s_iters / 10; ++i) {
+            sy::FiberMutex::Lock lock(mutex);
+            int v = 0;
+            sy::Scheduler::GetThis()->schedule([&chan](){ chan.send(1);});
+            chan.recv(v);
+            counter += v;
+        }
+    });
+    SY_ASSERT(counter == s_fibers * (s_iters / 10));
+}
+
+// 一半协程发送，一半协程接收
+static void bench_channel(const std::string& name, size_t capacity) {
+    sy::Channel<uint64_t> chan(capacity);
+    std::atomic<uint64_t> sum = {0};
+    std::atomic<size_t> index = {0};
+    run_fibers(name, s_fibers / 2 * s_iters, [&chan, &sum, &index]() {
+        if(index++ % 2 == 0) {
+            for(size_t i = 0; i < s_iters; ++i) {
+                chan.send(i);
+            }
+        } else {
+            uint64_t v = 0;
+            uint64_t local = 0;
+            for(size_t i = 0; i < s_iters; ++i) {
+                chan.recv(v);
+                local += v;
+            }
+            sum += local;
+        }
+    });
+    SY_ASSERT(sum == s_fibers / 2 * (s_iters * (s_iters - 1) / 2));
+}
+
+// 条件变量实现的有界队列，对比通道
+static void bench_condition() {
+    sy::FiberMutex mutex;
+    sy::FiberCondition not_empty;
+    sy::FiberCondition not_full;
+    std::deque<uint64_t> queue;
+    std::atomic<uint64_t> sum = {0};
+    std::atomic<size_t> index = {0};
+    run_fibers("FiberCondition queue(64)", s_fibers / 2 * s_iters, [&]() {
+        if(index++ % 2 == 0) {
+            for(size_t i = 0; i < s_iters; ++i) {
+                sy::FiberMutex::Lock lock(mutex);
+                not_full.wait(mutex, [&queue](){ return queue.size() < 64;});
+                queue.push_back(i);
+                not_empty.notify();
+            }
+        } else {
+            uint64_t local = 0;
+            for(size_t i = 0; i < s_iters; ++i) {
+                sy::FiberMutex::Lock lock(mutex);
+                not_empty.wait(mutex, [&queue](){ return !queue.empty();});
+                local += queue.front();
+                queue.pop_front();
+                not_full.notify();
+            }
+            sum += local;
+        }
+    });
+    SY_ASSERT(sum == s_fibers / 2 * (s_iters * (s_iters - 1) / 2));
+}
+
+int main(int argc, char** argv) {
+    s_fibers = argc > 1 ? atoi(argv[1]) : 1000;
+    s_iters = argc > 2 ? atoi(argv[2]) : 1000;
+    s_threads = argc > 3 ? atoi(argv[3]) : 4;
+    if(argc > 4) {
+        sy::Config::Lookup<uint32_t>("fiber.sync_spin")->setValue(atoi(argv[4]));
+    }
+    s_fibers = std::max<size_t>(s_fibers & ~(size_t)1, 2);
+
+    bench_mutex<sy::Mutex>("Mutex");
+    bench_mutex<sy::Spinlock>("Spinlock");
+    bench_mutex<sy::FiberMutex>("FiberMutex");
+    bench_rwmutex<sy::RWMutex>("RWMutex");
+    bench_rwmutex<sy::FiberRWMutex>("FiberRWMutex");
+    bench_fiber_mutex_park();
+    bench_channel("Channel(0)", 0);
+    bench_channel("Channel(64)", 64);
+    bench_channel("Channel(unbounded)", sy::Channel<uint64_t>::UNBOUNDED);
+    bench_condition();
+    return 0;
+}
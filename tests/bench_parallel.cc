@@ -0,0 +1,89 @@
+#include "sy/sy.h"
+#include <cmath>
+#include <random>
+
+static sy::Logger::ptr g_logger = SY_LOG_ROOT();
+
+// 每个元素的计算量，模拟构建快照时的序列化/哈希
+static double work(size_t i) {
+    double v = (double)i;
+    for(int j = 0; j < 64; ++j) {
+        v = std::sqrt(v + j) * 1.0001;
+    }
+    return v;
+}
+
+static void report(const char* name, size_t threads, uint64_t serial_us, uint64_t parallel_us) {
+    SY_LOG_INFO(g_logger) << name << " threads=" << threads
+        << " serial=" << serial_us << "us"
+        << " parallel=" << parallel_us << "us"
+        << " speedup=" << (parallel_us ? (double)serial_us / parallel_us : 0);
+}
+
+// 对比单线程和threads个调度线程的并行算法，n为元素数
+void bench_parallel(size_t threads, size_t n) {
+    sy::Scheduler sc(threads, false, "parallel");
+    sc.start();
+    sy::ParallelOptions opts(&sc);
+
+    std::vector<double> serial(n);
+    std::vector<double> parallel(n);
+    uint64_t begin = sy::GetCurrentUS();
+    for(size_t i = 0; i < n; ++i) {
+        serial[i] = work(i);
+    }
+    uint64_t serial_us = sy::GetCurrentUS() - begin;
+    begin = sy::GetCurrentUS();
+    sy::ParallelFor(0, n, [&parallel](size_t i) {
+        parallel[i] = work(i);
+    }, opts);
+    report("parallel_for", threads, serial_us, sy::GetCurrentUS() - begin);
+    SY_ASSERT(serial == parallel);
+
+    begin = sy::GetCurrentUS();
+    double sum = 0;
+    for(size_t i = 0; i < n; ++i) {
+        sum += work(i);
+    }
+    serial_us = sy::GetCurrentUS() - begin;
+    begin = sy::GetCurrentUS();
+    double psum = sy::ParallelReduce(0, n, 0.0, work, std::plus<double>(), opts);
+    report("parallel_reduce", threads, serial_us, sy::GetCurrentUS() - begin);
+    // 浮点加法的分组不同，结果可能有舍入误差
+    SY_ASSERT(std::fabs(sum - psum) <= std::fabs(sum) * 1e-9);
+
+    begin = sy::GetCurrentUS();
+    std::transform(serial.begin(), serial.end(), serial.begin(), [](double v) {
+        return work((size_t)v);
+    });
+    serial_us = sy::GetCurrentUS() - begin;
+    begin = sy::GetCurrentUS();
+    sy::ParallelTransform(parallel.begin(), parallel.end(), parallel.begin(), [](double v) {
+        return work((size_t)v);
+    }, opts);
+    report("parallel_transform", threads, serial_us, sy::GetCurrentUS() - begin);
+    SY_ASSERT(serial == parallel);
+
+    std::mt19937_64 rng(threads);
+    std::vector<uint64_t> keys(n * 8);
+    for(auto& i : keys) {
+        i = rng();
+    }
+    std::vector<uint64_t> pkeys = keys;
+    begin = sy::GetCurrentUS();
+    std::sort(keys.begin(), keys.end());
+    serial_us = sy::GetCurrentUS() - begin;
+    begin = sy::GetCurrentUS();
+    sy::ParallelSort(pkeys.begin(), pkeys.end(), opts);
+    report("parallel_sort", threads, serial_us, sy::GetCurrentUS() - begin);
+    SY_ASSERT(keys == pkeys);
+
+    sc.stop();
+}
+
+int main(int argc, char** argv) {
+    size_t n = argc > 1 ? atoll(argv[1]) : 1000000;
+    bench_parallel(argc > 2 ? atoi(argv[2]) : 8, n);
+    bench_parallel(argc > 3 ? atoi(argv[3]) : 32, n);
+    return 0;
+}
@@ -0,0 +1,40 @@
+#include "sy/sy.h"
+
+static sy::Logger::ptr g_logger = SY_LOG_ROOT();
+
+static std::atomic<uint64_t> s_done = {0};
+
+// 调度count个空回调，统计每秒执行的回调数量
+// pool_size为0时每个回调都new一个Fiber(复用前的行为)，否则复用本线程缓存的TERM协程
+void bench_callbacks(uint32_t pool_size, size_t threads, uint64_t count) {
+    sy::Config::Lookup<uint32_t>("scheduler.fiber_pool_size")->setValue(pool_size);
+    s_done = 0;
+
+    sy::Scheduler sc(threads, false, "bench");
+    sc.start();
+    uint64_t begin = sy::GetCurrentUS();
+    for(uint64_t i = 0; i < count; ++i) {
+        sc.schedule([](){
+            ++s_done;
+        });
+    }
+    sc.stop();
+    uint64_t used = sy::GetCurrentUS() - begin;
+    SY_LOG_INFO(g_logger) << "fiber_pool_size=" << pool_size
+        << " threads=" << threads
+        << " callbacks=" << s_done
+        << " used=" << used << "us"
+        << " callbacks/s=" << (used ? s_done * 1000000ull / used : 0);
+    std::stringstream ss;
+    sc.getStats().dump(ss);
+    SY_LOG_INFO(g_logger) << "stats:" << ss.str();
+}
+
+int main(int argc, char** argv) {
+    uint64_t count = argc > 1 ? atoll(argv[1]) : 1000000;
+    size_t threads = argc > 2 ? atoi(argv[2]) : 4;
+    uint32_t pool_size = argc > 3 ? atoi(argv[3]) : 64;
+    bench_callbacks(0, threads, count);
+    bench_callbacks(pool_size, threads, count);
+    return 0;
+}
@@ -0,0 +1,67 @@
+#include "sy/sy.h"
+#include <fstream>
+
+static sy::Logger::ptr g_logger = SY_LOG_ROOT();
+
+static std::atomic<uint64_t> s_started = {0};
+static std::atomic<uint64_t> s_rss = {0};
+
+// 当前进程的常驻内存(KB)
+static uint64_t get_rss_kb() {
+    std::ifstream ifs("/proc/self/statm");
+    uint64_t size = 0, rss = 0;
+    ifs >> size >> rss;
+    return rss * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+// 模拟常驻的连接协程：栈上放一些数据，反复让出，每次恢复后检查数据没有被别的协程破坏
+static void conn_fiber(uint64_t id, size_t fibers, size_t rounds) {
+    char buf[512];
+    memset(buf, (int)(id & 0xff), sizeof(buf));
+    for(size_t i = 0; i < rounds; ++i) {
+        // 所有协程都挂起过一次时，栈内存达到稳定，记下此时的常驻内存
+        if(i == 1 && ++s_started == fibers) {
+            s_rss = get_rss_kb();
+        }
+        sy::Scheduler::YieldToQueue();
+        for(size_t j = 0; j < sizeof(buf); ++j) {
+            SY_ASSERT(buf[j] == (char)(id & 0xff));
+        }
+    }
+}
+
+void bench_fibers(bool shared_stack, size_t threads, size_t fibers, size_t rounds) {
+    s_started = 0;
+    s_rss = 0;
+    uint64_t base_rss = get_rss_kb();
+
+    sy::Scheduler sc(threads, false, "bench");
+    sc.setSharedStack(shared_stack);
+    sc.start();
+    uint64_t begin = sy::GetCurrentUS();
+    for(size_t i = 0; i < fibers; ++i) {
+        sc.schedule([i, fibers, rounds](){
+            conn_fiber(i, fibers, rounds);
+        });
+    }
+    sc.stop();
+    uint64_t used = sy::GetCurrentUS() - begin;
+    uint64_t switches = fibers * rounds;
+    SY_LOG_INFO(g_logger) << "shared_stack=" << shared_stack
+        << " threads=" << threads
+        << " fibers=" << fibers
+        << " rounds=" << rounds
+        << " used=" << used << "us"
+        << " switches/s=" << (used ? switches * 1000000ull / used : 0)
+        << " rss=" << (s_rss > base_rss ? s_rss - base_rss : 0) << "KB";
+}
+
+int main(int argc, char** argv) {
+    size_t fibers = argc > 1 ? atoi(argv[1]) : 10000;
+    size_t rounds = argc > 2 ? atoi(argv[2]) : 100;
+    size_t threads = argc > 3 ? atoi(argv[3]) : 4;
+    // 每个协程独占栈时，栈的物理内存只有用到的页，但分配出去的栈会被缓存池保留
+    bench_fibers(false, threads, fibers, rounds);
+    bench_fibers(true, threads, fibers, rounds);
+    return 0;
+}
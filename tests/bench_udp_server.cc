@@ -0,0 +1,122 @@
+#include "sy/sy.h"
+#include <sys/resource.h>
+
+static sy::Logger::ptr g_logger = SY_LOG_ROOT();
+
+// 原样回显
+class EchoUdpServer : public sy::UdpServer {
+public:
+    EchoUdpServer(sy::IOManager* io_worker)
+        :sy::UdpServer(io_worker) {
+    }
+protected:
+    void handleDatagrams(sy::Socket::ptr sock, Datagram* msgs, size_t n, sy::UdpSendBatch& out) override {
+        for(size_t i = 0; i < n; ++i) {
+            out.add(msgs[i].data, msgs[i].len, msgs[i].addr, msgs[i].addrlen);
+        }
+    }
+};
+
+static std::atomic<uint64_t> s_received = {0};
+static std::atomic<bool> s_stop = {false};
+
+// 每个客户端协程一个socket，每轮用sendmmsg发window个数据报，再用recvmmsg收回显，丢包靠接收超时跳过
+static void client(sy::Address::ptr server, size_t window, size_t size) {
+    sy::Socket::ptr sock = sy::Socket::CreateUDP(server);
+    sock->setRecvTimeout(100);
+    std::string payload(size, 'x');
+    sockaddr_storage to;
+    memcpy(&to, server->getAddr(), server->getAddrLen());
+
+    std::vector<char> buffers(window * 2048);
+    std::vector<iovec> iovs(window);
+    std::vector<mmsghdr> msgs(window);
+    for(size_t i = 0; i < window; ++i) {
+        iovs[i].iov_base = &buffers[i * 2048];
+        iovs[i].iov_len = 2048;
+    }
+    sy::UdpSendBatch out;
+    while(!s_stop) {
+        for(size_t i = 0; i < window; ++i) {
+            out.add(payload.c_str(), payload.size(), (const sockaddr*)&to, server->getAddrLen());
+        }
+        out.flush(sock);
+        size_t got = 0;
+        while(got < window && !s_stop) {
+            for(size_t i = 0; i < window; ++i) {
+                memset(&msgs[i].msg_hdr, 0, sizeof(msghdr));
+                msgs[i].msg_hdr.msg_iov = &iovs[i];
+                msgs[i].msg_hdr.msg_iovlen = 1;
+            }
+            int n = sock->recvMulti(&msgs[0], window - got);
+            if(n <= 0) {
+                break;
+            }
+            got += n;
+        }
+        s_received += got;
+    }
+    sock->close();
+}
+
+static double cpu_seconds() {
+    rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec
+        + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1000000.0;
+}
+
+// threads个IO线程的服务器，clients个客户端协程压测seconds秒
+// 输出每秒回显的数据报数，和每CPU秒的数据报数(进程总CPU时间，包含客户端)
+void bench(size_t threads, size_t batch, bool reuseport, size_t clients, int seconds) {
+    // reuseport的接收循环要固定在各自的线程上，需要每线程独立的epoll
+    sy::Config::Lookup<bool>("iomanager.per_thread_reactor")->setValue(reuseport);
+    sy::IOManager server_iom(threads, false, "udp_server");
+    sy::Config::Lookup<bool>("iomanager.per_thread_reactor")->setValue(false);
+    sy::IOManager client_iom(threads, false, "udp_client");
+
+    EchoUdpServer::ptr server(new EchoUdpServer(&server_iom));
+    server->setBatch(batch);
+    server->setReusePort(reuseport);
+    SY_ASSERT(server->bind(sy::IPv4Address::Create("127.0.0.1", 0)));
+    sy::Address::ptr addr = server->getSocks()[0]->getLocalAddress();
+    SY_ASSERT(server->start());
+
+    s_received = 0;
+    s_stop = false;
+    for(size_t i = 0; i < clients; ++i) {
+        client_iom.schedule(std::bind(client, addr, batch, 64));
+    }
+    usleep(200 * 1000);
+    uint64_t begin_received = s_received;
+    double begin_cpu = cpu_seconds();
+    uint64_t begin = sy::GetCurrentUS();
+    sleep(seconds);
+    uint64_t received = s_received - begin_received;
+    double cpu = cpu_seconds() - begin_cpu;
+    double used = (sy::GetCurrentUS() - begin) / 1000000.0;
+    s_stop = true;
+
+    SY_LOG_INFO(g_logger) << "threads=" << threads
+        << " batch=" << batch
+        << " reuseport=" << reuseport
+        << " clients=" << clients
+        << " dgrams/s=" << (uint64_t)(received / used)
+        << " dgrams/cpu_s=" << (uint64_t)(cpu > 0 ? received / cpu : 0);
+
+    server->stop();
+    client_iom.stop();
+    server_iom.stop();
+}
+
+int main(int argc, char** argv) {
+    size_t threads = argc > 1 ? atoi(argv[1]) : 4;
+    int seconds = argc > 2 ? atoi(argv[2]) : 3;
+    size_t clients = threads * 16;
+    // 逐个收发 vs 批量收发，单socket vs 每线程一个SO_REUSEPORT socket
+    bench(threads, 1, false, clients, seconds);
+    bench(threads, 32, false, clients, seconds);
+    bench(threads, 1, true, clients, seconds);
+    bench(threads, 32, true, clients, seconds);
+    return 0;
+}
@@ -0,0 +1,44 @@
+#include "sy/sy.h"
+
+static sy::Logger::ptr g_logger = SY_LOG_ROOT();
+
+void test_parse() {
+    std::vector<int> cpus;
+    SY_ASSERT(sy::ThreadAffinity::ParseCpuList("0-3, 8,10-11", cpus));
+    SY_ASSERT(sy::ThreadAffinity::FormatCpuList(cpus) == "0-3,8,10-11");
+    SY_ASSERT(!sy::ThreadAffinity::ParseCpuList("3-1", cpus));
+    SY_ASSERT(!sy::ThreadAffinity::ParseCpuList("a", cpus));
+    SY_LOG_INFO(g_logger) << "test_parse ok";
+}
+
+// 每个调度线程绑定当前进程可用CPU中的一个，检查实际的亲和性
+void test_per_core() {
+    std::vector<int> avail = sy::Thread::GetCpus(0);
+    SY_ASSERT(!avail.empty());
+    sy::ThreadAffinity affinity;
+    affinity.cpus = avail;
+    affinity.perCore = true;
+    affinity.numaNode = sy::ThreadAffinity::GetCpuNode(avail[0]);
+
+    size_t threads = 4;
+    sy::Scheduler sc(threads, false, "affinity", affinity);
+    sc.start();
+    for(size_t i = 0; i < threads; ++i) {
+        int tid = sc.getWorkerThreadId(i);
+        if(tid < 0) {
+            continue;
+        }
+        std::vector<int> cpus = sy::Thread::GetCpus(tid);
+        SY_ASSERT(cpus.size() == 1);
+    }
+    std::stringstream ss;
+    sc.dumpLayout(ss);
+    SY_LOG_INFO(g_logger) << ss.str();
+    sc.stop();
+}
+
+int main(int argc, char** argv) {
+    test_parse();
+    test_per_core();
+    return 0;
+}
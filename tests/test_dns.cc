@@ -0,0 +1,174 @@
+#include "sy/sy.h"
+#include "sy/dns.h"
+#include <map>
+
+static sy::Logger::ptr g_logger = SY_LOG_ROOT();
+
+// 本地的DNS桩服务器：每个名字被查询的次数
+static std::map<std::string, int> s_queries;
+static sy::Mutex s_mutex;
+
+static void put_u16(std::string& out, uint16_t v) {
+    out.push_back((char)(v >> 8));
+    out.push_back((char)(v & 0xff));
+}
+
+static void put_name(std::string& out, const std::string& name) {
+    size_t begin = 0;
+    while(begin < name.size()) {
+        size_t end = name.find('.', begin);
+        if(end == std::string::npos) {
+            end = name.size();
+        }
+        out.push_back((char)(end - begin));
+        out.append(name, begin, end - begin);
+        begin = end + 1;
+    }
+    out.push_back(0);
+}
+
+// 一条回答，owner为空时用指向问题的压缩指针
+static void put_record(std::string& out, const std::string& owner, uint16_t type, const std::string& rdata) {
+    if(owner.empty()) {
+        put_u16(out, 0xc00c);
+    } else {
+        put_name(out, owner);
+    }
+    put_u16(out, type);
+    put_u16(out, 1);
+    put_u16(out, 0);
+    put_u16(out, 60);
+    put_u16(out, rdata.size());
+    out += rdata;
+}
+
+static std::string ipv4(const char* ip) {
+    in_addr addr;
+    inet_pton(AF_INET, ip, &addr);
+    return std::string((const char*)&addr, 4);
+}
+
+// 按名字构造响应：
+// a.test -> 10.0.0.1，alias.test -> CNAME a.test，slow.test延迟200ms -> 10.0.0.2，其他NXDOMAIN
+static std::string answer(const uint8_t* req, size_t len) {
+    std::string name;
+    size_t pos = 12;
+    while(pos < len && req[pos]) {
+        if(!name.empty()) {
+            name.push_back('.');
+        }
+        name.append((const char*)req + pos + 1, req[pos]);
+        pos += req[pos] + 1;
+    }
+    uint16_t type = (req[pos + 1] << 8) | req[pos + 2];
+    {
+        sy::Mutex::Lock lock(s_mutex);
+        ++s_queries[name];
+    }
+    if(name == "slow.test") {
+        usleep(200 * 1000);
+    }
+
+    std::string rsp((const char*)req, pos + 5);
+    std::string answers;
+    int count = 0;
+    if(type == sy::DnsResolver::A) {
+        if(name == "a.test") {
+            put_record(answers, "", sy::DnsResolver::A, ipv4("10.0.0.1"));
+            count = 1;
+        } else if(name == "alias.test") {
+            std::string target;
+            put_name(target, "a.test");
+            put_record(answers, "", sy::DnsResolver::CNAME, target);
+            put_record(answers, "a.test", sy::DnsResolver::A, ipv4("10.0.0.1"));
+            count = 2;
+        } else if(name == "slow.test") {
+            put_record(answers, "", sy::DnsResolver::A, ipv4("10.0.0.2"));
+            count = 1;
+        }
+    }
+    bool exists = name == "a.test" || name == "alias.test" || name == "slow.test";
+    // QR|RD|RA，不存在的名字rcode为3
+    rsp[2] = (char)0x81;
+    rsp[3] = (char)(exists ? 0x80 : 0x83);
+    rsp[6] = 0;
+    rsp[7] = (char)count;
+    return rsp + answers;
+}
+
+static void serve(sy::Socket::ptr sock) {
+    while(true) {
+        uint8_t buf[512];
+        sy::Address::ptr from(new sy::IPv4Address);
+        int n = sock->recvFrom(buf, sizeof(buf), from);
+        if(n <= 0) {
+            break;
+        }
+        std::string req((const char*)buf, n);
+        sy::IOManager::GetThis()->schedule([sock, req, from]() {
+            std::string rsp = answer((const uint8_t*)req.c_str(), req.size());
+            sock->sendTo(rsp.c_str(), rsp.size(), from);
+        });
+    }
+}
+
+static int queries(const std::string& name) {
+    sy::Mutex::Lock lock(s_mutex);
+    return s_queries[name];
+}
+
+void test_dns() {
+    sy::Socket::ptr server = sy::Socket::CreateUDPSocket();
+    SY_ASSERT(server->bind(sy::IPv4Address::Create("127.0.0.1", 0)));
+    sy::IOManager::GetThis()->schedule(std::bind(serve, server));
+
+    sy::DnsResolver* resolver = sy::DnsMgr::GetInstance();
+    resolver->setNameservers({server->getLocalAddress()});
+    resolver->setTimeout(1000, 1);
+    resolver->clearCache();
+
+    // 第二次命中缓存
+    std::vector<std::string> ips;
+    SY_ASSERT(resolver->resolve("a.test", AF_INET, ips) == sy::DnsResolver::OK);
+    SY_ASSERT(ips.size() == 1 && ips[0] == "10.0.0.1");
+    ips.clear();
+    SY_ASSERT(resolver->resolve("A.TEST.", AF_INET, ips) == sy::DnsResolver::OK);
+    SY_ASSERT(queries("a.test") == 1);
+
+    ips.clear();
+    SY_ASSERT(resolver->resolve("alias.test", AF_INET, ips) == sy::DnsResolver::OK);
+    SY_ASSERT(ips.size() == 1 && ips[0] == "10.0.0.1");
+
+    // 负缓存
+    SY_ASSERT(resolver->resolve("nx.test", AF_INET, ips) == sy::DnsResolver::NOT_FOUND);
+    SY_ASSERT(resolver->resolve("nx.test", AF_INET, ips) == sy::DnsResolver::NOT_FOUND);
+    SY_ASSERT(queries("nx.test") == 1);
+
+    // 并发查询同一个名字只发一次
+    std::atomic<int> done = {0};
+    for(int i = 0; i < 10; ++i) {
+        sy::IOManager::GetThis()->schedule([resolver, &done]() {
+            std::vector<std::string> v;
+            SY_ASSERT(resolver->resolve("slow.test", AF_INET, v) == sy::DnsResolver::OK);
+            SY_ASSERT(v.size() == 1 && v[0] == "10.0.0.2");
+            ++done;
+        });
+    }
+    while(done < 10) {
+        usleep(10 * 1000);
+    }
+    SY_ASSERT(queries("slow.test") == 1);
+
+    // Address::Lookup在协程里走异步解析
+    sy::Address::ptr addr = sy::Address::LookupAny("a.test:80");
+    SY_ASSERT(addr && addr->toString() == "10.0.0.1:80");
+    SY_LOG_INFO(g_logger) << "test_dns ok, addr=" << *addr;
+
+    server->close();
+}
+
+int main(int argc, char** argv) {
+    sy::IOManager iom(2);
+    iom.schedule(test_dns);
+    return 0;
+}
@@ -0,0 +1,91 @@
+#include "sy/sy.h"
+#include "sy/file_io.h"
+#include <fcntl.h>
+#include <string.h>
+
+static sy::Logger::ptr g_logger = SY_LOG_ROOT();
+
+static const char* s_path = "/tmp/test_file_io.dat";
+
+// 单线程IOManager里读写大文件，同时另一个协程每毫秒计数一次
+// 文件IO交给线程池时IO线程不被阻塞，计数协程可以一直执行
+void test_file_io() {
+    std::atomic<bool> stop = {false};
+    std::atomic<int> ticks = {0};
+    sy::IOManager::GetThis()->schedule([&stop, &ticks]() {
+        while(!stop) {
+            usleep(1000);
+            ++ticks;
+        }
+    });
+
+    std::string data(32 << 20, 0);
+    for(size_t i = 0; i < data.size(); ++i) {
+        data[i] = (char)(i * 7);
+    }
+    uint64_t begin = sy::GetCurrentMS();
+    int fd = sy::FileIO::Open(s_path, O_CREAT | O_TRUNC | O_RDWR);
+    SY_ASSERT(fd >= 0);
+    // 登记过的文件，hook的write/fsync也交给线程池
+    SY_ASSERT(write(fd, data.c_str(), data.size()) == (ssize_t)data.size());
+    SY_ASSERT(fsync(fd) == 0);
+
+    std::string buf(64 << 10, 0);
+    size_t total = 0;
+    SY_ASSERT(lseek(fd, 0, SEEK_SET) == 0);
+    while(true) {
+        ssize_t n = read(fd, &buf[0], buf.size());
+        SY_ASSERT(n >= 0);
+        if(n == 0) {
+            break;
+        }
+        SY_ASSERT(memcmp(&buf[0], data.c_str() + total, n) == 0);
+        total += n;
+    }
+    SY_ASSERT(total == data.size());
+    SY_ASSERT(pread(fd, &buf[0], 16, 12345) == 16);
+    SY_ASSERT(memcmp(&buf[0], data.c_str() + 12345, 16) == 0);
+    SY_LOG_INFO(g_logger) << "file io used=" << (sy::GetCurrentMS() - begin)
+        << "ms ticks=" << ticks;
+
+    // 零拷贝发送到socket，另一个协程接收
+    int fds[2];
+    SY_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    // socketpair在hook下也要登记为非阻塞的socket
+    sy::FdMgr::GetInstance()->get(fds[0], true);
+    sy::FdMgr::GetInstance()->get(fds[1], true);
+    std::atomic<size_t> received = {0};
+    std::atomic<bool> same = {true};
+    sy::IOManager::GetThis()->schedule([&]() {
+        std::string rbuf(64 << 10, 0);
+        while(true) {
+            ssize_t n = recv(fds[1], &rbuf[0], rbuf.size(), 0);
+            if(n <= 0) {
+                break;
+            }
+            if(memcmp(&rbuf[0], data.c_str() + 1000 + received, n)) {
+                same = false;
+            }
+            received += n;
+        }
+    });
+    ssize_t sent = sy::FileIO::SendFile(fds[0], fd, 1000, 8 << 20);
+    SY_ASSERT(sent == (8 << 20));
+    close(fds[0]);
+    while(received < (size_t)sent) {
+        usleep(1000);
+    }
+    SY_ASSERT(same);
+    SY_LOG_INFO(g_logger) << "sendfile sent=" << sent;
+
+    close(fds[1]);
+    sy::FileIO::Close(fd);
+    unlink(s_path);
+    stop = true;
+}
+
+int main(int argc, char** argv) {
+    sy::IOManager iom(1);
+    iom.schedule(test_file_io);
+    return 0;
+}
@@ -0,0 +1,70 @@
+#include "sy/sy.h"
+#include "sy/iomanager.h"
+
+static sy::Logger::ptr g_logger = SY_LOG_ROOT();
+
+// 模拟一个耗时ms毫秒的后端请求
+static int backend(int id, int ms) {
+    usleep(ms * 1000);
+    return id;
+}
+
+void test_basic() {
+    auto f = sy::Async([]() { return backend(1, 10);});
+    auto f2 = f.then([](sy::Future<int> self) { return self.get() * 10;});
+    SY_ASSERT(f.get() == 1);
+    SY_ASSERT(f2.get() == 10);
+
+    sy::Promise<std::string> p;
+    auto fs = p.getFuture();
+    sy::IOManager::GetThis()->addTimer(20, [p]() mutable {
+        p.setValue("hello");
+    });
+    SY_ASSERT(!fs.wait(5));
+    SY_ASSERT(fs.wait(1000));
+    SY_ASSERT(fs.get() == "hello");
+    SY_LOG_INFO(g_logger) << "test_basic ok";
+}
+
+void test_error() {
+    sy::Future<int> f;
+    {
+        sy::Promise<int> p;
+        f = p.getFuture();
+    }
+    SY_ASSERT(f.isReady() && f.getError() == sy::FutureBase::BROKEN_PROMISE);
+
+    sy::Promise<int> p;
+    auto t = p.getFuture().withTimeout(10);
+    t.wait();
+    SY_ASSERT(t.getError() == sy::FutureBase::TIMEOUT);
+    SY_LOG_INFO(g_logger) << "test_error ok";
+}
+
+void test_when() {
+    std::vector<sy::Future<int> > fs;
+    for(int i = 0; i < 5; ++i) {
+        fs.push_back(sy::Async([i]() { return backend(i, 50 - i * 10);}));
+    }
+    uint64_t ts = sy::GetCurrentMS();
+    size_t idx = sy::WhenAny(fs).get();
+    SY_LOG_INFO(g_logger) << "when_any idx=" << idx << " value=" << fs[idx].get()
+                          << " used=" << (sy::GetCurrentMS() - ts) << "ms";
+
+    auto all = sy::WhenAll(fs).get();
+    int sum = 0;
+    for(auto& i : all) {
+        sum += i.get();
+    }
+    SY_ASSERT(sum == 0 + 1 + 2 + 3 + 4);
+    SY_LOG_INFO(g_logger) << "when_all sum=" << sum
+                          << " used=" << (sy::GetCurrentMS() - ts) << "ms";
+}
+
+int main(int argc, char** argv) {
+    sy::IOManager iom(4, false);
+    iom.schedule(test_basic);
+    iom.schedule(test_error);
+    iom.schedule(test_when);
+    return 0;
+}
@@ -1,9 +1,11 @@
 #include "sy/hook.h"
 #include "sy/log.h"
 #include "sy/iomanager.h"
+#include "sy/macro.h"
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
+#include <poll.h>
 #include <unistd.h>
 #include <string.h>
 
@@ -63,9 +65,36 @@ void test_sock() {
     SY_LOG_INFO(g_logger) << buff;
 }
 
+// 单线程IOManager里一个协程poll等待，另一个协程稍后写入
+// poll如果阻塞了调度线程，写协程无法执行，poll只能超时返回
+void test_poll() {
+    int fds[2];
+    SY_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    sy::IOManager::GetThis()->schedule([fds](){
+        usleep(100 * 1000);
+        SY_ASSERT(write(fds[1], "x", 1) == 1);
+    });
+
+    struct pollfd pfd = {fds[0], POLLIN, 0};
+    uint64_t begin = sy::GetCurrentMS();
+    int rt = poll(&pfd, 1, 3000);
+    SY_LOG_INFO(g_logger) << "poll rt=" << rt << " revents=" << pfd.revents
+        << " used=" << (sy::GetCurrentMS() - begin) << "ms";
+    SY_ASSERT(rt == 1 && (pfd.revents & POLLIN));
+
+    // 没有数据时按超时返回
+    char c;
+    SY_ASSERT(read(fds[0], &c, 1) == 1);
+    rt = poll(&pfd, 1, 50);
+    SY_ASSERT(rt == 0);
+    close(fds[0]);
+    close(fds[1]);
+}
+
 int main(int argc, char** argv) {
     //test_sleep();
-    sy::IOManager iom;
+    sy::IOManager iom(1);
+    iom.schedule(test_poll);
     iom.schedule(test_sock);
     return 0;
 }
@@ -69,9 +69,100 @@ void test_timer() {
     }, true);
 }
 
+// 时间轮：10万个定时器添加再取消一半，统计耗时，剩下的应该全部按时触发
+// 另外用TimerHandle在栈上挂一个不分配内存的定时器
+void test_timer_wheel() {
+    sy::IOManager iom(2, false, "wheel");
+    static std::atomic<int> s_fired = {0};
+    const int N = 100000;
+    std::vector<sy::Timer::ptr> timers;
+    timers.reserve(N);
+    uint64_t begin = sy::GetCurrentUS();
+    for(int i = 0; i < N; ++i) {
+        timers.push_back(iom.addTimer(100 + i % 2000, [](){
+            ++s_fired;
+        }));
+    }
+    uint64_t added = sy::GetCurrentUS();
+    for(int i = 0; i < N; i += 2) {
+        timers[i]->cancel();
+    }
+    uint64_t cancelled = sy::GetCurrentUS();
+    SY_LOG_INFO(g_logger) << "add " << N << " timers used=" << (added - begin)
+        << "us, cancel " << N / 2 << " used=" << (cancelled - added) << "us";
+
+    static std::atomic<int> s_handle_fired = {0};
+    static std::atomic<bool> s_handle_done = {false};
+    iom.schedule([](){
+        sy::TimerHandle handle;
+        uint64_t start = sy::GetCurrentMS();
+        sy::IOManager::GetThis()->addTimer(handle, 50, [](void* arg){
+            ++s_handle_fired;
+            SY_LOG_INFO(g_logger) << "handle fired after "
+                << sy::GetCurrentMS() - *(uint64_t*)arg << "ms";
+            return (uint64_t)0;
+        }, &start);
+        sleep(1);
+        bool cancelled = handle.cancel();
+        SY_LOG_INFO(g_logger) << "handle cancel after fired=" << cancelled;
+        // 已经触发的定时器取消失败，回调只执行一次
+        SY_ASSERT(!cancelled);
+        SY_ASSERT2(s_handle_fired == 1, "handle fired=" << s_handle_fired);
+        s_handle_done = true;
+    });
+    // 最晚的定时器在2100ms左右到期
+    for(int i = 0; i < 500 && (s_fired < N / 2 || !s_handle_done); ++i) {
+        usleep(10 * 1000);
+    }
+    // 多等一会，被取消的定时器不应该再触发
+    usleep(200 * 1000);
+    SY_LOG_INFO(g_logger) << "fired=" << s_fired << " expect=" << N / 2;
+    SY_ASSERT2(s_fired == N / 2, "fired=" << s_fired << " expect=" << N / 2);
+    SY_ASSERT(s_handle_done);
+    SY_ASSERT(s_handle_fired == 1);
+}
+
+// io_uring后端：socketpair一端读一端写，读端先阻塞在ring上，写端1秒后写入
+void test_uring() {
+    sy::Config::Lookup<std::string>("iomanager.backend")->setValue("io_uring");
+    sy::IOManager iom(2, false, "uring");
+    SY_LOG_INFO(g_logger) << "backend=" << iom.getBackendName();
+
+    static int fds[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    iom.schedule([](){
+        sy::FdMgr::GetInstance()->get(fds[0], true);
+        char buf[64] = {0};
+        int rt = read(fds[0], buf, sizeof(buf) - 1);
+        SY_LOG_INFO(g_logger) << "read rt=" << rt << " buf=" << buf;
+
+        // 设置读超时，没有数据时500ms后超时返回
+        struct timeval tv = {0, 500 * 1000};
+        setsockopt(fds[0], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        rt = read(fds[0], buf, sizeof(buf) - 1);
+        SY_LOG_INFO(g_logger) << "read timeout rt=" << rt << " errno=" << errno
+                              << " errstr=" << strerror(errno);
+        close(fds[0]);
+    });
+    iom.schedule([](){
+        sy::FdMgr::GetInstance()->get(fds[1], true);
+        sleep(1);
+        int rt = write(fds[1], "hello io_uring", 14);
+        SY_LOG_INFO(g_logger) << "write rt=" << rt;
+        sleep(1);
+        close(fds[1]);
+    });
+}
+
 int main(int argc, char** argv) {
     g_logger->setLevel(sy::LogLevel::INFO);
     //test1();
-    test_timer();
+    if(argc > 1 && !strcmp(argv[1], "uring")) {
+        test_uring();
+    } else if(argc > 1 && !strcmp(argv[1], "wheel")) {
+        test_timer_wheel();
+    } else {
+        test_timer();
+    }
     return 0;
 }
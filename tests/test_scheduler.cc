@@ -13,13 +13,161 @@ void test_fiber() {
     }
 }
 
+// 批量提交任务：一次加锁进入队列，空闲线程通过窃取分摊执行
+void test_batch(sy::Scheduler& sc) {
+    static std::atomic<int> s_done = {0};
+    std::vector<std::function<void()> > cbs;
+    for(int i = 0; i < 1000; ++i) {
+        cbs.push_back([](){
+            ++s_done;
+        });
+    }
+    sc.schedule(cbs.begin(), cbs.end());
+    SY_LOG_INFO(g_logger) << "batch scheduled, done=" << s_done;
+}
+
+// CPU密集的循环：yield为true时在循环里调用MaybeYield让出
+static void busy_loop(uint64_t ms, bool yield) {
+    uint64_t begin = sy::GetCurrentMS();
+    uint64_t yields = 0;
+    while(sy::GetCurrentMS() - begin < ms) {
+        if(yield && sy::Fiber::MaybeYield()) {
+            ++yields;
+        }
+    }
+    SY_LOG_INFO(g_logger) << "busy_loop " << ms << "ms yields=" << yields;
+}
+
+// 单线程调度器上两个长循环，短任务要等多久：
+// 调用MaybeYield时每个时间片(fiber.yield_slice_ms)后短任务就有机会执行
+// 不调用时短任务要等长循环结束，开启的watchdog(scheduler.watchdog_ms)会输出长循环协程的调用栈
+void test_preempt(bool yield) {
+    sy::Config::Lookup<uint32_t>("scheduler.watchdog_ms")->setValue(1000);
+    sy::Scheduler sc(1, false, "preempt");
+    sc.start();
+    sc.schedule(std::bind(busy_loop, 1500, yield));
+    sc.schedule(std::bind(busy_loop, 1500, yield));
+    usleep(100 * 1000);
+    uint64_t begin = sy::GetCurrentMS();
+    uint64_t waited = ~0ull;
+    sc.schedule([begin, yield, &waited](){
+        waited = sy::GetCurrentMS() - begin;
+        SY_LOG_INFO(g_logger) << "short task yield=" << yield
+            << " waited " << waited << "ms";
+    });
+    sc.stop();
+    sy::Config::Lookup<uint32_t>("scheduler.watchdog_ms")->setValue(0);
+    // 让出时只等几个时间片；不让出时要等两个长循环跑完
+    if(yield) {
+        SY_ASSERT(waited < 500);
+    } else {
+        SY_ASSERT(waited != ~0ull && waited >= 1000);
+    }
+}
+
+// 弹性线程数：突发的积压任务让线程数涨到上限，空闲后逐个退出回到下限
+// 指定给已经退出的线程的任务由其他线程执行
+void test_elastic() {
+    sy::Config::Lookup<uint32_t>("scheduler.elastic_interval_ms")->setValue(50);
+    sy::Scheduler sc(4, false, "elastic");
+    sy::Scheduler::ElasticOptions opt;
+    opt.minThreads = 1;
+    opt.growBacklog = 16;
+    opt.shrinkIdleMs = 200;
+    SY_ASSERT(sc.setElastic(opt));
+    sc.start();
+    SY_ASSERT(sc.getThreadCount() == 1);
+
+    std::atomic<int> done = {0};
+    for(int i = 0; i < 200; ++i) {
+        sc.schedule([&done](){
+            uint64_t begin = sy::GetCurrentMS();
+            while(sy::GetCurrentMS() - begin < 5);
+            ++done;
+        });
+    }
+    size_t peak = 0;
+    while(done < 200) {
+        peak = std::max(peak, sc.getThreadCount());
+        usleep(10 * 1000);
+    }
+    int tid = sc.getWorkerThreadId(sc.getWorkerCount() - 1);
+    SY_LOG_INFO(g_logger) << "elastic peak threads=" << peak;
+    for(int i = 0; i < 300 && sc.getThreadCount() > 1; ++i) {
+        usleep(10 * 1000);
+    }
+    SY_LOG_INFO(g_logger) << "elastic idle threads=" << sc.getThreadCount();
+    if(tid >= 0) {
+        sc.schedule([&done](){ ++done;}, tid);
+    }
+    std::stringstream ss;
+    sc.dump(ss);
+    SY_LOG_INFO(g_logger) << ss.str();
+    sc.stop();
+    SY_ASSERT(done == (tid >= 0 ? 201 : 200));
+}
+
+// 优先级：积压的高优先级任务先执行，低优先级任务按比例穿插执行
+// 高优先级任务源源不断时低优先级任务也不会饿死
+void test_priority() {
+    sy::Scheduler sc(1, false, "priority");
+    sc.start();
+    // 先占住唯一的调度线程，让两种任务都积压在队列里
+    std::atomic<bool> gate = {false};
+    sc.schedule([&gate](){
+        while(!gate);
+    });
+    // 只在唯一的调度线程里访问
+    std::vector<int> order;
+    for(int i = 0; i < 100; ++i) {
+        sc.schedule([&order](){
+            order.push_back(sy::Scheduler::GetTaskPriority());
+        }, -1, sy::Scheduler::LOW);
+        sc.schedule([&order](){
+            order.push_back(sy::Scheduler::GetTaskPriority());
+        }, -1, sy::Scheduler::HIGH);
+    }
+
+    std::atomic<bool> low_done = {false};
+    std::atomic<int> high_runs = {0};
+    std::function<void()> flood = [&]() {
+        if(!low_done && ++high_runs < 100000) {
+            sy::Scheduler::GetThis()->schedule(flood, -1, sy::Scheduler::HIGH);
+        }
+    };
+    for(int i = 0; i < 4; ++i) {
+        sc.schedule(flood, -1, sy::Scheduler::HIGH);
+    }
+    sc.schedule([&low_done](){
+        low_done = true;
+    }, -1, sy::Scheduler::LOW);
+    gate = true;
+    sc.stop();
+
+    SY_ASSERT(order.size() == 200);
+    size_t first_low = std::find(order.begin(), order.end(), (int)sy::Scheduler::LOW) - order.begin();
+    size_t last_high = order.rend() - std::find(order.rbegin(), order.rend(), (int)sy::Scheduler::HIGH) - 1;
+    SY_LOG_INFO(g_logger) << "priority first_low=" << first_low << " last_high=" << last_high
+        << " high_runs_before_low=" << high_runs;
+    SY_ASSERT(first_low >= 16 && first_low < 100);
+    SY_ASSERT(last_high < 199);
+    // 没有防饿死时低优先级任务要等高优先级任务全部结束
+    SY_ASSERT(low_done && high_runs < 100000);
+}
+
 int main(int argc, char** argv) {
+    test_priority();
+    test_elastic();
+    test_preempt(true);
+    test_preempt(false);
+
     SY_LOG_INFO(g_logger) << "main";
     sy::Scheduler sc(3, false, "test");
     sc.start();
     sleep(2);
     SY_LOG_INFO(g_logger) << "schedule";
     sc.schedule(&test_fiber);
+    test_batch(sc);
     sc.stop();
     SY_LOG_INFO(g_logger) << "over";
     return 0;
@@ -0,0 +1,34 @@
+#include "sy/sy.h"
+#include "sy/stack_allocator.h"
+
+static sy::Logger::ptr g_logger = SY_LOG_ROOT();
+
+void run_in_fiber() {
+}
+
+// 创建并销毁大量短生命周期协程，对比malloc和pooled两种栈分配器的耗时
+void test_alloc(const std::string& name, int count) {
+    sy::Config::Lookup<std::string>("fiber.stack_allocator")->setValue(name);
+    sy::Fiber::GetThis();
+    uint64_t begin = sy::GetCurrentUS();
+    for(int i = 0; i < count; ++i) {
+        sy::Fiber::ptr fiber(new sy::Fiber(&run_in_fiber, 0, false));
+        fiber->resume();
+    }
+    uint64_t used = sy::GetCurrentUS() - begin;
+    SY_LOG_INFO(g_logger) << "allocator=" << name << " count=" << count
+        << " used=" << used << "us"
+        << " fibers/s=" << (used ? count * 1000000ull / used : 0);
+}
+
+int main(int argc, char** argv) {
+    int count = argc > 1 ? atoi(argv[1]) : 100000;
+    test_alloc("malloc", count);
+    test_alloc("pooled", count);
+
+    sy::PooledStackAllocator* pooled = (sy::PooledStackAllocator*)sy::StackAllocator::Get("pooled");
+    std::stringstream ss;
+    pooled->dump(ss);
+    SY_LOG_INFO(g_logger) << ss.str();
+    return 0;
+}
@@ -1,9 +1,94 @@
 #include "sy/tcp_server.h"
+#include "sy/fd_manager.h"
 #include "sy/iomanager.h"
 #include "sy/log.h"
+#include "sy/macro.h"
+#include <set>
 
 sy::Logger::ptr g_logger = SY_LOG_ROOT();
 
+// 本线程上的接收循环的监听socket
+static thread_local int t_listener = -1;
+
+// 记录处理连接的线程，检查连接是在接收它的线程上处理的
+class CountServer : public sy::TcpServer {
+public:
+    CountServer(sy::IOManager* iom)
+        :sy::TcpServer(iom, iom, iom)
+        ,m_iom(iom) {
+    }
+
+    int count() {
+        sy::Mutex::Lock lock(m_mutex);
+        return m_count;
+    }
+
+    size_t threads() {
+        sy::Mutex::Lock lock(m_mutex);
+        return m_threads.size();
+    }
+protected:
+    void startAccept(sy::Socket::ptr sock) override {
+        t_listener = sock->getSocket();
+        sy::TcpServer::startAccept(sock);
+    }
+
+    void handleClient(sy::Socket::ptr client) override {
+        // 本线程有接收循环，并且它的监听socket的事件一直在本线程上唤醒(没有换过线程)
+        SY_ASSERT2(t_listener >= 0, "client handled on a thread without accept loop");
+        sy::FdCtx::ptr ctx = sy::FdMgr::GetInstance()->get(t_listener);
+        SY_ASSERT(ctx);
+        SY_ASSERT2(m_iom->getWorkerThreadId(ctx->owner) == sy::GetThreadId()
+                , "listener=" << t_listener << " owner=" << ctx->owner);
+        sy::Mutex::Lock lock(m_mutex);
+        ++m_count;
+        m_threads.insert(sy::GetThreadId());
+    }
+private:
+    sy::IOManager* m_iom;
+    sy::Mutex m_mutex;
+    int m_count = 0;
+    std::set<pid_t> m_threads;
+};
+
+// 每个IO线程一个SO_REUSEPORT监听socket，各自批量接收并处理连接
+void test_reuseport() {
+    sy::TcpServerConf conf;
+    conf.reuseport = 1;
+    conf.accept_batch = 8;
+    conf.defer_accept = 1;
+    // 连接固定在线程上需要每线程reactor
+    sy::Config::Lookup<bool>("iomanager.per_thread_reactor")->setValue(true);
+    sy::IOManager iom(4, false, "reuseport");
+    sy::Config::Lookup<bool>("iomanager.per_thread_reactor")->setValue(false);
+    CountServer* server = new CountServer(&iom);
+    sy::TcpServer::ptr svr(server);
+    svr->setConf(conf);
+    SY_ASSERT(svr->bind(sy::IPv4Address::Create("127.0.0.1", 0)));
+    SY_ASSERT(svr->getSocks().size() == 4);
+    SY_ASSERT(svr->start());
+
+    sy::Address::ptr addr = svr->getSocks()[0]->getLocalAddress();
+    std::vector<sy::Socket::ptr> clients;
+    for(int i = 0; i < 64; ++i) {
+        sy::Socket::ptr sock = sy::Socket::CreateTCP(addr);
+        SY_ASSERT(sock->connect(addr));
+        // defer_accept时有数据到达才会被接收
+        sock->send("x", 1);
+        clients.push_back(sock);
+    }
+    uint64_t deadline = sy::GetCurrentMS() + 5000;
+    while(server->count() < 64 && sy::GetCurrentMS() < deadline) {
+        usleep(10 * 1000);
+    }
+    SY_LOG_INFO(g_logger) << "reuseport accepted=" << server->count()
+        << " threads=" << server->threads();
+    SY_ASSERT2(server->count() == 64, "accepted=" << server->count());
+    // 内核按四元组把连接分到各个监听socket，不会都落在一个线程上
+    SY_ASSERT2(server->threads() > 1, "threads=" << server->threads());
+    svr->stop();
+}
+
 void run() {
     auto addr = sy::Address::LookupAny("0.0.0.0:8033");
     //auto addr2 = sy::UnixAddress::ptr(new sy::UnixAddress("/tmp/unix_addr"));
@@ -21,6 +106,7 @@ void run() {
 }
 int main(int argc, char** argv) {
     sy::IOManager iom(2);
+    iom.schedule(test_reuseport);
     iom.schedule(run);
     return 0;
 }